@@ -0,0 +1,347 @@
+#include "checksum_journal.h"
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace dfs {
+
+namespace {
+
+constexpr size_t RECORD_PREFIX_SIZE = 8;            // length + crc32c
+constexpr uint32_t MAX_PAYLOAD_SIZE = 64 * 1024;    // Anything larger is corruption
+constexpr size_t CHECKPOINT_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t REPLAY_BUFFER_SIZE = 1024 * 1024;      // Must hold the largest record
+
+void putU16(std::string& buffer, uint16_t value) {
+    buffer.push_back(static_cast<char>(value & 0xFF));
+    buffer.push_back(static_cast<char>(value >> 8));
+}
+
+void putU32(std::string& buffer, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint16_t getU16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t getU32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+} // namespace
+
+ChecksumJournal::ChecksumJournal(const std::string& directory)
+    : journal_path_(directory + "/checksums.journal"),
+      rotated_journal_path_(directory + "/checksums.journal.old"),
+      checkpoint_path_(directory + "/checksums.checkpoint"),
+      directory_(directory),
+      journal_fd_(-1),
+      journal_opened_(false),
+      records_since_checkpoint_(0),
+      rotated_pending_(false),
+      checkpoint_running_(false) {
+}
+
+ChecksumJournal::~ChecksumJournal() {
+    if (journal_fd_ >= 0) {
+        ::close(journal_fd_);
+    }
+}
+
+bool ChecksumJournal::open(const EntryVisitor& apply) {
+    int64_t valid_end = 0;
+    int64_t checkpoint_entries = 0;
+
+    if (Utils::fileExists(checkpoint_path_)) {
+        checkpoint_entries = replayFile(checkpoint_path_, apply, valid_end);
+    }
+
+    // Left behind by a checkpoint that didn't finish
+    if (Utils::fileExists(rotated_journal_path_)) {
+        records_since_checkpoint_ += replayFile(rotated_journal_path_, apply, valid_end);
+        rotated_pending_ = true;
+    }
+
+    if (Utils::fileExists(journal_path_)) {
+        records_since_checkpoint_ += replayFile(journal_path_, apply, valid_end);
+
+        // Drop a torn tail so new records don't land behind garbage
+        int64_t file_size = Utils::getFileSize(journal_path_);
+        if (file_size > valid_end) {
+            Utils::logWarning("Truncating checksum journal after " + std::to_string(valid_end) +
+                              " of " + std::to_string(file_size) + " bytes");
+            if (::truncate(journal_path_.c_str(), valid_end) != 0) {
+                Utils::logError("Failed to truncate checksum journal: " + std::string(std::strerror(errno)));
+                return false;
+            }
+        }
+    }
+
+    Utils::logInfo("Checksum index replayed: " + std::to_string(checkpoint_entries) +
+                   " checkpoint entries, " + std::to_string(records_since_checkpoint_.load()) +
+                   " journal records");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return openJournal();
+}
+
+bool ChecksumJournal::recordPut(const std::string& chunk_id, const std::string& checksum) {
+    return append(RecordType::PUT, chunk_id, checksum);
+}
+
+bool ChecksumJournal::recordDelete(const std::string& chunk_id) {
+    return append(RecordType::DELETE, chunk_id, "");
+}
+
+bool ChecksumJournal::checkpointDue() const {
+    return rotated_pending_ || records_since_checkpoint_ >= CHECKPOINT_INTERVAL;
+}
+
+bool ChecksumJournal::checkpoint(const std::function<void(const EntryVisitor&)>& snapshot) {
+    // One checkpoint at a time; whoever loses the race has nothing to do
+    bool expected = false;
+    if (!checkpoint_running_.compare_exchange_strong(expected, true)) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // If an earlier checkpoint failed, its rotated journal is still needed
+        // and the current one simply keeps growing until this one succeeds
+        if (!rotated_pending_) {
+            if (journal_fd_ >= 0) {
+                // sync() only reaches the new journal from here on
+                if (::fdatasync(journal_fd_) != 0) {
+                    Utils::logError("Failed to sync checksum journal: " + std::string(std::strerror(errno)));
+                }
+                ::close(journal_fd_);
+                journal_fd_ = -1;
+            }
+            if (Utils::fileExists(journal_path_) &&
+                ::rename(journal_path_.c_str(), rotated_journal_path_.c_str()) != 0) {
+                Utils::logError("Failed to rotate checksum journal: " + std::string(std::strerror(errno)));
+            } else {
+                rotated_pending_ = true;
+            }
+            openJournal();
+        }
+        records_since_checkpoint_ = 0;
+    }
+
+    std::string temp_path = checkpoint_path_ + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Utils::logError("Failed to open checksum checkpoint: " + temp_path + " (" + std::strerror(errno) + ")");
+        checkpoint_running_ = false;
+        return false;
+    }
+
+    std::string buffer;
+    buffer.reserve(CHECKPOINT_BUFFER_SIZE);
+    bool ok = true;
+    int64_t entries = 0;
+
+    snapshot([&](const std::string& chunk_id, const std::string& checksum) {
+        encodeRecord(buffer, RecordType::PUT, chunk_id, checksum);
+        entries++;
+        if (buffer.size() >= CHECKPOINT_BUFFER_SIZE) {
+            ok = ok && writeAll(fd, buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    });
+
+    ok = ok && writeAll(fd, buffer.data(), buffer.size());
+    ok = ok && ::fdatasync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    ok = ok && ::rename(temp_path.c_str(), checkpoint_path_.c_str()) == 0;
+    // The rename has to be durable before the rotated journal goes
+    ok = ok && Utils::syncPath(directory_);
+
+    if (!ok) {
+        Utils::logError("Failed to write checksum checkpoint: " + std::string(std::strerror(errno)));
+        Utils::deleteFile(temp_path);
+        checkpoint_running_ = false;
+        return false;
+    }
+
+    // Everything in the rotated journal is covered by the checkpoint now
+    Utils::deleteFile(rotated_journal_path_);
+    rotated_pending_ = false;
+    checkpoint_running_ = false;
+
+    Utils::logDebug("Wrote checksum checkpoint with " + std::to_string(entries) + " entries");
+    return true;
+}
+
+bool ChecksumJournal::append(RecordType type, const std::string& chunk_id, const std::string& checksum) {
+    std::string record;
+    encodeRecord(record, type, chunk_id, checksum);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (journal_fd_ < 0 || !writeAll(journal_fd_, record.data(), record.size())) {
+        Utils::logError("Failed to append to checksum journal for chunk: " + chunk_id);
+        return false;
+    }
+
+    records_since_checkpoint_++;
+    return true;
+}
+
+bool ChecksumJournal::sync() {
+    int fd;
+    bool sync_directory;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (journal_fd_ < 0) {
+            return false;
+        }
+        // A rotation may close the descriptor while the sync runs
+        fd = ::dup(journal_fd_);
+        sync_directory = journal_opened_;
+        journal_opened_ = false;
+    }
+
+    bool ok = fd >= 0 && ::fdatasync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    ok = ok && (!sync_directory || Utils::syncPath(directory_));
+
+    if (!ok) {
+        Utils::logError("Failed to sync checksum journal: " + std::string(std::strerror(errno)));
+        std::lock_guard<std::mutex> lock(mutex_);
+        journal_opened_ = journal_opened_ || sync_directory;
+    }
+    return ok;
+}
+
+bool ChecksumJournal::openJournal() {
+    journal_fd_ = ::open(journal_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (journal_fd_ < 0) {
+        Utils::logError("Failed to open checksum journal: " + journal_path_ + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    journal_opened_ = true;
+    return true;
+}
+
+void ChecksumJournal::encodeRecord(std::string& buffer, RecordType type,
+                                   const std::string& chunk_id, const std::string& checksum) {
+    std::string payload;
+    payload.reserve(5 + chunk_id.size() + checksum.size());
+    payload.push_back(static_cast<char>(type));
+    putU16(payload, static_cast<uint16_t>(chunk_id.size()));
+    payload += chunk_id;
+    putU16(payload, static_cast<uint16_t>(checksum.size()));
+    payload += checksum;
+
+    putU32(buffer, static_cast<uint32_t>(payload.size()));
+    putU32(buffer, Utils::crc32c(payload.data(), payload.size()));
+    buffer += payload;
+}
+
+int64_t ChecksumJournal::replayFile(const std::string& path, const EntryVisitor& apply, int64_t& valid_end) {
+    valid_end = 0;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Utils::logError("Failed to open " + path + ": " + std::strerror(errno));
+        return 0;
+    }
+
+    // Read a buffer at a time; a record cut by the end of the buffer is
+    // moved to its start and completed by the next read
+    std::vector<uint8_t> data(REPLAY_BUFFER_SIZE);
+    size_t filled = 0;
+    size_t offset = 0;
+    int64_t records = 0;
+
+    while (true) {
+        uint32_t length = 0;
+        if (offset + RECORD_PREFIX_SIZE <= filled) {
+            length = getU32(&data[offset]);
+            if (length < 5 || length > MAX_PAYLOAD_SIZE) {
+                break;
+            }
+        }
+
+        if (offset + RECORD_PREFIX_SIZE > filled || offset + RECORD_PREFIX_SIZE + length > filled) {
+            std::memmove(data.data(), data.data() + offset, filled - offset);
+            filled -= offset;
+            offset = 0;
+
+            ssize_t bytes;
+            do {
+                bytes = ::read(fd, data.data() + filled, data.size() - filled);
+            } while (bytes < 0 && errno == EINTR);
+            if (bytes < 0) {
+                Utils::logError("Failed to read " + path + ": " + std::strerror(errno));
+            }
+            if (bytes <= 0) {
+                break;
+            }
+            filled += bytes;
+            continue;
+        }
+
+        uint32_t crc = getU32(&data[offset + 4]);
+        const uint8_t* payload = &data[offset + RECORD_PREFIX_SIZE];
+        if (Utils::crc32c(payload, length) != crc) {
+            break;
+        }
+
+        uint16_t id_length = getU16(payload + 1);
+        if (3u + id_length + 2u > length) {
+            break;
+        }
+        uint16_t checksum_length = getU16(payload + 3 + id_length);
+        if (5u + id_length + checksum_length != length) {
+            break;
+        }
+
+        std::string chunk_id(reinterpret_cast<const char*>(payload + 3), id_length);
+        RecordType type = static_cast<RecordType>(payload[0]);
+        if (type == RecordType::PUT) {
+            apply(chunk_id, std::string(reinterpret_cast<const char*>(payload + 5 + id_length),
+                                        checksum_length));
+        } else if (type == RecordType::DELETE) {
+            apply(chunk_id, "");
+        } else {
+            break;
+        }
+
+        offset += RECORD_PREFIX_SIZE + length;
+        valid_end += RECORD_PREFIX_SIZE + length;
+        records++;
+    }
+    ::close(fd);
+
+    int64_t file_size = Utils::getFileSize(path);
+    if (file_size > valid_end) {
+        Utils::logWarning("Ignoring " + std::to_string(file_size - valid_end) +
+                          " trailing bytes in " + path);
+    }
+    return records;
+}
+
+} // namespace dfs
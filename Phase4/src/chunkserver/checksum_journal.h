@@ -0,0 +1,75 @@
+#pragma once
+
+#include "utils.h"
+#include <string>
+#include <functional>
+#include <atomic>
+#include <mutex>
+
+namespace dfs {
+
+// Persistent form of the ChunkStorage checksum index: an append-only binary
+// journal of changes plus a periodic checkpoint of the whole index.
+//
+// Both files are sequences of records [length][crc32c][payload]; a payload
+// is a record type, the chunk id and (for PUT) the checksum. Startup loads
+// the checkpoint and replays the journal on top, stopping at the first torn
+// or corrupt record.
+class ChecksumJournal {
+public:
+    // Called once per entry; an empty checksum means the chunk was removed
+    using EntryVisitor = std::function<void(const std::string& chunk_id, const std::string& checksum)>;
+
+    static constexpr int64_t CHECKPOINT_INTERVAL = 100000; // Journal records between checkpoints
+
+    explicit ChecksumJournal(const std::string& directory);
+    ~ChecksumJournal();
+
+    ChecksumJournal(const ChecksumJournal&) = delete;
+    ChecksumJournal& operator=(const ChecksumJournal&) = delete;
+
+    // Replays the checkpoint and journal into `apply`, then opens the journal for appending
+    bool open(const EntryVisitor& apply);
+
+    bool recordPut(const std::string& chunk_id, const std::string& checksum);
+    bool recordDelete(const std::string& chunk_id);
+
+    // Makes the records appended so far durable
+    bool sync();
+
+    // True once the journal has grown enough (or a checkpoint was interrupted)
+    bool checkpointDue() const;
+
+    // Rotates the journal, writes the entries `snapshot` emits as the new
+    // checkpoint and drops the rotated journal. `snapshot` runs after the
+    // rotation, so changes racing with it are kept in the new journal.
+    bool checkpoint(const std::function<void(const EntryVisitor&)>& snapshot);
+
+private:
+    enum class RecordType : uint8_t {
+        PUT = 1,
+        DELETE = 2
+    };
+
+    std::string journal_path_;
+    std::string rotated_journal_path_;
+    std::string checkpoint_path_;
+    std::string directory_;
+
+    std::mutex mutex_;
+    int journal_fd_;
+    bool journal_opened_;                   // Since the last sync, so its directory entry needs syncing
+    std::atomic<int64_t> records_since_checkpoint_;
+    std::atomic<bool> rotated_pending_;     // A rotated journal is waiting for its checkpoint
+    std::atomic<bool> checkpoint_running_;
+
+    // Helper methods
+    bool append(RecordType type, const std::string& chunk_id, const std::string& checksum);
+    bool openJournal();
+    static void encodeRecord(std::string& buffer, RecordType type,
+                             const std::string& chunk_id, const std::string& checksum);
+    // Returns the number of records applied; valid_end is the offset after the last good one
+    static int64_t replayFile(const std::string& path, const EntryVisitor& apply, int64_t& valid_end);
+};
+
+} // namespace dfs
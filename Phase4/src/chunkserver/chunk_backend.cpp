@@ -0,0 +1,489 @@
+#include "chunk_backend.h"
+#include "segment_chunk_backend.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <atomic>
+#include <json/json.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace dfs {
+
+namespace {
+
+// Above this many chunks a sync flushes the whole filesystem
+constexpr size_t SYNCFS_THRESHOLD = 4;
+
+// Chunk files end with their metadata: [data][metadata JSON][footer], the
+// footer being the JSON's length and CRC32C followed by FOOTER_MAGIC.
+// Files without it come from before and keep their metadata in <chunk_id>.meta.
+constexpr size_t FOOTER_SIZE = 16;
+constexpr uint64_t FOOTER_MAGIC = 0x4b4e554843534644ULL;   // "DFSCHUNK" on disk
+constexpr uint32_t MAX_METADATA_SIZE = 16 * 1024 * 1024;   // Anything larger is corruption
+
+void putU32(std::string& buffer, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint32_t getU32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+uint64_t getU64(const uint8_t* data) {
+    return static_cast<uint64_t>(getU32(data)) | (static_cast<uint64_t>(getU32(data + 4)) << 32);
+}
+
+std::string encodeMetadata(const StoredChunkInfo& info) {
+    Json::Value metadata;
+    metadata["chunk_id"] = info.chunk_id;
+    metadata["checksum"] = info.checksum;
+    Json::Value block_checksums(Json::arrayValue);
+    for (uint32_t crc : info.block_checksums) {
+        block_checksums.append(Json::UInt(crc));
+    }
+    metadata["block_checksums"] = block_checksums;
+    metadata["is_encrypted"] = info.is_encrypted;
+    metadata["is_erasure_coded"] = info.is_erasure_coded;
+    metadata["created_time"] = static_cast<Json::Int64>(info.created_time);
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, metadata);
+}
+
+bool decodeMetadata(std::istream& in, const std::string& chunk_id, StoredChunkInfo& info) {
+    try {
+        Json::Value metadata;
+        Json::CharReaderBuilder builder;
+        std::string errors;
+
+        if (!Json::parseFromStream(builder, in, &metadata, &errors)) {
+            Utils::logError("Failed to parse chunk metadata JSON: " + errors);
+            return false;
+        }
+
+        info.chunk_id = chunk_id;
+        info.checksum = metadata["checksum"].asString();
+        info.block_checksums.clear();
+        for (const Json::Value& crc : metadata["block_checksums"]) {
+            info.block_checksums.push_back(crc.asUInt());
+        }
+        info.is_encrypted = metadata["is_encrypted"].asBool();
+        info.is_erasure_coded = metadata["is_erasure_coded"].asBool();
+        info.created_time = metadata["created_time"].asInt64();
+        return true;
+
+    } catch (const std::exception& e) {
+        Utils::logError("Error loading chunk metadata: " + std::string(e.what()));
+        return false;
+    }
+}
+
+// Finds where the chunk's data ends in a file of file_size bytes and, if
+// `metadata` is set, reads its metadata JSON; false if the file has no footer
+bool readFooter(int fd, int64_t file_size, int64_t& data_size, std::string* metadata) {
+    uint8_t footer[FOOTER_SIZE];
+    if (file_size < static_cast<int64_t>(FOOTER_SIZE) ||
+        ::pread(fd, footer, FOOTER_SIZE, file_size - FOOTER_SIZE) != static_cast<ssize_t>(FOOTER_SIZE) ||
+        getU64(footer + 8) != FOOTER_MAGIC) {
+        return false;
+    }
+
+    uint32_t length = getU32(footer);
+    if (length > MAX_METADATA_SIZE || length > file_size - FOOTER_SIZE) {
+        return false;
+    }
+    data_size = file_size - FOOTER_SIZE - length;
+
+    if (metadata) {
+        metadata->resize(length);
+        if (::pread(fd, &(*metadata)[0], length, data_size) != static_cast<ssize_t>(length) ||
+            Utils::crc32c(reinterpret_cast<const uint8_t*>(metadata->data()), length) != getU32(footer + 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isTempChunkFile(const std::string& filename) {
+    return filename.find(".tmp.") != std::string::npos;
+}
+
+bool isChunkDataFile(const std::string& filename) {
+    // checksums.* are ChunkStorage's index files
+    return filename.find(".meta") == std::string::npos &&
+           filename.rfind("checksums.", 0) != 0 &&
+           !isTempChunkFile(filename);
+}
+
+// A chunk deleted since needs no syncing
+bool syncChunkFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    bool synced = ::fdatasync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+} // namespace
+
+std::unique_ptr<ChunkBackend> ChunkBackend::create(StorageBackendType type,
+                                                   const std::string& directory,
+                                                   std::shared_ptr<IoEngine> io_engine) {
+    switch (type) {
+        case StorageBackendType::LOG_STRUCTURED:
+            return std::make_unique<SegmentChunkBackend>(directory, std::move(io_engine));
+        case StorageBackendType::FILE_PER_CHUNK:
+        default:
+            return std::make_unique<FileChunkBackend>(directory, std::move(io_engine));
+    }
+}
+
+const char* ChunkBackend::typeToString(StorageBackendType type) {
+    switch (type) {
+        case StorageBackendType::LOG_STRUCTURED: return "segment";
+        case StorageBackendType::FILE_PER_CHUNK: return "file";
+        default: return "unknown";
+    }
+}
+
+bool ChunkBackend::parseType(const std::string& name, StorageBackendType& type) {
+    if (name == "file") {
+        type = StorageBackendType::FILE_PER_CHUNK;
+        return true;
+    }
+    if (name == "segment") {
+        type = StorageBackendType::LOG_STRUCTURED;
+        return true;
+    }
+    return false;
+}
+
+// Writes into <chunk_id>.tmp.N and renames it into place on commit
+class FileChunkBackend::FileWriter : public ChunkBackend::Writer {
+public:
+    FileWriter(FileChunkBackend* backend, const std::string& chunk_id,
+               const std::string& temp_path, int fd)
+        : backend_(backend), chunk_id_(chunk_id), temp_path_(temp_path), fd_(fd), written_(0) {}
+
+    ~FileWriter() override {
+        abort();
+    }
+
+    bool append(const uint8_t* data, size_t size) override {
+        if (fd_ < 0) {
+            return false;
+        }
+
+        if (!backend_->io_engine_->writeAll(fd_, data, size, written_)) {
+            Utils::logError("Failed to append to chunk " + chunk_id_ + ": " + std::strerror(errno));
+            abort();
+            return false;
+        }
+        written_ += size;
+        return true;
+    }
+
+    bool commit(const StoredChunkInfo& info) override {
+        if (fd_ < 0) {
+            return false;
+        }
+
+        // The metadata goes into the same file, so the rename below replaces
+        // data and metadata together; syncing is left to sync()
+        std::string metadata = encodeMetadata(info);
+        std::string footer;
+        putU32(footer, static_cast<uint32_t>(metadata.size()));
+        putU32(footer, Utils::crc32c(reinterpret_cast<const uint8_t*>(metadata.data()), metadata.size()));
+        putU32(footer, static_cast<uint32_t>(FOOTER_MAGIC));
+        putU32(footer, static_cast<uint32_t>(FOOTER_MAGIC >> 32));
+        metadata += footer;
+
+        bool written = backend_->io_engine_->writeAll(fd_, reinterpret_cast<const uint8_t*>(metadata.data()),
+                                                      metadata.size(), written_);
+        written = ::close(fd_) == 0 && written;
+        fd_ = -1;
+
+        std::string file_path = backend_->getChunkFilePath(chunk_id_);
+        if (!written || ::rename(temp_path_.c_str(), file_path.c_str()) != 0) {
+            Utils::logError("Failed to commit chunk: " + file_path + " (" + std::strerror(errno) + ")");
+            Utils::deleteFile(temp_path_);
+            return false;
+        }
+
+        // A sidecar from before would only be stale now
+        Utils::deleteFile(backend_->getChunkMetadataPath(chunk_id_));
+
+        std::lock_guard<std::mutex> lock(backend_->unsynced_mutex_);
+        backend_->unsynced_chunks_.push_back(chunk_id_);
+        return true;
+    }
+
+    void abort() override {
+        if (fd_ < 0) {
+            return;
+        }
+
+        ::close(fd_);
+        fd_ = -1;
+        Utils::deleteFile(temp_path_);
+    }
+
+private:
+    FileChunkBackend* backend_;
+    std::string chunk_id_;
+    std::string temp_path_;
+    int fd_;
+    int64_t written_;
+};
+
+// The open descriptor keeps the data readable even if the chunk is
+// deleted or replaced concurrently
+class FileChunkBackend::FileReader : public ChunkBackend::Reader {
+public:
+    FileReader(std::shared_ptr<IoEngine> io_engine, int fd, int direct_fd, int64_t size)
+        : io_engine_(std::move(io_engine)), fd_(fd), direct_fd_(direct_fd), size_(size) {}
+
+    ~FileReader() override {
+        ::close(fd_);
+        if (direct_fd_ >= 0) {
+            ::close(direct_fd_);
+        }
+    }
+
+    int64_t size() const override { return size_; }
+
+    ssize_t read(int64_t offset, uint8_t* buffer, size_t length) override {
+        clip(offset, length);
+        int fd = descriptorFor(offset, buffer, length);
+        return io_engine_->read(fd, buffer, length, offset);
+    }
+
+    void readAsync(int64_t offset, uint8_t* buffer, size_t length, IoEngine::Completion done) override {
+        clip(offset, length);
+        int fd = descriptorFor(offset, buffer, length);
+        io_engine_->submitRead(fd, buffer, length, offset, std::move(done));
+    }
+
+private:
+    std::shared_ptr<IoEngine> io_engine_;
+    int fd_;
+    int direct_fd_;
+    int64_t size_;
+
+    // Keeps reads out of the metadata that follows the data
+    void clip(int64_t offset, size_t& length) const {
+        length = static_cast<size_t>(std::max<int64_t>(0, std::min<int64_t>(length, size_ - offset)));
+    }
+
+    int descriptorFor(int64_t offset, const uint8_t* buffer, size_t& length) const {
+        return direct_fd_ >= 0 && IoEngine::trimForDirectIo(buffer, offset, length) ? direct_fd_ : fd_;
+    }
+};
+
+FileChunkBackend::FileChunkBackend(const std::string& directory, std::shared_ptr<IoEngine> io_engine)
+    : directory_(directory), io_engine_(std::move(io_engine)) {
+
+    if (!Utils::fileExists(directory_)) {
+        if (!Utils::createDirectory(directory_)) {
+            Utils::logError("Failed to create storage directory: " + directory_);
+        }
+    }
+
+    // Leftovers from interrupted streaming writes
+    try {
+        for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+            if (entry.is_regular_file() && isTempChunkFile(entry.path().filename().string())) {
+                Utils::deleteFile(entry.path().string());
+            }
+        }
+    } catch (const std::exception& e) {
+        Utils::logError("Error cleaning up temp chunk files: " + std::string(e.what()));
+    }
+}
+
+std::unique_ptr<ChunkBackend::Writer> FileChunkBackend::openWriter(const std::string& chunk_id,
+                                                                   int64_t size_hint) {
+    std::string temp_path = getChunkTempPath(chunk_id);
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Utils::logError("Failed to open temp chunk file: " + temp_path + " (" + std::strerror(errno) + ")");
+        return nullptr;
+    }
+
+    (void)size_hint;
+    return std::make_unique<FileWriter>(this, chunk_id, temp_path, fd);
+}
+
+std::unique_ptr<ChunkBackend::Reader> FileChunkBackend::openReader(const std::string& chunk_id) {
+    std::string file_path = getChunkFilePath(chunk_id);
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    int64_t size = st.st_size;
+    readFooter(fd, st.st_size, size, nullptr);
+
+    // Reopened through the descriptor so both see the same version of the
+    // chunk. Not every filesystem takes O_DIRECT; reads then use the page cache.
+    int direct_fd = -1;
+    if (io_engine_->directIo()) {
+        std::string fd_path = "/proc/self/fd/" + std::to_string(fd);
+        direct_fd = ::open(fd_path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+
+    return std::make_unique<FileReader>(io_engine_, fd, direct_fd, size);
+}
+
+bool FileChunkBackend::removeChunk(const std::string& chunk_id) {
+    bool data_deleted = Utils::deleteFile(getChunkFilePath(chunk_id));
+    bool metadata_deleted = Utils::deleteFile(getChunkMetadataPath(chunk_id)) || errno == ENOENT;
+
+    if (!data_deleted || !metadata_deleted) {
+        Utils::logError("Failed to delete chunk files for: " + chunk_id);
+        return false;
+    }
+    return true;
+}
+
+bool FileChunkBackend::getChunkInfo(const std::string& chunk_id, StoredChunkInfo& info) {
+    int fd = ::open(getChunkFilePath(chunk_id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    std::string metadata;
+    int64_t size = 0;
+    bool loaded = false;
+    if (::fstat(fd, &st) == 0) {
+        if (readFooter(fd, st.st_size, size, &metadata)) {
+            std::istringstream in(metadata);
+            loaded = decodeMetadata(in, chunk_id, info);
+        } else {
+            size = st.st_size;
+            loaded = loadChunkMetadata(chunk_id, info);
+        }
+    }
+    ::close(fd);
+
+    if (!loaded) {
+        return false;
+    }
+    info.size = size;
+    return true;
+}
+
+int64_t FileChunkBackend::getChunkSize(const std::string& chunk_id) {
+    int fd = ::open(getChunkFilePath(chunk_id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    int64_t size = -1;
+    if (::fstat(fd, &st) == 0) {
+        size = st.st_size;
+        readFooter(fd, st.st_size, size, nullptr);
+    }
+    ::close(fd);
+    return size;
+}
+
+std::vector<StoredChunkInfo> FileChunkBackend::listChunks() {
+    std::vector<StoredChunkInfo> chunks;
+
+    try {
+        for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+
+            std::string filename = entry.path().filename().string();
+            if (isChunkDataFile(filename)) {
+                StoredChunkInfo info;
+                info.chunk_id = filename;
+                info.size = getChunkSize(filename);
+                if (info.size >= 0) {
+                    chunks.push_back(std::move(info));
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        Utils::logError("Error listing chunks: " + std::string(e.what()));
+    }
+
+    return chunks;
+}
+
+bool FileChunkBackend::sync() {
+    std::vector<std::string> chunk_ids;
+    {
+        std::lock_guard<std::mutex> lock(unsynced_mutex_);
+        chunk_ids.swap(unsynced_chunks_);
+    }
+    if (chunk_ids.empty()) {
+        return true;
+    }
+
+    // A big batch is cheaper to flush with one syncfs than file by file
+    bool ok = true;
+    if (chunk_ids.size() > SYNCFS_THRESHOLD) {
+        int fd = ::open(directory_.c_str(), O_RDONLY | O_CLOEXEC);
+        ok = fd >= 0 && ::syncfs(fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    } else {
+        for (const auto& chunk_id : chunk_ids) {
+            ok = syncChunkFile(getChunkFilePath(chunk_id)) && ok;
+        }
+        // The renames that put the chunks in place, and the removed sidecars
+        ok = ok && Utils::syncPath(directory_);
+    }
+
+    if (!ok) {
+        Utils::logError("Failed to sync " + std::to_string(chunk_ids.size()) + " chunks in " + directory_);
+        std::lock_guard<std::mutex> lock(unsynced_mutex_);
+        unsynced_chunks_.insert(unsynced_chunks_.end(), chunk_ids.begin(), chunk_ids.end());
+    }
+    return ok;
+}
+
+std::string FileChunkBackend::getChunkFilePath(const std::string& chunk_id) const {
+    return directory_ + "/" + chunk_id;
+}
+
+std::string FileChunkBackend::getChunkMetadataPath(const std::string& chunk_id) const {
+    return directory_ + "/" + chunk_id + ".meta";
+}
+
+std::string FileChunkBackend::getChunkTempPath(const std::string& chunk_id) const {
+    static std::atomic<uint64_t> temp_counter{0};
+    return directory_ + "/" + chunk_id + ".tmp." + std::to_string(temp_counter++);
+}
+
+bool FileChunkBackend::loadChunkMetadata(const std::string& chunk_id, StoredChunkInfo& info) {
+    std::ifstream file(getChunkMetadataPath(chunk_id));
+    return file.is_open() && decodeMetadata(file, chunk_id, info);
+}
+
+} // namespace dfs
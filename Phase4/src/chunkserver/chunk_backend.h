@@ -0,0 +1,131 @@
+#pragma once
+
+#include "utils.h"
+#include "io_engine.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cerrno>
+#include <sys/types.h>
+
+namespace dfs {
+
+// On-disk layout used by a ChunkStorage instance
+enum class StorageBackendType {
+    FILE_PER_CHUNK,   // One file per chunk, its metadata after the data
+    LOG_STRUCTURED    // Chunks appended into large preallocated segment files
+};
+
+// Per-chunk metadata persisted by the backend next to the data
+struct StoredChunkInfo {
+    std::string chunk_id;
+    int64_t size = 0;
+    std::string checksum;
+    std::vector<uint32_t> block_checksums;  // CRC32C per CHECKSUM_BLOCK_SIZE block, empty for older chunks
+    bool is_encrypted = false;
+    bool is_erasure_coded = false;
+    int64_t created_time = 0;
+};
+
+// Storage backend interface. Implementations must be safe to call from
+// multiple threads; ChunkStorage layers checksums and indexing on top.
+// Chunk data goes through the I/O engine the backend was created with.
+class ChunkBackend {
+public:
+    // Sequential writer for one chunk. Nothing is visible to readers until
+    // commit() succeeds; destroying an uncommitted writer discards the data.
+    class Writer {
+    public:
+        virtual ~Writer() = default;
+        virtual bool append(const uint8_t* data, size_t size) = 0;
+        virtual bool commit(const StoredChunkInfo& info) = 0;
+        virtual void abort() = 0;
+    };
+
+    // Random-access reader pinned to one committed version of a chunk. It
+    // stays valid even if the chunk is deleted or relocated meanwhile.
+    class Reader {
+    public:
+        virtual ~Reader() = default;
+        virtual int64_t size() const = 0;
+        virtual ssize_t read(int64_t offset, uint8_t* buffer, size_t length) = 0;
+
+        // Like read(), without blocking the caller; `done` gets the byte
+        // count or -errno, possibly on an I/O engine thread
+        virtual void readAsync(int64_t offset, uint8_t* buffer, size_t length, IoEngine::Completion done) {
+            ssize_t bytes = read(offset, buffer, length);
+            done(bytes < 0 ? -errno : bytes);
+        }
+    };
+
+    virtual ~ChunkBackend() = default;
+
+    // size_hint is the expected chunk size, or 0 if unknown
+    virtual std::unique_ptr<Writer> openWriter(const std::string& chunk_id, int64_t size_hint) = 0;
+    virtual std::unique_ptr<Reader> openReader(const std::string& chunk_id) = 0;
+    virtual bool removeChunk(const std::string& chunk_id) = 0;
+
+    virtual bool getChunkInfo(const std::string& chunk_id, StoredChunkInfo& info) = 0;
+    virtual int64_t getChunkSize(const std::string& chunk_id) = 0;
+
+    // Enumerates stored chunks. Fields the backend can't provide cheaply
+    // (e.g. checksums kept in sidecar files) may be left empty.
+    virtual std::vector<StoredChunkInfo> listChunks() = 0;
+
+    // Reclaims space held by deleted or overwritten chunks
+    virtual void compact() {}
+
+    // Makes every commit that returned before the call durable, data and
+    // metadata alike
+    virtual bool sync() = 0;
+
+    virtual StorageBackendType getType() const = 0;
+
+    static std::unique_ptr<ChunkBackend> create(StorageBackendType type,
+                                                const std::string& directory,
+                                                std::shared_ptr<IoEngine> io_engine);
+    static const char* typeToString(StorageBackendType type);
+    static bool parseType(const std::string& name, StorageBackendType& type);
+};
+
+// Original layout: one <dir>/<chunk_id> file per chunk. The metadata (JSON)
+// follows the data in the same file, so a commit is a single rename and a
+// single file to sync; chunks from before keep it in <dir>/<chunk_id>.meta.
+class FileChunkBackend : public ChunkBackend {
+public:
+    FileChunkBackend(const std::string& directory, std::shared_ptr<IoEngine> io_engine);
+
+    std::unique_ptr<Writer> openWriter(const std::string& chunk_id, int64_t size_hint) override;
+    std::unique_ptr<Reader> openReader(const std::string& chunk_id) override;
+    bool removeChunk(const std::string& chunk_id) override;
+
+    bool getChunkInfo(const std::string& chunk_id, StoredChunkInfo& info) override;
+    int64_t getChunkSize(const std::string& chunk_id) override;
+    std::vector<StoredChunkInfo> listChunks() override;
+
+    // Syncs the files of the chunks committed since the last sync and the
+    // directory; commits themselves never sync
+    bool sync() override;
+
+    StorageBackendType getType() const override { return StorageBackendType::FILE_PER_CHUNK; }
+
+private:
+    std::string directory_;
+    std::shared_ptr<IoEngine> io_engine_;
+
+    std::mutex unsynced_mutex_;
+    std::vector<std::string> unsynced_chunks_;  // Committed since the last sync
+
+    std::string getChunkFilePath(const std::string& chunk_id) const;
+    std::string getChunkMetadataPath(const std::string& chunk_id) const;
+    std::string getChunkTempPath(const std::string& chunk_id) const;
+
+    // From the .meta sidecar of a chunk written before metadata moved into the file
+    bool loadChunkMetadata(const std::string& chunk_id, StoredChunkInfo& info);
+
+    class FileWriter;
+    class FileReader;
+};
+
+} // namespace dfs
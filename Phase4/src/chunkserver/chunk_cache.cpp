@@ -0,0 +1,199 @@
+#include "chunk_cache.h"
+#include <algorithm>
+
+namespace dfs {
+
+namespace {
+
+constexpr size_t MIN_SKETCH_WIDTH = 1024;
+constexpr size_t SKETCH_COUNTERS_PER_ENTRY = 16;   // Track many more chunks than fit in the cache
+constexpr int64_t SAMPLE_SIZE_PER_COUNTER = 10;    // Increments per counter before aging
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+} // namespace
+
+ChunkCache::ChunkCache(const ChunkCacheOptions& options)
+    : capacity_(std::max<int64_t>(options.capacity_bytes, 0)),
+      max_entry_bytes_(std::min(options.max_entry_bytes, capacity_)),
+      protected_capacity_(static_cast<int64_t>(capacity_ * options.protected_ratio)),
+      bytes_(0),
+      protected_bytes_(0),
+      sketch_increments_(0) {
+    // Sized for chunks of a typical size filling the cache
+    size_t expected_entries = static_cast<size_t>(capacity_ / static_cast<int64_t>(CHUNK_SIZE)) + 1;
+    sketch_width_ = MIN_SKETCH_WIDTH;
+    while (sketch_width_ < expected_entries * SKETCH_COUNTERS_PER_ENTRY) {
+        sketch_width_ *= 2;
+    }
+    sketch_.assign(SKETCH_ROWS * sketch_width_, 0);
+    sample_size_ = static_cast<int64_t>(sketch_width_) * SAMPLE_SIZE_PER_COUNTER;
+    stats_.capacity_bytes = capacity_;
+}
+
+ChunkCache::Data ChunkCache::lookup(const std::string& chunk_id, const std::string& checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recordAccess(chunk_id);
+
+    auto it = index_.find(chunk_id);
+    if (it == index_.end()) {
+        stats_.misses++;
+        return nullptr;
+    }
+
+    EntryList::iterator entry = it->second;
+    if (entry->checksum != checksum) {
+        remove(entry);
+        stats_.misses++;
+        return nullptr;
+    }
+    stats_.hits++;
+
+    if (entry->is_protected) {
+        protected_.splice(protected_.begin(), protected_, entry);
+        return entry->data;
+    }
+
+    // Read again while on probation: protect it, making room by demoting
+    // the least recently used protected chunks
+    entry->is_protected = true;
+    protected_bytes_ += static_cast<int64_t>(entry->data->size());
+    protected_.splice(protected_.begin(), probation_, entry);
+    while (protected_bytes_ > protected_capacity_ && protected_.size() > 1) {
+        auto demoted = std::prev(protected_.end());
+        demoted->is_protected = false;
+        protected_bytes_ -= static_cast<int64_t>(demoted->data->size());
+        probation_.splice(probation_.begin(), protected_, demoted);
+    }
+    return entry->data;
+}
+
+bool ChunkCache::wouldAdmit(const std::string& chunk_id, int64_t size) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return admit(chunk_id, size);
+}
+
+bool ChunkCache::insert(const std::string& chunk_id, const std::string& checksum, Data data) {
+    int64_t size = data ? static_cast<int64_t>(data->size()) : 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(chunk_id);
+    if (it != index_.end()) {
+        remove(it->second);
+    }
+
+    if (!admit(chunk_id, size)) {
+        stats_.rejections++;
+        return false;
+    }
+
+    while (bytes_ + size > capacity_) {
+        evictOne();
+    }
+
+    probation_.push_front(Entry{chunk_id, checksum, std::move(data), false});
+    index_[chunk_id] = probation_.begin();
+    bytes_ += size;
+    stats_.insertions++;
+    return true;
+}
+
+void ChunkCache::invalidate(const std::string& chunk_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(chunk_id);
+    if (it != index_.end()) {
+        remove(it->second);
+    }
+}
+
+ChunkCache::Stats ChunkCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.bytes = bytes_;
+    stats.entries = static_cast<int64_t>(index_.size());
+    return stats;
+}
+
+bool ChunkCache::admit(const std::string& chunk_id, int64_t size) const {
+    if (size <= 0 || size > max_entry_bytes_) {
+        return false;
+    }
+    if (bytes_ + size <= capacity_) {
+        return true;
+    }
+
+    // Only worth it if every chunk it would push out is looked up less
+    // often; probationary chunks go first, as evictOne() takes them
+    uint8_t candidate = frequency(chunk_id);
+    int64_t freed = 0;
+    for (const EntryList* list : {&probation_, &protected_}) {
+        for (auto victim = list->rbegin(); victim != list->rend(); ++victim) {
+            if (frequency(victim->chunk_id) >= candidate) {
+                return false;
+            }
+            freed += static_cast<int64_t>(victim->data->size());
+            if (bytes_ - freed + size <= capacity_) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ChunkCache::remove(EntryList::iterator entry) {
+    int64_t size = static_cast<int64_t>(entry->data->size());
+    bytes_ -= size;
+    if (entry->is_protected) {
+        protected_bytes_ -= size;
+    }
+    index_.erase(entry->chunk_id);
+    (entry->is_protected ? protected_ : probation_).erase(entry);
+}
+
+void ChunkCache::evictOne() {
+    EntryList& list = probation_.empty() ? protected_ : probation_;
+    remove(std::prev(list.end()));
+    stats_.evictions++;
+}
+
+void ChunkCache::recordAccess(const std::string& chunk_id) {
+    uint64_t hash = std::hash<std::string>{}(chunk_id);
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        uint8_t& counter = sketch_[sketchIndex(hash, row)];
+        if (counter < MAX_FREQUENCY) {
+            counter++;
+        }
+    }
+
+    // Aging: halve everything so past popularity fades
+    if (++sketch_increments_ >= sample_size_) {
+        for (uint8_t& counter : sketch_) {
+            counter >>= 1;
+        }
+        sketch_increments_ /= 2;
+    }
+}
+
+uint8_t ChunkCache::frequency(const std::string& chunk_id) const {
+    uint64_t hash = std::hash<std::string>{}(chunk_id);
+    uint8_t estimate = MAX_FREQUENCY;
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        estimate = std::min(estimate, sketch_[sketchIndex(hash, row)]);
+    }
+    return estimate;
+}
+
+size_t ChunkCache::sketchIndex(uint64_t hash, int row) const {
+    uint64_t seeded = mix(hash + 0x9e3779b97f4a7c15ULL * static_cast<uint64_t>(row + 1));
+    return static_cast<size_t>(row) * sketch_width_ + (seeded & (sketch_width_ - 1));
+}
+
+} // namespace dfs
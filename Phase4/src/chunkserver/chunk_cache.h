@@ -0,0 +1,106 @@
+#pragma once
+
+#include "utils.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace dfs {
+
+struct ChunkCacheOptions {
+    int64_t capacity_bytes = 256 * 1024 * 1024;     // 0 disables the cache
+    int64_t max_entry_bytes = 16 * 1024 * 1024;     // Larger chunks are never cached
+    double protected_ratio = 0.8;                   // Share of the capacity for chunks read more than once
+};
+
+// Memory-bounded cache of whole, already verified chunks, so that hot
+// chunks are served without disk I/O or checksumming.
+//
+// Eviction is segmented LRU: new chunks enter a probationary segment and
+// move to the protected one when read again, so a scan can only displace
+// other chunks that were read once. Admission is TinyLFU: a small
+// count-min sketch tracks how often every chunk id was looked up lately,
+// and a chunk only gets in by evicting chunks looked up less often.
+//
+// Entries are keyed by chunk id and checksum; a lookup with a different
+// checksum (the chunk was rewritten) is a miss and drops the entry.
+class ChunkCache {
+public:
+    using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+    struct Stats {
+        int64_t hits = 0;
+        int64_t misses = 0;
+        int64_t insertions = 0;
+        int64_t rejections = 0;         // Offered chunks turned away by admission or size
+        int64_t evictions = 0;
+        int64_t bytes = 0;
+        int64_t entries = 0;
+        int64_t capacity_bytes = 0;
+    };
+
+    explicit ChunkCache(const ChunkCacheOptions& options = ChunkCacheOptions());
+
+    ChunkCache(const ChunkCache&) = delete;
+    ChunkCache& operator=(const ChunkCache&) = delete;
+
+    // The cached chunk if its checksum matches; counts towards the chunk's
+    // frequency either way
+    Data lookup(const std::string& chunk_id, const std::string& checksum);
+
+    // Whether insert() would keep a chunk of this size now, so callers can
+    // skip collecting the data otherwise
+    bool wouldAdmit(const std::string& chunk_id, int64_t size) const;
+
+    // Offers verified chunk data; false if it was not admitted
+    bool insert(const std::string& chunk_id, const std::string& checksum, Data data);
+
+    void invalidate(const std::string& chunk_id);
+
+    Stats getStats() const;
+
+private:
+    struct Entry {
+        std::string chunk_id;
+        std::string checksum;
+        Data data;
+        bool is_protected = false;
+    };
+    using EntryList = std::list<Entry>;
+
+    // Count-min sketch of 4-bit counters, halved every sample_size_ increments
+    static constexpr int SKETCH_ROWS = 4;
+    static constexpr uint8_t MAX_FREQUENCY = 15;
+
+    int64_t capacity_;
+    int64_t max_entry_bytes_;
+    int64_t protected_capacity_;
+
+    mutable std::mutex mutex_;
+    EntryList probation_;               // Most recently used first
+    EntryList protected_;
+    std::unordered_map<std::string, EntryList::iterator> index_;
+    int64_t bytes_;
+    int64_t protected_bytes_;
+
+    std::vector<uint8_t> sketch_;       // SKETCH_ROWS rows of sketch_width_ counters
+    size_t sketch_width_;               // Power of two
+    int64_t sketch_increments_;
+    int64_t sample_size_;
+
+    Stats stats_;
+
+    // Callers hold mutex_
+    bool admit(const std::string& chunk_id, int64_t size) const;
+    void remove(EntryList::iterator entry);
+    void evictOne();
+    void recordAccess(const std::string& chunk_id);
+    uint8_t frequency(const std::string& chunk_id) const;
+    size_t sketchIndex(uint64_t hash, int row) const;
+};
+
+} // namespace dfs
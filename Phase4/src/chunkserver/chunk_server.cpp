@@ -1,11 +1,15 @@
 #include "chunk_server.h"
 #include "crypto.h"
+#include "channel_pool.h"
 #include <iostream>
 #include <fstream>
 #include <signal.h>
 #include <sys/statvfs.h>
 #include <unistd.h>
 #include <queue>
+#include <deque>
+#include <limits>
+#include <cstdlib>
 
 namespace dfs {
 
@@ -19,15 +23,28 @@ void chunkServerSignalHandler(int signal) {
     }
 }
 
-ChunkServer::ChunkServer(const std::string& server_id, const std::string& storage_directory)
+ChunkServer::ChunkServer(const std::string& server_id, const std::string& storage_directory,
+                         StorageBackendType backend_type,
+                         const IoEngineOptions& io_options,
+                         const DurabilityOptions& durability)
     : server_id_(server_id),
       running_(false),
+      report_sequence_(0),
+      full_report_needed_(true),
+      last_full_report_time_(0),
       bytes_written_(0),
       bytes_read_(0),
       chunks_written_(0),
       chunks_read_(0) {
     
-    storage_ = std::make_unique<dfs::ChunkStorage>(storage_directory);
+    // The SYNC I/O engine runs its asynchronous requests on the same pool
+    io_pool_ = std::make_unique<IoThreadPool>(DEFAULT_IO_THREADS);
+    IoEngineOptions engine_options = io_options;
+    engine_options.sync_pool = io_pool_.get();
+    storage_ = std::make_unique<dfs::ChunkStorage>(storage_directory, backend_type, engine_options, durability);
+    storage_->setChangeListener([this](const std::string& chunk_id, bool stored) {
+        recordChunkChange(chunk_id, stored);
+    });
     
     Utils::logInfo("ChunkServer " + server_id_ + " initialized with storage at " + storage_directory);
 }
@@ -104,9 +121,11 @@ void ChunkServer::stop() {
     
     running_.store(false);
     
+    // Calls still in progress need the I/O pool to finish
     if (server_) {
         server_->Shutdown();
     }
+    io_pool_->shutdown();
     
     // Notify replication thread
     replication_cv_.notify_all();
@@ -125,90 +144,168 @@ void ChunkServer::stop() {
     Utils::logInfo("ChunkServer " + server_id_ + " stopped");
 }
 
-grpc::Status ChunkServer::WriteChunk(grpc::ServerContext* context,
-                                    const WriteChunkRequest* request,
-                                    WriteChunkResponse* response) {
+template <typename Handler>
+grpc::ServerUnaryReactor* ChunkServer::runOnIoPool(grpc::CallbackServerContext* context, Handler handler) {
+    // The request and response stay valid until the reactor finishes
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    io_pool_->submit([reactor, handler = std::move(handler)]() mutable {
+        reactor->Finish(handler());
+    });
+    return reactor;
+}
+
+grpc::ServerUnaryReactor* ChunkServer::WriteChunk(grpc::CallbackServerContext* context,
+                                                  const WriteChunkRequest* request,
+                                                  WriteChunkResponse* response) {
+    // The pool thread moves on while the write is being synced; the
+    // response goes out from the durability callback
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    io_pool_->submit([this, reactor, request, response] {
+        handleWriteChunk(request, response, [reactor] { reactor->Finish(grpc::Status::OK); });
+    });
+    return reactor;
+}
+
+grpc::ServerUnaryReactor* ChunkServer::ReadChunk(grpc::CallbackServerContext* context,
+                                                 const ReadChunkRequest* request,
+                                                 ReadChunkResponse* response) {
+    return runOnIoPool(context, [this, request, response] {
+        return handleReadChunk(request, response);
+    });
+}
+
+grpc::ServerUnaryReactor* ChunkServer::CheckChunkIntegrity(grpc::CallbackServerContext* context,
+                                                           const CheckIntegrityRequest* request,
+                                                           CheckIntegrityResponse* response) {
+    return runOnIoPool(context, [this, request, response] {
+        const std::string& chunk_id = request->chunk_id();
+        
+        bool is_valid = storage_->verifyChunkIntegrity(chunk_id);
+        std::string checksum = storage_->getChunkChecksum(chunk_id);
+        
+        response->set_is_valid(is_valid);
+        response->set_checksum(checksum);
+        
+        Utils::logDebug("Integrity check for chunk " + chunk_id + ": " + 
+                       (is_valid ? "VALID" : "INVALID"));
+        
+        return grpc::Status::OK;
+    });
+}
+
+grpc::ServerUnaryReactor* ChunkServer::CopyChunk(grpc::CallbackServerContext* context,
+                                                 const CopyChunkRequest* request,
+                                                 CopyChunkResponse* response) {
+    // Fetching from the source server blocks an I/O thread like a disk read would
+    return runOnIoPool(context, [this, request, response] {
+        const std::string& chunk_id = request->chunk_id();
+        const std::string& source_server = request->source_server();
+        
+        Utils::logInfo("CopyChunk request: " + chunk_id + " from " + source_server);
+        
+        bool success = copyChunkFromServer(chunk_id, source_server);
+        
+        if (success) {
+            response->set_success(true);
+            response->set_message("Chunk copied successfully");
+            Utils::logInfo("Successfully copied chunk " + chunk_id + " from " + source_server);
+        } else {
+            response->set_success(false);
+            response->set_message("Failed to copy chunk");
+            Utils::logError("Failed to copy chunk " + chunk_id + " from " + source_server);
+        }
+        
+        return grpc::Status::OK;
+    });
+}
+
+void ChunkServer::handleWriteChunk(const WriteChunkRequest* request, WriteChunkResponse* response,
+                                   std::function<void()> done) {
     const std::string& chunk_id = request->chunk_id();
     
     Utils::logDebug("WriteChunk request for: " + chunk_id);
     
-    // Convert protobuf bytes to vector
-    std::vector<uint8_t> data(request->data().begin(), request->data().end());
-    
-    // Verify checksum if provided
-    if (!request->checksum().empty()) {
-        std::string actual_checksum = Utils::calculateSHA256(data);
-        if (actual_checksum != request->checksum()) {
-            response->set_success(false);
-            response->set_message("Checksum mismatch");
-            Utils::logError("Checksum mismatch for chunk " + chunk_id);
-            return grpc::Status::OK;
-        }
-    }
+    // Encrypted chunks are stored as the client sent them. The data is
+    // hashed once, while it is written; that digest is both checked against
+    // the client's checksum and returned as the stored one.
+    const std::string& data = request->data();
+    std::shared_ptr<ChunkStorage::ChunkWriter> chunk_writer =
+        storage_->openChunkWriter(chunk_id, request->is_encrypted(), request->is_erasure_coded(), data.size());
     
-    // Handle encryption
-    std::vector<uint8_t> final_data = data;
-    if (request->is_encrypted()) {
-        // Data is already encrypted by client, just store it
-        Utils::logDebug("Storing encrypted chunk: " + chunk_id);
+    if (!chunk_writer ||
+        !chunk_writer->append(reinterpret_cast<const uint8_t*>(data.data()), data.size())) {
+        response->set_success(false);
+        response->set_message("Failed to write chunk to storage");
+        Utils::logError("Failed to write chunk " + chunk_id);
+        done();
+        return;
     }
     
-    // Write chunk to storage
-    bool success = storage_->writeChunk(chunk_id, final_data, 
-                                       request->is_encrypted(), 
-                                       request->is_erasure_coded());
-    
-    if (success) {
+    chunk_writer->commitAsync(request->checksum(),
+                              [this, request, response, chunk_writer, done = std::move(done)](bool ok) {
+        const std::string& chunk_id = request->chunk_id();
+        if (!ok) {
+            response->set_success(false);
+            response->set_message(request->checksum().empty() ? "Failed to write chunk to storage"
+                                                              : "Checksum mismatch");
+            Utils::logError("Failed to commit chunk " + chunk_id);
+            done();
+            return;
+        }
+        
         response->set_success(true);
-        response->set_stored_checksum(Utils::calculateSHA256(final_data));
+        response->set_stored_checksum(chunk_writer->checksum());
         response->set_message("Chunk written successfully");
         
         // Update metrics
-        bytes_written_ += data.size();
+        bytes_written_ += request->data().size();
         chunks_written_++;
         
         Utils::logInfo("Successfully wrote chunk " + chunk_id + 
-                      " (" + std::to_string(data.size()) + " bytes)");
-    } else {
-        response->set_success(false);
-        response->set_message("Failed to write chunk to storage");
-        Utils::logError("Failed to write chunk " + chunk_id);
-    }
-    
-    return grpc::Status::OK;
+                      " (" + std::to_string(request->data().size()) + " bytes)");
+        done();
+    });
 }
 
-grpc::Status ChunkServer::ReadChunk(grpc::ServerContext* context,
-                                   const ReadChunkRequest* request,
-                                   ReadChunkResponse* response) {
+grpc::Status ChunkServer::handleReadChunk(const ReadChunkRequest* request,
+                                         ReadChunkResponse* response) {
     const std::string& chunk_id = request->chunk_id();
     
     Utils::logDebug("ReadChunk request for: " + chunk_id);
     
-    // Read chunk from storage
-    std::vector<uint8_t> data = storage_->readChunk(chunk_id);
+    // Only the blocks the range touches are read and verified
+    const bool whole_chunk = request->offset() == 0 && request->length() == 0;
+    int64_t length = request->length() > 0 ? request->length() : std::numeric_limits<int64_t>::max();
+    std::vector<uint8_t> data;
+    std::vector<int64_t> corrupted_blocks;
     
-    if (data.empty()) {
+    if (!storage_->readChunkRange(chunk_id, request->offset(), length, data, &corrupted_blocks) ||
+        (whole_chunk && data.empty())) {
+        if (!corrupted_blocks.empty()) {
+            scheduleRepair(chunk_id);
+        }
         response->set_success(false);
         response->set_message("Chunk not found or corrupted");
         Utils::logWarning("Failed to read chunk " + chunk_id);
         return grpc::Status::OK;
     }
     
-    // Verify integrity if requested
-    if (request->verify_integrity()) {
-        if (!storage_->verifyChunkIntegrity(chunk_id)) {
-            response->set_success(false);
-            response->set_message("Chunk integrity verification failed");
-            Utils::logError("Integrity verification failed for chunk " + chunk_id);
-            return grpc::Status::OK;
-        }
+    // Only chunks without a checksum were returned unverified
+    std::string checksum = storage_->getChunkChecksum(chunk_id);
+    if (request->verify_integrity() && checksum.empty()) {
+        response->set_success(false);
+        response->set_message("Chunk integrity verification failed");
+        Utils::logError("Integrity verification failed for chunk " + chunk_id);
+        return grpc::Status::OK;
     }
     
     // Set response data
     response->set_success(true);
-    response->set_data(std::string(data.begin(), data.end()));
-    response->set_checksum(Utils::calculateSHA256(data));
+    response->set_data(data.data(), data.size());
+    response->set_data_crc32c(Utils::crc32c(data.data(), data.size()));
+    if (whole_chunk) {
+        response->set_checksum(checksum.empty() ? Utils::calculateSHA256(data) : checksum);
+    }
     response->set_message("Chunk read successfully");
     
     // Update metrics
@@ -221,44 +318,332 @@ grpc::Status ChunkServer::ReadChunk(grpc::ServerContext* context,
     return grpc::Status::OK;
 }
 
-grpc::Status ChunkServer::CheckChunkIntegrity(grpc::ServerContext* context,
-                                             const CheckIntegrityRequest* request,
-                                             CheckIntegrityResponse* response) {
-    const std::string& chunk_id = request->chunk_id();
+// Client stream of chunk frames. Frames are appended in order on the I/O
+// pool while the next ones are read off the wire (at most
+// MAX_QUEUED_FRAMES waiting); the response goes out once the chunk is
+// committed, or as soon as a write fails.
+class ChunkServer::WriteStreamReactor : public grpc::ServerReadReactor<WriteChunkFrame> {
+public:
+    WriteStreamReactor(ChunkServer* server, grpc::CallbackServerContext* context,
+                       WriteChunkResponse* response)
+        : server_(server), context_(context), response_(response),
+          reading_(true), appending_(false), end_of_stream_(false), finished_(false),
+          expected_size_(0) {
+        StartRead(&frame_);
+    }
     
-    bool is_valid = storage_->verifyChunkIntegrity(chunk_id);
-    std::string checksum = storage_->getChunkChecksum(chunk_id);
+    void OnReadDone(bool ok) override {
+        bool start_read = false;
+        bool start_append = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reading_ = false;
+            if (ok) {
+                frames_.push_back(std::move(frame_));
+                start_read = !finished_ && frames_.size() < MAX_QUEUED_FRAMES;
+                reading_ = start_read;
+            } else {
+                end_of_stream_ = true;
+            }
+            start_append = !appending_ && !finished_;
+            appending_ = appending_ || start_append;
+        }
+        
+        if (start_read) {
+            StartRead(&frame_);
+        }
+        if (start_append) {
+            server_->io_pool_->submit([this] { drain(); });
+        }
+    }
     
-    response->set_is_valid(is_valid);
-    response->set_checksum(checksum);
+    void OnDone() override {
+        delete this;
+    }
     
-    Utils::logDebug("Integrity check for chunk " + chunk_id + ": " + 
-                   (is_valid ? "VALID" : "INVALID"));
+private:
+    static constexpr size_t MAX_QUEUED_FRAMES = 2;
     
-    return grpc::Status::OK;
-}
+    ChunkServer* server_;
+    grpc::CallbackServerContext* context_;
+    WriteChunkResponse* response_;
+    
+    WriteChunkFrame frame_;                     // Being read
+    std::deque<WriteChunkFrame> frames_;        // Read, waiting to be appended
+    std::mutex mutex_;
+    bool reading_;
+    bool appending_;
+    bool end_of_stream_;
+    bool finished_;
+    
+    // Owned by whichever pool thread is draining
+    std::unique_ptr<dfs::ChunkStorage::ChunkWriter> chunk_writer_;
+    std::string chunk_id_;
+    std::string expected_checksum_;
+    int64_t expected_size_;
+    
+    // Appends the queued frames; commits once the stream has ended
+    void drain() {
+        while (true) {
+            WriteChunkFrame frame;
+            bool start_read = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (frames_.empty()) {
+                    appending_ = false;
+                    if (!end_of_stream_) {
+                        return;     // The next OnReadDone resumes
+                    }
+                    break;
+                }
+                
+                frame = std::move(frames_.front());
+                frames_.pop_front();
+                if (!reading_ && !end_of_stream_) {
+                    reading_ = true;
+                    start_read = true;
+                }
+            }
+            
+            if (start_read) {
+                StartRead(&frame_);
+            }
+            if (!append(frame)) {
+                finish();
+                return;
+            }
+        }
+        
+        commit();
+    }
+    
+    bool append(const WriteChunkFrame& frame) {
+        // First frame carries the chunk header
+        if (!chunk_writer_) {
+            chunk_id_ = frame.chunk_id();
+            expected_checksum_ = frame.checksum();
+            expected_size_ = frame.total_size();
+            
+            Utils::logDebug("WriteChunkStream request for: " + chunk_id_);
+            
+            chunk_writer_ = server_->storage_->openChunkWriter(chunk_id_, frame.is_encrypted(),
+                                                               frame.is_erasure_coded(), expected_size_);
+            if (!chunk_writer_) {
+                response_->set_success(false);
+                response_->set_message("Failed to open chunk for writing");
+                return false;
+            }
+        }
+        
+        // Frames go straight from the request buffer to the file
+        const std::string& payload = frame.data();
+        if (!chunk_writer_->append(reinterpret_cast<const uint8_t*>(payload.data()), payload.size())) {
+            response_->set_success(false);
+            response_->set_message("Failed to write chunk to storage");
+            Utils::logError("Failed to write chunk " + chunk_id_);
+            return false;
+        }
+        return true;
+    }
+    
+    // Finishes the call, once the chunk is durable if it got committed
+    void commit() {
+        if (!chunk_writer_) {
+            response_->set_success(false);
+            response_->set_message("Empty chunk stream");
+            finish();
+            return;
+        }
+        
+        // A cancelled stream ends like a complete one
+        if (context_->IsCancelled() ||
+            (expected_size_ > 0 && chunk_writer_->bytesWritten() != expected_size_)) {
+            chunk_writer_->abort();
+            response_->set_success(false);
+            response_->set_message("Incomplete chunk stream");
+            Utils::logError("Incomplete stream for chunk " + chunk_id_ + ": got " +
+                           std::to_string(chunk_writer_->bytesWritten()) + " of " +
+                           std::to_string(expected_size_) + " bytes");
+            finish();
+            return;
+        }
+        
+        // The pool thread is free while the chunk is being synced
+        chunk_writer_->commitAsync(expected_checksum_, [this](bool ok) {
+            committed(ok);
+            finish();
+        });
+    }
+    
+    void committed(bool ok) {
+        if (!ok) {
+            response_->set_success(false);
+            response_->set_message(expected_checksum_.empty() ? "Failed to write chunk to storage" 
+                                                              : "Checksum mismatch");
+            Utils::logError("Failed to commit chunk " + chunk_id_);
+            return;
+        }
+        
+        response_->set_success(true);
+        response_->set_stored_checksum(chunk_writer_->checksum());
+        response_->set_message("Chunk written successfully");
+        
+        server_->bytes_written_ += chunk_writer_->bytesWritten();
+        server_->chunks_written_++;
+        
+        Utils::logInfo("Successfully wrote chunk " + chunk_id_ + 
+                      " (" + std::to_string(chunk_writer_->bytesWritten()) + " bytes, streamed)");
+    }
+    
+    // The reactor may be gone as soon as Finish returns
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+        }
+        Finish(grpc::Status::OK);
+    }
+};
 
-grpc::Status ChunkServer::CopyChunk(grpc::ServerContext* context,
-                                   const CopyChunkRequest* request,
-                                   CopyChunkResponse* response) {
-    const std::string& chunk_id = request->chunk_id();
-    const std::string& source_server = request->source_server();
+// Server stream of a chunk. The next frame is read and verified on the I/O
+// pool while the previous one is on the wire. Verification failures end the
+// call with DATA_LOSS and the client throws away what it received.
+class ChunkServer::ReadStreamReactor : public grpc::ServerWriteReactor<ReadChunkFrame> {
+public:
+    ReadStreamReactor(ChunkServer* server, grpc::CallbackServerContext* context,
+                      const ReadChunkRequest* request)
+        : server_(server), context_(context), chunk_id_(request->chunk_id()),
+          current_(0), frames_loaded_(0), writing_(false), next_(Next::PENDING), client_gone_(false),
+          bytes_sent_(0) {
+        server_->io_pool_->submit([this] { open(); });
+    }
+    
+    void OnWriteDone(bool ok) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        writing_ = false;
+        if (!ok) {
+            client_gone_ = true;
+        }
+        if (next_ != Next::PENDING) {
+            advance(lock);
+        }
+    }
     
-    Utils::logInfo("CopyChunk request: " + chunk_id + " from " + source_server);
+    void OnDone() override {
+        delete this;
+    }
     
-    bool success = copyChunkFromServer(chunk_id, source_server);
+private:
+    enum class Next { PENDING, FRAME, END, FAILED };
     
-    if (success) {
-        response->set_success(true);
-        response->set_message("Chunk copied successfully");
-        Utils::logInfo("Successfully copied chunk " + chunk_id + " from " + source_server);
-    } else {
-        response->set_success(false);
-        response->set_message("Failed to copy chunk");
-        Utils::logError("Failed to copy chunk " + chunk_id + " from " + source_server);
+    ChunkServer* server_;
+    grpc::CallbackServerContext* context_;
+    std::string chunk_id_;
+    std::unique_ptr<dfs::ChunkStorage::ChunkReader> reader_;
+    
+    ReadChunkFrame frames_[2];      // frames_[current_] is on the wire, the other one is being loaded
+    int current_;
+    int64_t frames_loaded_;
+    
+    std::mutex mutex_;
+    bool writing_;
+    Next next_;                     // State of the frame being loaded
+    bool client_gone_;
+    int64_t bytes_sent_;
+    
+    void open() {
+        Utils::logDebug("ReadChunkStream request for: " + chunk_id_);
+        
+        reader_ = server_->storage_->openChunkReader(chunk_id_, STREAM_FRAME_SIZE);
+        if (!reader_) {
+            Finish(grpc::Status(grpc::StatusCode::NOT_FOUND, "Chunk not found"));
+            return;
+        }
+        load();
     }
     
-    return grpc::Status::OK;
+    void load() {
+        // The first frame carries size and checksum
+        ReadChunkFrame& frame = frames_[1 - current_];
+        if (frames_loaded_++ == 0) {
+            frame.set_total_size(reader_->size());
+            frame.set_checksum(reader_->checksum());
+        } else {
+            frame.clear_total_size();
+            frame.clear_checksum();
+        }
+        
+        // The disk read is in flight without holding a thread; the frame is
+        // verified and the callback runs on the I/O pool
+        reader_->nextAsync(*server_->io_pool_, [this, &frame](bool ok, const uint8_t* data, size_t size) {
+            Next next;
+            if (!ok) {
+                next = Next::FAILED;
+            } else if (size == 0) {
+                next = Next::END;
+            } else {
+                frame.set_data(data, size);
+                next = Next::FRAME;
+            }
+            
+            std::unique_lock<std::mutex> lock(mutex_);
+            next_ = next;
+            if (!writing_) {
+                advance(lock);
+            }
+        });
+    }
+    
+    // Called with the lock held once the previous frame is sent and the
+    // next one loaded
+    void advance(std::unique_lock<std::mutex>& lock) {
+        Next next = next_;
+        next_ = Next::PENDING;
+        
+        if (client_gone_ || context_->IsCancelled()) {
+            lock.unlock();
+            Finish(grpc::Status(grpc::StatusCode::CANCELLED, "Client cancelled chunk stream"));
+            return;
+        }
+        
+        switch (next) {
+            case Next::FRAME:
+                current_ = 1 - current_;
+                writing_ = true;
+                bytes_sent_ += frames_[current_].data().size();
+                lock.unlock();
+                
+                StartWrite(&frames_[current_]);
+                load();
+                return;
+                
+            case Next::END:
+                server_->bytes_read_ += bytes_sent_;
+                server_->chunks_read_++;
+                Utils::logDebug("Successfully streamed chunk " + chunk_id_ + 
+                               " (" + std::to_string(bytes_sent_) + " bytes)");
+                lock.unlock();
+                Finish(grpc::Status::OK);
+                return;
+                
+            default:
+                lock.unlock();
+                Utils::logWarning("Failed to stream chunk " + chunk_id_);
+                server_->scheduleRepair(chunk_id_);
+                Finish(grpc::Status(grpc::StatusCode::DATA_LOSS, "Chunk not found or corrupted"));
+                return;
+        }
+    }
+};
+
+grpc::ServerReadReactor<WriteChunkFrame>* ChunkServer::WriteChunkStream(grpc::CallbackServerContext* context,
+                                                                        WriteChunkResponse* response) {
+    return new WriteStreamReactor(this, context, response);
+}
+
+grpc::ServerWriteReactor<ReadChunkFrame>* ChunkServer::ReadChunkStream(grpc::CallbackServerContext* context,
+                                                                       const ReadChunkRequest* request) {
+    return new ReadStreamReactor(this, context, request);
 }
 
 void ChunkServer::sendHeartbeats() {
@@ -276,10 +661,41 @@ void ChunkServer::sendHeartbeats() {
         request.set_cpu_usage(getCpuUsage());
         request.set_memory_usage(getMemoryUsage());
         
-        // Add list of stored chunks
-        auto chunk_ids = storage_->getAllChunkIds();
-        for (const std::string& chunk_id : chunk_ids) {
-            request.add_stored_chunks(chunk_id);
+        ChunkCache::Stats cache = storage_->getCacheStats();
+        ChunkCacheStats* cache_stats = request.mutable_cache_stats();
+        cache_stats->set_hits(cache.hits);
+        cache_stats->set_misses(cache.misses);
+        cache_stats->set_insertions(cache.insertions);
+        cache_stats->set_rejections(cache.rejections);
+        cache_stats->set_evictions(cache.evictions);
+        cache_stats->set_cached_bytes(cache.bytes);
+        cache_stats->set_cached_chunks(cache.entries);
+        cache_stats->set_capacity_bytes(cache.capacity_bytes);
+        
+        // A full chunk report after registering, when the master asks for
+        // one and every FULL_CHUNK_REPORT_INTERVAL_MS; otherwise only what
+        // changed. Changes are taken before the listing so that none fall
+        // between the two.
+        int64_t now = Utils::getCurrentTimestamp();
+        bool full_report = full_report_needed_ ||
+                           now - last_full_report_time_ >= FULL_CHUNK_REPORT_INTERVAL_MS;
+        auto changes = takeChunkChanges();
+        
+        request.set_report_sequence(report_sequence_ + 1);
+        if (full_report) {
+            request.set_report_type(REPORT_FULL);
+            for (const std::string& chunk_id : storage_->getAllChunkIds()) {
+                request.add_stored_chunks(chunk_id);
+            }
+        } else if (!changes.empty()) {
+            request.set_report_type(REPORT_INCREMENTAL);
+            for (const auto& change : changes) {
+                if (change.second) {
+                    request.add_added_chunks(change.first);
+                } else {
+                    request.add_removed_chunks(change.first);
+                }
+            }
         }
         
         HeartbeatResponse response;
@@ -287,7 +703,31 @@ void ChunkServer::sendHeartbeats() {
         
         grpc::Status status = master_stub_->SendHeartbeat(&context, request, &response);
         
-        if (status.ok() && response.success()) {
+        if (!status.ok() || !response.success()) {
+            // Resent with the same sequence number, which the master accepts
+            // whether or not it applied this attempt
+            if (!full_report) {
+                restoreChunkChanges(changes);
+            }
+        } else if (request.report_type() != REPORT_NONE) {
+            report_sequence_++;
+            if (full_report) {
+                full_report_needed_ = false;
+                last_full_report_time_ = now;
+            }
+        }
+        
+        if (status.ok() && response.full_report_requested()) {
+            full_report_needed_ = true;
+        }
+        
+        if (status.ok() && !response.success()) {
+            // The master has forgotten about us (e.g. we were declared dead)
+            Utils::logWarning("Heartbeat rejected by master, registering again");
+            if (registerWithMaster()) {
+                full_report_needed_ = true;
+            }
+        } else if (status.ok()) {
             // Process any replication tasks
             for (const ReplicationTask& task : response.replication_tasks()) {
                 std::lock_guard<std::mutex> lock(replication_mutex_);
@@ -313,7 +753,7 @@ void ChunkServer::processReplicationTasks() {
         std::unique_lock<std::mutex> lock(replication_mutex_);
         
         replication_cv_.wait(lock, [this] { 
-            return !replication_queue_.empty() || !running_.load(); 
+            return !replication_queue_.empty() || !repair_queue_.empty() || !running_.load(); 
         });
         
         if (!running_.load()) break;
@@ -327,6 +767,16 @@ void ChunkServer::processReplicationTasks() {
             
             lock.lock();
         }
+        
+        while (!repair_queue_.empty()) {
+            std::string chunk_id = *repair_queue_.begin();
+            repair_queue_.erase(repair_queue_.begin());
+            lock.unlock();
+            
+            handleCorruptChunk(chunk_id);
+            
+            lock.lock();
+        }
     }
 }
 
@@ -340,8 +790,12 @@ void ChunkServer::performMaintenance() {
         
         Utils::logInfo("Performing maintenance tasks");
         
-        // Garbage collection
-        storage_->performGarbageCollection();
+        // Scrub every chunk; corrupted blocks are repaired from a replica,
+        // chunks that can't be repaired are dropped
+        storage_->performGarbageCollection(
+            [this](const std::string& chunk_id, const std::vector<int64_t>& corrupted_blocks) {
+                return repairChunk(chunk_id, corrupted_blocks);
+            });
         
         // Update system metrics
         updateSystemMetrics();
@@ -353,6 +807,26 @@ void ChunkServer::performMaintenance() {
     }
 }
 
+void ChunkServer::recordChunkChange(const std::string& chunk_id, bool stored) {
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    pending_chunk_changes_[chunk_id] = stored;
+}
+
+std::unordered_map<std::string, bool> ChunkServer::takeChunkChanges() {
+    std::unordered_map<std::string, bool> changes;
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    changes.swap(pending_chunk_changes_);
+    return changes;
+}
+
+void ChunkServer::restoreChunkChanges(const std::unordered_map<std::string, bool>& changes) {
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    for (const auto& change : changes) {
+        // Anything recorded since is newer
+        pending_chunk_changes_.emplace(change.first, change.second);
+    }
+}
+
 bool ChunkServer::registerWithMaster() {
     RegisterChunkServerRequest request;
     request.set_server_id(server_id_);
@@ -399,30 +873,50 @@ bool ChunkServer::copyChunkFromServer(const std::string& chunk_id, const std::st
         
         std::string source_address = parts[0] + ":" + parts[1];
         
-        // Create connection to source server
-        auto channel = grpc::CreateChannel(source_address, grpc::InsecureChannelCredentials());
-        auto stub = dfs::ChunkStorage::NewStub(channel);
+        // Reuse the pooled connection to the source server
+        auto stub = dfs::ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(source_address));
         
-        // Request chunk from source
+        // Stream the chunk from the source straight into local storage
         ReadChunkRequest request;
         request.set_chunk_id(chunk_id);
         request.set_verify_integrity(true);
         
-        ReadChunkResponse response;
+        auto chunk_writer = storage_->openChunkWriter(chunk_id, false, false);
+        if (!chunk_writer) {
+            Utils::logError("Failed to open local chunk for copy: " + chunk_id);
+            return false;
+        }
+        
         grpc::ClientContext context;
+        auto reader = stub->ReadChunkStream(&context, request);
         
-        grpc::Status status = stub->ReadChunk(&context, request, &response);
+        ReadChunkFrame frame;
+        std::string expected_checksum;
+        bool first_frame = true;
         
-        if (!status.ok() || !response.success()) {
-            Utils::logError("Failed to read chunk from source: " + 
-                           (status.ok() ? response.message() : status.error_message()));
-            return false;
+        while (reader->Read(&frame)) {
+            if (first_frame) {
+                expected_checksum = frame.checksum();
+                first_frame = false;
+            }
+            
+            const std::string& payload = frame.data();
+            if (!chunk_writer->append(reinterpret_cast<const uint8_t*>(payload.data()), payload.size())) {
+                context.TryCancel();
+                ChannelPool::getInstance().reportResult(source_address, reader->Finish());
+                Utils::logError("Failed to write copied chunk " + chunk_id);
+                return false;
+            }
         }
         
-        // Write chunk to local storage
-        std::vector<uint8_t> data(response.data().begin(), response.data().end());
+        grpc::Status status = reader->Finish();
+        ChannelPool::getInstance().reportResult(source_address, status);
+        if (!status.ok()) {
+            Utils::logError("Failed to read chunk from source: " + status.error_message());
+            return false;
+        }
         
-        bool success = storage_->writeChunk(chunk_id, data, false, false);
+        bool success = chunk_writer->commit(expected_checksum);
         
         if (success) {
             Utils::logInfo("Successfully copied chunk " + chunk_id + " from " + source_server);
@@ -438,6 +932,100 @@ bool ChunkServer::copyChunkFromServer(const std::string& chunk_id, const std::st
     }
 }
 
+void ChunkServer::scheduleRepair(const std::string& chunk_id) {
+    std::lock_guard<std::mutex> lock(replication_mutex_);
+    repair_queue_.insert(chunk_id);
+    replication_cv_.notify_one();
+}
+
+void ChunkServer::handleCorruptChunk(const std::string& chunk_id) {
+    // The chunk may have been fixed or dropped since it was queued
+    std::vector<int64_t> corrupted_blocks;
+    if (!storage_->chunkExists(chunk_id) || storage_->scrubChunk(chunk_id, corrupted_blocks)) {
+        return;
+    }
+    
+    if (!repairChunk(chunk_id, corrupted_blocks)) {
+        storage_->deleteChunk(chunk_id);
+        Utils::logWarning("Dropped corrupted chunk " + chunk_id);
+    }
+}
+
+bool ChunkServer::repairChunk(const std::string& chunk_id, const std::vector<int64_t>& corrupted_blocks) {
+    ChunkCorruptionResponse response;
+    if (!reportCorruption(chunk_id, corrupted_blocks, response) || corrupted_blocks.empty() ||
+        response.replica_addresses_size() == 0) {
+        // The master re-replicates the whole chunk
+        return false;
+    }
+    
+    for (const std::string& address : response.replica_addresses()) {
+        std::map<int64_t, std::vector<uint8_t>> blocks;
+        if (fetchChunkBlocks(chunk_id, address, corrupted_blocks, blocks) &&
+            storage_->repairChunkBlocks(chunk_id, blocks)) {
+            Utils::logInfo("Repaired chunk " + chunk_id + " with " + std::to_string(blocks.size()) +
+                          " blocks from " + address);
+            return true;
+        }
+    }
+    
+    // No replica could help; fall back to replacing the whole chunk
+    ChunkCorruptionResponse fallback_response;
+    reportCorruption(chunk_id, {}, fallback_response);
+    return false;
+}
+
+bool ChunkServer::reportCorruption(const std::string& chunk_id, const std::vector<int64_t>& corrupted_blocks,
+                                   ChunkCorruptionResponse& response) {
+    ChunkCorruptionRequest request;
+    request.set_server_id(server_id_);
+    request.set_chunk_id(chunk_id);
+    request.set_block_size(CHECKSUM_BLOCK_SIZE);
+    for (int64_t block : corrupted_blocks) {
+        request.add_corrupted_blocks(block);
+    }
+    request.set_error_details(corrupted_blocks.empty()
+                                  ? "Chunk checksum mismatch"
+                                  : std::to_string(corrupted_blocks.size()) + " corrupted blocks");
+    
+    grpc::ClientContext context;
+    grpc::Status status = master_stub_->ReportChunkCorruption(&context, request, &response);
+    if (!status.ok()) {
+        Utils::logWarning("Failed to report corruption of chunk " + chunk_id + ": " + status.error_message());
+        return false;
+    }
+    return true;
+}
+
+bool ChunkServer::fetchChunkBlocks(const std::string& chunk_id, const std::string& address,
+                                   const std::vector<int64_t>& block_indexes,
+                                   std::map<int64_t, std::vector<uint8_t>>& blocks) {
+    auto stub = dfs::ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(address));
+    
+    for (int64_t block : block_indexes) {
+        ReadChunkRequest request;
+        request.set_chunk_id(chunk_id);
+        request.set_offset(block * static_cast<int64_t>(CHECKSUM_BLOCK_SIZE));
+        request.set_length(CHECKSUM_BLOCK_SIZE);
+        
+        ReadChunkResponse response;
+        grpc::ClientContext context;
+        grpc::Status status = stub->ReadChunk(&context, request, &response);
+        ChannelPool::getInstance().reportResult(address, status);
+        
+        const std::string& data = response.data();
+        if (!status.ok() || !response.success() ||
+            Utils::crc32c(data.data(), data.size()) != response.data_crc32c()) {
+            Utils::logWarning("Failed to fetch block " + std::to_string(block) + " of chunk " +
+                             chunk_id + " from " + address);
+            return false;
+        }
+        
+        blocks[block].assign(data.begin(), data.end());
+    }
+    return true;
+}
+
 void ChunkServer::updateSystemMetrics() {
     // Update metrics object
     Metrics& metrics = Metrics::getInstance();
@@ -485,8 +1073,9 @@ int64_t ChunkServer::getFreeSpace() {
 
 // Main function
 int main(int argc, char** argv) {
-    if (argc != 6) {
-        std::cerr << "Usage: " << argv[0] << " <server_id> <address> <port> <master_address> <master_port>" << std::endl;
+    if (argc < 6 || argc > 10) {
+        std::cerr << "Usage: " << argv[0] << " <server_id> <address> <port> <master_address> <master_port>"
+                  << " [file|segment [auto|uring|sync [buffered|direct [none|write|group[:<ms>]]]]]" << std::endl;
         return 1;
     }
     
@@ -496,10 +1085,50 @@ int main(int argc, char** argv) {
     std::string master_address = argv[4];
     int master_port = std::stoi(argv[5]);
     
+    // On-disk layout for chunks, one file per chunk unless asked otherwise
+    dfs::StorageBackendType backend_type = dfs::StorageBackendType::FILE_PER_CHUNK;
+    if (argc >= 7 && !dfs::ChunkBackend::parseType(argv[6], backend_type)) {
+        std::cerr << "Unknown storage backend: " << argv[6] << " (expected file or segment)" << std::endl;
+        return 1;
+    }
+    
+    // Disk I/O engine: io_uring when the kernel has it, optionally bypassing the page cache
+    dfs::IoEngineOptions io_options;
+    if (argc >= 8 && !dfs::IoEngine::parseType(argv[7], io_options.type)) {
+        std::cerr << "Unknown I/O engine: " << argv[7] << " (expected auto, uring or sync)" << std::endl;
+        return 1;
+    }
+    if (argc >= 9) {
+        std::string mode = argv[8];
+        if (mode != "direct" && mode != "buffered") {
+            std::cerr << "Unknown I/O option: " << argv[8] << " (expected buffered or direct)" << std::endl;
+            return 1;
+        }
+        io_options.direct_io = mode == "direct";
+    }
+    
+    // When writes are acknowledged: after a group commit sync unless asked otherwise
+    dfs::DurabilityOptions durability;
+    if (argc == 10) {
+        std::string mode = argv[9];
+        size_t colon = mode.find(':');
+        bool valid = dfs::DurabilityOptions::parseMode(mode.substr(0, colon), durability.mode);
+        if (valid && colon != std::string::npos) {
+            char* end = nullptr;
+            durability.group_commit_interval_ms = std::strtoll(mode.c_str() + colon + 1, &end, 10);
+            valid = durability.mode == dfs::DurabilityMode::GROUP_COMMIT && *end == '\0' &&
+                    end != mode.c_str() + colon + 1 && durability.group_commit_interval_ms >= 0;
+        }
+        if (!valid) {
+            std::cerr << "Unknown durability mode: " << argv[9] << " (expected none, write or group[:<ms>])" << std::endl;
+            return 1;
+        }
+    }
+    
     // Create storage directory
     std::string storage_dir = "./data/chunks_" + std::to_string(port);
     
-    dfs::ChunkServer server(server_id, storage_dir);
+    dfs::ChunkServer server(server_id, storage_dir, backend_type, io_options, durability);
     server.start(address, port, master_address, master_port);
     
     return 0;
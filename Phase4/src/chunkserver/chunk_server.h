@@ -1,40 +1,60 @@
 #include "file_system.pb.h"
 #include "file_system.grpc.pb.h"
 #include "chunk_storage.h"
+#include "io_thread_pool.h"
 #include "utils.h"
 #include <grpcpp/grpcpp.h>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <unordered_map>
+#include <set>
+#include <map>
 
 namespace dfs {
 
-class ChunkServer final : public ChunkStorage::Service {
+// Chunk service on gRPC's callback API: RPC threads only move messages,
+// blocking disk work runs on the I/O thread pool, and streams keep a frame
+// on the wire while the next one is read or written. Streamed reads are
+// submitted to the I/O engine (io_uring where available) without holding
+// a thread at all. A few threads serve any number of concurrent calls.
+class ChunkServer final : public ChunkStorage::CallbackService {
 public:
-    ChunkServer(const std::string& server_id, const std::string& storage_directory);
+    ChunkServer(const std::string& server_id, const std::string& storage_directory,
+               StorageBackendType backend_type = StorageBackendType::FILE_PER_CHUNK,
+               const IoEngineOptions& io_options = IoEngineOptions(),
+               const DurabilityOptions& durability = DurabilityOptions());
     ~ChunkServer();
     
+    static constexpr size_t DEFAULT_IO_THREADS = 16;
+    
     // Start the server
     void start(const std::string& address, int port, 
               const std::string& master_address, int master_port);
     void stop();
     
     // ChunkStorage service implementation
-    grpc::Status WriteChunk(grpc::ServerContext* context,
-                           const WriteChunkRequest* request,
-                           WriteChunkResponse* response) override;
+    grpc::ServerUnaryReactor* WriteChunk(grpc::CallbackServerContext* context,
+                                         const WriteChunkRequest* request,
+                                         WriteChunkResponse* response) override;
+    
+    grpc::ServerUnaryReactor* ReadChunk(grpc::CallbackServerContext* context,
+                                        const ReadChunkRequest* request,
+                                        ReadChunkResponse* response) override;
     
-    grpc::Status ReadChunk(grpc::ServerContext* context,
-                          const ReadChunkRequest* request,
-                          ReadChunkResponse* response) override;
+    grpc::ServerUnaryReactor* CheckChunkIntegrity(grpc::CallbackServerContext* context,
+                                                  const CheckIntegrityRequest* request,
+                                                  CheckIntegrityResponse* response) override;
     
-    grpc::Status CheckChunkIntegrity(grpc::ServerContext* context,
-                                    const CheckIntegrityRequest* request,
-                                    CheckIntegrityResponse* response) override;
+    grpc::ServerUnaryReactor* CopyChunk(grpc::CallbackServerContext* context,
+                                        const CopyChunkRequest* request,
+                                        CopyChunkResponse* response) override;
     
-    grpc::Status CopyChunk(grpc::ServerContext* context,
-                          const CopyChunkRequest* request,
-                          CopyChunkResponse* response) override;
+    grpc::ServerReadReactor<WriteChunkFrame>* WriteChunkStream(grpc::CallbackServerContext* context,
+                                                               WriteChunkResponse* response) override;
+    
+    grpc::ServerWriteReactor<ReadChunkFrame>* ReadChunkStream(grpc::CallbackServerContext* context,
+                                                              const ReadChunkRequest* request) override;
     
 private:
     std::string server_id_;
@@ -44,6 +64,7 @@ private:
     int master_port_;
     
     std::unique_ptr<grpc::Server> server_;
+    std::unique_ptr<IoThreadPool> io_pool_;     // Declared before storage_, whose I/O engine uses it
     std::unique_ptr<dfs::ChunkStorage> storage_;
     std::unique_ptr<ChunkManagement::Stub> master_stub_;
     
@@ -52,20 +73,58 @@ private:
     std::thread replication_thread_;
     std::thread maintenance_thread_;
     
-    // Replication tasks queue
+    // Replication tasks queue, and chunks found corrupted while serving
+    // reads (repaired by the same thread)
     std::queue<ReplicationTask> replication_queue_;
+    std::set<std::string> repair_queue_;
     std::mutex replication_mutex_;
     std::condition_variable replication_cv_;
     
+    // Chunks added or removed since the last report to the master (latest
+    // state per chunk wins). The rest of the report state belongs to the
+    // heartbeat thread.
+    std::unordered_map<std::string, bool> pending_chunk_changes_;  // chunk_id -> stored
+    std::mutex report_mutex_;
+    uint64_t report_sequence_;          // Last report the master accepted
+    bool full_report_needed_;
+    int64_t last_full_report_time_;
+    
     // Background tasks
     void sendHeartbeats();
     void processReplicationTasks();
     void performMaintenance();
     
+    // Chunk reports
+    void recordChunkChange(const std::string& chunk_id, bool stored);
+    std::unordered_map<std::string, bool> takeChunkChanges();
+    void restoreChunkChanges(const std::unordered_map<std::string, bool>& changes);
+    
+    // Call handlers, run on the I/O pool
+    class WriteStreamReactor;
+    class ReadStreamReactor;
+    template <typename Handler>
+    grpc::ServerUnaryReactor* runOnIoPool(grpc::CallbackServerContext* context, Handler handler);
+    // Calls `done` with the response filled in once the chunk is durable
+    void handleWriteChunk(const WriteChunkRequest* request, WriteChunkResponse* response,
+                          std::function<void()> done);
+    grpc::Status handleReadChunk(const ReadChunkRequest* request, ReadChunkResponse* response);
+    
     // Helper methods
     bool registerWithMaster();
     void handleReplicationTask(const ReplicationTask& task);
     bool copyChunkFromServer(const std::string& chunk_id, const std::string& source_server);
+    
+    // Corruption handling. Located corruption is reported block by block and
+    // repaired from a replica the master names; otherwise (or if that fails)
+    // the master is told to replace the whole chunk.
+    void scheduleRepair(const std::string& chunk_id);
+    void handleCorruptChunk(const std::string& chunk_id);
+    bool repairChunk(const std::string& chunk_id, const std::vector<int64_t>& corrupted_blocks);
+    bool reportCorruption(const std::string& chunk_id, const std::vector<int64_t>& corrupted_blocks,
+                          ChunkCorruptionResponse& response);
+    bool fetchChunkBlocks(const std::string& chunk_id, const std::string& address,
+                          const std::vector<int64_t>& block_indexes,
+                          std::map<int64_t, std::vector<uint8_t>>& blocks);
     void updateSystemMetrics();
     
     // System metrics
@@ -1,14 +1,21 @@
 #include "chunk_storage.h"
 #include <fstream>
-#include <filesystem>
+#include <future>
 #include <json/json.h>
 #include <sys/statvfs.h>
 
 namespace dfs {
 
-ChunkStorage::ChunkStorage(const std::string& storage_directory) 
+ChunkStorage::ChunkStorage(const std::string& storage_directory, StorageBackendType backend_type,
+                           const IoEngineOptions& io_options, const DurabilityOptions& durability,
+                           const ChunkCacheOptions& cache_options) 
     : storage_directory_(storage_directory),
-      checksum_index_file_(storage_directory + "/checksums.json") {
+      legacy_index_file_(storage_directory + "/checksums.json"),
+      io_engine_(IoEngine::create(io_options)),
+      durability_mode_(durability.mode),
+      cache_(cache_options),
+      checkpoint_requested_(false),
+      checkpoint_stopping_(false) {
     
     // Create storage directory if it doesn't exist
     if (!Utils::fileExists(storage_directory_)) {
@@ -17,16 +24,39 @@ ChunkStorage::ChunkStorage(const std::string& storage_directory)
         }
     }
     
-    // Load existing checksum index
+    backend_ = ChunkBackend::create(backend_type, storage_directory_, io_engine_);
+    journal_ = std::make_unique<ChecksumJournal>(storage_directory_);
+    
+    // Replay the persisted checksum index
     loadChecksumIndex();
     
-    // Scan directory for existing chunks
+    // Pick up the chunks the backend already holds
     updateStorageStats();
     
-    Utils::logInfo("ChunkStorage initialized at: " + storage_directory_);
+    if (durability_mode_ != DurabilityMode::NONE) {
+        syncer_ = std::make_unique<GroupCommitSyncer>(durability, [this] { return sync(); });
+    }
+    checkpoint_thread_ = std::thread(&ChunkStorage::checkpointLoop, this);
+    
+    Utils::logInfo("ChunkStorage initialized at: " + storage_directory_ + 
+                   " (" + ChunkBackend::typeToString(backend_type) + " backend, " +
+                   io_engine_->name() + " I/O" + (io_engine_->directIo() ? ", direct" : "") +
+                   ", " + DurabilityOptions::modeToString(durability_mode_) + " durability, " +
+                   std::to_string(cache_options.capacity_bytes / (1024 * 1024)) + "MB chunk cache)");
 }
 
 ChunkStorage::~ChunkStorage() {
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+        checkpoint_stopping_ = true;
+        checkpoint_cv_.notify_one();
+    }
+    checkpoint_thread_.join();
+    
+    if (syncer_) {
+        syncer_->shutdown();
+    }
+    sync();
     saveChecksumIndex();
     Utils::logInfo("ChunkStorage destroyed");
 }
@@ -35,175 +65,300 @@ bool ChunkStorage::writeChunk(const std::string& chunk_id,
                              const std::vector<uint8_t>& data,
                              bool is_encrypted,
                              bool is_erasure_coded) {
-    std::unique_lock<std::shared_mutex> lock(storage_mutex_);
-    
-    std::string file_path = getChunkFilePath(chunk_id);
-    
-    // Calculate checksum before writing
-    std::string checksum = Utils::calculateSHA256(data);
-    
-    // Write chunk data
-    if (!Utils::writeFile(file_path, data)) {
-        Utils::logError("Failed to write chunk file: " + file_path);
+    auto writer = openChunkWriter(chunk_id, is_encrypted, is_erasure_coded, data.size());
+    if (!writer) {
+        Utils::logError("Failed to write chunk: " + chunk_id);
         return false;
     }
     
-    // Save metadata
-    if (!saveChunkMetadata(chunk_id, checksum, is_encrypted, is_erasure_coded)) {
-        Utils::logError("Failed to save chunk metadata: " + chunk_id);
-        // Clean up the data file
-        Utils::deleteFile(file_path);
+    if (!writer->append(data.data(), data.size()) || !writer->commit()) {
+        Utils::logError("Failed to write chunk: " + chunk_id);
         return false;
     }
     
-    // Update indices
-    chunk_checksums_[chunk_id] = checksum;
-    stored_chunks_.insert(chunk_id);
-    
-    Utils::logDebug("Wrote chunk: " + chunk_id + " (" + std::to_string(data.size()) + " bytes)");
     return true;
 }
 
 std::vector<uint8_t> ChunkStorage::readChunk(const std::string& chunk_id) {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
+    std::string checksum;
+    ChunkCache::Data cached = lookupCached(chunk_id, checksum);
+    if (cached) {
+        Utils::logDebug("Read chunk from cache: " + chunk_id + " (" + std::to_string(cached->size()) + " bytes)");
+        return *cached;
+    }
     
-    if (stored_chunks_.find(chunk_id) == stored_chunks_.end()) {
+    std::unique_ptr<ChunkBackend::Reader> reader;
+    StoredChunkInfo info;
+    if (!openChunk(chunk_id, reader, info)) {
         Utils::logWarning("Chunk not found: " + chunk_id);
         return {};
     }
     
-    std::string file_path = getChunkFilePath(chunk_id);
-    std::vector<uint8_t> data = Utils::readFile(file_path);
-    
-    if (data.empty()) {
-        Utils::logError("Failed to read chunk file: " + file_path);
+    std::vector<uint8_t> data;
+    if (reader->size() == 0 || !readVerified(chunk_id, *reader, info, 0, reader->size(), data, nullptr)) {
+        Utils::logError("Failed to read chunk: " + chunk_id);
         return {};
     }
+    offerToCache(chunk_id, info.checksum, data);
     
-    // Verify integrity
-    std::string expected_checksum;
-    auto checksum_it = chunk_checksums_.find(chunk_id);
-    if (checksum_it != chunk_checksums_.end()) {
-        expected_checksum = checksum_it->second;
-    } else {
-        // Try to load from metadata
-        bool is_encrypted, is_erasure_coded;
-        if (!loadChunkMetadata(chunk_id, expected_checksum, is_encrypted, is_erasure_coded)) {
-            Utils::logWarning("No checksum available for chunk: " + chunk_id);
-            return data; // Return data without verification
-        }
+    Utils::logDebug("Read chunk: " + chunk_id + " (" + std::to_string(data.size()) + " bytes)");
+    return data;
+}
+
+bool ChunkStorage::readChunkRange(const std::string& chunk_id, int64_t offset, int64_t length,
+                                  std::vector<uint8_t>& data, std::vector<int64_t>* corrupted_blocks) {
+    std::string checksum;
+    ChunkCache::Data cached = lookupCached(chunk_id, checksum);
+    
+    std::unique_ptr<ChunkBackend::Reader> reader;
+    StoredChunkInfo info;
+    if (!cached && !openChunk(chunk_id, reader, info)) {
+        Utils::logWarning("Chunk not found: " + chunk_id);
+        return false;
     }
     
-    std::string actual_checksum = Utils::calculateSHA256(data);
-    if (actual_checksum != expected_checksum) {
-        Utils::logError("Checksum mismatch for chunk " + chunk_id + 
-                       " (expected: " + expected_checksum + 
-                       ", actual: " + actual_checksum + ")");
-        return {}; // Return empty data for corrupted chunk
+    int64_t chunk_size = cached ? static_cast<int64_t>(cached->size()) : reader->size();
+    if (offset < 0 || length < 0 || offset > chunk_size) {
+        Utils::logWarning("Invalid range for chunk " + chunk_id + ": " + std::to_string(offset) +
+                         "+" + std::to_string(length));
+        return false;
     }
     
-    Utils::logDebug("Read chunk: " + chunk_id + " (" + std::to_string(data.size()) + " bytes)");
-    return data;
+    length = std::min(length, chunk_size - offset);
+    if (cached) {
+        data.assign(cached->begin() + offset, cached->begin() + offset + length);
+        return true;
+    }
+    
+    if (!readVerified(chunk_id, *reader, info, offset, length, data, corrupted_blocks)) {
+        return false;
+    }
+    if (offset == 0 && length == chunk_size) {
+        offerToCache(chunk_id, info.checksum, data);
+    }
+    return true;
 }
 
-bool ChunkStorage::deleteChunk(const std::string& chunk_id) {
-    std::unique_lock<std::shared_mutex> lock(storage_mutex_);
+std::unique_ptr<ChunkStorage::ChunkWriter> ChunkStorage::openChunkWriter(const std::string& chunk_id,
+                                                                      bool is_encrypted,
+                                                                      bool is_erasure_coded,
+                                                                      int64_t size_hint) {
+    auto backend_writer = backend_->openWriter(chunk_id, size_hint);
+    if (!backend_writer) {
+        return nullptr;
+    }
     
-    if (stored_chunks_.find(chunk_id) == stored_chunks_.end()) {
-        Utils::logWarning("Chunk not found for deletion: " + chunk_id);
+    return std::unique_ptr<ChunkWriter>(
+        new ChunkWriter(this, chunk_id, std::move(backend_writer), is_encrypted, is_erasure_coded));
+}
+
+bool ChunkStorage::readChunkStream(const std::string& chunk_id, size_t frame_size,
+                                   const std::function<bool(const uint8_t*, size_t)>& sink) {
+    // The reader stays pinned to the version it was opened on even if the
+    // chunk is deleted concurrently, so no lock is held while frames are on the wire
+    auto reader = openChunkReader(chunk_id, frame_size);
+    if (!reader) {
         return false;
     }
     
-    std::string file_path = getChunkFilePath(chunk_id);
-    std::string metadata_path = getChunkMetadataPath(chunk_id);
+    while (true) {
+        const uint8_t* data;
+        size_t size;
+        if (!reader->next(data, size)) {
+            return false;
+        }
+        if (size == 0) break;
+        
+        if (!sink(data, size)) {
+            return false;
+        }
+    }
+    
+    Utils::logDebug("Streamed chunk: " + chunk_id + " (" + std::to_string(reader->size()) + " bytes)");
+    return true;
+}
+
+std::unique_ptr<ChunkStorage::ChunkReader> ChunkStorage::openChunkReader(const std::string& chunk_id,
+                                                                         size_t frame_size) {
+    if (frame_size == 0) {
+        frame_size = STREAM_FRAME_SIZE;
+    }
     
-    // Delete files
-    bool data_deleted = Utils::deleteFile(file_path);
-    bool metadata_deleted = Utils::deleteFile(metadata_path);
+    std::string checksum;
+    ChunkCache::Data cached = lookupCached(chunk_id, checksum);
+    if (cached) {
+        return std::unique_ptr<ChunkReader>(new ChunkReader(chunk_id, std::move(cached), checksum, frame_size));
+    }
     
-    if (!data_deleted || !metadata_deleted) {
-        Utils::logError("Failed to delete chunk files for: " + chunk_id);
-        return false;
+    std::unique_ptr<ChunkBackend::Reader> reader;
+    StoredChunkInfo info;
+    if (!openChunk(chunk_id, reader, info)) {
+        Utils::logWarning("Chunk not found: " + chunk_id);
+        return nullptr;
     }
     
-    // Update indices
-    chunk_checksums_.erase(chunk_id);
-    stored_chunks_.erase(chunk_id);
+    if (info.checksum.empty()) {
+        Utils::logWarning("No checksum available for chunk: " + chunk_id);
+    }
+    
+    // Collect the chunk while it streams if the cache would keep it
+    ChunkCache* fill_cache = !info.checksum.empty() && cache_.wouldAdmit(chunk_id, reader->size())
+                                 ? &cache_ : nullptr;
+    return std::unique_ptr<ChunkReader>(new ChunkReader(chunk_id, std::move(reader), std::move(info),
+                                                        frame_size, *io_engine_, fill_cache));
+}
+
+bool ChunkStorage::deleteChunk(const std::string& chunk_id) {
+    {
+        IndexStripe& stripe = stripeFor(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        
+        if (stripe.chunks.find(chunk_id) == stripe.chunks.end()) {
+            Utils::logWarning("Chunk not found for deletion: " + chunk_id);
+            return false;
+        }
+        
+        if (!backend_->removeChunk(chunk_id)) {
+            Utils::logError("Failed to delete chunk: " + chunk_id);
+            return false;
+        }
+        
+        // Update indices
+        stripe.checksums.erase(chunk_id);
+        stripe.chunks.erase(chunk_id);
+        journal_->recordDelete(chunk_id);
+        notifyChange(chunk_id, false);
+    }
+    
+    requestCheckpoint();
     
     Utils::logDebug("Deleted chunk: " + chunk_id);
     return true;
 }
 
 bool ChunkStorage::chunkExists(const std::string& chunk_id) const {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
-    return stored_chunks_.find(chunk_id) != stored_chunks_.end();
+    const IndexStripe& stripe = stripeFor(chunk_id);
+    std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+    return stripe.chunks.find(chunk_id) != stripe.chunks.end();
+}
+
+int64_t ChunkStorage::getChunkSize(const std::string& chunk_id) const {
+    return backend_->getChunkSize(chunk_id);
 }
 
 bool ChunkStorage::verifyChunkIntegrity(const std::string& chunk_id) {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
-    
-    if (stored_chunks_.find(chunk_id) == stored_chunks_.end()) {
+    std::vector<int64_t> corrupted_blocks;
+    return scrubChunk(chunk_id, corrupted_blocks);
+}
+
+std::string ChunkStorage::getChunkChecksum(const std::string& chunk_id) {
+    const IndexStripe& stripe = stripeFor(chunk_id);
+    std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+    return lookupChecksum(stripe, chunk_id);
+}
+
+bool ChunkStorage::scrubChunk(const std::string& chunk_id, std::vector<int64_t>& corrupted_blocks) {
+    std::unique_ptr<ChunkBackend::Reader> reader;
+    StoredChunkInfo info;
+    if (!openChunk(chunk_id, reader, info)) {
         return false;
     }
     
-    std::string file_path = getChunkFilePath(chunk_id);
-    std::vector<uint8_t> data = Utils::readFile(file_path);
-    
-    if (data.empty()) {
-        Utils::logError("Failed to read chunk for integrity check: " + chunk_id);
-        return false;
+    if (!hasBlockChecksums(info, reader->size())) {
+        if (info.checksum.empty()) {
+            Utils::logError("No checksum available for integrity check: " + chunk_id);
+            return false;
+        }
+        
+        std::string actual_checksum;
+        if (!computeChunkChecksum(*reader, actual_checksum)) {
+            Utils::logError("Failed to read chunk for integrity check: " + chunk_id);
+            return false;
+        }
+        return actual_checksum == info.checksum;
     }
     
-    std::string actual_checksum = Utils::calculateSHA256(data);
-    
-    auto checksum_it = chunk_checksums_.find(chunk_id);
-    if (checksum_it == chunk_checksums_.end()) {
-        // Try to load from metadata
-        std::string expected_checksum;
-        bool is_encrypted, is_erasure_coded;
-        if (!loadChunkMetadata(chunk_id, expected_checksum, is_encrypted, is_erasure_coded)) {
-            Utils::logError("No checksum available for integrity check: " + chunk_id);
+    // A few blocks at a time, so scrubbing doesn't hold whole chunks in memory
+    std::vector<uint8_t> buffer(16 * CHECKSUM_BLOCK_SIZE);
+    for (int64_t offset = 0; offset < reader->size(); offset += buffer.size()) {
+        size_t size = static_cast<size_t>(std::min<int64_t>(buffer.size(), reader->size() - offset));
+        if (!readFully(*reader, offset, buffer.data(), size)) {
+            Utils::logError("Failed to read chunk for integrity check: " + chunk_id);
+            corrupted_blocks.clear();
             return false;
         }
-        return actual_checksum == expected_checksum;
+        verifyBlocks(info, offset / CHECKSUM_BLOCK_SIZE, buffer.data(), size, corrupted_blocks);
     }
     
-    return actual_checksum == checksum_it->second;
+    if (!corrupted_blocks.empty()) {
+        Utils::logWarning("Chunk " + chunk_id + " has " + std::to_string(corrupted_blocks.size()) +
+                         " corrupted blocks");
+        return false;
+    }
+    return true;
 }
 
-std::string ChunkStorage::getChunkChecksum(const std::string& chunk_id) {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
+bool ChunkStorage::repairChunkBlocks(const std::string& chunk_id,
+                                     const std::map<int64_t, std::vector<uint8_t>>& blocks) {
+    std::unique_ptr<ChunkBackend::Reader> reader;
+    StoredChunkInfo info;
+    if (!openChunk(chunk_id, reader, info) || !hasBlockChecksums(info, reader->size())) {
+        Utils::logError("Cannot repair chunk without block checksums: " + chunk_id);
+        return false;
+    }
     
-    auto it = chunk_checksums_.find(chunk_id);
-    if (it != chunk_checksums_.end()) {
-        return it->second;
+    // The chunk is rewritten from its good blocks and the replacements; the
+    // old version stays in place until the new one is committed
+    auto writer = openChunkWriter(chunk_id, info.is_encrypted, info.is_erasure_coded, reader->size());
+    if (!writer) {
+        return false;
     }
     
-    // Try to load from metadata
-    std::string checksum;
-    bool is_encrypted, is_erasure_coded;
-    if (loadChunkMetadata(chunk_id, checksum, is_encrypted, is_erasure_coded)) {
-        return checksum;
+    std::vector<uint8_t> buffer(CHECKSUM_BLOCK_SIZE);
+    for (int64_t block = 0; block < static_cast<int64_t>(info.block_checksums.size()); ++block) {
+        int64_t offset = block * CHECKSUM_BLOCK_SIZE;
+        size_t size = static_cast<size_t>(std::min<int64_t>(CHECKSUM_BLOCK_SIZE, reader->size() - offset));
+        
+        const uint8_t* data = buffer.data();
+        auto replacement = blocks.find(block);
+        if (replacement != blocks.end()) {
+            if (replacement->second.size() != size) {
+                Utils::logError("Replacement for block " + std::to_string(block) + " of chunk " +
+                               chunk_id + " has the wrong size");
+                return false;
+            }
+            data = replacement->second.data();
+        } else if (!readFully(*reader, offset, buffer.data(), size)) {
+            Utils::logError("Failed to read chunk for repair: " + chunk_id);
+            return false;
+        }
+        
+        if (Utils::crc32c(data, size) != info.block_checksums[block]) {
+            Utils::logError("Block " + std::to_string(block) + " of chunk " + chunk_id +
+                           (replacement != blocks.end() ? " from the replica" : "") + " is corrupted");
+            return false;
+        }
+        
+        if (!writer->append(data, size)) {
+            return false;
+        }
     }
     
-    return "";
+    if (!writer->commit(info.checksum)) {
+        return false;
+    }
+    
+    Utils::logInfo("Repaired " + std::to_string(blocks.size()) + " blocks of chunk " + chunk_id);
+    return true;
 }
 
 int64_t ChunkStorage::getTotalStorageUsed() const {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
-    
     int64_t total_size = 0;
-    
-    try {
-        for (const std::string& chunk_id : stored_chunks_) {
-            std::string file_path = getChunkFilePath(chunk_id);
-            int64_t size = Utils::getFileSize(file_path);
-            if (size > 0) {
-                total_size += size;
-            }
+    for (const std::string& chunk_id : getAllChunkIds()) {
+        int64_t size = backend_->getChunkSize(chunk_id);
+        if (size > 0) {
+            total_size += size;
         }
-    } catch (const std::exception& e) {
-        Utils::logError("Error calculating storage usage: " + std::string(e.what()));
     }
     
     return total_size;
@@ -221,266 +376,791 @@ int64_t ChunkStorage::getAvailableStorage() const {
 }
 
 int ChunkStorage::getChunkCount() const {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
-    return stored_chunks_.size();
+    size_t count = 0;
+    for (const IndexStripe& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        count += stripe.chunks.size();
+    }
+    return count;
 }
 
 std::vector<std::string> ChunkStorage::getAllChunkIds() const {
-    std::shared_lock<std::shared_mutex> lock(storage_mutex_);
-    return std::vector<std::string>(stored_chunks_.begin(), stored_chunks_.end());
+    std::vector<std::string> chunk_ids;
+    for (const IndexStripe& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        chunk_ids.insert(chunk_ids.end(), stripe.chunks.begin(), stripe.chunks.end());
+    }
+    return chunk_ids;
 }
 
-void ChunkStorage::performGarbageCollection() {
-    std::unique_lock<std::shared_mutex> lock(storage_mutex_);
-    
+void ChunkStorage::performGarbageCollection(const RepairHandler& repair) {
     Utils::logInfo("Starting garbage collection");
     
-    std::vector<std::string> chunks_to_remove;
+    int removed = 0;
     
-    for (const std::string& chunk_id : stored_chunks_) {
-        std::string file_path = getChunkFilePath(chunk_id);
+    // Chunks are verified without holding any lock; a chunk is only dropped
+    // if it wasn't rewritten in the meantime
+    for (const std::string& chunk_id : getAllChunkIds()) {
+        std::string checksum = getChunkChecksum(chunk_id);
+        bool missing = backend_->getChunkSize(chunk_id) < 0;
+        std::vector<int64_t> corrupted_blocks;
         
-        // Check if file exists
-        if (!Utils::fileExists(file_path)) {
-            chunks_to_remove.push_back(chunk_id);
+        if (!missing && scrubChunk(chunk_id, corrupted_blocks)) {
             continue;
         }
         
-        // Check integrity
-        if (!verifyChunkIntegrity(chunk_id)) {
+        if (!missing && repair && repair(chunk_id, corrupted_blocks)) {
+            continue;
+        }
+        
+        IndexStripe& stripe = stripeFor(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        
+        if (stripe.chunks.find(chunk_id) == stripe.chunks.end() ||
+            lookupChecksum(stripe, chunk_id) != checksum) {
+            continue;
+        }
+        
+        if (!missing) {
             Utils::logWarning("Removing corrupted chunk during GC: " + chunk_id);
-            chunks_to_remove.push_back(chunk_id);
         }
-    }
-    
-    // Remove invalid chunks
-    for (const std::string& chunk_id : chunks_to_remove) {
-        stored_chunks_.erase(chunk_id);
-        chunk_checksums_.erase(chunk_id);
         
-        // Try to delete files (may already be missing)
-        Utils::deleteFile(getChunkFilePath(chunk_id));
-        Utils::deleteFile(getChunkMetadataPath(chunk_id));
+        stripe.chunks.erase(chunk_id);
+        stripe.checksums.erase(chunk_id);
+        journal_->recordDelete(chunk_id);
+        notifyChange(chunk_id, false);
+        
+        // May already be missing
+        backend_->removeChunk(chunk_id);
+        removed++;
     }
     
     // Save updated index
     saveChecksumIndex();
     
+    // Reclaim space from deleted and overwritten chunks (log-structured backend)
+    backend_->compact();
+    
     Utils::logInfo("Garbage collection completed. Removed " + 
-                   std::to_string(chunks_to_remove.size()) + " chunks");
+                   std::to_string(removed) + " chunks");
 }
 
 void ChunkStorage::rebuildChecksumIndex() {
-    std::unique_lock<std::shared_mutex> lock(storage_mutex_);
-    
     Utils::logInfo("Rebuilding checksum index");
     
-    chunk_checksums_.clear();
-    stored_chunks_.clear();
+    // Hash everything first, then swap the result in stripe by stripe
+    std::array<IndexStripe, INDEX_STRIPES> rebuilt;
+    int found = 0;
     
-    try {
-        // Scan storage directory
-        std::filesystem::path storage_path(storage_directory_);
+    for (const StoredChunkInfo& info : backend_->listChunks()) {
+        auto reader = backend_->openReader(info.chunk_id);
+        std::string checksum;
+        if (reader && computeChunkChecksum(*reader, checksum)) {
+            IndexStripe& stripe = rebuilt[std::hash<std::string>{}(info.chunk_id) % INDEX_STRIPES];
+            stripe.checksums[info.chunk_id] = checksum;
+            stripe.chunks.insert(info.chunk_id);
+            found++;
+        }
+    }
+    
+    for (size_t i = 0; i < INDEX_STRIPES; ++i) {
+        std::unique_lock<std::shared_mutex> lock(stripes_[i].mutex);
+        stripes_[i].checksums.swap(rebuilt[i].checksums);
+        stripes_[i].chunks.swap(rebuilt[i].chunks);
+        stripes_[i].infos.clear();
         
-        for (const auto& entry : std::filesystem::directory_iterator(storage_path)) {
-            if (entry.is_regular_file()) {
-                std::string filename = entry.path().filename().string();
-                
-                // Check if it's a chunk file (not metadata)
-                if (filename.find(".meta") == std::string::npos && 
-                    filename != "checksums.json") {
-                    
-                    std::string chunk_id = filename;
-                    std::vector<uint8_t> data = Utils::readFile(entry.path().string());
-                    
-                    if (!data.empty()) {
-                        std::string checksum = Utils::calculateSHA256(data);
-                        chunk_checksums_[chunk_id] = checksum;
-                        stored_chunks_.insert(chunk_id);
-                        
-                        // Update metadata file
-                        saveChunkMetadata(chunk_id, checksum, false, false);
-                    }
-                }
+        // rebuilt[i] now holds the previous contents of the stripe
+        for (const std::string& chunk_id : rebuilt[i].chunks) {
+            if (stripes_[i].chunks.count(chunk_id) == 0) {
+                notifyChange(chunk_id, false);
+            }
+        }
+        for (const std::string& chunk_id : stripes_[i].chunks) {
+            if (rebuilt[i].chunks.count(chunk_id) == 0) {
+                notifyChange(chunk_id, true);
             }
         }
-    } catch (const std::exception& e) {
-        Utils::logError("Error rebuilding checksum index: " + std::string(e.what()));
     }
     
     saveChecksumIndex();
     
     Utils::logInfo("Checksum index rebuilt. Found " + 
-                   std::to_string(stored_chunks_.size()) + " chunks");
+                   std::to_string(found) + " chunks");
 }
 
-std::string ChunkStorage::getChunkFilePath(const std::string& chunk_id) const {
-    return storage_directory_ + "/" + chunk_id;
+void ChunkStorage::commitChunk(const std::string& chunk_id,
+                               ChunkBackend::Writer& backend_writer,
+                               int64_t size,
+                               const std::string& checksum,
+                               const std::vector<uint32_t>& block_checksums,
+                               bool is_encrypted,
+                               bool is_erasure_coded,
+                               GroupCommitSyncer::DurableCallback done) {
+    StoredChunkInfo info;
+    info.chunk_id = chunk_id;
+    info.checksum = checksum;
+    info.block_checksums = block_checksums;
+    info.is_encrypted = is_encrypted;
+    info.is_erasure_coded = is_erasure_coded;
+    info.size = size;
+    info.created_time = Utils::getCurrentTimestamp();
+    
+    bool committed;
+    {
+        // Publishing the data and its checksum under the stripe lock keeps
+        // readers from pairing a new version with an old checksum
+        IndexStripe& stripe = stripeFor(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        
+        committed = backend_writer.commit(info);
+        if (committed) {
+            stripe.checksums[chunk_id] = checksum;
+            stripe.chunks.insert(chunk_id);
+            journal_->recordPut(chunk_id, checksum);
+            notifyChange(chunk_id, true);
+            stripe.infos[chunk_id] = std::move(info);
+        } else if (backend_->getChunkSize(chunk_id) < 0 && stripe.chunks.erase(chunk_id) > 0) {
+            // A failed commit may have taken the previous version with it
+            stripe.checksums.erase(chunk_id);
+            journal_->recordDelete(chunk_id);
+            notifyChange(chunk_id, false);
+        }
+    }
+    
+    if (!committed) {
+        Utils::logError("Failed to commit chunk: " + chunk_id);
+        done(false);
+        return;
+    }
+    
+    requestCheckpoint();
+    
+    if (!syncer_) {
+        done(true);
+        return;
+    }
+    
+    // The data is visible already; only the acknowledgement waits for the sync
+    syncer_->notifyDurable(size, [chunk_id, done = std::move(done)](bool ok) {
+        if (!ok) {
+            Utils::logError("Failed to sync chunk: " + chunk_id);
+        }
+        done(ok);
+    });
 }
 
-std::string ChunkStorage::getChunkMetadataPath(const std::string& chunk_id) const {
-    return storage_directory_ + "/" + chunk_id + ".meta";
+bool ChunkStorage::sync() {
+    // Chunk data before the journal records pointing at it
+    bool backend_synced = backend_->sync();
+    bool journal_synced = journal_->sync();
+    return backend_synced && journal_synced;
 }
 
-bool ChunkStorage::saveChecksumIndex() {
-    try {
-        Json::Value root;
+void ChunkStorage::notifyChange(const std::string& chunk_id, bool stored) {
+    // A cached copy and the kept metadata belong to the version that was
+    // just replaced or removed
+    cache_.invalidate(chunk_id);
+    stripeFor(chunk_id).infos.erase(chunk_id);
+    
+    if (change_listener_) {
+        change_listener_(chunk_id, stored);
+    }
+}
+
+ChunkStorage::IndexStripe& ChunkStorage::stripeFor(const std::string& chunk_id) {
+    return stripes_[std::hash<std::string>{}(chunk_id) % INDEX_STRIPES];
+}
+
+const ChunkStorage::IndexStripe& ChunkStorage::stripeFor(const std::string& chunk_id) const {
+    return stripes_[std::hash<std::string>{}(chunk_id) % INDEX_STRIPES];
+}
+
+std::string ChunkStorage::lookupChecksum(const IndexStripe& stripe, const std::string& chunk_id) {
+    auto it = stripe.checksums.find(chunk_id);
+    if (it != stripe.checksums.end()) {
+        return it->second;
+    }
+    
+    // Fall back to the metadata stored with the chunk
+    StoredChunkInfo info;
+    if (backend_->getChunkInfo(chunk_id, info)) {
+        return info.checksum;
+    }
+    
+    return "";
+}
+
+ChunkCache::Data ChunkStorage::lookupCached(const std::string& chunk_id, std::string& checksum) {
+    {
+        const IndexStripe& stripe = stripeFor(chunk_id);
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
         
-        for (const auto& pair : chunk_checksums_) {
-            root[pair.first] = pair.second;
+        auto it = stripe.checksums.find(chunk_id);
+        if (it == stripe.checksums.end() || it->second.empty() ||
+            stripe.chunks.find(chunk_id) == stripe.chunks.end()) {
+            return nullptr;
         }
+        checksum = it->second;
+    }
+    
+    // Like an open reader, the copy stays valid if the chunk changes now
+    return cache_.lookup(chunk_id, checksum);
+}
+
+void ChunkStorage::offerToCache(const std::string& chunk_id, const std::string& checksum,
+                                const std::vector<uint8_t>& data) {
+    if (!checksum.empty() && cache_.wouldAdmit(chunk_id, static_cast<int64_t>(data.size()))) {
+        cache_.insert(chunk_id, checksum, std::make_shared<const std::vector<uint8_t>>(data));
+    }
+}
+
+bool ChunkStorage::openChunk(const std::string& chunk_id, std::unique_ptr<ChunkBackend::Reader>& reader,
+                             StoredChunkInfo& info) {
+    IndexStripe& stripe = stripeFor(chunk_id);
+    
+    // Data and metadata are only replaced together under the stripe lock
+    auto open = [&](const StoredChunkInfo& stored) {
+        info = stored;
+        auto checksum = stripe.checksums.find(chunk_id);
+        if (checksum != stripe.checksums.end()) {
+            info.checksum = checksum->second;
+        }
+        reader = backend_->openReader(chunk_id);
+        return reader != nullptr;
+    };
+    
+    {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
         
-        Json::StreamWriterBuilder builder;
-        std::string json_string = Json::writeString(builder, root);
-        
-        std::ofstream file(checksum_index_file_);
-        if (!file.is_open()) {
-            Utils::logError("Failed to open checksum index file for writing");
+        if (stripe.chunks.find(chunk_id) == stripe.chunks.end()) {
             return false;
         }
         
-        file << json_string;
-        return file.good();
-        
-    } catch (const std::exception& e) {
-        Utils::logError("Error saving checksum index: " + std::string(e.what()));
+        auto it = stripe.infos.find(chunk_id);
+        if (it != stripe.infos.end()) {
+            return open(it->second);
+        }
+    }
+    
+    // First open since startup: the backend's metadata is loaded once
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+    
+    if (stripe.chunks.find(chunk_id) == stripe.chunks.end()) {
         return false;
     }
+    
+    auto it = stripe.infos.find(chunk_id);
+    if (it == stripe.infos.end()) {
+        StoredChunkInfo loaded;
+        if (!backend_->getChunkInfo(chunk_id, loaded)) {
+            loaded = StoredChunkInfo{};
+        }
+        it = stripe.infos.emplace(chunk_id, std::move(loaded)).first;
+    }
+    return open(it->second);
 }
 
-bool ChunkStorage::loadChecksumIndex() {
-    if (!Utils::fileExists(checksum_index_file_)) {
-        Utils::logInfo("Checksum index file not found, starting fresh");
-        return true;
-    }
-    
-    try {
-        std::ifstream file(checksum_index_file_);
-        if (!file.is_open()) {
-            Utils::logError("Failed to open checksum index file for reading");
+bool ChunkStorage::readVerified(const std::string& chunk_id, ChunkBackend::Reader& reader,
+                                const StoredChunkInfo& info, int64_t offset, int64_t length,
+                                std::vector<uint8_t>& data, std::vector<int64_t>* corrupted_blocks) {
+    if (!hasBlockChecksums(info, reader.size())) {
+        // Chunks without block checksums can only be verified whole
+        std::vector<uint8_t> chunk_data(reader.size());
+        if (!readFully(reader, 0, chunk_data.data(), chunk_data.size())) {
+            Utils::logError("Failed to read chunk: " + chunk_id);
             return false;
         }
         
-        Json::Value root;
-        Json::CharReaderBuilder builder;
-        std::string errors;
-        
-        if (!Json::parseFromStream(builder, file, &root, &errors)) {
-            Utils::logError("Failed to parse checksum index JSON: " + errors);
+        if (info.checksum.empty()) {
+            Utils::logWarning("No checksum available for chunk: " + chunk_id);
+        } else if (Utils::calculateSHA256(chunk_data) != info.checksum) {
+            Utils::logError("Checksum mismatch for chunk " + chunk_id);
             return false;
         }
         
-        chunk_checksums_.clear();
-        stored_chunks_.clear();
-        
-        for (const auto& member : root.getMemberNames()) {
-            chunk_checksums_[member] = root[member].asString();
-            stored_chunks_.insert(member);
+        if (offset == 0 && length == reader.size()) {
+            data.swap(chunk_data);
+        } else {
+            data.assign(chunk_data.begin() + offset, chunk_data.begin() + offset + length);
         }
-        
-        Utils::logInfo("Loaded checksum index with " + 
-                       std::to_string(chunk_checksums_.size()) + " entries");
         return true;
-        
-    } catch (const std::exception& e) {
-        Utils::logError("Error loading checksum index: " + std::string(e.what()));
+    }
+    
+    // Read the covering blocks, check them, then trim to the range
+    int64_t first_block = offset / CHECKSUM_BLOCK_SIZE;
+    int64_t begin = first_block * CHECKSUM_BLOCK_SIZE;
+    int64_t end = std::min<int64_t>(reader.size(), (offset + length + CHECKSUM_BLOCK_SIZE - 1) /
+                                                   CHECKSUM_BLOCK_SIZE * CHECKSUM_BLOCK_SIZE);
+    
+    data.resize(end - begin);
+    if (!readFully(reader, begin, data.data(), data.size())) {
+        Utils::logError("Failed to read chunk: " + chunk_id);
         return false;
     }
+    
+    std::vector<int64_t> corrupted;
+    verifyBlocks(info, first_block, data.data(), data.size(), corrupted);
+    if (!corrupted.empty()) {
+        Utils::logError("Chunk " + chunk_id + " has " + std::to_string(corrupted.size()) +
+                       " corrupted blocks, first " + std::to_string(corrupted.front()));
+        if (corrupted_blocks) {
+            corrupted_blocks->insert(corrupted_blocks->end(), corrupted.begin(), corrupted.end());
+        }
+        return false;
+    }
+    
+    data.erase(data.begin(), data.begin() + (offset - begin));
+    data.resize(length);
+    return true;
 }
 
-bool ChunkStorage::saveChunkMetadata(const std::string& chunk_id, 
-                                    const std::string& checksum,
-                                    bool is_encrypted,
-                                    bool is_erasure_coded) {
-    try {
-        Json::Value metadata;
-        metadata["chunk_id"] = chunk_id;
-        metadata["checksum"] = checksum;
-        metadata["is_encrypted"] = is_encrypted;
-        metadata["is_erasure_coded"] = is_erasure_coded;
-        metadata["created_time"] = static_cast<Json::Int64>(Utils::getCurrentTimestamp());
-        
-        Json::StreamWriterBuilder builder;
-        std::string json_string = Json::writeString(builder, metadata);
-        
-        std::string metadata_path = getChunkMetadataPath(chunk_id);
-        std::ofstream file(metadata_path);
-        
-        if (!file.is_open()) {
-            Utils::logError("Failed to open metadata file for writing: " + metadata_path);
+bool ChunkStorage::hasBlockChecksums(const StoredChunkInfo& info, int64_t size) {
+    // Anything else is a chunk from before block checksums
+    return !info.block_checksums.empty() &&
+           static_cast<int64_t>(info.block_checksums.size()) ==
+               (size + static_cast<int64_t>(CHECKSUM_BLOCK_SIZE) - 1) / static_cast<int64_t>(CHECKSUM_BLOCK_SIZE);
+}
+
+void ChunkStorage::verifyBlocks(const StoredChunkInfo& info, int64_t first_block,
+                                const uint8_t* data, size_t size, std::vector<int64_t>& corrupted_blocks) {
+    for (size_t done = 0; done < size; done += CHECKSUM_BLOCK_SIZE) {
+        int64_t block = first_block + static_cast<int64_t>(done / CHECKSUM_BLOCK_SIZE);
+        if (Utils::crc32c(data + done, std::min(CHECKSUM_BLOCK_SIZE, size - done)) != info.block_checksums[block]) {
+            corrupted_blocks.push_back(block);
+        }
+    }
+}
+
+bool ChunkStorage::readFully(ChunkBackend::Reader& reader, int64_t offset, uint8_t* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t bytes = reader.read(offset, buffer, length);
+        if (bytes <= 0) {
             return false;
         }
-        
-        file << json_string;
-        return file.good();
-        
-    } catch (const std::exception& e) {
-        Utils::logError("Error saving chunk metadata: " + std::string(e.what()));
-        return false;
+        offset += bytes;
+        buffer += bytes;
+        length -= bytes;
     }
+    return true;
 }
 
-bool ChunkStorage::loadChunkMetadata(const std::string& chunk_id,
-                                    std::string& checksum,
-                                    bool& is_encrypted,
-                                    bool& is_erasure_coded) {
-    std::string metadata_path = getChunkMetadataPath(chunk_id);
-    
-    if (!Utils::fileExists(metadata_path)) {
+bool ChunkStorage::computeChunkChecksum(ChunkBackend::Reader& reader, std::string& checksum) {
+    if (reader.size() == 0) {
         return false;
     }
     
-    try {
-        std::ifstream file(metadata_path);
-        if (!file.is_open()) {
+    std::vector<uint8_t> frame(STREAM_FRAME_SIZE);
+    SHA256Stream hasher;
+    int64_t offset = 0;
+    
+    while (offset < reader.size()) {
+        ssize_t bytes = reader.read(offset, frame.data(), frame.size());
+        if (bytes <= 0) {
             return false;
         }
+        hasher.update(frame.data(), bytes);
+        offset += bytes;
+    }
+    
+    checksum = hasher.finalizeHex();
+    return true;
+}
+
+// ChunkReader implementation
+ChunkStorage::ChunkReader::ChunkReader(const std::string& chunk_id,
+                                       std::unique_ptr<ChunkBackend::Reader> reader,
+                                       StoredChunkInfo info, size_t frame_size, IoEngine& io_engine,
+                                       ChunkCache* fill_cache)
+    : chunk_id_(chunk_id),
+      reader_(std::move(reader)),
+      info_(std::move(info)),
+      size_(reader_->size()),
+      frame_size_(frame_size),
+      verify_blocks_(hasBlockChecksums(info_, size_)),
+      buffer_offset_(0),
+      buffer_fill_(0),
+      buffer_pos_(0),
+      fill_cache_(fill_cache) {
+    // With block checksums every block is checked before any of it is
+    // handed out, so corrupted data never leaves the server
+    buffer_ = io_engine.allocateBuffer(verify_blocks_ ? (frame_size_ + CHECKSUM_BLOCK_SIZE - 1) /
+                                                            CHECKSUM_BLOCK_SIZE * CHECKSUM_BLOCK_SIZE
+                                                      : frame_size_);
+    if (fill_cache_) {
+        fill_.reserve(static_cast<size_t>(size_));
+    }
+}
+
+// The whole chunk is one buffer fill, verified before it was cached
+ChunkStorage::ChunkReader::ChunkReader(const std::string& chunk_id, ChunkCache::Data cached,
+                                       std::string checksum, size_t frame_size)
+    : chunk_id_(chunk_id),
+      size_(static_cast<int64_t>(cached->size())),
+      frame_size_(frame_size),
+      verify_blocks_(false),
+      buffer_offset_(0),
+      buffer_fill_(cached->size()),
+      buffer_pos_(0),
+      cached_(std::move(cached)),
+      fill_cache_(nullptr) {
+    info_.chunk_id = chunk_id;
+    info_.size = size_;
+    info_.checksum = std::move(checksum);
+}
+
+bool ChunkStorage::ChunkReader::next(const uint8_t*& data, size_t& size) {
+    if (buffer_pos_ == buffer_fill_) {
+        size_t length;
+        if (!startFill(length)) {
+            return false;
+        }
+        if (length > 0) {
+            if (!readFully(*reader_, buffer_offset_, buffer_.data(), length)) {
+                Utils::logError("Failed to read chunk: " + chunk_id_);
+                return false;
+            }
+            if (!finishFill(length)) {
+                return false;
+            }
+        }
+    }
+    
+    take(data, size);
+    return true;
+}
+
+void ChunkStorage::ChunkReader::nextAsync(IoThreadPool& pool, FrameCallback done) {
+    if (buffer_pos_ == buffer_fill_) {
+        size_t length;
+        if (!startFill(length)) {
+            done(false, nullptr, 0);
+            return;
+        }
+        if (length > 0) {
+            readAsync(pool, 0, length, std::move(done));
+            return;
+        }
+    }
+    
+    const uint8_t* data;
+    size_t size;
+    take(data, size);
+    done(true, data, size);
+}
+
+void ChunkStorage::ChunkReader::readAsync(IoThreadPool& pool, size_t done_bytes, size_t length,
+                                          FrameCallback done) {
+    reader_->readAsync(buffer_offset_ + done_bytes, buffer_.data() + done_bytes, length - done_bytes,
+                       [this, &pool, done_bytes, length, done = std::move(done)](ssize_t result) mutable {
+        if (result <= 0) {
+            Utils::logError("Failed to read chunk: " + chunk_id_);
+            done(false, nullptr, 0);
+            return;
+        }
         
-        Json::Value metadata;
-        Json::CharReaderBuilder builder;
-        std::string errors;
+        // Short reads (including the unaligned tail of a direct read) continue
+        if (done_bytes + result < length) {
+            readAsync(pool, done_bytes + result, length, std::move(done));
+            return;
+        }
         
-        if (!Json::parseFromStream(builder, file, &metadata, &errors)) {
-            Utils::logError("Failed to parse chunk metadata JSON: " + errors);
+        // Hashing a frame would hold up every other read's completion
+        pool.submit([this, length, done = std::move(done)] {
+            if (!finishFill(length)) {
+                done(false, nullptr, 0);
+                return;
+            }
+            
+            const uint8_t* data;
+            size_t size;
+            take(data, size);
+            done(true, data, size);
+        });
+    });
+}
+
+bool ChunkStorage::ChunkReader::startFill(size_t& length) {
+    buffer_offset_ += buffer_fill_;
+    buffer_fill_ = 0;
+    buffer_pos_ = 0;
+    length = 0;
+    
+    if (buffer_offset_ >= size_) {
+        if (size_ == 0) {
+            Utils::logError("Failed to read chunk: " + chunk_id_);
             return false;
         }
+        if (cached_) {
+            return true;
+        }
         
-        checksum = metadata["checksum"].asString();
-        is_encrypted = metadata["is_encrypted"].asBool();
-        is_erasure_coded = metadata["is_erasure_coded"].asBool();
+        if (!verify_blocks_ && !info_.checksum.empty()) {
+            std::string actual_checksum = hasher_.finalizeHex();
+            if (actual_checksum != info_.checksum) {
+                Utils::logError("Checksum mismatch for chunk " + chunk_id_ + 
+                               " (expected: " + info_.checksum + 
+                               ", actual: " + actual_checksum + ")");
+                return false;
+            }
+        }
         
+        if (fill_cache_) {
+            fill_cache_->insert(chunk_id_, info_.checksum,
+                                std::make_shared<const std::vector<uint8_t>>(std::move(fill_)));
+            fill_cache_ = nullptr;
+        }
         return true;
-        
-    } catch (const std::exception& e) {
-        Utils::logError("Error loading chunk metadata: " + std::string(e.what()));
-        return false;
     }
+    
+    length = static_cast<size_t>(std::min<int64_t>(buffer_.size(), size_ - buffer_offset_));
+    return true;
 }
 
-void ChunkStorage::updateStorageStats() {
-    stored_chunks_.clear();
+bool ChunkStorage::ChunkReader::finishFill(size_t length) {
+    if (verify_blocks_) {
+        std::vector<int64_t> corrupted_blocks;
+        verifyBlocks(info_, buffer_offset_ / CHECKSUM_BLOCK_SIZE, buffer_.data(), length, corrupted_blocks);
+        if (!corrupted_blocks.empty()) {
+            Utils::logError("Block " + std::to_string(corrupted_blocks.front()) +
+                           " of chunk " + chunk_id_ + " is corrupted");
+            return false;
+        }
+    } else {
+        hasher_.update(buffer_.data(), length);
+    }
+    
+    if (fill_cache_) {
+        fill_.insert(fill_.end(), buffer_.data(), buffer_.data() + length);
+    }
+    
+    buffer_fill_ = length;
+    return true;
+}
+
+void ChunkStorage::ChunkReader::take(const uint8_t*& data, size_t& size) {
+    data = (cached_ ? cached_->data() : buffer_.data()) + buffer_pos_;
+    size = std::min(frame_size_, buffer_fill_ - buffer_pos_);
+    buffer_pos_ += size;
+}
+
+ChunkStorage::ChunkWriter::ChunkWriter(ChunkStorage* storage, const std::string& chunk_id,
+                                       std::unique_ptr<ChunkBackend::Writer> backend_writer,
+                                       bool is_encrypted, bool is_erasure_coded)
+    : storage_(storage),
+      chunk_id_(chunk_id),
+      backend_writer_(std::move(backend_writer)),
+      is_encrypted_(is_encrypted),
+      is_erasure_coded_(is_erasure_coded),
+      bytes_written_(0),
+      block_crc_(0),
+      block_fill_(0) {
+}
+
+ChunkStorage::ChunkWriter::~ChunkWriter() {
+    abort();
+}
+
+bool ChunkStorage::ChunkWriter::append(const uint8_t* data, size_t size) {
+    if (!backend_writer_) {
+        return false;
+    }
     
-    try {
-        std::filesystem::path storage_path(storage_directory_);
+    if (!backend_writer_->append(data, size)) {
+        abort();
+        return false;
+    }
+    
+    hasher_.update(data, size);
+    bytes_written_ += size;
+    
+    for (size_t done = 0; done < size;) {
+        size_t count = std::min(CHECKSUM_BLOCK_SIZE - block_fill_, size - done);
+        block_crc_ = Utils::crc32c(data + done, count, block_crc_);
+        block_fill_ += count;
+        done += count;
         
-        if (!std::filesystem::exists(storage_path)) {
+        if (block_fill_ == CHECKSUM_BLOCK_SIZE) {
+            block_checksums_.push_back(block_crc_);
+            block_crc_ = 0;
+            block_fill_ = 0;
+        }
+    }
+    return true;
+}
+
+bool ChunkStorage::ChunkWriter::commit(const std::string& expected_checksum) {
+    std::promise<bool> durable;
+    commitAsync(expected_checksum, [&durable](bool ok) { durable.set_value(ok); });
+    return durable.get_future().get();
+}
+
+void ChunkStorage::ChunkWriter::commitAsync(const std::string& expected_checksum, CommitCallback done) {
+    if (!backend_writer_) {
+        done(false);
+        return;
+    }
+    
+    checksum_ = hasher_.finalizeHex();
+    if (!expected_checksum.empty() && checksum_ != expected_checksum) {
+        Utils::logError("Checksum mismatch for streamed chunk " + chunk_id_ +
+                       " (expected: " + expected_checksum + ", actual: " + checksum_ + ")");
+        abort();
+        done(false);
+        return;
+    }
+    
+    if (block_fill_ > 0) {
+        block_checksums_.push_back(block_crc_);
+        block_fill_ = 0;
+    }
+    
+    // `done` may destroy this writer, so the commit works on its own copies
+    std::unique_ptr<ChunkBackend::Writer> backend_writer = std::move(backend_writer_);
+    std::string chunk_id = chunk_id_;
+    std::string checksum = checksum_;
+    std::vector<uint32_t> block_checksums = std::move(block_checksums_);
+    int64_t size = bytes_written_;
+    
+    storage_->commitChunk(chunk_id, *backend_writer, size, checksum, block_checksums,
+                          is_encrypted_, is_erasure_coded_,
+                          [chunk_id, size, done = std::move(done)](bool ok) {
+        if (ok) {
+            Utils::logDebug("Wrote chunk: " + chunk_id + " (" + std::to_string(size) + " bytes, streamed)");
+        }
+        done(ok);
+    });
+}
+
+void ChunkStorage::ChunkWriter::abort() {
+    if (!backend_writer_) {
+        return;
+    }
+    
+    backend_writer_->abort();
+    backend_writer_.reset();
+}
+
+bool ChunkStorage::saveChecksumIndex() {
+    // Each stripe is copied under its lock and written out without it
+    return journal_->checkpoint([this](const ChecksumJournal::EntryVisitor& emit) {
+        for (const IndexStripe& stripe : stripes_) {
+            std::vector<std::pair<std::string, std::string>> entries;
+            {
+                std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+                entries.reserve(stripe.chunks.size());
+                for (const std::string& chunk_id : stripe.chunks) {
+                    auto it = stripe.checksums.find(chunk_id);
+                    if (it != stripe.checksums.end()) {
+                        entries.emplace_back(chunk_id, it->second);
+                    }
+                }
+            }
+            
+            for (const auto& entry : entries) {
+                emit(entry.first, entry.second);
+            }
+        }
+    });
+}
+
+void ChunkStorage::requestCheckpoint() {
+    if (!journal_->checkpointDue()) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+    checkpoint_requested_ = true;
+    checkpoint_cv_.notify_one();
+}
+
+void ChunkStorage::checkpointLoop() {
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+    
+    while (true) {
+        checkpoint_cv_.wait(lock, [this] { return checkpoint_stopping_ || checkpoint_requested_; });
+        if (checkpoint_stopping_) {
             return;
         }
+        checkpoint_requested_ = false;
         
-        for (const auto& entry : std::filesystem::directory_iterator(storage_path)) {
-            if (entry.is_regular_file()) {
-                std::string filename = entry.path().filename().string();
-                
-                // Check if it's a chunk file (not metadata or index)
-                if (filename.find(".meta") == std::string::npos && 
-                    filename != "checksums.json") {
-                    stored_chunks_.insert(filename);
+        lock.unlock();
+        bool ok = !journal_->checkpointDue() || saveChecksumIndex();
+        lock.lock();
+        
+        // The journal stays due after a failure; don't retry on every write
+        if (!ok) {
+            checkpoint_cv_.wait_for(lock, std::chrono::seconds(1), [this] { return checkpoint_stopping_; });
+        }
+    }
+}
+
+bool ChunkStorage::loadChecksumIndex() {
+    // Only called from the constructor, nothing else can see the stripes yet
+    bool migrate_legacy = Utils::fileExists(legacy_index_file_);
+    
+    if (migrate_legacy) {
+        try {
+            std::ifstream file(legacy_index_file_);
+            Json::Value root;
+            Json::CharReaderBuilder builder;
+            std::string errors;
+            
+            if (!file.is_open() || !Json::parseFromStream(builder, file, &root, &errors)) {
+                Utils::logError("Failed to parse legacy checksum index JSON: " + errors);
+            } else {
+                for (const auto& member : root.getMemberNames()) {
+                    IndexStripe& stripe = stripeFor(member);
+                    stripe.checksums[member] = root[member].asString();
+                    stripe.chunks.insert(member);
                 }
             }
+        } catch (const std::exception& e) {
+            Utils::logError("Error loading legacy checksum index: " + std::string(e.what()));
+        }
+    }
+    
+    // The journal is newer than any legacy index, so it is replayed on top
+    bool opened = journal_->open([this](const std::string& chunk_id, const std::string& checksum) {
+        IndexStripe& stripe = stripeFor(chunk_id);
+        if (checksum.empty()) {
+            stripe.checksums.erase(chunk_id);
+            stripe.chunks.erase(chunk_id);
+        } else {
+            stripe.checksums[chunk_id] = checksum;
+            stripe.chunks.insert(chunk_id);
+        }
+    });
+    
+    if (!opened) {
+        return false;
+    }
+    
+    if (migrate_legacy || journal_->checkpointDue()) {
+        if (!saveChecksumIndex()) {
+            return false;
         }
+        if (migrate_legacy) {
+            Utils::deleteFile(legacy_index_file_);
+            Utils::logInfo("Migrated checksums.json into the checksum journal");
+        }
+    }
+    
+    return true;
+}
+
+void ChunkStorage::updateStorageStats() {
+    for (IndexStripe& stripe : stripes_) {
+        stripe.chunks.clear();
+    }
+    
+    for (const StoredChunkInfo& info : backend_->listChunks()) {
+        IndexStripe& stripe = stripeFor(info.chunk_id);
+        stripe.chunks.insert(info.chunk_id);
         
-    } catch (const std::exception& e) {
-        Utils::logError("Error updating storage stats: " + std::string(e.what()));
+        // Backends that keep checksums with the data fill in gaps in the index
+        if (!info.checksum.empty()) {
+            stripe.checksums[info.chunk_id] = info.checksum;
+        }
     }
 }
 
@@ -5,21 +5,133 @@
 #include "utils.h"
 #include "crypto.h"
 #include "erasure_coding.h"
+#include "chunk_backend.h"
+#include "checksum_journal.h"
+#include "group_commit.h"
+#include "chunk_cache.h"
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
 #include <mutex>
+#include <shared_mutex>
+#include <array>
 #include <memory>
+#include <functional>
+#include <thread>
+#include <condition_variable>
 
 namespace dfs {
 
 // Chunk storage manager
 class ChunkStorage {
 public:
-    ChunkStorage(const std::string& storage_directory);
+    // Streaming chunk writer. Frames go straight to the storage backend and
+    // the chunk only becomes visible once commit() succeeds.
+    class ChunkWriter {
+    public:
+        ~ChunkWriter();
+        
+        ChunkWriter(const ChunkWriter&) = delete;
+        ChunkWriter& operator=(const ChunkWriter&) = delete;
+        
+        bool append(const uint8_t* data, size_t size);
+        
+        // Fails (and discards the data) if expected_checksum is set and doesn't match
+        bool commit(const std::string& expected_checksum = "");
+        
+        // commit() without waiting for the sync: the chunk is visible on
+        // return, and `done` runs once it is as durable as the durability
+        // mode asks - on the syncer thread, or inline if there is nothing to
+        // wait for. `done` may destroy the writer.
+        using CommitCallback = std::function<void(bool ok)>;
+        void commitAsync(const std::string& expected_checksum, CommitCallback done);
+        void abort();
+        
+        int64_t bytesWritten() const { return bytes_written_; }
+        const std::string& checksum() const { return checksum_; }
+        
+    private:
+        friend class ChunkStorage;
+        ChunkWriter(ChunkStorage* storage, const std::string& chunk_id,
+                    std::unique_ptr<ChunkBackend::Writer> backend_writer,
+                    bool is_encrypted, bool is_erasure_coded);
+        
+        ChunkStorage* storage_;
+        std::string chunk_id_;
+        std::unique_ptr<ChunkBackend::Writer> backend_writer_;
+        bool is_encrypted_;
+        bool is_erasure_coded_;
+        int64_t bytes_written_;
+        SHA256Stream hasher_;
+        std::string checksum_;
+        std::vector<uint32_t> block_checksums_;
+        uint32_t block_crc_;        // CRC32C of the block being filled
+        size_t block_fill_;
+    };
+    
+    // Pull-style chunk reader for callers that send frames asynchronously;
+    // verifies like readChunkStream. Stays on the version it was opened on.
+    // Cached chunks are served from memory.
+    class ChunkReader {
+    public:
+        ChunkReader(const ChunkReader&) = delete;
+        ChunkReader& operator=(const ChunkReader&) = delete;
+        
+        int64_t size() const { return size_; }
+        const std::string& checksum() const { return info_.checksum; }
+        
+        // Next frame of at most frame_size bytes, valid until the next call;
+        // size 0 at the end. False if the chunk can't be read or is corrupted,
+        // in which case frames already delivered must be discarded.
+        bool next(const uint8_t*& data, size_t& size);
+        
+        // next() without blocking: the disk read goes through the I/O engine,
+        // then verification and `done` run on `pool` (inline if the frame is
+        // already buffered, on the engine's thread if the read fails). One
+        // call at a time.
+        using FrameCallback = std::function<void(bool ok, const uint8_t* data, size_t size)>;
+        void nextAsync(IoThreadPool& pool, FrameCallback done);
+        
+    private:
+        friend class ChunkStorage;
+        ChunkReader(const std::string& chunk_id, std::unique_ptr<ChunkBackend::Reader> reader,
+                    StoredChunkInfo info, size_t frame_size, IoEngine& io_engine, ChunkCache* fill_cache);
+        ChunkReader(const std::string& chunk_id, ChunkCache::Data cached, std::string checksum,
+                    size_t frame_size);
+        
+        // Moves past the buffered data; length is what to read next, 0 at the end
+        bool startFill(size_t& length);
+        bool finishFill(size_t length);
+        void readAsync(IoThreadPool& pool, size_t done_bytes, size_t length, FrameCallback done);
+        void take(const uint8_t*& data, size_t& size);
+        
+        std::string chunk_id_;
+        std::unique_ptr<ChunkBackend::Reader> reader_;   // Null when served from the cache
+        StoredChunkInfo info_;
+        int64_t size_;
+        size_t frame_size_;
+        bool verify_blocks_;        // Otherwise the whole chunk's SHA-256 is checked at the end
+        SHA256Stream hasher_;
+        IoEngine::Buffer buffer_;   // Aligned, so reads can bypass the page cache
+        int64_t buffer_offset_;     // Chunk offset of buffer_
+        size_t buffer_fill_;
+        size_t buffer_pos_;
+        ChunkCache::Data cached_;                   // Whole chunk, if it was cached
+        ChunkCache* fill_cache_;                    // Gets the chunk once it is read and verified
+        std::vector<uint8_t> fill_;
+    };
+    
+    // Unless durability is NONE, a write returns once it is synced to disk
+    ChunkStorage(const std::string& storage_directory,
+                 StorageBackendType backend_type = StorageBackendType::FILE_PER_CHUNK,
+                 const IoEngineOptions& io_options = IoEngineOptions(),
+                 const DurabilityOptions& durability = DurabilityOptions(),
+                 const ChunkCacheOptions& cache_options = ChunkCacheOptions());
     ~ChunkStorage();
     
-    // Core operations
+    // Core operations. Reads of whole chunks go through the chunk cache;
+    // range reads are served from it but don't fill it.
     bool writeChunk(const std::string& chunk_id, 
                    const std::vector<uint8_t>& data,
                    bool is_encrypted = false,
@@ -27,45 +139,157 @@ public:
     
     std::vector<uint8_t> readChunk(const std::string& chunk_id);
     
+    // Reads `length` bytes at `offset`, clipped to the end of the chunk.
+    // Only the CHECKSUM_BLOCK_SIZE blocks the range touches are read and
+    // verified (chunks stored before block checksums are verified whole);
+    // the indexes of corrupted blocks go to `corrupted_blocks`.
+    bool readChunkRange(const std::string& chunk_id, int64_t offset, int64_t length,
+                        std::vector<uint8_t>& data, std::vector<int64_t>* corrupted_blocks = nullptr);
+    
+    // Streaming operations (bounded memory, one frame at a time).
+    // size_hint is the expected chunk size in bytes, or 0 if unknown.
+    std::unique_ptr<ChunkWriter> openChunkWriter(const std::string& chunk_id,
+                                                 bool is_encrypted = false,
+                                                 bool is_erasure_coded = false,
+                                                 int64_t size_hint = 0);
+    
+    // Hands the chunk to `sink` in frames of at most frame_size bytes and
+    // verifies the checksum on the fly. Returns false if the chunk is missing,
+    // the sink gives up, or the data turns out to be corrupted - in which case
+    // frames already delivered must be discarded by the caller.
+    bool readChunkStream(const std::string& chunk_id, size_t frame_size,
+                         const std::function<bool(const uint8_t*, size_t)>& sink);
+    
+    // Null if the chunk doesn't exist
+    std::unique_ptr<ChunkReader> openChunkReader(const std::string& chunk_id, size_t frame_size);
+    
     bool deleteChunk(const std::string& chunk_id);
     
     bool chunkExists(const std::string& chunk_id) const;
+    int64_t getChunkSize(const std::string& chunk_id) const;
     
     // Integrity checking
     bool verifyChunkIntegrity(const std::string& chunk_id);
     std::string getChunkChecksum(const std::string& chunk_id);
     
+    // Checks every block of the chunk; false if it is missing or corrupted.
+    // Corrupted blocks are listed in `corrupted_blocks`, which stays empty
+    // if the damage can't be located (no block checksums, read errors).
+    bool scrubChunk(const std::string& chunk_id, std::vector<int64_t>& corrupted_blocks);
+    
+    // Block-level repair: rewrites the chunk with the given blocks (by
+    // index) replaced by good copies, e.g. from another replica. Fails
+    // unless the result matches the chunk's checksum.
+    bool repairChunkBlocks(const std::string& chunk_id,
+                           const std::map<int64_t, std::vector<uint8_t>>& blocks);
+    
     // Statistics
     int64_t getTotalStorageUsed() const;
     int64_t getAvailableStorage() const;
     int getChunkCount() const;
     std::vector<std::string> getAllChunkIds() const;
     
-    // Maintenance
-    void performGarbageCollection();
+    // Maintenance. Garbage collection scrubs every chunk and drops the
+    // missing and corrupted ones; `repair` gets a chance to fix a corrupted
+    // chunk first (with its corrupted blocks, possibly none) and returns
+    // true if it did.
+    using RepairHandler = std::function<bool(const std::string& chunk_id,
+                                             const std::vector<int64_t>& corrupted_blocks)>;
+    void performGarbageCollection(const RepairHandler& repair = nullptr);
     void rebuildChecksumIndex();
     
+    StorageBackendType getBackendType() const { return backend_->getType(); }
+    const char* getIoEngineName() const { return io_engine_->name(); }
+    DurabilityMode getDurabilityMode() const { return durability_mode_; }
+    ChunkCache::Stats getCacheStats() const { return cache_.getStats(); }
+    
+    // Syncs every write that completed so far (not needed for durability
+    // unless it is NONE)
+    bool sync();
+    
+    // Called with (chunk_id, stored) whenever a chunk appears or disappears,
+    // under the chunk's stripe lock so calls for one chunk arrive in order.
+    // Set it before the storage is shared between threads.
+    using ChangeListener = std::function<void(const std::string& chunk_id, bool stored)>;
+    void setChangeListener(ChangeListener listener) { change_listener_ = std::move(listener); }
+    
 private:
     std::string storage_directory_;
-    std::string checksum_index_file_;
+    std::string legacy_index_file_;   // checksums.json from before the journal, migrated on startup
+    std::shared_ptr<IoEngine> io_engine_;
+    std::unique_ptr<ChunkBackend> backend_;
+    std::unique_ptr<ChecksumJournal> journal_;
+    DurabilityMode durability_mode_;
+    std::unique_ptr<GroupCommitSyncer> syncer_;   // Null for DurabilityMode::NONE
+    ChunkCache cache_;
+    ChangeListener change_listener_;
+    
+    // Journal checkpoints rewrite the whole index, so writers only ask for
+    // them and this thread writes them while the journal keeps growing
+    std::mutex checkpoint_mutex_;
+    std::condition_variable checkpoint_cv_;
+    bool checkpoint_requested_;
+    bool checkpoint_stopping_;
+    std::thread checkpoint_thread_;
+    
+    // The chunk index is split into stripes by chunk id so that unrelated
+    // chunks never contend; only index updates run under a stripe lock,
+    // hashing and disk I/O happen outside of it
+    static constexpr size_t INDEX_STRIPES = 64;
+    
+    struct IndexStripe {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::string> checksums;
+        std::unordered_set<std::string> chunks;
+        // Backend metadata (block checksums) of the current versions, kept
+        // from the commit or the first open so opens don't go to the backend
+        std::unordered_map<std::string, StoredChunkInfo> infos;
+    };
     
-    mutable std::shared_mutex storage_mutex_;
-    std::unordered_map<std::string, std::string> chunk_checksums_;
-    std::unordered_set<std::string> stored_chunks_;
+    std::array<IndexStripe, INDEX_STRIPES> stripes_;
     
     // Helper methods
-    std::string getChunkFilePath(const std::string& chunk_id) const;
-    std::string getChunkMetadataPath(const std::string& chunk_id) const;
+    IndexStripe& stripeFor(const std::string& chunk_id);
+    const IndexStripe& stripeFor(const std::string& chunk_id) const;
+    // Publishes the chunk, then calls `done` once it is as durable as the
+    // durability mode asks (inline if it failed or there is no syncer);
+    // the arguments aren't used once `done` may have run
+    void commitChunk(const std::string& chunk_id,
+                     ChunkBackend::Writer& backend_writer,
+                     int64_t size,
+                     const std::string& checksum,
+                     const std::vector<uint32_t>& block_checksums,
+                     bool is_encrypted,
+                     bool is_erasure_coded,
+                     GroupCommitSyncer::DurableCallback done);
+    // The chunk's current version if it is cached, with its checksum
+    ChunkCache::Data lookupCached(const std::string& chunk_id, std::string& checksum);
+    // Offers a chunk that was just read whole and verified to the cache
+    void offerToCache(const std::string& chunk_id, const std::string& checksum,
+                      const std::vector<uint8_t>& data);
+    // Opens the chunk's current version along with the metadata it was
+    // committed with (checksum from the index, the rest from infos)
+    bool openChunk(const std::string& chunk_id, std::unique_ptr<ChunkBackend::Reader>& reader,
+                   StoredChunkInfo& info);
+    // Reads [offset, offset + length) of an open chunk, verified as readChunkRange describes
+    bool readVerified(const std::string& chunk_id, ChunkBackend::Reader& reader,
+                      const StoredChunkInfo& info, int64_t offset, int64_t length,
+                      std::vector<uint8_t>& data, std::vector<int64_t>* corrupted_blocks);
+    static bool hasBlockChecksums(const StoredChunkInfo& info, int64_t size);
+    // Checks data, whole blocks of the chunk starting at first_block
+    static void verifyBlocks(const StoredChunkInfo& info, int64_t first_block,
+                             const uint8_t* data, size_t size, std::vector<int64_t>& corrupted_blocks);
+    static bool readFully(ChunkBackend::Reader& reader, int64_t offset, uint8_t* buffer, size_t length);
+    // Callers hold the chunk's stripe lock
+    std::string lookupChecksum(const IndexStripe& stripe, const std::string& chunk_id);
+    bool computeChunkChecksum(ChunkBackend::Reader& reader, std::string& checksum);
+    // Callers hold the chunk's stripe lock exclusively
+    void notifyChange(const std::string& chunk_id, bool stored);
     bool saveChecksumIndex();
+    // Wakes the checkpoint thread if the journal is due for a checkpoint
+    void requestCheckpoint();
+    void checkpointLoop();
     bool loadChecksumIndex();
-    bool saveChunkMetadata(const std::string& chunk_id, 
-                          const std::string& checksum,
-                          bool is_encrypted,
-                          bool is_erasure_coded);
-    bool loadChunkMetadata(const std::string& chunk_id,
-                          std::string& checksum,
-                          bool& is_encrypted,
-                          bool& is_erasure_coded);
     void updateStorageStats();
 };
 
@@ -0,0 +1,126 @@
+#include "group_commit.h"
+#include "utils.h"
+
+namespace dfs {
+
+bool DurabilityOptions::parseMode(const std::string& name, DurabilityMode& mode) {
+    if (name == "none") {
+        mode = DurabilityMode::NONE;
+        return true;
+    }
+    if (name == "write") {
+        mode = DurabilityMode::PER_WRITE;
+        return true;
+    }
+    if (name == "group") {
+        mode = DurabilityMode::GROUP_COMMIT;
+        return true;
+    }
+    return false;
+}
+
+const char* DurabilityOptions::modeToString(DurabilityMode mode) {
+    switch (mode) {
+        case DurabilityMode::NONE: return "none";
+        case DurabilityMode::PER_WRITE: return "write";
+        case DurabilityMode::GROUP_COMMIT: return "group";
+        default: return "unknown";
+    }
+}
+
+GroupCommitSyncer::GroupCommitSyncer(const DurabilityOptions& options, SyncFunction sync)
+    : interval_(options.mode == DurabilityMode::GROUP_COMMIT ? options.group_commit_interval_ms : 0),
+      batch_bytes_(options.mode == DurabilityMode::GROUP_COMMIT ? options.group_commit_bytes : 0),
+      sync_(std::move(sync)),
+      pending_bytes_(0),
+      sync_count_(0),
+      synced_commits_(0),
+      stopping_(false) {
+    thread_ = std::thread(&GroupCommitSyncer::syncLoop, this);
+}
+
+GroupCommitSyncer::~GroupCommitSyncer() {
+    shutdown();
+}
+
+void GroupCommitSyncer::notifyDurable(int64_t bytes, DurableCallback done) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+        lock.unlock();
+        done(sync_());
+        return;
+    }
+
+    if (pending_.empty()) {
+        first_pending_ = std::chrono::steady_clock::now();
+    }
+    pending_.push_back(std::move(done));
+    pending_bytes_ += bytes;
+    syncer_cv_.notify_one();
+}
+
+void GroupCommitSyncer::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        syncer_cv_.notify_one();
+    }
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+int64_t GroupCommitSyncer::getSyncCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sync_count_;
+}
+
+int64_t GroupCommitSyncer::getSyncedCommits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return synced_commits_;
+}
+
+void GroupCommitSyncer::syncLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        syncer_cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return;
+        }
+
+        // Let the batch fill up; shutdown syncs right away
+        syncer_cv_.wait_until(lock, first_pending_ + interval_, [this] {
+            return stopping_ || pending_bytes_ >= batch_bytes_;
+        });
+
+        // Everything registered so far completed its writes before registering
+        std::vector<DurableCallback> batch;
+        batch.swap(pending_);
+        pending_bytes_ = 0;
+
+        lock.unlock();
+        bool ok = sync_();
+        lock.lock();
+
+        if (!ok) {
+            Utils::logError("Failed to sync a batch of " + std::to_string(batch.size()) + " writes");
+        }
+        sync_count_++;
+        synced_commits_ += batch.size();
+
+        // Only the commits this sync covered learn about its failure
+        lock.unlock();
+        for (DurableCallback& done : batch) {
+            done(ok);
+        }
+        batch.clear();
+        lock.lock();
+    }
+}
+
+} // namespace dfs
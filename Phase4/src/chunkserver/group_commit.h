@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace dfs {
+
+// When a chunk write is acknowledged relative to it reaching stable storage
+enum class DurabilityMode {
+    NONE,           // As soon as it is written; the kernel flushes it eventually
+    PER_WRITE,      // After a sync that covers it, started as soon as it commits
+    GROUP_COMMIT    // After a sync that covers it, batched with other writes
+};
+
+struct DurabilityOptions {
+    DurabilityMode mode = DurabilityMode::GROUP_COMMIT;
+    int64_t group_commit_interval_ms = 5;               // Longest a write waits for its batch to start syncing
+    int64_t group_commit_bytes = 64 * 1024 * 1024;      // Sync early once this much is waiting
+
+    // "none", "write" or "group"
+    static bool parseMode(const std::string& name, DurabilityMode& mode);
+    static const char* modeToString(DurabilityMode mode);
+};
+
+// Group commit: writers register their commits and are called back while
+// one thread syncs them in batches. A batch starts syncing once the interval
+// has passed since its first commit or enough bytes are waiting; commits
+// arriving during a sync form the next batch, so each sync covers everything
+// the previous one kept waiting. PER_WRITE is the same with no wait before
+// syncing.
+class GroupCommitSyncer {
+public:
+    // Makes every write that completed before the call durable
+    using SyncFunction = std::function<bool()>;
+
+    // Gets whether the sync covering the write succeeded
+    using DurableCallback = std::function<void(bool ok)>;
+
+    GroupCommitSyncer(const DurabilityOptions& options, SyncFunction sync);
+    ~GroupCommitSyncer();
+
+    GroupCommitSyncer(const GroupCommitSyncer&) = delete;
+    GroupCommitSyncer& operator=(const GroupCommitSyncer&) = delete;
+
+    // Calls `done` once a sync started after the call has finished, on the
+    // syncer thread; false means that sync failed and the write may not be
+    // durable. Keep `done` short, it holds up the rest of the batch.
+    void notifyDurable(int64_t bytes, DurableCallback done);
+
+    // Syncs what is waiting and stops the thread; later commits are synced
+    // on the caller's thread before notifyDurable returns
+    void shutdown();
+
+    int64_t getSyncCount() const;
+    int64_t getSyncedCommits() const;
+
+private:
+    std::chrono::milliseconds interval_;
+    int64_t batch_bytes_;
+    SyncFunction sync_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable syncer_cv_;     // Commits are waiting, or shutdown
+    std::vector<DurableCallback> pending_;  // Registered since the last sync started
+    int64_t pending_bytes_;
+    std::chrono::steady_clock::time_point first_pending_;
+    int64_t sync_count_;
+    int64_t synced_commits_;
+    bool stopping_;
+    std::thread thread_;
+
+    void syncLoop();
+};
+
+} // namespace dfs
@@ -0,0 +1,545 @@
+#include "io_engine.h"
+#include "utils.h"
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define DFS_HAVE_IO_URING 1
+#endif
+#endif
+
+namespace dfs {
+
+namespace {
+
+size_t alignUp(size_t size) {
+    return (size + IoEngine::DIRECT_IO_ALIGNMENT - 1) / IoEngine::DIRECT_IO_ALIGNMENT *
+           IoEngine::DIRECT_IO_ALIGNMENT;
+}
+
+} // namespace
+
+// Buffer implementation
+IoEngine::Buffer::~Buffer() {
+    release();
+}
+
+IoEngine::Buffer::Buffer(Buffer&& other) noexcept
+    : engine_(other.engine_), data_(other.data_), size_(other.size_), index_(other.index_) {
+    other.engine_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.index_ = -1;
+}
+
+IoEngine::Buffer& IoEngine::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        engine_ = other.engine_;
+        data_ = other.data_;
+        size_ = other.size_;
+        index_ = other.index_;
+        other.engine_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.index_ = -1;
+    }
+    return *this;
+}
+
+void IoEngine::Buffer::release() {
+    if (!data_) {
+        return;
+    }
+
+    if (index_ >= 0) {
+        engine_->releaseBuffer(index_);
+    } else {
+        std::free(data_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    index_ = -1;
+}
+
+IoEngine::IoEngine(const IoEngineOptions& options)
+    : options_(options), pool_memory_(nullptr) {
+    options_.buffer_size = alignUp(std::max<size_t>(options_.buffer_size, 1));
+
+    if (options_.buffer_count > 0) {
+        pool_memory_ = static_cast<uint8_t*>(
+            std::aligned_alloc(DIRECT_IO_ALIGNMENT, options_.buffer_count * options_.buffer_size));
+        if (!pool_memory_) {
+            Utils::logWarning("Failed to allocate I/O buffer pool, using heap buffers");
+            options_.buffer_count = 0;
+        }
+    }
+
+    for (size_t i = options_.buffer_count; i > 0; --i) {
+        free_buffers_.push_back(static_cast<int>(i - 1));
+    }
+}
+
+IoEngine::~IoEngine() {
+    std::free(pool_memory_);
+}
+
+IoEngine::Buffer IoEngine::allocateBuffer(size_t size) {
+    size_t aligned = alignUp(std::max<size_t>(size, 1));
+    if (aligned <= options_.buffer_size) {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (!free_buffers_.empty()) {
+            int index = free_buffers_.back();
+            free_buffers_.pop_back();
+            return Buffer(this, pool_memory_ + index * options_.buffer_size, aligned, index);
+        }
+    }
+
+    uint8_t* data = static_cast<uint8_t*>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, aligned));
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    return Buffer(this, data, aligned, -1);
+}
+
+void IoEngine::releaseBuffer(int index) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    free_buffers_.push_back(index);
+}
+
+ssize_t IoEngine::read(int fd, uint8_t* buffer, size_t length, int64_t offset) {
+    while (true) {
+        ssize_t bytes = ::pread(fd, buffer, length, offset);
+        if (bytes < 0 && errno == EINTR) continue;
+        return bytes;
+    }
+}
+
+ssize_t IoEngine::write(int fd, const uint8_t* data, size_t size, int64_t offset) {
+    while (true) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written < 0 && errno == EINTR) continue;
+        return written;
+    }
+}
+
+bool IoEngine::writeAll(int fd, const uint8_t* data, size_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size, offset);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool IoEngine::trimForDirectIo(const void* buffer, int64_t offset, size_t& length) {
+    if (reinterpret_cast<uintptr_t>(buffer) % DIRECT_IO_ALIGNMENT != 0 ||
+        offset % static_cast<int64_t>(DIRECT_IO_ALIGNMENT) != 0 ||
+        length < DIRECT_IO_ALIGNMENT) {
+        return false;
+    }
+
+    length -= length % DIRECT_IO_ALIGNMENT;
+    return true;
+}
+
+std::shared_ptr<IoEngine> IoEngine::create(const IoEngineOptions& options) {
+    if (options.type != IoEngineType::SYNC) {
+        if (auto engine = IoUringEngine::create(options)) {
+            return engine;
+        }
+        if (options.type == IoEngineType::IO_URING) {
+            Utils::logWarning("io_uring is not available, falling back to pread/pwrite");
+        }
+    }
+    return std::make_shared<SyncIoEngine>(options);
+}
+
+bool IoEngine::parseType(const std::string& name, IoEngineType& type) {
+    if (name == "auto") {
+        type = IoEngineType::AUTO;
+        return true;
+    }
+    if (name == "uring") {
+        type = IoEngineType::IO_URING;
+        return true;
+    }
+    if (name == "sync") {
+        type = IoEngineType::SYNC;
+        return true;
+    }
+    return false;
+}
+
+// SyncIoEngine implementation
+SyncIoEngine::SyncIoEngine(const IoEngineOptions& options)
+    : IoEngine(options), workers_(options.sync_pool) {
+    if (!workers_) {
+        own_workers_ = std::make_unique<IoThreadPool>(std::max<size_t>(options.sync_threads, 1));
+        workers_ = own_workers_.get();
+    }
+}
+
+SyncIoEngine::~SyncIoEngine() {
+    if (own_workers_) {
+        own_workers_->shutdown();
+    }
+}
+
+void SyncIoEngine::submitRead(int fd, uint8_t* buffer, size_t length, int64_t offset, Completion done) {
+    workers_->submit([this, fd, buffer, length, offset, done = std::move(done)] {
+        ssize_t bytes = read(fd, buffer, length, offset);
+        done(bytes < 0 ? -errno : bytes);
+    });
+}
+
+void SyncIoEngine::submitWrite(int fd, const uint8_t* data, size_t size, int64_t offset, Completion done) {
+    workers_->submit([this, fd, data, size, offset, done = std::move(done)] {
+        ssize_t written = write(fd, data, size, offset);
+        done(written < 0 ? -errno : written);
+    });
+}
+
+#ifdef DFS_HAVE_IO_URING
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                                      nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+} // namespace
+
+// The mapped submission and completion rings. Submitters serialize on
+// submit_mutex; only the completion thread moves the completion head.
+struct IoUringEngine::Ring {
+    int fd = -1;
+    unsigned entries = 0;
+    unsigned cq_entries = 0;
+
+    void* sq_memory = MAP_FAILED;
+    size_t sq_memory_size = 0;
+    void* cq_memory = MAP_FAILED;
+    size_t cq_memory_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    std::mutex submit_mutex;
+    std::condition_variable slot_cv;
+    unsigned in_flight = 0;         // Kept within cq_entries, except by the completion thread
+
+    std::thread completion_thread;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_memory != MAP_FAILED && cq_memory != sq_memory) {
+            ::munmap(cq_memory, cq_memory_size);
+        }
+        if (sq_memory != MAP_FAILED) {
+            ::munmap(sq_memory, sq_memory_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+std::unique_ptr<IoUringEngine> IoUringEngine::create(const IoEngineOptions& options) {
+    std::unique_ptr<IoUringEngine> engine(new IoUringEngine(options));
+    if (!engine->setup()) {
+        return nullptr;
+    }
+
+    engine->ring_->completion_thread = std::thread(&IoUringEngine::completionLoop, engine.get());
+    Utils::logInfo("io_uring I/O engine ready (" + std::to_string(engine->ring_->entries) + " entries" +
+                   (engine->buffers_registered_ ? ", registered buffers" : "") +
+                   (options.direct_io ? ", direct I/O" : "") + ")");
+    return engine;
+}
+
+IoUringEngine::IoUringEngine(const IoEngineOptions& options)
+    : IoEngine(options), ring_(std::make_unique<Ring>()), buffers_registered_(false) {}
+
+IoUringEngine::~IoUringEngine() {
+    if (ring_->completion_thread.joinable()) {
+        // A no-op with user_data 0 tells the completion thread to exit
+        submit(false, -1, nullptr, 0, 0, nullptr);
+        ring_->completion_thread.join();
+    }
+}
+
+bool IoUringEngine::setup() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    ring_->fd = ioUringSetup(std::max(options_.queue_depth, 1u), &params);
+    if (ring_->fd >= 0 && !(params.features & IORING_FEAT_NODROP)) {
+        Utils::logDebug("io_uring lacks IORING_FEAT_NODROP");
+        return false;
+    }
+    if (ring_->fd < 0) {
+        Utils::logDebug("io_uring_setup failed: " + std::string(std::strerror(errno)));
+        return false;
+    }
+    ring_->entries = params.sq_entries;
+    ring_->cq_entries = params.cq_entries;
+
+    // IORING_OP_READ and IORING_OP_WRITE (Linux 5.6) are required
+    size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::vector<uint8_t> probe_memory(probe_size, 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(probe_memory.data());
+    if (ioUringRegister(ring_->fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        probe->last_op < IORING_OP_WRITE ||
+        !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+        Utils::logDebug("io_uring lacks IORING_OP_READ/IORING_OP_WRITE");
+        return false;
+    }
+
+    ring_->sq_memory_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring_->cq_memory_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring_->sq_memory_size = ring_->cq_memory_size = std::max(ring_->sq_memory_size, ring_->cq_memory_size);
+    }
+
+    ring_->sq_memory = ::mmap(nullptr, ring_->sq_memory_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_SQ_RING);
+    if (ring_->sq_memory == MAP_FAILED) {
+        return false;
+    }
+
+    if (single_mmap) {
+        ring_->cq_memory = ring_->sq_memory;
+    } else {
+        ring_->cq_memory = ::mmap(nullptr, ring_->cq_memory_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_CQ_RING);
+        if (ring_->cq_memory == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    ring_->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring_->sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, ring_->sqes_size, PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_SQES));
+    if (ring_->sqes == MAP_FAILED) {
+        return false;
+    }
+
+    uint8_t* sq = static_cast<uint8_t*>(ring_->sq_memory);
+    ring_->sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring_->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring_->sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring_->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    uint8_t* cq = static_cast<uint8_t*>(ring_->cq_memory);
+    ring_->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring_->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring_->cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring_->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Registered buffers save the kernel pinning pages on every request;
+    // without them (e.g. RLIMIT_MEMLOCK too low) plain reads still work
+    if (pool_memory_) {
+        std::vector<iovec> iovecs(options_.buffer_count);
+        for (size_t i = 0; i < iovecs.size(); ++i) {
+            iovecs[i].iov_base = pool_memory_ + i * options_.buffer_size;
+            iovecs[i].iov_len = options_.buffer_size;
+        }
+        if (ioUringRegister(ring_->fd, IORING_REGISTER_BUFFERS, iovecs.data(),
+                            static_cast<unsigned>(iovecs.size())) == 0) {
+            buffers_registered_ = true;
+        } else {
+            Utils::logWarning("Failed to register io_uring buffers: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    return true;
+}
+
+int IoUringEngine::registeredBuffer(const uint8_t* data, size_t length) const {
+    if (!buffers_registered_ || data < pool_memory_ ||
+        data >= pool_memory_ + options_.buffer_count * options_.buffer_size) {
+        return -1;
+    }
+
+    size_t index = static_cast<size_t>(data - pool_memory_) / options_.buffer_size;
+    const uint8_t* end = pool_memory_ + (index + 1) * options_.buffer_size;
+    return data + length <= end ? static_cast<int>(index) : -1;
+}
+
+void IoUringEngine::submit(bool is_write, int fd, const uint8_t* data, size_t length, int64_t offset,
+                           Completion done) {
+    // The callback travels through the ring as user_data; 0 is the shutdown marker
+    Completion* request = done ? new Completion(std::move(done)) : nullptr;
+    int buffer_index = registeredBuffer(data, length);
+
+    bool on_completion_thread = std::this_thread::get_id() == ring_->completion_thread.get_id();
+
+    {
+        std::unique_lock<std::mutex> lock(ring_->submit_mutex);
+
+        // Callbacks submit follow-up requests from the completion thread,
+        // which must never wait for itself; the kernel keeps completions
+        // beyond the queue size (IORING_FEAT_NODROP)
+        if (!on_completion_thread) {
+            ring_->slot_cv.wait(lock, [this] { return ring_->in_flight < ring_->cq_entries; });
+        }
+
+        unsigned tail = *ring_->sq_tail;
+        while (tail - __atomic_load_n(ring_->sq_head, __ATOMIC_ACQUIRE) >= ring_->entries) {
+            // Entries queued by submitters that haven't entered yet
+            ioUringEnter(ring_->fd, ring_->entries, 0, 0);
+        }
+
+        unsigned index = tail & *ring_->sq_mask;
+        io_uring_sqe* sqe = &ring_->sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+
+        if (!request) {
+            sqe->opcode = IORING_OP_NOP;
+        } else if (buffer_index >= 0) {
+            sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = static_cast<uint16_t>(buffer_index);
+        } else {
+            sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(length, std::numeric_limits<int32_t>::max()));
+        sqe->off = static_cast<uint64_t>(offset);
+        sqe->user_data = reinterpret_cast<uint64_t>(request);
+
+        ring_->sq_array[index] = index;
+        __atomic_store_n(ring_->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ring_->in_flight++;
+    }
+
+    // Each entry gets its own enter call, which submits whatever is queued.
+    // A busy ring is waited out, except on the completion thread: it leaves
+    // the entry queued and submits it before it next waits
+    while (ioUringEnter(ring_->fd, 1, 0, 0) < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EBUSY) {
+            if (on_completion_thread) break;
+            continue;
+        }
+        Utils::logError("io_uring_enter failed: " + std::string(std::strerror(errno)));
+        break;
+    }
+}
+
+void IoUringEngine::submitRead(int fd, uint8_t* buffer, size_t length, int64_t offset, Completion done) {
+    submit(false, fd, buffer, length, offset, std::move(done));
+}
+
+void IoUringEngine::submitWrite(int fd, const uint8_t* data, size_t size, int64_t offset, Completion done) {
+    submit(true, fd, data, size, offset, std::move(done));
+}
+
+void IoUringEngine::completionLoop() {
+    while (true) {
+        unsigned head = *ring_->cq_head;
+        unsigned tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            unsigned queued = __atomic_load_n(ring_->sq_tail, __ATOMIC_ACQUIRE) -
+                              __atomic_load_n(ring_->sq_head, __ATOMIC_ACQUIRE);
+            if (ioUringEnter(ring_->fd, queued, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                Utils::logError("io_uring wait failed: " + std::string(std::strerror(errno)));
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            continue;
+        }
+
+        bool stopping = false;
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = ring_->cqes[head & *ring_->cq_mask];
+            Completion* request = reinterpret_cast<Completion*>(cqe.user_data);
+            ssize_t result = cqe.res;
+
+            // Free the slot before running the callback, which may submit again
+            __atomic_store_n(ring_->cq_head, head + 1, __ATOMIC_RELEASE);
+            {
+                std::lock_guard<std::mutex> lock(ring_->submit_mutex);
+                ring_->in_flight--;
+            }
+            ring_->slot_cv.notify_one();
+
+            if (!request) {
+                stopping = true;
+                continue;
+            }
+            (*request)(result);
+            delete request;
+        }
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+#else
+
+// Built without io_uring headers: always fall back
+std::unique_ptr<IoUringEngine> IoUringEngine::create(const IoEngineOptions&) {
+    return nullptr;
+}
+
+struct IoUringEngine::Ring {};
+
+IoUringEngine::IoUringEngine(const IoEngineOptions& options)
+    : IoEngine(options), buffers_registered_(false) {}
+
+IoUringEngine::~IoUringEngine() = default;
+
+bool IoUringEngine::setup() { return false; }
+int IoUringEngine::registeredBuffer(const uint8_t*, size_t) const { return -1; }
+void IoUringEngine::submit(bool, int, const uint8_t*, size_t, int64_t, Completion) {}
+void IoUringEngine::completionLoop() {}
+
+void IoUringEngine::submitRead(int, uint8_t*, size_t, int64_t, Completion done) { done(-ENOSYS); }
+void IoUringEngine::submitWrite(int, const uint8_t*, size_t, int64_t, Completion done) { done(-ENOSYS); }
+
+#endif
+
+} // namespace dfs
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "io_thread_pool.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace dfs {
+
+enum class IoEngineType {
+    AUTO,       // io_uring if the kernel has it, otherwise SYNC
+    IO_URING,   // Shared submission ring, completions reaped by one thread
+    SYNC        // pread/pwrite; asynchronous requests run on a thread pool
+};
+
+struct IoEngineOptions {
+    IoEngineType type = IoEngineType::AUTO;
+    bool direct_io = false;             // Read chunk data with O_DIRECT, bypassing the page cache
+    unsigned queue_depth = 256;         // io_uring submission queue entries
+    size_t buffer_count = 64;           // Aligned buffers kept for reads (registered with io_uring)
+    size_t buffer_size = 256 * 1024;
+    size_t sync_threads = 16;           // Workers behind asynchronous requests of the SYNC engine
+    IoThreadPool* sync_pool = nullptr;  // Runs them instead of its own workers; must outlive the engine
+};
+
+// Disk I/O for the chunk backends. Requests can be submitted asynchronously,
+// so one thread keeps many reads in flight, or made blocking. Both forms
+// follow pread/pwrite: a request may transfer fewer bytes than asked.
+// Blocking requests are plain pread/pwrite on the caller's thread in every
+// engine; a thread that waits anyway gains nothing from a queue hop.
+class IoEngine {
+public:
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    // Bytes transferred, or -errno
+    using Completion = std::function<void(ssize_t result)>;
+
+    // Aligned memory for reads, from the engine's pool (registered with the
+    // kernel where possible) or the heap if the pool is exhausted. The size
+    // is rounded up to DIRECT_IO_ALIGNMENT.
+    class Buffer {
+    public:
+        Buffer() = default;
+        ~Buffer();
+
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        uint8_t* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        friend class IoEngine;
+        Buffer(IoEngine* engine, uint8_t* data, size_t size, int index)
+            : engine_(engine), data_(data), size_(size), index_(index) {}
+
+        void release();
+
+        IoEngine* engine_ = nullptr;
+        uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        int index_ = -1;                // Pool slot, -1 for heap buffers
+    };
+
+    virtual ~IoEngine();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    // Asynchronous requests; the buffer must stay valid until `done` runs,
+    // which may be on an engine thread
+    virtual void submitRead(int fd, uint8_t* buffer, size_t length, int64_t offset, Completion done) = 0;
+    virtual void submitWrite(int fd, const uint8_t* data, size_t size, int64_t offset, Completion done) = 0;
+
+    // Blocking requests; -1 with errno set on failure
+    ssize_t read(int fd, uint8_t* buffer, size_t length, int64_t offset);
+    ssize_t write(int fd, const uint8_t* data, size_t size, int64_t offset);
+
+    // Writes all of `data`, continuing short writes
+    bool writeAll(int fd, const uint8_t* data, size_t size, int64_t offset);
+
+    Buffer allocateBuffer(size_t size);
+
+    bool directIo() const { return options_.direct_io; }
+
+    // Whether a read can use O_DIRECT: buffer and offset aligned, at least
+    // one whole block. Trims length to whole blocks; the rest is left for a
+    // follow-up read through the page cache, as after a short read.
+    static bool trimForDirectIo(const void* buffer, int64_t offset, size_t& length);
+
+    virtual const char* name() const = 0;
+
+    // Falls back to the SYNC engine if io_uring is unavailable
+    static std::shared_ptr<IoEngine> create(const IoEngineOptions& options);
+    static bool parseType(const std::string& name, IoEngineType& type);
+
+protected:
+    explicit IoEngine(const IoEngineOptions& options);
+
+    IoEngineOptions options_;
+    uint8_t* pool_memory_;              // buffer_count buffers of buffer_size, contiguous
+
+private:
+    std::mutex pool_mutex_;
+    std::vector<int> free_buffers_;
+
+    void releaseBuffer(int index);
+};
+
+// Fallback engine: asynchronous requests are blocking calls on a pool
+// thread, the shared sync_pool if one is given
+class SyncIoEngine : public IoEngine {
+public:
+    explicit SyncIoEngine(const IoEngineOptions& options);
+    ~SyncIoEngine() override;
+
+    void submitRead(int fd, uint8_t* buffer, size_t length, int64_t offset, Completion done) override;
+    void submitWrite(int fd, const uint8_t* data, size_t size, int64_t offset, Completion done) override;
+
+    const char* name() const override { return "sync"; }
+
+private:
+    std::unique_ptr<IoThreadPool> own_workers_;
+    IoThreadPool* workers_;
+};
+
+// io_uring engine, driven through the raw system calls. Any thread may
+// submit; one thread reaps completions and runs the callbacks, so these
+// must not block. Reads into the buffer pool use the registered buffers.
+class IoUringEngine : public IoEngine {
+public:
+    // Null if the kernel lacks io_uring or the operations it needs
+    static std::unique_ptr<IoUringEngine> create(const IoEngineOptions& options);
+    ~IoUringEngine() override;
+
+    void submitRead(int fd, uint8_t* buffer, size_t length, int64_t offset, Completion done) override;
+    void submitWrite(int fd, const uint8_t* data, size_t size, int64_t offset, Completion done) override;
+
+    const char* name() const override { return "io_uring"; }
+
+private:
+    struct Ring;
+
+    explicit IoUringEngine(const IoEngineOptions& options);
+
+    bool setup();
+    // Index of the registered buffer holding [data, data + length), or -1
+    int registeredBuffer(const uint8_t* data, size_t length) const;
+    void submit(bool is_write, int fd, const uint8_t* data, size_t length, int64_t offset,
+                Completion done);
+    void completionLoop();
+
+    std::unique_ptr<Ring> ring_;
+    bool buffers_registered_;
+};
+
+} // namespace dfs
@@ -0,0 +1,75 @@
+#include "io_thread_pool.h"
+
+namespace dfs {
+
+IoThreadPool::IoThreadPool(size_t thread_count)
+    : stopping_(false), busy_threads_(0) {
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back(&IoThreadPool::workerLoop, this);
+    }
+}
+
+IoThreadPool::~IoThreadPool() {
+    shutdown();
+}
+
+void IoThreadPool::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stopping_) {
+            tasks_.push_back(std::move(task));
+            cv_.notify_one();
+            return;
+        }
+    }
+    
+    task();
+}
+
+void IoThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    
+    for (std::thread& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+size_t IoThreadPool::getQueueDepth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void IoThreadPool::workerLoop() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        
+        busy_threads_++;
+        task();
+        busy_threads_--;
+    }
+}
+
+} // namespace dfs
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+namespace dfs {
+
+// Fixed set of threads that run the chunk server's blocking work (disk I/O,
+// hashing) so that RPC threads never wait on the disk. Tasks start in
+// submission order.
+class IoThreadPool {
+public:
+    using Task = std::function<void()>;
+    
+    explicit IoThreadPool(size_t thread_count);
+    ~IoThreadPool();
+    
+    IoThreadPool(const IoThreadPool&) = delete;
+    IoThreadPool& operator=(const IoThreadPool&) = delete;
+    
+    void submit(Task task);
+    
+    // Runs the tasks already queued, then stops the threads; later
+    // submissions run on the caller's thread
+    void shutdown();
+    
+    size_t getThreadCount() const { return threads_.size(); }
+    size_t getQueueDepth() const;
+    int64_t getBusyThreads() const { return busy_threads_.load(); }
+    
+private:
+    std::vector<std::thread> threads_;
+    std::deque<Task> tasks_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_;
+    std::atomic<int64_t> busy_threads_;
+    
+    void workerLoop();
+};
+
+} // namespace dfs
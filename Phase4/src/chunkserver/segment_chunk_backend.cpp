@@ -0,0 +1,909 @@
+#include "segment_chunk_backend.h"
+#include <filesystem>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace dfs {
+
+namespace {
+
+constexpr uint32_t RECORD_MAGIC = 0x44465353; // "DFSS"
+
+bool preadAll(int fd, uint8_t* buffer, size_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t bytes = ::pread(fd, buffer, size, offset);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (bytes == 0) {
+            return false;
+        }
+        buffer += bytes;
+        size -= bytes;
+        offset += bytes;
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const uint8_t* data, size_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool copyRange(int source_fd, int64_t source_offset, int target_fd, int64_t target_offset,
+               int64_t length) {
+    std::vector<uint8_t> buffer(std::min<int64_t>(length, 1024 * 1024));
+    for (int64_t copied = 0; copied < length; ) {
+        size_t bytes = static_cast<size_t>(std::min<int64_t>(buffer.size(), length - copied));
+        if (!preadAll(source_fd, buffer.data(), bytes, source_offset + copied) ||
+            !pwriteAll(target_fd, buffer.data(), bytes, target_offset + copied)) {
+            return false;
+        }
+        copied += bytes;
+    }
+    return true;
+}
+
+int64_t padToBlock(int64_t size) {
+    const int64_t block = SegmentChunkBackend::SEGMENT_BLOCK_SIZE;
+    return (size + block - 1) / block * block;
+}
+
+} // namespace
+
+// Fixed part of a record's header block, followed by the chunk id, the
+// checksum and block_checksum_count CRC32Cs
+struct SegmentChunkBackend::RecordHeader {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;          // bit 0: encrypted, bit 1: erasure coded
+    uint64_t sequence;
+    int64_t span;
+    int64_t data_size;
+    int64_t created_time;
+    uint32_t id_length;
+    uint32_t checksum_length;
+    uint32_t header_crc;     // CRC32C of the used part of the block with this field zeroed
+    uint32_t block_checksum_count;  // 0 in records written before block checksums
+};
+
+SegmentChunkBackend::Segment::~Segment() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (direct_fd >= 0) {
+        ::close(direct_fd);
+    }
+}
+
+// Streams into an extent reserved in the active segment. If the chunk
+// outgrows the reservation, the data written so far moves to a bigger one.
+class SegmentChunkBackend::SegmentWriter : public ChunkBackend::Writer {
+public:
+    SegmentWriter(SegmentChunkBackend* backend, const std::string& chunk_id,
+                  std::shared_ptr<Segment> segment, int64_t offset, int64_t capacity)
+        : backend_(backend), chunk_id_(chunk_id), segment_(std::move(segment)),
+          offset_(offset), capacity_(capacity), written_(0) {}
+
+    ~SegmentWriter() override {
+        abort();
+    }
+
+    bool append(const uint8_t* data, size_t size) override {
+        if (!segment_) {
+            return false;
+        }
+
+        if (written_ + static_cast<int64_t>(size) > capacity_ && !grow(written_ + size)) {
+            abort();
+            return false;
+        }
+
+        if (!backend_->io_engine_->writeAll(segment_->fd, data, size, offset_ + SEGMENT_BLOCK_SIZE + written_)) {
+            Utils::logError("Failed to append to chunk " + chunk_id_ + ": " + std::strerror(errno));
+            abort();
+            return false;
+        }
+
+        written_ += size;
+        return true;
+    }
+
+    bool commit(const StoredChunkInfo& info) override {
+        if (!segment_) {
+            return false;
+        }
+
+        StoredChunkInfo stored = info;
+        stored.chunk_id = chunk_id_;
+        stored.size = written_;
+
+        int64_t span = SEGMENT_BLOCK_SIZE + padToBlock(written_);
+        int64_t reserved = SEGMENT_BLOCK_SIZE + capacity_;
+
+        std::lock_guard<std::mutex> lock(backend_->mutex_);
+        segment_->pending_writers--;
+
+        // Hand the unused tail of the reservation back as a skippable record,
+        // then flip the header to PUT - that write is the commit point
+        bool ok = span == reserved ||
+                  backend_->writeHeader(*segment_, offset_ + span, RecordType::RESERVED, 0,
+                                        reserved - span, StoredChunkInfo{});
+        uint64_t sequence = backend_->next_sequence_++;
+        ok = ok && backend_->writeHeader(*segment_, offset_, RecordType::PUT, sequence, span, stored);
+
+        if (ok) {
+            RecordLocation location;
+            location.segment = segment_;
+            location.offset = offset_;
+            location.span = span;
+            location.sequence = sequence;
+            location.info = std::move(stored);
+            backend_->publishRecord(chunk_id_, std::move(location));
+        } else {
+            Utils::logError("Failed to commit chunk record: " + chunk_id_);
+        }
+
+        segment_.reset();
+        return ok;
+    }
+
+    void abort() override {
+        if (!segment_) {
+            return;
+        }
+
+        // The extent stays a RESERVED record and is reclaimed by compaction
+        std::lock_guard<std::mutex> lock(backend_->mutex_);
+        segment_->pending_writers--;
+        segment_.reset();
+    }
+
+private:
+    bool grow(int64_t needed) {
+        int64_t capacity = padToBlock(std::max(needed, capacity_ * 2));
+        std::shared_ptr<Segment> segment;
+        int64_t offset = 0;
+        {
+            std::lock_guard<std::mutex> lock(backend_->mutex_);
+            if (!backend_->reserveExtent(SEGMENT_BLOCK_SIZE + capacity, segment, offset)) {
+                return false;
+            }
+        }
+
+        bool copied = copyRange(segment_->fd, offset_ + SEGMENT_BLOCK_SIZE,
+                                segment->fd, offset + SEGMENT_BLOCK_SIZE, written_);
+        {
+            std::lock_guard<std::mutex> lock(backend_->mutex_);
+            (copied ? segment_ : segment)->pending_writers--;
+        }
+
+        if (!copied) {
+            Utils::logError("Failed to grow chunk record: " + chunk_id_);
+            return false;
+        }
+
+        segment_ = std::move(segment);
+        offset_ = offset;
+        capacity_ = capacity;
+        return true;
+    }
+
+    SegmentChunkBackend* backend_;
+    std::string chunk_id_;
+    std::shared_ptr<Segment> segment_;
+    int64_t offset_;    // Header block of the reserved extent
+    int64_t capacity_;  // Data bytes the extent can hold
+    int64_t written_;
+};
+
+// Holds a reference to the segment, so compaction can't close it underneath
+class SegmentChunkBackend::SegmentReader : public ChunkBackend::Reader {
+public:
+    SegmentReader(std::shared_ptr<IoEngine> io_engine, std::shared_ptr<Segment> segment,
+                  int64_t data_offset, int64_t size)
+        : io_engine_(std::move(io_engine)), segment_(std::move(segment)),
+          data_offset_(data_offset), size_(size) {}
+
+    int64_t size() const override { return size_; }
+
+    ssize_t read(int64_t offset, uint8_t* buffer, size_t length) override {
+        if (offset >= size_) {
+            return 0;
+        }
+
+        int fd = descriptorFor(offset, buffer, length);
+        return io_engine_->read(fd, buffer, length, data_offset_ + offset);
+    }
+
+    void readAsync(int64_t offset, uint8_t* buffer, size_t length, IoEngine::Completion done) override {
+        if (offset >= size_) {
+            done(0);
+            return;
+        }
+
+        int fd = descriptorFor(offset, buffer, length);
+        io_engine_->submitRead(fd, buffer, length, data_offset_ + offset, std::move(done));
+    }
+
+private:
+    std::shared_ptr<IoEngine> io_engine_;
+    std::shared_ptr<Segment> segment_;
+    int64_t data_offset_;   // Block aligned, so chunk offsets align like file offsets
+    int64_t size_;
+
+    // Clips the read to the chunk and picks the descriptor
+    int descriptorFor(int64_t offset, const uint8_t* buffer, size_t& length) const {
+        length = static_cast<size_t>(std::min<int64_t>(length, size_ - offset));
+        return segment_->direct_fd >= 0 && IoEngine::trimForDirectIo(buffer, offset, length)
+                   ? segment_->direct_fd : segment_->fd;
+    }
+};
+
+SegmentChunkBackend::SegmentChunkBackend(const std::string& directory, std::shared_ptr<IoEngine> io_engine)
+    : directory_(directory),
+      segment_directory_(directory + "/segments"),
+      io_engine_(std::move(io_engine)),
+      next_sequence_(1),
+      next_segment_id_(1),
+      directory_dirty_(false) {
+
+    if (!Utils::fileExists(segment_directory_)) {
+        if (!Utils::createDirectory(segment_directory_)) {
+            Utils::logError("Failed to create segment directory: " + segment_directory_);
+        }
+    }
+
+    loadSegments();
+
+    Utils::logInfo("Segment store loaded " + std::to_string(index_.size()) + " chunks from " +
+                   std::to_string(segments_.size()) + " segments");
+}
+
+std::unique_ptr<ChunkBackend::Writer> SegmentChunkBackend::openWriter(const std::string& chunk_id,
+                                                                      int64_t size_hint) {
+    int64_t capacity = padToBlock(size_hint > 0 ? size_hint : static_cast<int64_t>(CHUNK_SIZE));
+    std::shared_ptr<Segment> segment;
+    int64_t offset = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!reserveExtent(SEGMENT_BLOCK_SIZE + capacity, segment, offset)) {
+            Utils::logError("Failed to reserve segment space for chunk: " + chunk_id);
+            return nullptr;
+        }
+    }
+
+    return std::make_unique<SegmentWriter>(this, chunk_id, segment, offset, capacity);
+}
+
+std::unique_ptr<ChunkBackend::Reader> SegmentChunkBackend::openReader(const std::string& chunk_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(chunk_id);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+
+    const RecordLocation& location = it->second;
+    return std::make_unique<SegmentReader>(io_engine_, location.segment,
+                                           location.offset + SEGMENT_BLOCK_SIZE,
+                                           location.info.size);
+}
+
+bool SegmentChunkBackend::removeChunk(const std::string& chunk_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (index_.find(chunk_id) == index_.end()) {
+        return false;
+    }
+
+    std::shared_ptr<Segment> segment;
+    int64_t offset = 0;
+    if (!reserveExtent(SEGMENT_BLOCK_SIZE, segment, offset)) {
+        Utils::logError("Failed to reserve segment space for tombstone: " + chunk_id);
+        return false;
+    }
+    segment->pending_writers--;
+
+    StoredChunkInfo info;
+    info.chunk_id = chunk_id;
+    info.created_time = Utils::getCurrentTimestamp();
+
+    uint64_t sequence = next_sequence_++;
+    if (!writeHeader(*segment, offset, RecordType::DELETE, sequence, SEGMENT_BLOCK_SIZE, info)) {
+        Utils::logError("Failed to write tombstone for chunk: " + chunk_id);
+        return false;
+    }
+
+    RecordLocation location;
+    location.segment = segment;
+    location.offset = offset;
+    location.span = SEGMENT_BLOCK_SIZE;
+    location.sequence = sequence;
+    location.info = std::move(info);
+    publishTombstone(chunk_id, std::move(location));
+    return true;
+}
+
+bool SegmentChunkBackend::getChunkInfo(const std::string& chunk_id, StoredChunkInfo& info) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(chunk_id);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    info = it->second.info;
+    return true;
+}
+
+int64_t SegmentChunkBackend::getChunkSize(const std::string& chunk_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(chunk_id);
+    return it != index_.end() ? it->second.info.size : -1;
+}
+
+std::vector<StoredChunkInfo> SegmentChunkBackend::listChunks() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<StoredChunkInfo> chunks;
+    chunks.reserve(index_.size());
+    for (const auto& pair : index_) {
+        chunks.push_back(pair.second.info);
+    }
+    return chunks;
+}
+
+void SegmentChunkBackend::compact() {
+    std::vector<std::shared_ptr<Segment>> victims;
+    std::unordered_map<Segment*, std::vector<std::pair<std::string, bool>>> records;
+    int64_t reclaimable = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (const auto& pair : segments_) {
+            const auto& segment = pair.second;
+            if (segment->sealed && segment->pending_writers == 0 &&
+                segment->live_bytes < COMPACTION_LIVE_RATIO * segment->write_offset) {
+                victims.push_back(segment);
+                records[segment.get()];
+                reclaimable += segment->write_offset - segment->live_bytes;
+            }
+        }
+
+        if (victims.empty()) {
+            return;
+        }
+
+        for (const auto& pair : index_) {
+            auto it = records.find(pair.second.segment.get());
+            if (it != records.end()) {
+                it->second.emplace_back(pair.first, false);
+            }
+        }
+        for (const auto& pair : tombstones_) {
+            auto it = records.find(pair.second.segment.get());
+            if (it != records.end()) {
+                it->second.emplace_back(pair.first, true);
+            }
+        }
+    }
+
+    int compacted = 0;
+    for (const auto& victim : victims) {
+        bool moved_all = true;
+        for (const auto& record : records[victim.get()]) {
+            if (!relocateRecord(record.first, victim, record.second)) {
+                moved_all = false;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (moved_all && victim->live_bytes == 0) {
+            retireSegment(victim);
+        }
+        if (victim->obsolete) {
+            compacted++;
+        }
+    }
+
+    // Deletes the victims once their records are durable in the new segments
+    sync();
+
+    Utils::logInfo("Segment compaction retired " + std::to_string(compacted) + " of " +
+                   std::to_string(victims.size()) + " segments (" +
+                   std::to_string(reclaimable) + " bytes reclaimable)");
+}
+
+bool SegmentChunkBackend::sync() {
+    std::vector<std::shared_ptr<Segment>> segments;
+    std::vector<std::string> retired_paths;
+    bool sync_directory;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        segments.swap(dirty_segments_);
+        for (const auto& segment : segments) {
+            segment->dirty = false;
+        }
+        retired_paths.swap(retired_paths_);
+        sync_directory = directory_dirty_;
+        directory_dirty_ = false;
+    }
+
+    bool ok = true;
+    for (const auto& segment : segments) {
+        if (::fdatasync(segment->fd) != 0) {
+            Utils::logError("Failed to sync segment " + segment->path + ": " + std::strerror(errno));
+            ok = false;
+        }
+    }
+    if (sync_directory && !Utils::syncPath(segment_directory_)) {
+        Utils::logError("Failed to sync segment directory: " + std::string(std::strerror(errno)));
+        ok = false;
+    }
+
+    if (!ok) {
+        // Retried by the next sync
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& segment : segments) {
+            if (!segment->dirty && !segment->obsolete) {
+                segment->dirty = true;
+                dirty_segments_.push_back(segment);
+            }
+        }
+        directory_dirty_ = directory_dirty_ || sync_directory;
+        retired_paths_.insert(retired_paths_.end(), retired_paths.begin(), retired_paths.end());
+        return false;
+    }
+
+    // Whatever replaced the retired segments' records is durable now
+    for (const auto& path : retired_paths) {
+        if (::unlink(path.c_str()) != 0) {
+            Utils::logError("Failed to delete segment file: " + path + " (" + std::strerror(errno) + ")");
+            continue;
+        }
+        Utils::logDebug("Deleted segment: " + path);
+    }
+    // A segment coming back after a crash could revive chunks deleted since
+    if (!retired_paths.empty() && !Utils::syncPath(segment_directory_)) {
+        Utils::logWarning("Failed to sync segment directory: " + std::string(std::strerror(errno)));
+    }
+    return true;
+}
+
+std::string SegmentChunkBackend::getSegmentPath(uint32_t segment_id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%08u.log", segment_id);
+    return segment_directory_ + "/" + name;
+}
+
+void SegmentChunkBackend::openDirect(Segment& segment) {
+    // Not every filesystem takes O_DIRECT; reads then use the page cache
+    if (io_engine_->directIo()) {
+        segment.direct_fd = ::open(segment.path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+}
+
+std::shared_ptr<SegmentChunkBackend::Segment> SegmentChunkBackend::createSegment() {
+    auto segment = std::make_shared<Segment>();
+    segment->id = next_segment_id_;
+    segment->path = getSegmentPath(segment->id);
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+    if (segment->fd < 0) {
+        Utils::logError("Failed to create segment file: " + segment->path + " (" + std::strerror(errno) + ")");
+        return nullptr;
+    }
+    next_segment_id_++;
+    openDirect(*segment);
+
+    // Preallocating keeps the segment contiguous on disk; not fatal if unsupported
+    int result = ::posix_fallocate(segment->fd, 0, SEGMENT_SIZE);
+    if (result != 0) {
+        Utils::logWarning("Could not preallocate segment " + segment->path + ": " + std::strerror(result));
+    }
+
+    segments_[segment->id] = segment;
+    directory_dirty_ = true;
+    Utils::logDebug("Created segment: " + segment->path);
+    return segment;
+}
+
+void SegmentChunkBackend::markDirty(Segment& segment) {
+    if (!segment.dirty) {
+        segment.dirty = true;
+        dirty_segments_.push_back(segment.shared_from_this());
+    }
+}
+
+bool SegmentChunkBackend::reserveExtent(int64_t span, std::shared_ptr<Segment>& segment, int64_t& offset) {
+    // Oversized records get a segment of their own rather than failing
+    if (!active_segment_ ||
+        (active_segment_->write_offset > 0 && active_segment_->write_offset + span > SEGMENT_SIZE)) {
+        if (active_segment_) {
+            active_segment_->sealed = true;
+        }
+        active_segment_ = createSegment();
+        if (!active_segment_) {
+            return false;
+        }
+    }
+
+    segment = active_segment_;
+    offset = segment->write_offset;
+
+    // Mark the extent right away so a crash mid-write leaves a record that
+    // startup can skip instead of a hole that ends the scan
+    if (!writeHeader(*segment, offset, RecordType::RESERVED, 0, span, StoredChunkInfo{})) {
+        return false;
+    }
+
+    segment->write_offset += span;
+    segment->pending_writers++;
+    return true;
+}
+
+bool SegmentChunkBackend::writeHeader(Segment& segment, int64_t offset, RecordType type,
+                                      uint64_t sequence, int64_t span, const StoredChunkInfo& info) {
+    size_t used = sizeof(RecordHeader) + info.chunk_id.size() + info.checksum.size();
+    if (used > static_cast<size_t>(SEGMENT_BLOCK_SIZE)) {
+        Utils::logError("Chunk id too long for segment record: " + info.chunk_id);
+        return false;
+    }
+    
+    // Chunks too big for their block checksums to fit (over ~60MB) go without
+    size_t block_checksum_bytes = info.block_checksums.size() * sizeof(uint32_t);
+    if (used + block_checksum_bytes > static_cast<size_t>(SEGMENT_BLOCK_SIZE)) {
+        Utils::logWarning("Dropping block checksums of oversized chunk: " + info.chunk_id);
+        block_checksum_bytes = 0;
+    }
+    size_t checksums_offset = used;
+    used += block_checksum_bytes;
+
+    RecordHeader header{};
+    header.magic = RECORD_MAGIC;
+    header.type = static_cast<uint16_t>(type);
+    header.flags = (info.is_encrypted ? 1 : 0) | (info.is_erasure_coded ? 2 : 0);
+    header.sequence = sequence;
+    header.span = span;
+    header.data_size = info.size;
+    header.created_time = info.created_time;
+    header.id_length = static_cast<uint32_t>(info.chunk_id.size());
+    header.checksum_length = static_cast<uint32_t>(info.checksum.size());
+    header.block_checksum_count = static_cast<uint32_t>(block_checksum_bytes / sizeof(uint32_t));
+
+    std::vector<uint8_t> block(SEGMENT_BLOCK_SIZE, 0);
+    std::memcpy(block.data(), &header, sizeof(header));
+    std::memcpy(block.data() + sizeof(header), info.chunk_id.data(), info.chunk_id.size());
+    std::memcpy(block.data() + sizeof(header) + info.chunk_id.size(),
+                info.checksum.data(), info.checksum.size());
+    if (block_checksum_bytes > 0) {
+        std::memcpy(block.data() + checksums_offset, info.block_checksums.data(), block_checksum_bytes);
+    }
+
+    uint32_t crc = Utils::crc32c(block.data(), used);
+    std::memcpy(block.data() + offsetof(RecordHeader, header_crc), &crc, sizeof(crc));
+
+    if (!pwriteAll(segment.fd, block.data(), block.size(), offset)) {
+        Utils::logError("Failed to write record header to " + segment.path + ": " + std::strerror(errno));
+        return false;
+    }
+    markDirty(segment);
+    return true;
+}
+
+void SegmentChunkBackend::publishRecord(const std::string& chunk_id, RecordLocation location) {
+    location.segment->live_bytes += location.span;
+
+    auto tombstone = tombstones_.find(chunk_id);
+    if (tombstone != tombstones_.end()) {
+        location.oldest_shadowed = std::min(location.oldest_shadowed, tombstone->second.oldest_shadowed);
+        releaseRecord(tombstone->second);
+        tombstones_.erase(tombstone);
+    }
+
+    auto it = index_.find(chunk_id);
+    if (it != index_.end()) {
+        location.oldest_shadowed = std::min({location.oldest_shadowed, it->second.oldest_shadowed,
+                                             it->second.segment->id});
+        releaseRecord(it->second);
+        it->second = std::move(location);
+    } else {
+        index_.emplace(chunk_id, std::move(location));
+    }
+}
+
+void SegmentChunkBackend::publishTombstone(const std::string& chunk_id, RecordLocation location) {
+    location.segment->live_bytes += location.span;
+
+    auto it = index_.find(chunk_id);
+    if (it != index_.end()) {
+        location.oldest_shadowed = std::min({location.oldest_shadowed, it->second.oldest_shadowed,
+                                             it->second.segment->id});
+        releaseRecord(it->second);
+        index_.erase(it);
+    }
+
+    auto tombstone = tombstones_.find(chunk_id);
+    if (tombstone != tombstones_.end()) {
+        location.oldest_shadowed = std::min(location.oldest_shadowed, tombstone->second.oldest_shadowed);
+        releaseRecord(tombstone->second);
+        tombstone->second = std::move(location);
+    } else {
+        tombstones_.emplace(chunk_id, std::move(location));
+    }
+}
+
+void SegmentChunkBackend::releaseRecord(RecordLocation& location) {
+    Segment& segment = *location.segment;
+    segment.live_bytes -= location.span;
+
+    // A sealed segment with nothing live left can go without compaction
+    if (segment.sealed && segment.live_bytes == 0 && segment.pending_writers == 0) {
+        retireSegment(location.segment);
+    }
+}
+
+bool SegmentChunkBackend::tombstoneNeeded(const RecordLocation& tombstone) const {
+    // Superseded PUTs only ever live in segments no newer than their
+    // tombstone, so it can go once none of those segments remain
+    if (tombstone.oldest_shadowed == NO_SEGMENT) {
+        return false;
+    }
+
+    auto it = segments_.lower_bound(tombstone.oldest_shadowed);
+    return it != segments_.end() && it->first < tombstone.segment->id;
+}
+
+void SegmentChunkBackend::retireSegment(const std::shared_ptr<Segment>& segment) {
+    if (segment->obsolete) {
+        return;
+    }
+
+    segment->obsolete = true;
+    segments_.erase(segment->id);
+
+    // Until the records that replaced its contents are synced, a crash
+    // would need the segment again
+    retired_paths_.push_back(segment->path);
+    Utils::logDebug("Retired segment: " + segment->path);
+}
+
+void SegmentChunkBackend::loadSegments() {
+    std::vector<uint32_t> segment_ids;
+
+    try {
+        for (const auto& entry : std::filesystem::directory_iterator(segment_directory_)) {
+            unsigned int segment_id = 0;
+            char suffix = 0;
+            std::string filename = entry.path().filename().string();
+            if (entry.is_regular_file() &&
+                std::sscanf(filename.c_str(), "segment-%u.lo%c", &segment_id, &suffix) == 2 &&
+                suffix == 'g') {
+                segment_ids.push_back(segment_id);
+            }
+        }
+    } catch (const std::exception& e) {
+        Utils::logError("Error listing segment files: " + std::string(e.what()));
+    }
+
+    std::sort(segment_ids.begin(), segment_ids.end());
+
+    uint64_t max_sequence = 0;
+    for (uint32_t segment_id : segment_ids) {
+        auto segment = std::make_shared<Segment>();
+        segment->id = segment_id;
+        segment->path = getSegmentPath(segment_id);
+        segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CLOEXEC);
+
+        if (segment->fd < 0) {
+            Utils::logError("Failed to open segment file: " + segment->path + " (" + std::strerror(errno) + ")");
+            continue;
+        }
+        openDirect(*segment);
+
+        segments_[segment_id] = segment;
+        next_segment_id_ = segment_id + 1;
+        scanSegment(segment, max_sequence);
+    }
+    next_sequence_ = max_sequence + 1;
+
+    // Keep appending to the newest segment if it has room
+    for (auto& pair : segments_) {
+        pair.second->sealed = true;
+    }
+    if (!segments_.empty()) {
+        auto& newest = segments_.rbegin()->second;
+        if (newest->write_offset < SEGMENT_SIZE) {
+            newest->sealed = false;
+            active_segment_ = newest;
+        }
+    }
+}
+
+bool SegmentChunkBackend::scanSegment(const std::shared_ptr<Segment>& segment, uint64_t& max_sequence) {
+    struct stat st;
+    if (::fstat(segment->fd, &st) != 0) {
+        Utils::logError("Failed to stat segment file: " + segment->path);
+        return false;
+    }
+
+    std::vector<uint8_t> block(SEGMENT_BLOCK_SIZE);
+    int64_t offset = 0;
+
+    // Records are contiguous; the first block without a valid header is the end of the log
+    while (offset + SEGMENT_BLOCK_SIZE <= st.st_size) {
+        if (!preadAll(segment->fd, block.data(), block.size(), offset)) {
+            break;
+        }
+
+        RecordHeader header;
+        std::memcpy(&header, block.data(), sizeof(header));
+        if (header.magic != RECORD_MAGIC) {
+            break;
+        }
+
+        size_t used = sizeof(header) + static_cast<size_t>(header.id_length) + header.checksum_length;
+        size_t checksums_offset = used;
+        used += static_cast<size_t>(header.block_checksum_count) * sizeof(uint32_t);
+        if (used > block.size()) {
+            Utils::logWarning("Corrupt record header in " + segment->path + " at " + std::to_string(offset));
+            break;
+        }
+
+        uint32_t zero = 0;
+        std::memcpy(block.data() + offsetof(RecordHeader, header_crc), &zero, sizeof(zero));
+        // The padding after the last record of an oversized segment is never written
+        if (Utils::crc32c(block.data(), used) != header.header_crc ||
+            header.span < SEGMENT_BLOCK_SIZE || header.span % SEGMENT_BLOCK_SIZE != 0 ||
+            header.data_size > header.span - SEGMENT_BLOCK_SIZE ||
+            offset + SEGMENT_BLOCK_SIZE + header.data_size > st.st_size) {
+            Utils::logWarning("Corrupt record header in " + segment->path + " at " + std::to_string(offset));
+            break;
+        }
+
+        RecordType type = static_cast<RecordType>(header.type);
+        if (type == RecordType::PUT || type == RecordType::DELETE) {
+            const char* text = reinterpret_cast<const char*>(block.data()) + sizeof(header);
+
+            RecordLocation location;
+            location.segment = segment;
+            location.offset = offset;
+            location.span = header.span;
+            location.sequence = header.sequence;
+            location.info.chunk_id.assign(text, header.id_length);
+            location.info.checksum.assign(text + header.id_length, header.checksum_length);
+            location.info.block_checksums.resize(header.block_checksum_count);
+            if (header.block_checksum_count > 0) {
+                std::memcpy(location.info.block_checksums.data(), block.data() + checksums_offset,
+                            header.block_checksum_count * sizeof(uint32_t));
+            }
+            location.info.size = header.data_size;
+            location.info.is_encrypted = (header.flags & 1) != 0;
+            location.info.is_erasure_coded = (header.flags & 2) != 0;
+            location.info.created_time = header.created_time;
+
+            max_sequence = std::max(max_sequence, header.sequence);
+            std::string chunk_id = location.info.chunk_id;
+            applyScannedRecord(chunk_id, std::move(location), type == RecordType::DELETE);
+        }
+
+        offset += header.span;
+    }
+
+    segment->write_offset = offset;
+    return true;
+}
+
+void SegmentChunkBackend::applyScannedRecord(const std::string& chunk_id, RecordLocation location,
+                                             bool tombstone) {
+    RecordLocation* current = nullptr;
+    auto it = index_.find(chunk_id);
+    if (it != index_.end()) {
+        current = &it->second;
+    } else {
+        auto tombstone_it = tombstones_.find(chunk_id);
+        if (tombstone_it != tombstones_.end()) {
+            current = &tombstone_it->second;
+        }
+    }
+
+    // Older than what we have: dead, but the winner must remember it exists.
+    // Equal sequences are copies left by interrupted compaction; the later one wins.
+    if (current && current->sequence > location.sequence) {
+        current->oldest_shadowed = std::min(current->oldest_shadowed, location.segment->id);
+        return;
+    }
+
+    if (tombstone) {
+        publishTombstone(chunk_id, std::move(location));
+    } else {
+        publishRecord(chunk_id, std::move(location));
+    }
+}
+
+bool SegmentChunkBackend::relocateRecord(const std::string& chunk_id,
+                                         const std::shared_ptr<Segment>& victim, bool tombstone) {
+    auto& records = tombstone ? tombstones_ : index_;
+    RecordLocation source;
+    std::shared_ptr<Segment> target;
+    int64_t offset = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = records.find(chunk_id);
+        if (it == records.end() || it->second.segment != victim) {
+            return true; // Superseded or deleted meanwhile
+        }
+
+        if (tombstone && !tombstoneNeeded(it->second)) {
+            releaseRecord(it->second);
+            records.erase(it);
+            return true;
+        }
+
+        source = it->second;
+        if (!reserveExtent(source.span, target, offset)) {
+            return false;
+        }
+    }
+
+    // Copy the data first and the header last; until then the new extent
+    // is a RESERVED record that startup skips
+    std::vector<uint8_t> header(SEGMENT_BLOCK_SIZE);
+    bool copied = copyRange(victim->fd, source.offset + SEGMENT_BLOCK_SIZE,
+                            target->fd, offset + SEGMENT_BLOCK_SIZE, source.info.size) &&
+                  preadAll(victim->fd, header.data(), header.size(), source.offset);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    target->pending_writers--;
+
+    if (!copied) {
+        Utils::logError("Failed to relocate chunk record: " + chunk_id);
+        return false;
+    }
+
+    auto it = records.find(chunk_id);
+    if (it == records.end() || it->second.segment != victim || it->second.offset != source.offset) {
+        return true; // Changed while copying; the copy stays a RESERVED record
+    }
+
+    if (!pwriteAll(target->fd, header.data(), header.size(), offset)) {
+        Utils::logError("Failed to relocate chunk record: " + chunk_id);
+        return false;
+    }
+    markDirty(*target);
+
+    // If the victim outlives this pass, the stale copy in it must stay shadowed
+    RecordLocation& location = it->second;
+    releaseRecord(location);
+    location.segment = target;
+    location.offset = offset;
+    if (!tombstone) {
+        location.oldest_shadowed = std::min(location.oldest_shadowed, victim->id);
+    }
+    target->live_bytes += location.span;
+    return true;
+}
+
+} // namespace dfs
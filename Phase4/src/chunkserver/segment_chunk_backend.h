@@ -0,0 +1,130 @@
+#pragma once
+
+#include "chunk_backend.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <limits>
+
+namespace dfs {
+
+// Log-structured layout: chunks are appended to large preallocated segment
+// files under <dir>/segments and located through an in-memory index that is
+// rebuilt by scanning the segment headers on startup.
+//
+// Every record starts on a SEGMENT_BLOCK_SIZE boundary with one header block
+// (RecordHeader followed by the chunk id, checksum and block checksums, if
+// they fit), then the chunk data
+// padded to the next block boundary. Overwrites and deletes append a new
+// record with a higher sequence number; the latest record for a chunk wins.
+class SegmentChunkBackend : public ChunkBackend {
+public:
+    static constexpr int64_t SEGMENT_SIZE = 256LL * 1024 * 1024; // 256MB segment files
+    static constexpr int64_t SEGMENT_BLOCK_SIZE = 4096;
+    static constexpr double COMPACTION_LIVE_RATIO = 0.5; // Compact sealed segments below this
+
+    SegmentChunkBackend(const std::string& directory, std::shared_ptr<IoEngine> io_engine);
+
+    std::unique_ptr<Writer> openWriter(const std::string& chunk_id, int64_t size_hint) override;
+    std::unique_ptr<Reader> openReader(const std::string& chunk_id) override;
+    bool removeChunk(const std::string& chunk_id) override;
+
+    bool getChunkInfo(const std::string& chunk_id, StoredChunkInfo& info) override;
+    int64_t getChunkSize(const std::string& chunk_id) override;
+    std::vector<StoredChunkInfo> listChunks() override;
+
+    // Copies live records out of sparsely used sealed segments, then deletes them
+    void compact() override;
+
+    // Syncs the segments written since the last sync, then deletes the
+    // segments retired meanwhile
+    bool sync() override;
+
+    StorageBackendType getType() const override { return StorageBackendType::LOG_STRUCTURED; }
+
+private:
+    enum class RecordType : uint16_t {
+        RESERVED = 0,   // Space handed to a writer that hasn't committed (yet)
+        PUT = 1,
+        DELETE = 2
+    };
+
+    struct RecordHeader;
+
+    static constexpr uint32_t NO_SEGMENT = std::numeric_limits<uint32_t>::max();
+
+    // One segment file. It is unlinked by the first sync after it becomes
+    // obsolete; open readers keep the descriptor (and so the data) alive
+    // until they finish.
+    struct Segment : std::enable_shared_from_this<Segment> {
+        uint32_t id = 0;
+        std::string path;
+        int fd = -1;
+        int direct_fd = -1;        // O_DIRECT descriptor for data reads, if enabled
+        int64_t write_offset = 0;  // End of the last allocated record
+        int64_t live_bytes = 0;    // Bytes held by records the index still points to
+        int pending_writers = 0;   // Reserved extents not yet committed or aborted
+        bool sealed = false;
+        bool obsolete = false;
+        bool dirty = false;        // Written since the last sync
+
+        ~Segment();
+    };
+
+    struct RecordLocation {
+        std::shared_ptr<Segment> segment;
+        int64_t offset = 0;    // Start of the header block
+        int64_t span = 0;      // Header block plus padded data
+        uint64_t sequence = 0;
+        uint32_t oldest_shadowed = NO_SEGMENT; // Oldest segment that may hold superseded records
+        StoredChunkInfo info;
+    };
+
+    class SegmentWriter;
+    class SegmentReader;
+
+    std::string directory_;
+    std::string segment_directory_;
+    std::shared_ptr<IoEngine> io_engine_;
+
+    mutable std::mutex mutex_;
+    std::map<uint32_t, std::shared_ptr<Segment>> segments_;
+    std::shared_ptr<Segment> active_segment_;
+    std::unordered_map<std::string, RecordLocation> index_;
+    std::unordered_map<std::string, RecordLocation> tombstones_;
+    uint64_t next_sequence_;
+    uint32_t next_segment_id_;
+
+    // Waiting for the next sync
+    std::vector<std::shared_ptr<Segment>> dirty_segments_;
+    std::vector<std::string> retired_paths_;   // Deleted once the records replacing them are durable
+    bool directory_dirty_;                      // Segment files were created
+
+    // Helper methods (callers hold mutex_ unless noted)
+    std::string getSegmentPath(uint32_t segment_id) const;
+    void openDirect(Segment& segment);
+    std::shared_ptr<Segment> createSegment();
+    void markDirty(Segment& segment);
+    bool reserveExtent(int64_t span, std::shared_ptr<Segment>& segment, int64_t& offset);
+    bool writeHeader(Segment& segment, int64_t offset, RecordType type, uint64_t sequence,
+                     int64_t span, const StoredChunkInfo& info);
+    void publishRecord(const std::string& chunk_id, RecordLocation location);
+    void publishTombstone(const std::string& chunk_id, RecordLocation location);
+    void releaseRecord(RecordLocation& location);
+    bool tombstoneNeeded(const RecordLocation& tombstone) const;
+    void retireSegment(const std::shared_ptr<Segment>& segment);
+
+    // Startup only, no locking needed
+    void loadSegments();
+    bool scanSegment(const std::shared_ptr<Segment>& segment, uint64_t& max_sequence);
+    void applyScannedRecord(const std::string& chunk_id, RecordLocation location, bool tombstone);
+
+    // Compaction step, takes mutex_ itself
+    bool relocateRecord(const std::string& chunk_id, const std::shared_ptr<Segment>& victim,
+                        bool tombstone);
+};
+
+} // namespace dfs
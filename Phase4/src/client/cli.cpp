@@ -3,6 +3,7 @@
 #include <sstream>
 #include <algorithm>
 #include <iomanip>
+#include <fstream>
 
 namespace dfs {
 
@@ -12,6 +13,7 @@ CLI::CLI(std::unique_ptr<DFSClient> client)
     // Register command handlers
     commands_["put"] = &CLI::handlePut;
     commands_["get"] = &CLI::handleGet;
+    commands_["read"] = &CLI::handleRead;
     commands_["delete"] = &CLI::handleDelete;
     commands_["rm"] = &CLI::handleDelete;
     commands_["list"] = &CLI::handleList;
@@ -74,6 +76,10 @@ void CLI::handlePut(const std::vector<std::string>& args) {
         std::cout << "Options:" << std::endl;
         std::cout << "  --no-encryption   Disable encryption" << std::endl;
         std::cout << "  --erasure-coding  Enable erasure coding" << std::endl;
+        std::cout << "  --ec-profile K+M  Erasure code with K data and M parity blocks (e.g. 6+3)" << std::endl;
+        std::cout << "  --ec-profile K+L+G  Locally repairable code: L local groups, G global parities (e.g. 12+2+2)" << std::endl;
+        std::cout << "  --parallelism N   Chunks uploaded concurrently (default "
+                  << Uploader::DEFAULT_CHUNKS_IN_FLIGHT << ")" << std::endl;
         return;
     }
     
@@ -95,9 +101,28 @@ void CLI::handlePut(const std::vector<std::string>& args) {
     bool enable_encryption = options.find("no-encryption") == options.end();
     bool enable_erasure_coding = options.find("erasure-coding") != options.end();
     
+    // A profile implies erasure coding
+    ErasureCodingProfile erasure_profile;
+    auto profile_option = options.find("ec-profile");
+    if (profile_option != options.end()) {
+        if (!ErasureCodingProfile::parse(profile_option->second, erasure_profile)) {
+            std::cout << "Error: Invalid erasure coding profile '" << profile_option->second
+                      << "' (expected K+M or K+L+G, e.g. 6+3 or 12+2+2)" << std::endl;
+            return;
+        }
+        enable_erasure_coding = true;
+    }
+    
+    size_t parallelism = Uploader::DEFAULT_CHUNKS_IN_FLIGHT;
+    if (!parseParallelism(options, parallelism)) {
+        return;
+    }
+    client_->setErasureCodingProfile(erasure_profile);
+    client_->setUploadParallelism(parallelism);
+    
     std::cout << "Uploading " << local_file << " to " << remote_file << std::endl;
     if (!enable_encryption) std::cout << "  Encryption: Disabled" << std::endl;
-    if (enable_erasure_coding) std::cout << "  Erasure Coding: Enabled" << std::endl;
+    if (enable_erasure_coding) std::cout << "  Erasure Coding: " << erasure_profile.toString() << std::endl;
     
     bool success = client_->put(local_file, remote_file, enable_encryption, enable_erasure_coding);
     
@@ -107,13 +132,25 @@ void CLI::handlePut(const std::vector<std::string>& args) {
 }
 
 void CLI::handleGet(const std::vector<std::string>& args) {
-    if (args.size() != 2) {
-        std::cout << "Usage: get <remote_file> <local_file>" << std::endl;
+    std::map<std::string, std::string> options;
+    std::vector<std::string> remaining_args;
+    
+    if (!parseOptions(args, options, remaining_args) || remaining_args.size() != 2) {
+        std::cout << "Usage: get <remote_file> <local_file> [options]" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  --parallelism N   Chunks downloaded concurrently (default "
+                  << Downloader::DEFAULT_CHUNKS_IN_FLIGHT << ")" << std::endl;
         return;
     }
     
-    std::string remote_file = args[0];
-    std::string local_file = args[1];
+    size_t parallelism = Downloader::DEFAULT_CHUNKS_IN_FLIGHT;
+    if (!parseParallelism(options, parallelism)) {
+        return;
+    }
+    client_->setDownloadParallelism(parallelism);
+    
+    std::string remote_file = remaining_args[0];
+    std::string local_file = remaining_args[1];
     
     std::cout << "Downloading " << remote_file << " to " << local_file << std::endl;
     
@@ -124,6 +161,61 @@ void CLI::handleGet(const std::vector<std::string>& args) {
     }
 }
 
+void CLI::handleRead(const std::vector<std::string>& args) {
+    if (args.size() != 3 && args.size() != 4) {
+        std::cout << "Usage: read <remote_file> <offset> <length> [local_file]" << std::endl;
+        return;
+    }
+    
+    // Parsed as signed so that "-1" is rejected rather than wrapped around
+    int64_t offset;
+    int64_t length;
+    try {
+        size_t offset_end = 0;
+        size_t length_end = 0;
+        offset = std::stoll(args[1], &offset_end);
+        length = std::stoll(args[2], &length_end);
+        if (offset_end != args[1].size() || length_end != args[2].size()) {
+            throw std::invalid_argument("trailing characters");
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Invalid offset or length" << std::endl;
+        return;
+    }
+    
+    if (offset < 0) {
+        std::cout << "Error: Offset must not be negative" << std::endl;
+        return;
+    }
+    // The whole range is buffered before it is written out
+    if (length <= 0 || length > static_cast<int64_t>(MAX_READ_LENGTH)) {
+        std::cout << "Error: Length must be between 1 and " << MAX_READ_LENGTH
+                  << " bytes; use get for whole files" << std::endl;
+        return;
+    }
+    
+    std::vector<uint8_t> data(static_cast<size_t>(length));
+    int64_t count = client_->pread(args[0], data.data(), data.size(), offset);
+    if (count < 0) {
+        std::cout << "Read failed!" << std::endl;
+        return;
+    }
+    data.resize(count);
+    
+    if (args.size() == 4) {
+        std::ofstream file(args[3], std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file) {
+            std::cout << "Failed to write " << args[3] << std::endl;
+            return;
+        }
+        std::cout << "Read " << count << " bytes into " << args[3] << std::endl;
+    } else {
+        std::cout.write(reinterpret_cast<const char*>(data.data()), data.size());
+        std::cout << std::endl;
+    }
+}
+
 void CLI::handleDelete(const std::vector<std::string>& args) {
     if (args.size() != 1) {
         std::cout << "Usage: delete <remote_file>" << std::endl;
@@ -271,10 +363,18 @@ void CLI::printHelp() {
               << "Disable encryption for upload" << std::endl;
     std::cout << std::left << std::setw(25) << "  --erasure-coding" 
               << "Enable erasure coding for upload" << std::endl;
+    std::cout << std::left << std::setw(25) << "  --ec-profile <profile>" 
+              << "Erasure coding profile, k+m or k+l+g (default 4+2)" << std::endl;
+    std::cout << std::left << std::setw(25) << "  --parallelism <n>" 
+              << "Chunks uploaded concurrently" << std::endl;
     std::cout << std::endl;
     
     std::cout << std::left << std::setw(25) << "get <remote> <local>" 
               << "Download a file from the DFS" << std::endl;
+    std::cout << std::left << std::setw(25) << "  --parallelism <n>" 
+              << "Chunks downloaded concurrently" << std::endl;
+    std::cout << std::left << std::setw(25) << "read <remote> <off> <n>" 
+              << "Read part of a file (to stdout or [local])" << std::endl;
     std::cout << std::endl;
     
     std::cout << std::left << std::setw(25) << "delete <remote>" 
@@ -315,7 +415,10 @@ void CLI::printHelp() {
     std::cout << "─────────" << std::endl;
     std::cout << "  put document.pdf /docs/document.pdf" << std::endl;
     std::cout << "  get /docs/document.pdf downloaded.pdf" << std::endl;
+    std::cout << "  read /data/table.parquet 1048000 576 footer.bin" << std::endl;
     std::cout << "  put large_file.zip /backup/large_file.zip --erasure-coding" << std::endl;
+    std::cout << "  put archive.tar /cold/archive.tar --ec-profile 10+4" << std::endl;
+    std::cout << "  put dataset.bin /cold/dataset.bin --ec-profile 12+2+2" << std::endl;
     std::cout << "  list /docs/" << std::endl;
     std::cout << "  info /docs/document.pdf" << std::endl;
     std::cout << "  delete /docs/old_document.pdf" << std::endl;
@@ -363,4 +466,24 @@ bool CLI::parseOptions(const std::vector<std::string>& args,
     }
     
     return true;
+}
+
+bool CLI::parseParallelism(const std::map<std::string, std::string>& options, size_t& chunks_in_flight) {
+    auto option = options.find("parallelism");
+    if (option == options.end()) {
+        return true;
+    }
+    
+    try {
+        size_t end = 0;
+        long long value = std::stoll(option->second, &end);
+        if (end == option->second.size() && value >= 1 && value <= static_cast<long long>(MAX_PARALLELISM)) {
+            chunks_in_flight = static_cast<size_t>(value);
+            return true;
+        }
+    } catch (const std::exception& e) {
+    }
+    std::cout << "Error: Invalid parallelism '" << option->second << "' (expected 1 to "
+              << MAX_PARALLELISM << ")" << std::endl;
+    return false;
 }
\ No newline at end of file
@@ -17,6 +17,7 @@ public:
     // Command handlers
     void handlePut(const std::vector<std::string>& args);
     void handleGet(const std::vector<std::string>& args);
+    void handleRead(const std::vector<std::string>& args);
     void handleDelete(const std::vector<std::string>& args);
     void handleList(const std::vector<std::string>& args);
     void handleInfo(const std::vector<std::string>& args);
@@ -33,6 +34,12 @@ private:
     using CommandHandler = void (CLI::*)(const std::vector<std::string>&);
     std::map<std::string, CommandHandler> commands_;
     
+    // Largest range a single read command will fetch
+    static constexpr size_t MAX_READ_LENGTH = 64 * 1024 * 1024;
+    
+    // Each chunk in flight holds about a chunk in memory
+    static constexpr size_t MAX_PARALLELISM = 64;
+    
     // Helper methods
     std::vector<std::string> parseCommand(const std::string& input);
     void printPrompt();
@@ -41,6 +48,9 @@ private:
     bool parseOptions(const std::vector<std::string>& args, 
                      std::map<std::string, std::string>& options,
                      std::vector<std::string>& remaining_args);
+    
+    // Value of --parallelism if given; false (after printing why) if it is invalid
+    bool parseParallelism(const std::map<std::string, std::string>& options, size_t& chunks_in_flight);
 };
 
 } // namespace dfs
@@ -75,6 +85,8 @@ int main(int argc, char** argv) {
             cli.handlePut(args);
         } else if (command == "get") {
             cli.handleGet(args);
+        } else if (command == "read") {
+            cli.handleRead(args);
         } else if (command == "delete" || command == "rm") {
             cli.handleDelete(args);
         } else if (command == "list" || command == "ls") {
@@ -1,91 +1,123 @@
 #include "client.h"
-#include "erasure_coding.h"
+#include "channel_pool.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
 #include <chrono>
 #include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <limits>
 
 namespace dfs {
 
 // CacheManager implementation
-CacheManager::CacheManager(size_t max_cache_size_mb) 
+namespace {
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+CacheManager::CacheManager(size_t max_cache_size_mb, size_t shard_count) 
     : max_size_(max_cache_size_mb * 1024 * 1024),
+      shards_(roundUpToPowerOfTwo(shard_count)),
+      shard_mask_(shards_.size() - 1),
       total_size_(0),
+      entry_count_(0),
+      next_victim_shard_(0),
       cache_hits_(0),
       cache_misses_(0) {
-    Utils::logInfo("CacheManager initialized with " + std::to_string(max_cache_size_mb) + "MB capacity");
+    Utils::logInfo("CacheManager initialized with " + std::to_string(max_cache_size_mb) + "MB capacity in " +
+                   std::to_string(shards_.size()) + " shards");
 }
 
 CacheManager::~CacheManager() {
     clear();
 }
 
-bool CacheManager::put(const std::string& chunk_id, const std::vector<uint8_t>& data) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    
-    // Check if already exists
-    auto it = cache_.find(chunk_id);
-    if (it != cache_.end()) {
-        // Update existing entry
-        total_size_ -= it->second.size;
-        it->second.data = data;
-        it->second.size = data.size();
-        it->second.last_accessed = Utils::getCurrentTimestamp();
-        total_size_ += data.size();
-        return true;
+bool CacheManager::put(const std::string& chunk_id, BufferPtr data) {
+    if (!data || data->size() > max_size_) {
+        return false;
     }
     
-    // Evict if necessary
-    while (total_size_ + data.size() > max_size_ && !cache_.empty()) {
-        evictLRU();
+    size_t size = data->size();
+    Shard& shard = shardFor(chunk_id);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        
+        // Replace an existing entry
+        auto it = shard.index.find(chunk_id);
+        if (it != shard.index.end()) {
+            erase(shard, it->second);
+        }
+        
+        shard.lru.push_front(CacheEntry{chunk_id, std::move(data)});
+        shard.index[chunk_id] = shard.lru.begin();
+        total_size_ += size;
+        entry_count_++;
+        
+        // Evict if necessary, keeping the new entry
+        while (total_size_.load() > max_size_ && shard.lru.size() > 1) {
+            evictLRU(shard);
+        }
     }
     
-    // Add new entry
-    CacheEntry entry;
-    entry.data = data;
-    entry.size = data.size();
-    entry.last_accessed = Utils::getCurrentTimestamp();
-    
-    cache_[chunk_id] = entry;
-    total_size_ += data.size();
+    if (total_size_.load() > max_size_) {
+        evictFromOtherShards(shard);
+    }
     
     return true;
 }
 
-std::vector<uint8_t> CacheManager::get(const std::string& chunk_id) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
+CacheManager::BufferPtr CacheManager::get(const std::string& chunk_id) {
+    Shard& shard = shardFor(chunk_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
     
-    auto it = cache_.find(chunk_id);
-    if (it != cache_.end()) {
+    auto it = shard.index.find(chunk_id);
+    if (it != shard.index.end()) {
         cache_hits_++;
-        it->second.last_accessed = Utils::getCurrentTimestamp();
-        return it->second.data;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->data;
     }
     
     cache_misses_++;
-    return {};
+    return nullptr;
 }
 
 bool CacheManager::contains(const std::string& chunk_id) const {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    return cache_.find(chunk_id) != cache_.end();
+    const Shard& shard = shardFor(chunk_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.index.find(chunk_id) != shard.index.end();
 }
 
 void CacheManager::remove(const std::string& chunk_id) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
+    Shard& shard = shardFor(chunk_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
     
-    auto it = cache_.find(chunk_id);
-    if (it != cache_.end()) {
-        total_size_ -= it->second.size;
-        cache_.erase(it);
+    auto it = shard.index.find(chunk_id);
+    if (it != shard.index.end()) {
+        erase(shard, it->second);
     }
 }
 
 void CacheManager::clear() {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_.clear();
-    total_size_ = 0;
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        while (!shard.lru.empty()) {
+            erase(shard, shard.lru.begin());
+        }
+    }
 }
 
 double CacheManager::getHitRate() const {
@@ -93,24 +125,53 @@ double CacheManager::getHitRate() const {
     return (total_accesses > 0) ? (static_cast<double>(cache_hits_) / total_accesses) : 0.0;
 }
 
-void CacheManager::evictLRU() {
-    if (cache_.empty()) return;
-    
-    auto oldest = cache_.begin();
-    for (auto it = cache_.begin(); it != cache_.end(); ++it) {
-        if (it->second.last_accessed < oldest->second.last_accessed) {
-            oldest = it;
+CacheManager::Shard& CacheManager::shardFor(const std::string& chunk_id) {
+    return shards_[std::hash<std::string>{}(chunk_id) & shard_mask_];
+}
+
+const CacheManager::Shard& CacheManager::shardFor(const std::string& chunk_id) const {
+    return shards_[std::hash<std::string>{}(chunk_id) & shard_mask_];
+}
+
+void CacheManager::evictFromOtherShards(const Shard& skip) {
+    // Victims rotate over the shards so that no single one is drained
+    // first; one full pass without evicting anything means the rest is
+    // held by entries just put in other shards
+    size_t idle_shards = 0;
+    while (total_size_.load() > max_size_ && idle_shards < shards_.size()) {
+        Shard& shard = shards_[next_victim_shard_++ & shard_mask_];
+        if (&shard == &skip) {
+            idle_shards++;
+            continue;
         }
+        
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.lru.empty()) {
+            idle_shards++;
+            continue;
+        }
+        evictLRU(shard);
+        idle_shards = 0;
     }
-    
-    total_size_ -= oldest->second.size;
-    cache_.erase(oldest);
+}
+
+void CacheManager::evictLRU(Shard& shard) {
+    if (shard.lru.empty()) return;
+    erase(shard, std::prev(shard.lru.end()));
+}
+
+void CacheManager::erase(Shard& shard, EntryList::iterator entry) {
+    total_size_ -= entry->data->size();
+    entry_count_--;
+    shard.index.erase(entry->chunk_id);
+    shard.lru.erase(entry);
 }
 
 // Uploader implementation
 Uploader::Uploader(std::shared_ptr<FileService::Stub> file_service,
                    std::shared_ptr<CacheManager> cache_manager)
-    : file_service_(file_service), cache_manager_(cache_manager) {
+    : file_service_(file_service), cache_manager_(cache_manager),
+      max_chunks_in_flight_(DEFAULT_CHUNKS_IN_FLIGHT) {
 }
 
 bool Uploader::uploadFile(const std::string& local_path, 
@@ -120,14 +181,13 @@ bool Uploader::uploadFile(const std::string& local_path,
     
     Utils::logInfo("Starting upload: " + local_path + " -> " + remote_path);
     
-    // Read file
-    std::vector<uint8_t> file_data = Utils::readFile(local_path);
-    if (file_data.empty()) {
+    // The file is streamed from disk chunk by chunk, never read whole
+    int64_t file_size = Utils::getFileSize(local_path);
+    if (file_size <= 0) {
         Utils::logError("Failed to read file: " + local_path);
         return false;
     }
     
-    int64_t file_size = file_data.size();
     Utils::logInfo("File size: " + std::to_string(file_size) + " bytes");
     
     // Create file on master
@@ -136,6 +196,11 @@ bool Uploader::uploadFile(const std::string& local_path,
     create_request.set_file_size(file_size);
     create_request.set_enable_encryption(enable_encryption);
     create_request.set_enable_erasure_coding(enable_erasure_coding);
+    if (enable_erasure_coding) {
+        create_request.set_erasure_data_blocks(erasure_profile_.data_blocks);
+        create_request.set_erasure_parity_blocks(erasure_profile_.parity_blocks);
+        create_request.set_erasure_local_parity_blocks(erasure_profile_.local_parity_blocks);
+    }
     
     CreateFileResponse create_response;
     grpc::ClientContext create_context;
@@ -150,10 +215,14 @@ bool Uploader::uploadFile(const std::string& local_path,
     
     std::string file_id = create_response.file_id();
     
-    // Allocate chunks
+    // Allocate chunks; an erasure-coded file gets a group of blocks for each
+    // chunk-sized piece
+    const int unit_count = static_cast<int>((file_size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    const int blocks_per_unit = enable_erasure_coding ? erasure_profile_.getTotalBlocks() : 1;
+    
     AllocateChunksRequest alloc_request;
     alloc_request.set_file_id(file_id);
-    alloc_request.set_chunk_count((file_size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    alloc_request.set_chunk_count(unit_count * blocks_per_unit);
     alloc_request.set_enable_erasure_coding(enable_erasure_coding);
     
     AllocateChunksResponse alloc_response;
@@ -167,62 +236,133 @@ bool Uploader::uploadFile(const std::string& local_path,
         return false;
     }
     
-    // Split file into chunks
-    std::vector<std::vector<uint8_t>> chunks = splitFileIntoChunks(file_data);
-    
-    if (chunks.size() != static_cast<size_t>(alloc_response.allocated_chunks_size())) {
+    const int chunk_count = alloc_response.allocated_chunks_size();
+    if (chunk_count != alloc_request.chunk_count()) {
         Utils::logError("Chunk count mismatch");
         return false;
     }
     
-    // Upload chunks
+    std::string key_id = file_id + "_key";
+    if (enable_encryption && !KeyManager::getInstance().hasKey(key_id)) {
+        Utils::logError("Encryption key not found for file: " + file_id);
+        return false;
+    }
+    
+    std::unique_ptr<ErasureCoding> erasure_coder;
+    if (enable_erasure_coding) {
+        erasure_coder = std::make_unique<ErasureCoding>(erasure_profile_);
+    }
+    
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Utils::logError("Failed to open file: " + local_path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    
+    // Upload chunks. Each worker takes the next chunk, reads it straight from
+    // the file, encrypts it and streams it to its servers, so reading and
+    // encrypting one chunk overlaps the transfer of the others. At most
+    // max_chunks_in_flight_ chunks (or block groups) are in flight at once.
+    std::vector<std::string> uploaded_chunk_ids(chunk_count);
+    std::atomic<int> next_chunk(0);
+    std::atomic<bool> failed(false);
+    std::mutex progress_mutex;
     int64_t uploaded_bytes = 0;
-    std::vector<std::string> uploaded_chunk_ids;
     
-    for (int i = 0; i < alloc_response.allocated_chunks_size(); ++i) {
-        const ChunkInfo& chunk_info = alloc_response.allocated_chunks(i);
+    auto upload_worker = [&]() {
+        std::vector<uint8_t> chunk_data;
         
-        if (i >= static_cast<int>(chunks.size())) {
-            Utils::logError("Chunk index out of range");
-            return false;
-        }
-        
-        std::vector<uint8_t> chunk_data = chunks[i];
-        
-        // Encrypt chunk if needed
-        if (enable_encryption) {
-            KeyManager& key_manager = KeyManager::getInstance();
-            std::string key_id = file_id + "_key";
+        while (!failed.load()) {
+            int i = next_chunk++;
+            if (i >= unit_count) {
+                break;
+            }
             
-            if (!key_manager.hasKey(key_id)) {
-                Utils::logError("Encryption key not found for file: " + file_id);
-                return false;
+            int64_t offset = static_cast<int64_t>(i) * CHUNK_SIZE;
+            size_t size = static_cast<size_t>(std::min<int64_t>(CHUNK_SIZE, file_size - offset));
+            
+            if (erasure_coder) {
+                std::vector<const ChunkInfo*> group;
+                for (int b = 0; b < blocks_per_unit; ++b) {
+                    group.push_back(&alloc_response.allocated_chunks(i * blocks_per_unit + b));
+                }
+                
+                if (!uploadBlockGroup(fd, offset, size, group, *erasure_coder,
+                                      enable_encryption ? key_id : "")) {
+                    Utils::logError("Failed to upload block group " + std::to_string(i) + " of " + local_path);
+                    failed = true;
+                    break;
+                }
+                
+                for (int b = 0; b < blocks_per_unit; ++b) {
+                    uploaded_chunk_ids[i * blocks_per_unit + b] = group[b]->chunk_id();
+                }
+                
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                uploaded_bytes += size;
+                if (progress_callback_) {
+                    progress_callback_(uploaded_bytes, file_size);
+                }
+                continue;
             }
             
-            chunk_data = Crypto::encryptChunk(chunk_data, key_id);
-            if (chunk_data.empty()) {
-                Utils::logError("Failed to encrypt chunk");
-                return false;
+            const ChunkInfo& chunk_info = alloc_response.allocated_chunks(i);
+            
+            if (!readFileRange(fd, offset, size, chunk_data)) {
+                Utils::logError("Failed to read chunk " + std::to_string(i) + " of " + local_path);
+                failed = true;
+                break;
+            }
+            
+            // Encrypt chunk if needed
+            std::vector<uint8_t> encrypted_data;
+            if (enable_encryption) {
+                encrypted_data = Crypto::encryptChunk(chunk_data, key_id);
+                if (encrypted_data.empty()) {
+                    Utils::logError("Failed to encrypt chunk");
+                    failed = true;
+                    break;
+                }
             }
-        }
-        
-        // Upload chunk to all servers
-        std::vector<std::string> server_addresses;
-        for (int j = 0; j < chunk_info.server_addresses_size(); ++j) {
-            server_addresses.push_back(chunk_info.server_addresses(j));
-        }
-        
-        if (uploadChunk(chunk_info.chunk_id(), chunk_data, server_addresses, enable_encryption)) {
-            uploaded_chunk_ids.push_back(chunk_info.chunk_id());
-            uploaded_bytes += chunks[i].size();
             
+            std::vector<std::string> server_addresses(chunk_info.server_addresses().begin(),
+                                                      chunk_info.server_addresses().end());
+            
+            if (!uploadChunk(chunk_info.chunk_id(), enable_encryption ? encrypted_data : chunk_data,
+                             server_addresses, enable_encryption)) {
+                Utils::logError("Failed to upload chunk: " + chunk_info.chunk_id());
+                failed = true;
+                break;
+            }
+            
+            uploaded_chunk_ids[i] = chunk_info.chunk_id();
+            
+            // The cache takes the buffer over; the next chunk is read into a new one
+            if (cache_manager_) {
+                cache_manager_->put(chunk_info.chunk_id(), std::make_shared<const CacheManager::Buffer>(
+                    std::move(enable_encryption ? encrypted_data : chunk_data)));
+            }
+            
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            uploaded_bytes += size;
             if (progress_callback_) {
                 progress_callback_(uploaded_bytes, file_size);
             }
-        } else {
-            Utils::logError("Failed to upload chunk: " + chunk_info.chunk_id());
-            return false;
         }
+    };
+    
+    size_t worker_count = std::min(max_chunks_in_flight_, static_cast<size_t>(unit_count));
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers.emplace_back(upload_worker);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    ::close(fd);
+    
+    if (failed.load()) {
+        return false;
     }
     
     // Complete upload
@@ -258,24 +398,44 @@ bool Uploader::uploadChunk(const std::string& chunk_id,
     }
     
     bool success = false;
+    std::string checksum = Utils::calculateSHA256(data);
     
     // Try to upload to all servers
     for (const std::string& server_address : server_addresses) {
         try {
-            auto channel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
-            auto stub = ChunkStorage::NewStub(channel);
-            
-            WriteChunkRequest request;
-            request.set_chunk_id(chunk_id);
-            request.set_data(std::string(data.begin(), data.end()));
-            request.set_checksum(Utils::calculateSHA256(data));
-            request.set_is_encrypted(is_encrypted);
-            request.set_is_erasure_coded(false);
+            auto stub = ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(server_address));
             
             WriteChunkResponse response;
             grpc::ClientContext context;
             
-            grpc::Status status = stub->WriteChunk(&context, request, &response);
+            // Send the chunk in fixed-size frames instead of one big message
+            auto writer = stub->WriteChunkStream(&context, &response);
+            
+            WriteChunkFrame frame;
+            frame.set_chunk_id(chunk_id);
+            frame.set_total_size(data.size());
+            frame.set_checksum(checksum);
+            frame.set_is_encrypted(is_encrypted);
+            frame.set_is_erasure_coded(false);
+            
+            size_t offset = 0;
+            do {
+                size_t frame_size = std::min(STREAM_FRAME_SIZE, data.size() - offset);
+                frame.set_data(data.data() + offset, frame_size);
+                if (!writer->Write(frame)) {
+                    break; // Server closed the stream; Finish() reports why
+                }
+                offset += frame_size;
+                
+                if (offset == frame_size) {
+                    // Header only travels with the first frame
+                    frame.Clear();
+                }
+            } while (offset < data.size());
+            
+            writer->WritesDone();
+            grpc::Status status = writer->Finish();
+            ChannelPool::getInstance().reportResult(server_address, status);
             
             if (status.ok() && response.success()) {
                 success = true;
@@ -290,33 +450,151 @@ bool Uploader::uploadChunk(const std::string& chunk_id,
         }
     }
     
-    // Cache the chunk if upload was successful
-    if (success && cache_manager_) {
-        cache_manager_->put(chunk_id, data);
-    }
-    
     return success;
 }
 
-std::vector<std::vector<uint8_t>> Uploader::splitFileIntoChunks(const std::vector<uint8_t>& file_data) {
-    std::vector<std::vector<uint8_t>> chunks;
+bool Uploader::uploadBlockGroup(int fd, int64_t offset, size_t size,
+                                const std::vector<const ChunkInfo*>& blocks,
+                                const ErasureCoding& coder,
+                                const std::string& key_id) {
+    // Encryption needs the whole piece; plain data is streamed from the file
+    std::vector<uint8_t> encrypted_data;
+    if (!key_id.empty()) {
+        std::vector<uint8_t> plain_data;
+        if (!readFileRange(fd, offset, size, plain_data)) {
+            Utils::logError("Failed to read file at offset " + std::to_string(offset));
+            return false;
+        }
+        encrypted_data = Crypto::encryptChunk(plain_data, key_id);
+        if (encrypted_data.empty()) {
+            Utils::logError("Failed to encrypt chunk");
+            return false;
+        }
+    }
+    
+    StripeLayout layout(coder.getDataBlocks(), StripeLayout::DEFAULT_CELL_SIZE,
+                        key_id.empty() ? size : encrypted_data.size());
+    
+    // One stream per block (erasure-coded blocks are not replicated)
+    struct BlockStream {
+        std::string address;
+        std::unique_ptr<ChunkStorage::Stub> stub;
+        grpc::ClientContext context;
+        WriteChunkResponse response;
+        std::unique_ptr<grpc::ClientWriter<WriteChunkFrame>> writer;
+        SHA256Stream hasher;
+        bool header_sent = false;
+    };
+    
+    std::vector<std::unique_ptr<BlockStream>> streams;
+    for (const ChunkInfo* block : blocks) {
+        if (block->server_addresses_size() == 0) {
+            Utils::logError("No server address provided for block " + block->chunk_id());
+            return false;
+        }
+        
+        auto stream = std::make_unique<BlockStream>();
+        stream->address = block->server_addresses(0);
+        stream->stub = ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(stream->address));
+        stream->writer = stream->stub->WriteChunkStream(&stream->context, &stream->response);
+        streams.push_back(std::move(stream));
+    }
+    
+    StripeEncoder encoder(coder, layout, [&](int64_t, const std::vector<const uint8_t*>& cells,
+                                             size_t cell_size) {
+        for (size_t b = 0; b < streams.size(); ++b) {
+            BlockStream& stream = *streams[b];
+            
+            WriteChunkFrame frame;
+            if (!stream.header_sent) {
+                // The checksum is only known at the end; the server's is compared then
+                frame.set_chunk_id(blocks[b]->chunk_id());
+                frame.set_total_size(layout.getBlockSize());
+                frame.set_is_encrypted(!key_id.empty());
+                frame.set_is_erasure_coded(true);
+                stream.header_sent = true;
+            }
+            frame.set_data(cells[b], cell_size);
+            stream.hasher.update(cells[b], cell_size);
+            
+            if (!stream.writer->Write(frame)) {
+                Utils::logWarning("Stream for block " + blocks[b]->chunk_id() + " to " +
+                                 stream.address + " closed early");
+                return false;
+            }
+        }
+        return true;
+    });
+    
+    bool encoded;
+    if (!key_id.empty()) {
+        encoded = encoder.append(encrypted_data.data(), encrypted_data.size()) && encoder.finish();
+    } else {
+        std::vector<uint8_t> stripe_data;
+        size_t done = 0;
+        encoded = true;
+        while (encoded && done < size) {
+            size_t count = std::min(layout.getStripeSize(), size - done);
+            if (!readFileRange(fd, offset + done, count, stripe_data)) {
+                Utils::logError("Failed to read file at offset " + std::to_string(offset + done));
+                encoded = false;
+                break;
+            }
+            encoded = encoder.append(stripe_data.data(), count);
+            done += count;
+        }
+        encoded = encoded && encoder.finish();
+    }
     
-    size_t chunk_size = CHUNK_SIZE;
-    for (size_t i = 0; i < file_data.size(); i += chunk_size) {
-        size_t actual_chunk_size = std::min(chunk_size, file_data.size() - i);
+    bool success = encoded;
+    for (size_t b = 0; b < streams.size(); ++b) {
+        BlockStream& stream = *streams[b];
+        if (!encoded) {
+            stream.context.TryCancel();
+        }
+        stream.writer->WritesDone();
+        grpc::Status status = stream.writer->Finish();
+        ChannelPool::getInstance().reportResult(stream.address, status);
         
-        std::vector<uint8_t> chunk(file_data.begin() + i, 
-                                  file_data.begin() + i + actual_chunk_size);
-        chunks.push_back(chunk);
+        if (!encoded) {
+            continue;
+        }
+        if (!status.ok() || !stream.response.success()) {
+            Utils::logWarning("Failed to upload block " + blocks[b]->chunk_id() + " to " + stream.address +
+                             ": " + (status.ok() ? stream.response.message() : status.error_message()));
+            success = false;
+        } else if (stream.response.stored_checksum() != stream.hasher.finalizeHex()) {
+            Utils::logWarning("Checksum mismatch for block " + blocks[b]->chunk_id() + " on " + stream.address);
+            success = false;
+        }
     }
     
-    return chunks;
+    return success;
+}
+
+bool Uploader::readFileRange(int fd, int64_t offset, size_t size, std::vector<uint8_t>& buffer) {
+    buffer.resize(size);
+    
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = ::pread(fd, buffer.data() + done, size - done, offset + done);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (count == 0) {
+            return false; // File shrank since we looked at its size
+        }
+        done += count;
+    }
+    return true;
 }
 
 // Downloader implementation
 Downloader::Downloader(std::shared_ptr<FileService::Stub> file_service,
                        std::shared_ptr<CacheManager> cache_manager)
-    : file_service_(file_service), cache_manager_(cache_manager) {
+    : file_service_(file_service), cache_manager_(cache_manager),
+      max_chunks_in_flight_(DEFAULT_CHUNKS_IN_FLIGHT) {
 }
 
 bool Downloader::downloadFile(const std::string& remote_path, 
@@ -343,52 +621,136 @@ bool Downloader::downloadFile(const std::string& remote_path,
     
     Utils::logInfo("File size: " + std::to_string(file_size) + " bytes");
     
-    // Download chunks
-    std::vector<std::vector<uint8_t>> chunks;
+    // Erasure-coded files store every CHUNK_SIZE piece as a block group
+    ErasureCodingProfile erasure_profile;
+    if (!getErasureProfile(file_info, erasure_profile)) {
+        Utils::logError("Invalid erasure coding profile for: " + remote_path);
+        return false;
+    }
+    
+    const int blocks_per_unit = file_info.is_erasure_coded() ? erasure_profile.getTotalBlocks() : 1;
+    const int unit_count = static_cast<int>((file_size + static_cast<int64_t>(CHUNK_SIZE) - 1) /
+                                            static_cast<int64_t>(CHUNK_SIZE));
+    if (file_size < 0 || file_info.chunks_size() != static_cast<int64_t>(unit_count) * blocks_per_unit) {
+        Utils::logError("Chunk count doesn't match the file size: " + remote_path);
+        return false;
+    }
+    
+    std::unique_ptr<ErasureCoding> erasure_coder;
+    if (file_info.is_erasure_coded()) {
+        erasure_coder = std::make_unique<ErasureCoding>(erasure_profile);
+    }
+    
+    if (file_info.is_encrypted() && !KeyManager::getInstance().hasKey(file_info.encryption_key_id())) {
+        Utils::logError("Decryption key not found");
+        return false;
+    }
+    
+    // Written next to the destination and renamed into place once complete,
+    // so a failed download never leaves a partial file behind
+    std::string temp_path = local_path + ".part";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Utils::logError("Failed to write file: " + local_path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    
+    // Download chunks. Workers fetch chunks in any order and write each one
+    // at its offset as soon as it arrives; at most max_chunks_in_flight_
+    // chunks are in memory at once. Chunk i starts its search at replica i
+    // so that concurrent fetches spread over the servers.
+    std::atomic<int> next_chunk(0);
+    std::atomic<bool> failed(false);
+    std::mutex progress_mutex;
     int64_t downloaded_bytes = 0;
     
-    for (const ChunkInfo& chunk_info : file_info.chunks()) {
-        std::vector<std::string> server_addresses;
-        for (const std::string& address : chunk_info.server_addresses()) {
-            server_addresses.push_back(address);
-        }
-        
-        std::vector<uint8_t> chunk_data = downloadChunk(chunk_info.chunk_id(), server_addresses);
-        
-        if (chunk_data.empty()) {
-            Utils::logError("Failed to download chunk: " + chunk_info.chunk_id());
-            return false;
-        }
-        
-        // Decrypt chunk if needed
-        if (file_info.is_encrypted()) {
-            KeyManager& key_manager = KeyManager::getInstance();
-            if (key_manager.hasKey(file_info.encryption_key_id())) {
-                chunk_data = Crypto::decryptChunk(chunk_data, file_info.encryption_key_id());
-                if (chunk_data.empty()) {
-                    Utils::logError("Failed to decrypt chunk");
-                    return false;
+    auto download_worker = [&]() {
+        while (!failed.load()) {
+            int i = next_chunk++;
+            if (i >= unit_count) {
+                break;
+            }
+            
+            int64_t offset = static_cast<int64_t>(i) * CHUNK_SIZE;
+            int64_t size = std::min<int64_t>(CHUNK_SIZE, file_size - offset);
+            CacheManager::BufferPtr chunk_data;
+            
+            if (erasure_coder) {
+                std::vector<const ChunkInfo*> group;
+                for (int b = 0; b < blocks_per_unit; ++b) {
+                    group.push_back(&file_info.chunks(i * blocks_per_unit + b));
+                }
+                
+                int64_t data_size = file_info.is_encrypted() ? Crypto::getEncryptedSize(size) : size;
+                chunk_data = std::make_shared<const CacheManager::Buffer>(
+                    downloadBlockGroup(group, *erasure_coder, data_size));
+                if (chunk_data->empty()) {
+                    Utils::logError("Failed to download block group " + std::to_string(i) +
+                                   " of " + remote_path);
+                    failed = true;
+                    break;
                 }
             } else {
-                Utils::logError("Decryption key not found");
-                return false;
+                const ChunkInfo& chunk_info = file_info.chunks(i);
+                chunk_data = downloadChunk(chunk_info.chunk_id(), orderReplicas(chunk_info, i));
+                
+                if (!chunk_data || chunk_data->empty()) {
+                    Utils::logError("Failed to download chunk: " + chunk_info.chunk_id());
+                    failed = true;
+                    break;
+                }
+            }
+            
+            // Decrypt chunk if needed
+            if (file_info.is_encrypted()) {
+                chunk_data = std::make_shared<const CacheManager::Buffer>(
+                    Crypto::decryptChunk(*chunk_data, file_info.encryption_key_id()));
+                if (chunk_data->empty()) {
+                    Utils::logError("Failed to decrypt chunk");
+                    failed = true;
+                    break;
+                }
+            }
+            
+            if (static_cast<int64_t>(chunk_data->size()) != size) {
+                Utils::logError("Unexpected size for chunk " + std::to_string(i) + " of " + remote_path +
+                               ": " + std::to_string(chunk_data->size()) + " bytes");
+                failed = true;
+                break;
+            }
+            
+            if (!writeFileRange(fd, offset, *chunk_data)) {
+                Utils::logError("Failed to write file: " + local_path + " (" + std::strerror(errno) + ")");
+                failed = true;
+                break;
+            }
+            
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            downloaded_bytes += chunk_data->size();
+            if (progress_callback_) {
+                progress_callback_(downloaded_bytes, file_size);
             }
         }
-        
-        chunks.push_back(chunk_data);
-        downloaded_bytes += chunk_data.size();
-        
-        if (progress_callback_) {
-            progress_callback_(downloaded_bytes, file_size);
-        }
+    };
+    
+    size_t worker_count = std::min(max_chunks_in_flight_, static_cast<size_t>(unit_count));
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers.emplace_back(download_worker);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
     }
     
-    // Assemble file
-    std::vector<uint8_t> file_data = assembleChunks(chunks);
+    bool ok = !failed.load() && ::ftruncate(fd, file_size) == 0;
+    ok = (::close(fd) == 0) && ok;
+    ok = ok && ::rename(temp_path.c_str(), local_path.c_str()) == 0;
     
-    // Write to local file
-    if (!Utils::writeFile(local_path, file_data)) {
-        Utils::logError("Failed to write file: " + local_path);
+    if (!ok) {
+        if (!failed.load()) {
+            Utils::logError("Failed to write file: " + local_path + " (" + std::strerror(errno) + ")");
+        }
+        Utils::deleteFile(temp_path);
         return false;
     }
     
@@ -396,35 +758,177 @@ bool Downloader::downloadFile(const std::string& remote_path,
     return true;
 }
 
-std::vector<uint8_t> Downloader::downloadChunk(const std::string& chunk_id,
-                                               const std::vector<std::string>& server_addresses) {
+int64_t Downloader::readRange(const std::string& remote_path, int64_t offset, void* buffer, size_t count) {
+    if (offset < 0) {
+        Utils::logError("Invalid offset " + std::to_string(offset) + " for " + remote_path);
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    int64_t length = static_cast<int64_t>(std::min<size_t>(count, std::numeric_limits<int64_t>::max()));
+    
+    // Only the chunks covering the range are looked up
+    GetFileRangeRequest range_request;
+    range_request.set_filename(remote_path);
+    range_request.set_offset(offset);
+    range_request.set_length(length);
+    
+    GetFileRangeResponse range_response;
+    grpc::ClientContext range_context;
+    
+    grpc::Status status = file_service_->GetFileRange(&range_context, range_request, &range_response);
+    
+    if (!status.ok() || !range_response.found()) {
+        Utils::logError("File not found: " + remote_path);
+        return -1;
+    }
+    
+    const FileInfo& file_info = range_response.file_info();
+    int64_t file_size = file_info.size();
+    if (offset >= file_size) {
+        return 0;
+    }
+    int64_t end = offset + std::min(length, file_size - offset);
+    
+    ErasureCodingProfile erasure_profile;
+    if (!getErasureProfile(file_info, erasure_profile)) {
+        Utils::logError("Invalid erasure coding profile for: " + remote_path);
+        return -1;
+    }
+    
+    const int blocks_per_unit = file_info.is_erasure_coded() ? erasure_profile.getTotalBlocks() : 1;
+    const int64_t first_unit = range_response.first_chunk_index();
+    const int64_t end_unit = (end + static_cast<int64_t>(CHUNK_SIZE) - 1) / static_cast<int64_t>(CHUNK_SIZE);
+    if (first_unit != offset / static_cast<int64_t>(CHUNK_SIZE) ||
+        file_info.chunks_size() != (end_unit - first_unit) * blocks_per_unit) {
+        Utils::logError("Chunk count doesn't match the file size: " + remote_path);
+        return -1;
+    }
+    
+    std::unique_ptr<ErasureCoding> erasure_coder;
+    if (file_info.is_erasure_coded()) {
+        erasure_coder = std::make_unique<ErasureCoding>(erasure_profile);
+    }
+    
+    if (file_info.is_encrypted() && !KeyManager::getInstance().hasKey(file_info.encryption_key_id())) {
+        Utils::logError("Decryption key not found");
+        return -1;
+    }
+    
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    for (int64_t unit = first_unit; unit < end_unit; ++unit) {
+        // The part of the range inside this chunk (or block group)
+        int64_t unit_offset = unit * static_cast<int64_t>(CHUNK_SIZE);
+        int64_t unit_size = std::min<int64_t>(CHUNK_SIZE, file_size - unit_offset);
+        int64_t range_offset = std::max(offset, unit_offset) - unit_offset;
+        size_t range_length = std::min(end, unit_offset + unit_size) - unit_offset - range_offset;
+        uint8_t* range_out = out + (unit_offset + range_offset - offset);
+        int first_block = static_cast<int>(unit - first_unit) * blocks_per_unit;
+        
+        bool ok;
+        if (file_info.is_encrypted()) {
+            // Encrypted chunks are authenticated as a whole, so all of the
+            // chunk is fetched and decrypted
+            CacheManager::BufferPtr encrypted;
+            if (erasure_coder) {
+                std::vector<const ChunkInfo*> group;
+                for (int b = 0; b < blocks_per_unit; ++b) {
+                    group.push_back(&file_info.chunks(first_block + b));
+                }
+                encrypted = std::make_shared<const CacheManager::Buffer>(
+                    downloadBlockGroup(group, *erasure_coder, Crypto::getEncryptedSize(unit_size)));
+            } else {
+                const ChunkInfo& chunk_info = file_info.chunks(first_block);
+                encrypted = downloadChunk(chunk_info.chunk_id(), orderReplicas(chunk_info, unit));
+            }
+            
+            std::vector<uint8_t> chunk_data;
+            if (encrypted && !encrypted->empty()) {
+                chunk_data = Crypto::decryptChunk(*encrypted, file_info.encryption_key_id());
+            }
+            ok = static_cast<int64_t>(chunk_data.size()) == unit_size;
+            if (ok) {
+                std::memcpy(range_out, chunk_data.data() + range_offset, range_length);
+            }
+        } else if (erasure_coder) {
+            // Only the cells holding the range are read, or the same bytes
+            // of the blocks needed to rebuild an unreadable one
+            StripeLayout layout(erasure_coder->getDataBlocks(), StripeLayout::DEFAULT_CELL_SIZE, unit_size);
+            StripeReader reader(*erasure_coder, layout,
+                                [&](int block, int64_t block_offset, size_t length, uint8_t* block_out) {
+                const ChunkInfo& info = file_info.chunks(first_block + block);
+                if (!downloadChunkRange(info.chunk_id(), orderReplicas(info, 0), block_offset, length, block_out)) {
+                    Utils::logWarning("Block " + info.chunk_id() + " unavailable, rebuilding it from the group");
+                    return false;
+                }
+                return true;
+            });
+            ok = reader.read(range_offset, range_length, range_out);
+        } else {
+            const ChunkInfo& chunk_info = file_info.chunks(first_block);
+            ok = downloadChunkRange(chunk_info.chunk_id(), orderReplicas(chunk_info, unit),
+                                    range_offset, range_length, range_out);
+        }
+        
+        if (!ok) {
+            Utils::logError("Failed to read chunk " + std::to_string(unit) + " of " + remote_path);
+            return -1;
+        }
+    }
+    
+    return end - offset;
+}
+
+CacheManager::BufferPtr Downloader::downloadChunk(const std::string& chunk_id,
+                                                  const std::vector<std::string>& server_addresses) {
     
     // Check cache first
-    if (cache_manager_ && cache_manager_->contains(chunk_id)) {
-        return cache_manager_->get(chunk_id);
+    if (cache_manager_) {
+        CacheManager::BufferPtr cached = cache_manager_->get(chunk_id);
+        if (cached) {
+            return cached;
+        }
     }
     
     // Try to download from any server
     for (const std::string& server_address : server_addresses) {
         try {
-            auto channel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
-            auto stub = ChunkStorage::NewStub(channel);
+            auto stub = ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(server_address));
             
             ReadChunkRequest request;
             request.set_chunk_id(chunk_id);
             request.set_verify_integrity(true);
             
-            ReadChunkResponse response;
             grpc::ClientContext context;
+            auto reader = stub->ReadChunkStream(&context, request);
             
-            grpc::Status status = stub->ReadChunk(&context, request, &response);
+            // Frames are appended as they arrive; the first one carries size and checksum
+            auto data = std::make_shared<CacheManager::Buffer>();
+            std::string expected_checksum;
+            SHA256Stream hasher;
+            ReadChunkFrame frame;
+            bool first_frame = true;
             
-            if (status.ok() && response.success()) {
-                std::vector<uint8_t> data(response.data().begin(), response.data().end());
+            while (reader->Read(&frame)) {
+                if (first_frame) {
+                    expected_checksum = frame.checksum();
+                    data->reserve(frame.total_size());
+                    first_frame = false;
+                }
                 
+                const std::string& payload = frame.data();
+                hasher.update(payload.data(), payload.size());
+                data->insert(data->end(), payload.begin(), payload.end());
+            }
+            
+            grpc::Status status = reader->Finish();
+            ChannelPool::getInstance().reportResult(server_address, status);
+            
+            if (status.ok()) {
                 // Verify checksum
-                std::string actual_checksum = Utils::calculateSHA256(data);
-                if (actual_checksum == response.checksum()) {
+                std::string actual_checksum = hasher.finalizeHex();
+                if (actual_checksum == expected_checksum) {
                     // Cache the chunk
                     if (cache_manager_) {
                         cache_manager_->put(chunk_id, data);
@@ -437,7 +941,7 @@ std::vector<uint8_t> Downloader::downloadChunk(const std::string& chunk_id,
                 }
             } else {
                 Utils::logWarning("Failed to download chunk " + chunk_id + " from " + server_address + 
-                                 ": " + (status.ok() ? response.message() : status.error_message()));
+                                 ": " + status.error_message());
             }
             
         } catch (const std::exception& e) {
@@ -445,30 +949,156 @@ std::vector<uint8_t> Downloader::downloadChunk(const std::string& chunk_id,
         }
     }
     
-    return {}; // Failed to download from any server
+    return nullptr; // Failed to download from any server
 }
 
-std::vector<uint8_t> Downloader::assembleChunks(const std::vector<std::vector<uint8_t>>& chunks) {
-    std::vector<uint8_t> assembled_data;
+bool Downloader::downloadChunkRange(const std::string& chunk_id,
+                                    const std::vector<std::string>& server_addresses,
+                                    int64_t offset, size_t length, uint8_t* out) {
+    if (length == 0) {
+        return true;
+    }
+    
+    // Chunks cached by earlier downloads serve ranges as well
+    if (cache_manager_) {
+        CacheManager::BufferPtr data = cache_manager_->get(chunk_id);
+        if (data && offset + length <= data->size()) {
+            std::memcpy(out, data->data() + offset, length);
+            return true;
+        }
+    }
+    
+    size_t done = 0;
+    for (const std::string& server_address : server_addresses) {
+        auto stub = ChunkStorage::NewStub(ChannelPool::getInstance().getChannel(server_address));
+        
+        while (done < length) {
+            size_t piece = std::min(length - done, MAX_RANGE_REQUEST_SIZE);
+            
+            ReadChunkRequest request;
+            request.set_chunk_id(chunk_id);
+            request.set_verify_integrity(true);
+            request.set_offset(offset + done);
+            request.set_length(piece);
+            
+            ReadChunkResponse response;
+            grpc::ClientContext context;
+            grpc::Status status = stub->ReadChunk(&context, request, &response);
+            ChannelPool::getInstance().reportResult(server_address, status);
+            
+            const std::string& data = response.data();
+            if (!status.ok() || !response.success() || data.size() != piece ||
+                Utils::crc32c(data.data(), data.size()) != response.data_crc32c()) {
+                Utils::logWarning("Failed to read " + std::to_string(piece) + " bytes at " +
+                                 std::to_string(offset + done) + " of chunk " + chunk_id + " from " +
+                                 server_address + ": " +
+                                 (status.ok() ? response.message() : status.error_message()));
+                break;
+            }
+            
+            std::memcpy(out + done, data.data(), piece);
+            done += piece;
+        }
+        
+        if (done == length) {
+            Utils::logDebug("Read " + std::to_string(length) + " bytes of chunk " + chunk_id);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+std::vector<uint8_t> Downloader::downloadBlockGroup(const std::vector<const ChunkInfo*>& blocks,
+                                                    ErasureCoding& coder, int64_t data_size) {
+    StripeLayout layout(coder.getDataBlocks(), StripeLayout::DEFAULT_CELL_SIZE, data_size);
+    
+    // Blocks are fetched whole on first use; a group read without failures
+    // only ever touches the data blocks
+    std::vector<CacheManager::BufferPtr> block_data(blocks.size());
+    StripeReader reader(coder, layout, [&](int block, int64_t offset, size_t length, uint8_t* out) {
+        CacheManager::BufferPtr& data = block_data[block];
+        if (!data) {
+            const ChunkInfo& info = *blocks[block];
+            data = downloadChunk(info.chunk_id(), orderReplicas(info, 0));
+            if (!data || static_cast<int64_t>(data->size()) != layout.getBlockSize()) {
+                Utils::logWarning("Block " + info.chunk_id() + " unavailable, rebuilding it from the group");
+                data.reset();
+                return false;
+            }
+        }
+        
+        std::memcpy(out, data->data() + offset, length);
+        return true;
+    });
     
-    for (const auto& chunk : chunks) {
-        assembled_data.insert(assembled_data.end(), chunk.begin(), chunk.end());
+    std::vector<uint8_t> group_data(data_size);
+    if (!reader.read(0, group_data.size(), group_data.data())) {
+        return {};
+    }
+    return group_data;
+}
+
+bool Downloader::getErasureProfile(const FileInfo& file, ErasureCodingProfile& profile) {
+    if (file.erasure_data_blocks() > 0) {
+        profile.data_blocks = file.erasure_data_blocks();
+        profile.parity_blocks = file.erasure_parity_blocks();
+        profile.local_parity_blocks = file.erasure_local_parity_blocks();
+    }
+    return !file.is_erasure_coded() || profile.isValid();
+}
+
+std::vector<std::string> Downloader::orderReplicas(const ChunkInfo& chunk, size_t rotation) {
+    std::vector<std::string> server_addresses(chunk.server_addresses().begin(),
+                                              chunk.server_addresses().end());
+    if (!server_addresses.empty()) {
+        std::rotate(server_addresses.begin(),
+                    server_addresses.begin() + rotation % server_addresses.size(),
+                    server_addresses.end());
     }
     
-    return assembled_data;
+    std::stable_partition(server_addresses.begin(), server_addresses.end(),
+                          [](const std::string& address) {
+                              return ChannelPool::getInstance().isHealthy(address);
+                          });
+    return server_addresses;
+}
+
+bool Downloader::writeFileRange(int fd, int64_t offset, const std::vector<uint8_t>& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t count = ::pwrite(fd, data.data() + done, data.size() - done, offset + done);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += count;
+    }
+    return true;
 }
 
 // DFSClient implementation
 DFSClient::DFSClient(const std::string& master_address, int master_port) 
-    : verbose_logging_(false) {
+    : verbose_logging_(false),
+      upload_parallelism_(Uploader::DEFAULT_CHUNKS_IN_FLIGHT),
+      download_parallelism_(Downloader::DEFAULT_CHUNKS_IN_FLIGHT) {
     
     std::string address = master_address + ":" + std::to_string(master_port);
     channel_ = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
     file_service_ = FileService::NewStub(channel_);
     
     cache_manager_ = std::make_shared<CacheManager>(100); // 100MB cache
+    createTransfers();
+    
+    Utils::logInfo("DFSClient connected to master at " + address);
+}
+
+void DFSClient::createTransfers() {
     uploader_ = std::make_unique<Uploader>(file_service_, cache_manager_);
+    uploader_->setMaxChunksInFlight(upload_parallelism_);
+    uploader_->setErasureCodingProfile(erasure_profile_);
     downloader_ = std::make_unique<Downloader>(file_service_, cache_manager_);
+    downloader_->setMaxChunksInFlight(download_parallelism_);
     
     // Set progress callbacks
     uploader_->setProgressCallback([this](int64_t current, int64_t total) {
@@ -482,8 +1112,6 @@ DFSClient::DFSClient(const std::string& master_address, int master_port)
             printProgressBar(current, total, "Downloading");
         }
     });
-    
-    Utils::logInfo("DFSClient connected to master at " + address);
 }
 
 DFSClient::~DFSClient() {
@@ -538,6 +1166,10 @@ bool DFSClient::get(const std::string& remote_file, const std::string& local_fil
     return success;
 }
 
+int64_t DFSClient::pread(const std::string& remote_file, void* buffer, size_t count, int64_t offset) {
+    return downloader_->readRange(remote_file, offset, buffer, count);
+}
+
 bool DFSClient::deleteFile(const std::string& remote_file) {
     DeleteFileRequest request;
     request.set_filename(remote_file);
@@ -588,7 +1220,7 @@ bool DFSClient::listFiles(const std::string& path_prefix) {
                   << std::setw(15) << formatFileSize(file.size())
                   << std::setw(20) << Utils::timestampToString(file.created_time())
                   << std::setw(10) << (file.is_encrypted() ? "Yes" : "No")
-                  << std::setw(10) << (file.chunks_size() > 0 && file.chunks(0).is_erasure_coded() ? "Yes" : "No")
+                  << std::setw(10) << (file.is_erasure_coded() ? formatErasureProfile(file) : "No")
                   << std::endl;
     }
     
@@ -622,7 +1254,7 @@ bool DFSClient::getFileInfo(const std::string& remote_file) {
     std::cout << "  Created: " << Utils::timestampToString(file.created_time()) << std::endl;
     std::cout << "  Modified: " << Utils::timestampToString(file.modified_time()) << std::endl;
     std::cout << "  Encrypted: " << (file.is_encrypted() ? "Yes" : "No") << std::endl;
-    std::cout << "  Erasure Coded: " << (file.chunks_size() > 0 && file.chunks(0).is_erasure_coded() ? "Yes" : "No") << std::endl;
+    std::cout << "  Erasure Coded: " << (file.is_erasure_coded() ? formatErasureProfile(file) : "No") << std::endl;
     std::cout << "  Chunks: " << file.chunks_size() << std::endl;
     
     if (verbose_logging_) {
@@ -644,8 +1276,22 @@ bool DFSClient::getFileInfo(const std::string& remote_file) {
 
 void DFSClient::setCacheSize(size_t size_mb) {
     cache_manager_ = std::make_shared<CacheManager>(size_mb);
-    uploader_ = std::make_unique<Uploader>(file_service_, cache_manager_);
-    downloader_ = std::make_unique<Downloader>(file_service_, cache_manager_);
+    createTransfers();
+}
+
+void DFSClient::setUploadParallelism(size_t chunks_in_flight) {
+    upload_parallelism_ = chunks_in_flight > 0 ? chunks_in_flight : 1;
+    uploader_->setMaxChunksInFlight(upload_parallelism_);
+}
+
+void DFSClient::setDownloadParallelism(size_t chunks_in_flight) {
+    download_parallelism_ = chunks_in_flight > 0 ? chunks_in_flight : 1;
+    downloader_->setMaxChunksInFlight(download_parallelism_);
+}
+
+void DFSClient::setErasureCodingProfile(const ErasureCodingProfile& profile) {
+    erasure_profile_ = profile;
+    uploader_->setErasureCodingProfile(erasure_profile_);
 }
 
 void DFSClient::printStatistics() {
@@ -708,4 +1354,17 @@ std::string DFSClient::formatDuration(int64_t milliseconds) {
     return ss.str();
 }
 
+std::string DFSClient::formatErasureProfile(const FileInfo& file) {
+    if (file.erasure_data_blocks() <= 0) {
+        return "Yes"; // Created before profiles were recorded
+    }
+    
+    ErasureCodingProfile profile{file.erasure_data_blocks(), file.erasure_parity_blocks(),
+                                 file.erasure_local_parity_blocks()};
+    std::stringstream ss;
+    ss << profile.toString() << " (" << std::fixed << std::setprecision(2)
+       << profile.getStorageOverhead() << "x)";
+    return ss.str();
+}
+
 } // namespace dfs
\ No newline at end of file
@@ -4,50 +4,82 @@
 #include "file_system.grpc.pb.h"
 #include "utils.h"
 #include "crypto.h"
+#include "erasure_coding.h"
 #include <memory>
 #include <string>
 #include <vector>
+#include <list>
 #include <unordered_map>
 
 namespace dfs {
 
-// Client cache manager for frequently accessed chunks
+// Client cache manager for frequently accessed chunks. Chunks are held as
+// shared immutable buffers, so hits hand out a reference instead of a copy.
+//
+// The cache is split into shards by chunk id, each with its own lock and
+// an LRU list indexed by chunk id, so concurrent download workers rarely
+// contend and lookups and evictions stay O(1). The byte budget is global:
+// a put evicts the least recently used chunks of its own shard first and
+// only takes from the other shards once its own has nothing older left.
 class CacheManager {
 public:
-    CacheManager(size_t max_cache_size_mb = 100);
+    using Buffer = std::vector<uint8_t>;
+    using BufferPtr = std::shared_ptr<const Buffer>;
+    
+    static constexpr size_t DEFAULT_SHARD_COUNT = 16;
+    
+    // shard_count is rounded up to a power of two
+    CacheManager(size_t max_cache_size_mb = 100, size_t shard_count = DEFAULT_SHARD_COUNT);
     ~CacheManager();
     
-    // Cache operations
-    bool put(const std::string& chunk_id, const std::vector<uint8_t>& data);
-    std::vector<uint8_t> get(const std::string& chunk_id);
+    // Cache operations; get returns nullptr on a miss. Chunks larger than
+    // the whole cache are not stored.
+    bool put(const std::string& chunk_id, BufferPtr data);
+    BufferPtr get(const std::string& chunk_id);
     bool contains(const std::string& chunk_id) const;
     void remove(const std::string& chunk_id);
     void clear();
     
     // Statistics
-    size_t size() const { return cache_.size(); }
-    size_t getTotalSize() const { return total_size_; }
+    size_t size() const { return entry_count_.load(); }
+    size_t getTotalSize() const { return total_size_.load(); }
     double getHitRate() const;
     
 private:
     struct CacheEntry {
-        std::vector<uint8_t> data;
-        int64_t last_accessed;
-        size_t size;
+        std::string chunk_id;
+        BufferPtr data;
+    };
+    using EntryList = std::list<CacheEntry>;
+    
+    // Aligned so that shards used by different threads do not share cache lines
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        EntryList lru;                  // Most recently used first
+        std::unordered_map<std::string, EntryList::iterator> index;
     };
     
     size_t max_size_;
-    size_t total_size_;
-    std::unordered_map<std::string, CacheEntry> cache_;
-    mutable std::mutex cache_mutex_;
+    std::vector<Shard> shards_;
+    size_t shard_mask_;
+    std::atomic<size_t> total_size_;    // Bytes held by all shards
+    std::atomic<size_t> entry_count_;
+    std::atomic<size_t> next_victim_shard_;
     
     // Statistics
     std::atomic<int64_t> cache_hits_;
     std::atomic<int64_t> cache_misses_;
     
-    // LRU eviction
-    void evictLRU();
-    void updateAccessTime(const std::string& chunk_id);
+    Shard& shardFor(const std::string& chunk_id);
+    const Shard& shardFor(const std::string& chunk_id) const;
+    
+    // Evicts from the other shards until the cache fits its budget; called
+    // without any shard lock held
+    void evictFromOtherShards(const Shard& skip);
+    
+    // Callers hold the shard's mutex
+    void evictLRU(Shard& shard);
+    void erase(Shard& shard, EntryList::iterator entry);
 };
 
 // File uploader
@@ -61,22 +93,41 @@ public:
                    bool enable_encryption = true,
                    bool enable_erasure_coding = false);
     
-    // Progress callback
+    // Progress callback (called from the upload workers, one call at a time)
     void setProgressCallback(std::function<void(int64_t, int64_t)> callback) {
         progress_callback_ = callback;
     }
     
+    // Chunks read, encrypted and sent concurrently; each one in flight holds
+    // about one chunk in memory
+    static constexpr size_t DEFAULT_CHUNKS_IN_FLIGHT = 4;
+    void setMaxChunksInFlight(size_t count) { max_chunks_in_flight_ = count > 0 ? count : 1; }
+    
+    // Stripe profile requested for erasure-coded uploads
+    void setErasureCodingProfile(const ErasureCodingProfile& profile) { erasure_profile_ = profile; }
+    
 private:
     std::shared_ptr<FileService::Stub> file_service_;
     std::shared_ptr<CacheManager> cache_manager_;
     std::function<void(int64_t, int64_t)> progress_callback_;
+    size_t max_chunks_in_flight_;
+    ErasureCodingProfile erasure_profile_;
     
     bool uploadChunk(const std::string& chunk_id,
                     const std::vector<uint8_t>& data,
                     const std::vector<std::string>& server_addresses,
                     bool is_encrypted = false);
     
-    std::vector<std::vector<uint8_t>> splitFileIntoChunks(const std::vector<uint8_t>& file_data);
+    // Erasure-coded upload of one block group: `size` bytes of the file at
+    // `offset` (encrypted first if key_id is set) are cut into stripes, and
+    // each stripe's cells go to the blocks' streams as soon as its parity is
+    // computed. Unencrypted data is read from the file a stripe at a time.
+    bool uploadBlockGroup(int fd, int64_t offset, size_t size,
+                          const std::vector<const ChunkInfo*>& blocks,
+                          const ErasureCoding& coder,
+                          const std::string& key_id);
+    
+    static bool readFileRange(int fd, int64_t offset, size_t size, std::vector<uint8_t>& buffer);
 };
 
 // File downloader
@@ -88,20 +139,55 @@ public:
     bool downloadFile(const std::string& remote_path, 
                      const std::string& local_path);
     
-    // Progress callback
+    // Reads up to `count` bytes of the file at `offset` into `buffer`, like
+    // pread(2): only the chunks covering the range are looked up and, unless
+    // the file is encrypted, only the requested bytes of them are fetched.
+    // Returns the number of bytes read (short at the end of the file), -1 on
+    // failure.
+    int64_t readRange(const std::string& remote_path, int64_t offset, void* buffer, size_t count);
+    
+    // Progress callback (called from the download workers, one call at a time)
     void setProgressCallback(std::function<void(int64_t, int64_t)> callback) {
         progress_callback_ = callback;
     }
     
+    // Chunks fetched concurrently; each one in flight holds about one chunk in memory
+    static constexpr size_t DEFAULT_CHUNKS_IN_FLIGHT = 4;
+    void setMaxChunksInFlight(size_t count) { max_chunks_in_flight_ = count > 0 ? count : 1; }
+    
 private:
     std::shared_ptr<FileService::Stub> file_service_;
     std::shared_ptr<CacheManager> cache_manager_;
     std::function<void(int64_t, int64_t)> progress_callback_;
+    size_t max_chunks_in_flight_;
+    
+    // The verified chunk, shared with the cache; nullptr if no replica had it
+    CacheManager::BufferPtr downloadChunk(const std::string& chunk_id,
+                                          const std::vector<std::string>& server_addresses);
+    
+    // Largest range requested in one ReadChunk call
+    static constexpr size_t MAX_RANGE_REQUEST_SIZE = 1024 * 1024;
     
-    std::vector<uint8_t> downloadChunk(const std::string& chunk_id,
-                                      const std::vector<std::string>& server_addresses);
+    // `length` bytes of a chunk at `offset`, checked against the servers'
+    // CRC32C; a server that fails mid-range hands over to the next one
+    bool downloadChunkRange(const std::string& chunk_id,
+                            const std::vector<std::string>& server_addresses,
+                            int64_t offset, size_t length, uint8_t* out);
     
-    std::vector<uint8_t> assembleChunks(const std::vector<std::vector<uint8_t>>& chunks);
+    // Data of an erasure-coded block group (`data_size` bytes, still
+    // encrypted if the file is); blocks that cannot be fetched are rebuilt
+    // from the others. Empty on failure.
+    std::vector<uint8_t> downloadBlockGroup(const std::vector<const ChunkInfo*>& blocks,
+                                            ErasureCoding& coder, int64_t data_size);
+    
+    // Stripe profile of an erasure-coded file; false if it is not valid
+    static bool getErasureProfile(const FileInfo& file, ErasureCodingProfile& profile);
+    
+    // Replicas of a chunk starting at the `rotation`-th, those that just
+    // stopped answering last
+    static std::vector<std::string> orderReplicas(const ChunkInfo& chunk, size_t rotation);
+    
+    static bool writeFileRange(int fd, int64_t offset, const std::vector<uint8_t>& data);
 };
 
 // Main DFS client
@@ -114,13 +200,18 @@ public:
     bool put(const std::string& local_file, const std::string& remote_file,
             bool enable_encryption = true, bool enable_erasure_coding = false);
     bool get(const std::string& remote_file, const std::string& local_file);
+    int64_t pread(const std::string& remote_file, void* buffer, size_t count, int64_t offset);
     bool deleteFile(const std::string& remote_file);
     bool listFiles(const std::string& path_prefix = "");
     bool getFileInfo(const std::string& remote_file);
     
     // Configuration
     void enableVerboseLogging(bool enable) { verbose_logging_ = enable; }
+    // Settings below are kept across setCacheSize
     void setCacheSize(size_t size_mb);
+    void setUploadParallelism(size_t chunks_in_flight);
+    void setDownloadParallelism(size_t chunks_in_flight);
+    void setErasureCodingProfile(const ErasureCodingProfile& profile);
     
     // Statistics
     void printStatistics();
@@ -133,11 +224,19 @@ private:
     std::unique_ptr<Downloader> downloader_;
     
     bool verbose_logging_;
+    size_t upload_parallelism_;
+    size_t download_parallelism_;
+    ErasureCodingProfile erasure_profile_;
+    
+    // (Re)creates the uploader and downloader on cache_manager_ with the
+    // settings above
+    void createTransfers();
     
     // Helper methods
     void printProgressBar(int64_t current, int64_t total, const std::string& operation);
     std::string formatFileSize(int64_t bytes);
     std::string formatDuration(int64_t milliseconds);
+    std::string formatErasureProfile(const FileInfo& file);
 };
 
 } // namespace dfs
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "channel_pool.h"
+#include "utils.h"
+
+namespace dfs {
+
+ChannelPool& ChannelPool::getInstance() {
+    static ChannelPool instance;
+    return instance;
+}
+
+ChannelPool::ChannelPool()
+    : subchannels_per_peer_(DEFAULT_SUBCHANNELS_PER_PEER),
+      idle_timeout_ms_(DEFAULT_IDLE_TIMEOUT_MS),
+      last_eviction_(Utils::getCurrentTimestamp()) {
+}
+
+std::shared_ptr<grpc::Channel> ChannelPool::getChannel(const std::string& address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    int64_t now = Utils::getCurrentTimestamp();
+    if (now - last_eviction_ >= idle_timeout_ms_ / 2) {
+        evictIdleLocked(now);
+    }
+
+    Peer& peer = peers_.try_emplace(address, Peer{{}, 0, 0, 0, 0}).first->second;
+    peer.last_used = now;
+
+    // Connections are opened lazily, one more per request until the peer has all of them
+    if (peer.channels.size() < subchannels_per_peer_) {
+        peer.channels.push_back(createChannel(address, peer.channels.size()));
+        return peer.channels.back();
+    }
+
+    size_t index = peer.next_channel++ % peer.channels.size();
+    std::shared_ptr<grpc::Channel>& channel = peer.channels[index];
+    if (channel->GetState(false) == GRPC_CHANNEL_SHUTDOWN) {
+        channel = createChannel(address, index);
+    }
+    return channel;
+}
+
+void ChannelPool::reportResult(const std::string& address, const grpc::Status& status) {
+    bool connection_error = status.error_code() == grpc::StatusCode::UNAVAILABLE ||
+                            status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = peers_.find(address);
+    if (it == peers_.end()) {
+        return;
+    }
+
+    Peer& peer = it->second;
+    if (!connection_error) {
+        peer.consecutive_failures = 0;
+        return;
+    }
+
+    if (++peer.consecutive_failures >= MAX_CONSECUTIVE_FAILURES) {
+        // Fresh channels skip gRPC's reconnect backoff once the peer is back
+        Utils::logWarning("Dropping connections to unresponsive peer " + address);
+        peer.channels.clear();
+        peer.next_channel = 0;
+        peer.consecutive_failures = 0;
+        peer.unhealthy_until = Utils::getCurrentTimestamp() + UNHEALTHY_COOLDOWN_MS;
+    }
+}
+
+bool ChannelPool::isHealthy(const std::string& address) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = peers_.find(address);
+    return it == peers_.end() || Utils::getCurrentTimestamp() >= it->second.unhealthy_until;
+}
+
+void ChannelPool::setSubchannelsPerPeer(size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    subchannels_per_peer_ = count > 0 ? count : 1;
+}
+
+void ChannelPool::setIdleTimeout(int64_t timeout_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_timeout_ms_ = timeout_ms;
+}
+
+void ChannelPool::evictIdle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evictIdleLocked(Utils::getCurrentTimestamp());
+}
+
+void ChannelPool::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peers_.clear();
+}
+
+size_t ChannelPool::getPeerCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peers_.size();
+}
+
+void ChannelPool::evictIdleLocked(int64_t now) {
+    last_eviction_ = now;
+
+    // Channels still held by callers stay usable; the pool just forgets them
+    for (auto it = peers_.begin(); it != peers_.end();) {
+        if (now - it->second.last_used >= idle_timeout_ms_ && now >= it->second.unhealthy_until) {
+            it = peers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::shared_ptr<grpc::Channel> ChannelPool::createChannel(const std::string& address, size_t index) const {
+    grpc::ChannelArguments args;
+    // Channels with identical arguments would otherwise share one global
+    // subchannel (one TCP connection) per address
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+    Utils::logDebug("Opening channel " + std::to_string(index) + " to " + address);
+    return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args);
+}
+
+} // namespace dfs
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+namespace dfs {
+
+// Process-wide pool of gRPC channels keyed by peer address, so that chunk
+// transfers reuse warm connections instead of dialing for every chunk.
+//
+// Each peer gets up to `subchannels_per_peer` channels with their own TCP
+// connections, handed out round robin. Peers unused for the idle timeout
+// are dropped. Callers report RPC results: after repeated connection
+// failures a peer's channels are discarded (the next request dials afresh)
+// and the peer counts as unhealthy for a cool-down period.
+class ChannelPool {
+public:
+    static ChannelPool& getInstance();
+
+    static constexpr size_t DEFAULT_SUBCHANNELS_PER_PEER = 2;
+    static constexpr int64_t DEFAULT_IDLE_TIMEOUT_MS = 5 * 60 * 1000;
+    static constexpr int MAX_CONSECUTIVE_FAILURES = 3;
+    static constexpr int64_t UNHEALTHY_COOLDOWN_MS = 10 * 1000;
+
+    std::shared_ptr<grpc::Channel> getChannel(const std::string& address);
+
+    // Only connection-level errors (UNAVAILABLE, DEADLINE_EXCEEDED) count against a peer
+    void reportResult(const std::string& address, const grpc::Status& status);
+    bool isHealthy(const std::string& address) const;
+
+    // Configuration (applies to channels created afterwards)
+    void setSubchannelsPerPeer(size_t count);
+    void setIdleTimeout(int64_t timeout_ms);
+
+    void evictIdle();
+    void clear();
+    size_t getPeerCount() const;
+
+private:
+    ChannelPool();
+
+    struct Peer {
+        std::vector<std::shared_ptr<grpc::Channel>> channels;
+        size_t next_channel;
+        int64_t last_used;
+        int consecutive_failures;
+        int64_t unhealthy_until;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Peer> peers_;
+    size_t subchannels_per_peer_;
+    int64_t idle_timeout_ms_;
+    int64_t last_eviction_;
+
+    // Callers hold mutex_
+    void evictIdleLocked(int64_t now);
+    std::shared_ptr<grpc::Channel> createChannel(const std::string& address, size_t index) const;
+};
+
+} // namespace dfs
@@ -68,6 +68,9 @@ public:
     static std::vector<uint8_t> decryptChunk(const std::vector<uint8_t>& encryptedData, 
                                            const std::string& keyId);
     
+    // Size of encrypted chunk data (IV + ciphertext + tag)
+    static size_t getEncryptedSize(size_t plaintextSize) { return plaintextSize + IV_SIZE + TAG_SIZE; }
+    
     // Digital signatures for integrity
     static std::string signData(const std::vector<uint8_t>& data, 
                                const std::string& privateKey);
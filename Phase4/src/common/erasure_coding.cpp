@@ -1,179 +1,172 @@
 #include "erasure_coding.h"
 #include "utils.h"
+#include "gf256.h"
 #include <algorithm>
 #include <cstring>
 #include <stdexcept>
 
 namespace dfs {
 
-// Static member initialization
-uint8_t ErasureCoding::gf_log_table_[256];
-uint8_t ErasureCoding::gf_exp_table_[256];
-bool ErasureCoding::tables_initialized_ = false;
+namespace {
 
-ErasureCoding::ErasureCoding(int dataBlocks, int parityBlocks) 
-    : data_blocks_(dataBlocks), parity_blocks_(parityBlocks) {
-    if (!tables_initialized_) {
-        initializeTables();
-        tables_initialized_ = true;
-    }
-}
+constexpr size_t CODING_SLICE_SIZE = 16 * 1024; // Inputs and outputs of a slice stay in L1/L2
 
-ErasureCoding::~ErasureCoding() = default;
+} // namespace
 
-void ErasureCoding::initializeTables() {
-    // Initialize Galois field tables for GF(2^8)
-    // Primitive polynomial: x^8 + x^4 + x^3 + x^2 + 1 (0x11D)
-    
-    gf_exp_table_[0] = 1;
-    gf_log_table_[0] = 0; // undefined, but we'll set it to 0
-    
-    int x = 1;
-    for (int i = 1; i < 255; ++i) {
-        x <<= 1;
-        if (x & 0x100) {
-            x ^= 0x11D; // primitive polynomial
-        }
-        gf_exp_table_[i] = x;
-        gf_log_table_[x] = i;
+bool ErasureCodingProfile::isValid() const {
+    if (data_blocks < 1 || parity_blocks < 0 || local_parity_blocks < 0 ||
+        getTotalBlocks() > ErasureCoding::MAX_TOTAL_BLOCKS) {
+        return false;
     }
-    
-    gf_exp_table_[255] = gf_exp_table_[0];
-    gf_log_table_[1] = 0;
+    // Local groups are equal slices of the data blocks
+    return local_parity_blocks == 0 ||
+           (local_parity_blocks <= data_blocks && data_blocks % local_parity_blocks == 0);
 }
 
-uint8_t ErasureCoding::gf_add(uint8_t a, uint8_t b) {
-    return a ^ b; // Addition in GF(2^8) is XOR
+std::string ErasureCodingProfile::toString() const {
+    std::string text = std::to_string(data_blocks) + "+";
+    if (local_parity_blocks > 0) {
+        text += std::to_string(local_parity_blocks) + "+";
+    }
+    return text + std::to_string(parity_blocks);
 }
 
-uint8_t ErasureCoding::gf_multiply(uint8_t a, uint8_t b) {
-    if (a == 0 || b == 0) return 0;
+bool ErasureCodingProfile::parse(const std::string& text, ErasureCodingProfile& profile) {
+    auto parts = Utils::splitString(text, '+');
+    if (parts.size() != 2 && parts.size() != 3) {
+        return false;
+    }
     
-    int log_a = gf_log_table_[a];
-    int log_b = gf_log_table_[b];
-    int log_result = (log_a + log_b) % 255;
+    std::vector<int> values;
+    for (const std::string& part : parts) {
+        if (part.empty() || part.size() > 3 || part.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        values.push_back(std::stoi(part));
+    }
     
-    return gf_exp_table_[log_result];
+    ErasureCodingProfile parsed{values[0], values.back(), parts.size() == 3 ? values[1] : 0};
+    if (!parsed.isValid()) {
+        return false;
+    }
+    
+    profile = parsed;
+    return true;
 }
 
-uint8_t ErasureCoding::gf_divide(uint8_t a, uint8_t b) {
-    if (a == 0) return 0;
-    if (b == 0) throw std::runtime_error("Division by zero in GF(256)");
-    
-    int log_a = gf_log_table_[a];
-    int log_b = gf_log_table_[b];
-    int log_result = (log_a - log_b + 255) % 255;
-    
-    return gf_exp_table_[log_result];
+ErasureCoding::ErasureCoding(int dataBlocks, int parityBlocks)
+    : ErasureCoding(ErasureCodingProfile{dataBlocks, parityBlocks, 0}) {
 }
 
-uint8_t ErasureCoding::gf_power(uint8_t base, int exp) {
-    if (base == 0) return 0;
-    if (exp == 0) return 1;
+ErasureCoding::ErasureCoding(const ErasureCodingProfile& profile)
+    : data_blocks_(profile.data_blocks), parity_blocks_(profile.parity_blocks),
+      local_parity_blocks_(profile.local_parity_blocks) {
+    if (!profile.isValid()) {
+        throw std::invalid_argument("Unsupported erasure coding configuration: " + profile.toString());
+    }
     
-    int log_base = gf_log_table_[base];
-    int log_result = (log_base * exp) % 255;
+    int total_blocks = getTotalBlocks();
+    encoding_matrix_.assign(total_blocks * data_blocks_, 0);
     
-    return gf_exp_table_[log_result];
-}
-
-std::vector<std::vector<uint8_t>> ErasureCoding::createVandermondeMatrix(int rows, int cols) {
-    std::vector<std::vector<uint8_t>> matrix(rows, std::vector<uint8_t>(cols));
+    // Data blocks are stored as they are
+    for (int i = 0; i < data_blocks_; ++i) {
+        encoding_matrix_[i * data_blocks_ + i] = 1;
+    }
     
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            matrix[i][j] = gf_power(i + 1, j);
+    // Local parity r is the XOR of the data blocks of group r
+    for (int j = 0; j < data_blocks_; ++j) {
+        int group = getLocalGroup(j);
+        if (group >= 0) {
+            encoding_matrix_[(data_blocks_ + group) * data_blocks_ + j] = 1;
         }
     }
     
-    return matrix;
+    // Global parity row i is the Cauchy row 1 / (x_i + y_j) with x_i = i and
+    // y_j = j: all the points are distinct, so without local groups every
+    // square submatrix of the generator obtained by keeping data_blocks_ rows
+    // is invertible and any data_blocks_ surviving blocks rebuild the data
+    // (Vandermonde rows under an identity do not guarantee that)
+    for (int i = data_blocks_ + local_parity_blocks_; i < total_blocks; ++i) {
+        for (int j = 0; j < data_blocks_; ++j) {
+            encoding_matrix_[i * data_blocks_ + j] = gf256::inv(static_cast<uint8_t>(i ^ j));
+        }
+    }
 }
 
-std::vector<std::vector<uint8_t>> ErasureCoding::invertMatrix(const std::vector<std::vector<uint8_t>>& matrix) {
-    int n = matrix.size();
-    if (n == 0 || matrix[0].size() != n) {
+ErasureCoding::~ErasureCoding() = default;
+
+std::vector<uint8_t> ErasureCoding::invertMatrix(const std::vector<uint8_t>& matrix, int n) {
+    if (n <= 0 || matrix.size() != static_cast<size_t>(n) * n) {
         throw std::runtime_error("Matrix must be square for inversion");
     }
     
     // Create augmented matrix [A|I]
-    std::vector<std::vector<uint8_t>> augmented(n, std::vector<uint8_t>(2 * n));
+    const int width = 2 * n;
+    std::vector<uint8_t> augmented(n * width, 0);
     
     for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < n; ++j) {
-            augmented[i][j] = matrix[i][j];
-            augmented[i][j + n] = (i == j) ? 1 : 0;
-        }
+        std::copy(matrix.begin() + i * n, matrix.begin() + (i + 1) * n, augmented.begin() + i * width);
+        augmented[i * width + n + i] = 1;
     }
     
     // Gaussian elimination
     for (int i = 0; i < n; ++i) {
+        uint8_t* row = &augmented[i * width];
+        
         // Find pivot
         int pivot = i;
-        for (int k = i + 1; k < n; ++k) {
-            if (augmented[k][i] != 0) {
-                pivot = k;
-                break;
-            }
+        while (pivot < n && augmented[pivot * width + i] == 0) {
+            pivot++;
         }
         
-        if (augmented[pivot][i] == 0) {
+        if (pivot == n) {
             throw std::runtime_error("Matrix is not invertible");
         }
         
         // Swap rows if needed
         if (pivot != i) {
-            std::swap(augmented[i], augmented[pivot]);
+            std::swap_ranges(row, row + width, &augmented[pivot * width]);
         }
         
         // Scale row to make diagonal element 1
-        uint8_t diagonal = augmented[i][i];
-        for (int j = 0; j < 2 * n; ++j) {
-            if (augmented[i][j] != 0) {
-                augmented[i][j] = gf_divide(augmented[i][j], diagonal);
-            }
-        }
+        gf256::mulRegion(gf256::inv(row[i]), row, row, width);
         
         // Eliminate column
         for (int k = 0; k < n; ++k) {
-            if (k != i && augmented[k][i] != 0) {
-                uint8_t factor = augmented[k][i];
-                for (int j = 0; j < 2 * n; ++j) {
-                    augmented[k][j] = gf_add(augmented[k][j], 
-                                           gf_multiply(factor, augmented[i][j]));
-                }
+            uint8_t factor = augmented[k * width + i];
+            if (k != i && factor != 0) {
+                gf256::mulAddRegion(factor, row, &augmented[k * width], width);
             }
         }
     }
     
     // Extract inverse matrix
-    std::vector<std::vector<uint8_t>> inverse(n, std::vector<uint8_t>(n));
+    std::vector<uint8_t> inverse(n * n);
     for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < n; ++j) {
-            inverse[i][j] = augmented[i][j + n];
-        }
+        std::copy(augmented.begin() + i * width + n, augmented.begin() + (i + 1) * width,
+                  inverse.begin() + i * n);
     }
     
     return inverse;
 }
 
-std::vector<uint8_t> ErasureCoding::matrixVectorMultiply(const std::vector<std::vector<uint8_t>>& matrix,
-                                                        const std::vector<uint8_t>& vector) {
-    int rows = matrix.size();
-    int cols = matrix[0].size();
-    
-    if (cols != static_cast<int>(vector.size())) {
-        throw std::runtime_error("Matrix-vector dimension mismatch");
-    }
-    
-    std::vector<uint8_t> result(rows, 0);
-    
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            result[i] = gf_add(result[i], gf_multiply(matrix[i][j], vector[j]));
+void ErasureCoding::multiplyBlocks(const uint8_t* matrix,
+                                   const std::vector<const uint8_t*>& inputs,
+                                   const std::vector<uint8_t*>& outputs,
+                                   size_t block_size) {
+    const size_t columns = inputs.size();
+    
+    for (size_t offset = 0; offset < block_size; offset += CODING_SLICE_SIZE) {
+        size_t length = std::min(CODING_SLICE_SIZE, block_size - offset);
+        
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            const uint8_t* row = matrix + i * columns;
+            gf256::mulRegion(row[0], inputs[0] + offset, outputs[i] + offset, length);
+            for (size_t j = 1; j < columns; ++j) {
+                gf256::mulAddRegion(row[j], inputs[j] + offset, outputs[i] + offset, length);
+            }
         }
     }
-    
-    return result;
 }
 
 std::vector<std::vector<uint8_t>> ErasureCoding::encode(const std::vector<uint8_t>& data) {
@@ -182,137 +175,308 @@ std::vector<std::vector<uint8_t>> ErasureCoding::encode(const std::vector<uint8_
     }
     
     // Calculate block size
-    int block_size = (data.size() + data_blocks_ - 1) / data_blocks_;
+    size_t block_size = (data.size() + data_blocks_ - 1) / data_blocks_;
     
-    // Pad data and split into blocks
-    std::vector<uint8_t> padded_data = data;
-    while (padded_data.size() < static_cast<size_t>(data_blocks_ * block_size)) {
-        padded_data.push_back(0);
-    }
-    
-    std::vector<std::vector<uint8_t>> data_blocks(data_blocks_, std::vector<uint8_t>(block_size));
+    // Split data into blocks; the last one is zero-padded
+    std::vector<std::vector<uint8_t>> all_blocks(getTotalBlocks(), std::vector<uint8_t>(block_size, 0));
     for (int i = 0; i < data_blocks_; ++i) {
-        std::copy(padded_data.begin() + i * block_size,
-                  padded_data.begin() + (i + 1) * block_size,
-                  data_blocks[i].begin());
+        size_t begin = std::min(data.size(), i * block_size);
+        size_t end = std::min(data.size(), begin + block_size);
+        std::copy(data.begin() + begin, data.begin() + end, all_blocks[i].begin());
     }
     
-    // Create encoding matrix (Vandermonde)
-    auto encoding_matrix = createVandermondeMatrix(data_blocks_ + parity_blocks_, data_blocks_);
-    
-    // Generate all blocks (data + parity)
-    std::vector<std::vector<uint8_t>> all_blocks(data_blocks_ + parity_blocks_);
-    
-    // Copy data blocks
+    std::vector<const uint8_t*> inputs;
     for (int i = 0; i < data_blocks_; ++i) {
-        all_blocks[i] = data_blocks[i];
+        inputs.push_back(all_blocks[i].data());
     }
-    
-    // Generate parity blocks
-    for (int i = data_blocks_; i < data_blocks_ + parity_blocks_; ++i) {
-        all_blocks[i].resize(block_size);
-        for (int j = 0; j < block_size; ++j) {
-            std::vector<uint8_t> column(data_blocks_);
-            for (int k = 0; k < data_blocks_; ++k) {
-                column[k] = data_blocks[k][j];
-            }
-            
-            std::vector<uint8_t> encoded_column = matrixVectorMultiply(
-                std::vector<std::vector<uint8_t>>(
-                    encoding_matrix.begin() + i,
-                    encoding_matrix.begin() + i + 1
-                ), column);
-            
-            all_blocks[i][j] = encoded_column[0];
-        }
+    std::vector<uint8_t*> outputs;
+    for (int i = data_blocks_; i < getTotalBlocks(); ++i) {
+        outputs.push_back(all_blocks[i].data());
     }
     
+    encodeStripe(inputs, outputs, block_size);
+    
     return all_blocks;
 }
 
+void ErasureCoding::encodeStripe(const std::vector<const uint8_t*>& data_cells,
+                                 const std::vector<uint8_t*>& parity_cells,
+                                 size_t cell_size) const {
+    if (data_cells.size() != static_cast<size_t>(data_blocks_) ||
+        parity_cells.size() != static_cast<size_t>(getTotalBlocks() - data_blocks_)) {
+        throw std::runtime_error("Invalid cell count for stripe encoding");
+    }
+    
+    multiplyBlocks(&encoding_matrix_[data_blocks_ * data_blocks_], data_cells, parity_cells, cell_size);
+}
+
 std::vector<uint8_t> ErasureCoding::decode(const std::vector<std::vector<uint8_t>>& blocks,
                                           const std::vector<bool>& availability) {
-    if (blocks.size() != static_cast<size_t>(data_blocks_ + parity_blocks_) ||
-        availability.size() != static_cast<size_t>(data_blocks_ + parity_blocks_)) {
+    if (blocks.size() != static_cast<size_t>(getTotalBlocks()) ||
+        availability.size() != static_cast<size_t>(getTotalBlocks())) {
         throw std::runtime_error("Invalid block or availability vector size");
     }
     
-    // Count available blocks
-    int available_count = 0;
-    std::vector<int> available_indices;
-    for (int i = 0; i < static_cast<int>(availability.size()); ++i) {
-        if (availability[i]) {
-            available_count++;
-            available_indices.push_back(i);
+    // Decode from the first usable available blocks, which include every
+    // available data block
+    std::vector<int> source_blocks;
+    if (!selectSourceBlocks(availability, source_blocks)) {
+        throw std::runtime_error("Not enough blocks available for decoding");
+    }
+    
+    size_t block_size = blocks[source_blocks[0]].size();
+    for (int index : source_blocks) {
+        if (blocks[index].size() != block_size) {
+            throw std::runtime_error("Erasure coded blocks differ in size");
         }
     }
     
-    if (available_count < data_blocks_) {
-        throw std::runtime_error("Not enough blocks available for decoding");
+    std::vector<uint8_t> result(data_blocks_ * block_size);
+    
+    // Available data blocks are copied as they are
+    for (int index : source_blocks) {
+        if (index < data_blocks_) {
+            std::copy(blocks[index].begin(), blocks[index].end(), result.begin() + index * block_size);
+        }
     }
     
-    // If we have all data blocks, just concatenate them
-    bool have_all_data = true;
-    for (int i = 0; i < data_blocks_; ++i) {
-        if (!availability[i]) {
-            have_all_data = false;
-            break;
+    if (source_blocks.back() < data_blocks_) {
+        return result; // Nothing missing
+    }
+    
+    auto plan = getDecodePlan(source_blocks);
+    
+    std::vector<const uint8_t*> inputs;
+    for (int index : source_blocks) {
+        inputs.push_back(blocks[index].data());
+    }
+    std::vector<uint8_t*> outputs;
+    for (int index : plan->missing_blocks) {
+        outputs.push_back(result.data() + index * block_size);
+    }
+    
+    multiplyBlocks(plan->recovery_rows.data(), inputs, outputs, block_size);
+    
+    return result;
+}
+
+std::shared_ptr<const ErasureCoding::DecodePlan> ErasureCoding::getDecodePlan(
+    const std::vector<int>& source_blocks) {
+    uint64_t pattern = 0;
+    for (int index : source_blocks) {
+        pattern |= uint64_t(1) << index;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(decode_cache_mutex_);
+        auto it = decode_plan_index_.find(pattern);
+        if (it != decode_plan_index_.end()) {
+            decode_plans_.splice(decode_plans_.begin(), decode_plans_, it->second);
+            return it->second->second;
         }
     }
     
-    if (have_all_data) {
-        std::vector<uint8_t> result;
-        for (int i = 0; i < data_blocks_; ++i) {
-            result.insert(result.end(), blocks[i].begin(), blocks[i].end());
+    // Inverted outside the lock; a racing thread may build the same plan
+    auto plan = createDecodePlan(source_blocks);
+    
+    std::lock_guard<std::mutex> lock(decode_cache_mutex_);
+    if (decode_plan_index_.find(pattern) == decode_plan_index_.end()) {
+        decode_plans_.emplace_front(pattern, plan);
+        decode_plan_index_[pattern] = decode_plans_.begin();
+        
+        if (decode_plans_.size() > DECODE_CACHE_CAPACITY) {
+            decode_plan_index_.erase(decode_plans_.back().first);
+            decode_plans_.pop_back();
         }
-        return result;
     }
+    return plan;
+}
+
+std::shared_ptr<const ErasureCoding::DecodePlan> ErasureCoding::createDecodePlan(
+    const std::vector<int>& source_blocks) const {
+    auto plan = std::make_shared<DecodePlan>();
     
-    // Use first data_blocks_ available blocks for decoding
-    available_indices.resize(data_blocks_);
+    // The rows of the generator matrix for the source blocks map the data
+    // to them; the inverse maps them back to the data
+    std::vector<uint8_t> decoding_matrix(data_blocks_ * data_blocks_);
+    for (int i = 0; i < data_blocks_; ++i) {
+        std::copy(encoding_matrix_.begin() + source_blocks[i] * data_blocks_,
+                  encoding_matrix_.begin() + (source_blocks[i] + 1) * data_blocks_,
+                  decoding_matrix.begin() + i * data_blocks_);
+    }
     
-    // Create decoding matrix
-    auto encoding_matrix = createVandermondeMatrix(data_blocks_ + parity_blocks_, data_blocks_);
-    std::vector<std::vector<uint8_t>> decoding_matrix(data_blocks_);
+    std::vector<uint8_t> inverse = invertMatrix(decoding_matrix, data_blocks_);
     
+    // Only the rows for the missing data blocks are needed
+    std::vector<bool> present(data_blocks_, false);
+    for (int index : source_blocks) {
+        if (index < data_blocks_) {
+            present[index] = true;
+        }
+    }
     for (int i = 0; i < data_blocks_; ++i) {
-        decoding_matrix[i] = encoding_matrix[available_indices[i]];
+        if (!present[i]) {
+            plan->missing_blocks.push_back(i);
+            plan->recovery_rows.insert(plan->recovery_rows.end(), inverse.begin() + i * data_blocks_,
+                                       inverse.begin() + (i + 1) * data_blocks_);
+        }
     }
     
-    auto inverse_matrix = invertMatrix(decoding_matrix);
+    return plan;
+}
+
+bool ErasureCoding::canDecode(const std::vector<bool>& availability) const {
+    std::vector<int> source_blocks;
+    return availability.size() == static_cast<size_t>(getTotalBlocks()) &&
+           selectSourceBlocks(availability, source_blocks);
+}
+
+int ErasureCoding::getLocalGroup(int block) const {
+    if (local_parity_blocks_ == 0 || block < 0) {
+        return -1;
+    }
+    if (block < data_blocks_) {
+        return block / (data_blocks_ / local_parity_blocks_);
+    }
+    if (block < data_blocks_ + local_parity_blocks_) {
+        return block - data_blocks_;
+    }
+    return -1;
+}
+
+bool ErasureCoding::selectSourceBlocks(const std::vector<bool>& availability,
+                                       std::vector<int>& source_blocks) const {
+    source_blocks.clear();
+    
+    if (local_parity_blocks_ == 0) {
+        // Any data_blocks_ rows of the generator are independent
+        for (size_t i = 0; i < availability.size() &&
+                           static_cast<int>(source_blocks.size()) < data_blocks_; ++i) {
+            if (availability[i]) {
+                source_blocks.push_back(static_cast<int>(i));
+            }
+        }
+        return static_cast<int>(source_blocks.size()) == data_blocks_;
+    }
     
-    // Decode block by block
-    int block_size = blocks[available_indices[0]].size();
-    std::vector<std::vector<uint8_t>> decoded_blocks(data_blocks_, std::vector<uint8_t>(block_size));
+    // Rows of a local group are dependent once the group is complete, so
+    // rows are only taken if they are independent of the ones already taken
+    // (kept reduced, each with a leading 1 in its pivot column)
+    std::vector<std::vector<uint8_t>> basis;
+    std::vector<int> pivots;
     
-    for (int j = 0; j < block_size; ++j) {
-        std::vector<uint8_t> available_symbols(data_blocks_);
-        for (int i = 0; i < data_blocks_; ++i) {
-            available_symbols[i] = blocks[available_indices[i]][j];
+    for (size_t i = 0; i < availability.size() &&
+                       static_cast<int>(source_blocks.size()) < data_blocks_; ++i) {
+        if (!availability[i]) {
+            continue;
         }
         
-        std::vector<uint8_t> decoded_symbols = matrixVectorMultiply(inverse_matrix, available_symbols);
+        std::vector<uint8_t> row(encoding_matrix_.begin() + i * data_blocks_,
+                                 encoding_matrix_.begin() + (i + 1) * data_blocks_);
+        for (size_t b = 0; b < basis.size(); ++b) {
+            gf256::mulAddRegion(row[pivots[b]], basis[b].data(), row.data(), data_blocks_);
+        }
         
-        for (int i = 0; i < data_blocks_; ++i) {
-            decoded_blocks[i][j] = decoded_symbols[i];
+        auto pivot = std::find_if(row.begin(), row.end(), [](uint8_t value) { return value != 0; });
+        if (pivot == row.end()) {
+            continue;
         }
+        gf256::mulRegion(gf256::inv(*pivot), row.data(), row.data(), data_blocks_);
+        
+        pivots.push_back(static_cast<int>(pivot - row.begin()));
+        basis.push_back(std::move(row));
+        source_blocks.push_back(static_cast<int>(i));
     }
     
-    // Concatenate decoded blocks
-    std::vector<uint8_t> result;
-    for (int i = 0; i < data_blocks_; ++i) {
-        result.insert(result.end(), decoded_blocks[i].begin(), decoded_blocks[i].end());
+    return static_cast<int>(source_blocks.size()) == data_blocks_;
+}
+
+bool ErasureCoding::getLocalRepairSources(int block, const std::vector<bool>& availability,
+                                          std::vector<int>& members) const {
+    int group = getLocalGroup(block);
+    if (group < 0) {
+        return false;
     }
     
-    return result;
+    int group_size = data_blocks_ / local_parity_blocks_;
+    members.clear();
+    for (int j = group * group_size; j < (group + 1) * group_size; ++j) {
+        if (j != block) {
+            members.push_back(j);
+        }
+    }
+    if (block != data_blocks_ + group) {
+        members.push_back(data_blocks_ + group);
+    }
+    
+    return std::all_of(members.begin(), members.end(), [&](int index) { return availability[index]; });
 }
 
-bool ErasureCoding::canDecode(const std::vector<bool>& availability) const {
-    int available_count = 0;
-    for (bool avail : availability) {
-        if (avail) available_count++;
+std::vector<int> ErasureCoding::getRepairSources(int block, const std::vector<bool>& availability) const {
+    if (block < 0 || block >= getTotalBlocks() ||
+        availability.size() != static_cast<size_t>(getTotalBlocks())) {
+        return {};
+    }
+    
+    std::vector<int> sources;
+    if (getLocalRepairSources(block, availability, sources)) {
+        return sources;
+    }
+    
+    // Otherwise decode the data and re-encode the block
+    std::vector<bool> others = availability;
+    others[block] = false;
+    if (!selectSourceBlocks(others, sources)) {
+        return {};
     }
-    return available_count >= data_blocks_;
+    return sources;
+}
+
+std::vector<uint8_t> ErasureCoding::repairBlock(int block,
+                                                const std::vector<std::vector<uint8_t>>& blocks,
+                                                const std::vector<bool>& availability) {
+    if (blocks.size() != static_cast<size_t>(getTotalBlocks())) {
+        throw std::runtime_error("Invalid block vector size");
+    }
+    
+    std::vector<int> sources = getRepairSources(block, availability);
+    if (sources.empty()) {
+        throw std::runtime_error("Not enough blocks available to repair block " + std::to_string(block));
+    }
+    
+    size_t block_size = blocks[sources[0]].size();
+    for (int index : sources) {
+        if (blocks[index].size() != block_size) {
+            throw std::runtime_error("Erasure coded blocks differ in size");
+        }
+    }
+    
+    std::vector<uint8_t> repaired(block_size);
+    
+    std::vector<int> members;
+    if (getLocalRepairSources(block, availability, members)) {
+        // A local group XORs to zero
+        std::vector<const uint8_t*> inputs;
+        for (int index : members) {
+            inputs.push_back(blocks[index].data());
+        }
+        std::vector<uint8_t> ones(inputs.size(), 1);
+        multiplyBlocks(ones.data(), inputs, {repaired.data()}, block_size);
+        return repaired;
+    }
+    
+    std::vector<bool> source_availability(blocks.size(), false);
+    for (int index : sources) {
+        source_availability[index] = true;
+    }
+    std::vector<uint8_t> data = decode(blocks, source_availability);
+    
+    std::vector<const uint8_t*> inputs;
+    for (int i = 0; i < data_blocks_; ++i) {
+        inputs.push_back(data.data() + i * block_size);
+    }
+    multiplyBlocks(&encoding_matrix_[block * data_blocks_], inputs, {repaired.data()}, block_size);
+    return repaired;
 }
 
 // ErasureCodedChunkManager implementation
@@ -321,6 +485,10 @@ ErasureCodedChunkManager::ErasureCodedChunkManager(int dataBlocks, int parityBlo
     : erasure_coder_(dataBlocks, parityBlocks) {
 }
 
+ErasureCodedChunkManager::ErasureCodedChunkManager(const ErasureCodingProfile& profile)
+    : erasure_coder_(profile) {
+}
+
 ErasureCodedChunkManager::CodeGroup ErasureCodedChunkManager::encodeChunk(
     const std::string& chunkId, const std::vector<uint8_t>& data) {
     
@@ -328,6 +496,7 @@ ErasureCodedChunkManager::CodeGroup ErasureCodedChunkManager::encodeChunk(
     group.group_id = chunkId + "_group";
     group.data_blocks = erasure_coder_.getDataBlocks();
     group.parity_blocks = erasure_coder_.getParityBlocks();
+    group.local_parity_blocks = erasure_coder_.getLocalParityBlocks();
     group.original_size = data.size();
     
     // Encode the data
@@ -353,24 +522,10 @@ std::vector<uint8_t> ErasureCodedChunkManager::decodeChunk(const CodeGroup& grou
         throw std::runtime_error("No blocks available for decoding");
     }
     
-    // Sort blocks by index
-    auto sorted_blocks = group.blocks;
-    std::sort(sorted_blocks.begin(), sorted_blocks.end(),
-              [](const CodedChunk& a, const CodedChunk& b) {
-                  return a.block_index < b.block_index;
-              });
-    
     // Prepare blocks and availability for decoder
-    int total_blocks = group.data_blocks + group.parity_blocks;
-    std::vector<std::vector<uint8_t>> blocks(total_blocks);
-    std::vector<bool> availability(total_blocks, false);
-    
-    for (const auto& chunk : sorted_blocks) {
-        if (chunk.block_index >= 0 && chunk.block_index < total_blocks) {
-            blocks[chunk.block_index] = chunk.data;
-            availability[chunk.block_index] = true;
-        }
-    }
+    std::vector<std::vector<uint8_t>> blocks;
+    std::vector<bool> availability;
+    collectBlocks(group, blocks, availability);
     
     // Decode
     auto decoded_data = erasure_coder_.decode(blocks, availability);
@@ -380,7 +535,7 @@ std::vector<uint8_t> ErasureCodedChunkManager::decodeChunk(const CodeGroup& grou
 }
 
 bool ErasureCodedChunkManager::canDecodeChunk(const CodeGroup& group) const {
-    std::vector<bool> availability(group.data_blocks + group.parity_blocks, false);
+    std::vector<bool> availability(erasure_coder_.getTotalBlocks(), false);
     
     for (const auto& chunk : group.blocks) {
         if (chunk.block_index >= 0 && 
@@ -392,36 +547,69 @@ bool ErasureCodedChunkManager::canDecodeChunk(const CodeGroup& group) const {
     return erasure_coder_.canDecode(availability);
 }
 
+std::vector<int> ErasureCodedChunkManager::getBlocksNeededForRepair(const CodeGroup& group,
+                                                                   int missingIndex) const {
+    std::vector<bool> availability(erasure_coder_.getTotalBlocks(), false);
+    
+    for (const auto& chunk : group.blocks) {
+        if (chunk.block_index >= 0 && 
+            chunk.block_index < static_cast<int>(availability.size())) {
+            availability[chunk.block_index] = true;
+        }
+    }
+    
+    return erasure_coder_.getRepairSources(missingIndex, availability);
+}
+
 std::vector<ErasureCodedChunkManager::CodedChunk> ErasureCodedChunkManager::repairMissingBlocks(
     const CodeGroup& group, const std::vector<int>& missingIndices) {
     
-    // First decode the original data
-    auto original_data = decodeChunk(group);
+    std::vector<std::vector<uint8_t>> blocks;
+    std::vector<bool> availability;
+    collectBlocks(group, blocks, availability);
     
-    // Re-encode to get all blocks
-    auto full_group = encodeChunk(group.group_id, original_data);
+    for (int index : missingIndices) {
+        if (index >= 0 && index < static_cast<int>(availability.size())) {
+            availability[index] = false;
+        }
+    }
     
-    // Return only the missing blocks
+    // Each block is rebuilt from the fewest blocks possible (its local group
+    // when it has one); rebuilt blocks can then serve the next repairs
     std::vector<CodedChunk> repaired_blocks;
     for (int index : missingIndices) {
-        if (index >= 0 && index < static_cast<int>(full_group.blocks.size())) {
-            repaired_blocks.push_back(full_group.blocks[index]);
+        if (index < 0 || index >= static_cast<int>(availability.size())) {
+            continue;
         }
+        
+        CodedChunk chunk;
+        chunk.chunk_id = group.group_id + "_block_" + std::to_string(index);
+        chunk.block_index = index;
+        chunk.is_parity = (index >= erasure_coder_.getDataBlocks());
+        chunk.data = erasure_coder_.repairBlock(index, blocks, availability);
+        chunk.checksum = Utils::calculateSHA256(chunk.data);
+        
+        blocks[index] = chunk.data;
+        availability[index] = true;
+        repaired_blocks.push_back(std::move(chunk));
     }
     
     return repaired_blocks;
 }
 
-std::vector<uint8_t> ErasureCodedChunkManager::padData(const std::vector<uint8_t>& data, int blockSize) {
-    std::vector<uint8_t> padded = data;
-    int data_blocks = erasure_coder_.getDataBlocks();
-    size_t target_size = data_blocks * blockSize;
+void ErasureCodedChunkManager::collectBlocks(const CodeGroup& group,
+                                             std::vector<std::vector<uint8_t>>& blocks,
+                                             std::vector<bool>& availability) const {
+    int total_blocks = erasure_coder_.getTotalBlocks();
+    blocks.assign(total_blocks, {});
+    availability.assign(total_blocks, false);
     
-    while (padded.size() < target_size) {
-        padded.push_back(0);
+    for (const auto& chunk : group.blocks) {
+        if (chunk.block_index >= 0 && chunk.block_index < total_blocks) {
+            blocks[chunk.block_index] = chunk.data;
+            availability[chunk.block_index] = true;
+        }
     }
-    
-    return padded;
 }
 
 std::vector<uint8_t> ErasureCodedChunkManager::removePadding(const std::vector<uint8_t>& data, 
@@ -433,4 +621,183 @@ std::vector<uint8_t> ErasureCodedChunkManager::removePadding(const std::vector<u
     return std::vector<uint8_t>(data.begin(), data.begin() + originalSize);
 }
 
-} // namespace dfs
\ No newline at end of file
+// StripeLayout implementation
+
+StripeLayout::StripeLayout(int dataBlocks, size_t cellSize, int64_t dataSize)
+    : data_blocks_(dataBlocks), cell_size_(cellSize), data_size_(dataSize) {
+    if (dataBlocks < 1 || cellSize == 0 || dataSize < 0) {
+        throw std::invalid_argument("Invalid stripe layout");
+    }
+    
+    full_stripes_ = data_size_ / getStripeSize();
+    size_t remainder = data_size_ % getStripeSize();
+    last_cell_size_ = (remainder + data_blocks_ - 1) / data_blocks_;
+}
+
+int64_t StripeLayout::getStripeCount() const {
+    return full_stripes_ + (last_cell_size_ > 0 ? 1 : 0);
+}
+
+size_t StripeLayout::getCellSize(int64_t stripe) const {
+    return stripe < full_stripes_ ? cell_size_ : last_cell_size_;
+}
+
+int64_t StripeLayout::getBlockSize() const {
+    return full_stripes_ * static_cast<int64_t>(cell_size_) + last_cell_size_;
+}
+
+std::vector<StripeLayout::Extent> StripeLayout::mapRange(int64_t offset, int64_t length) const {
+    std::vector<Extent> extents;
+    int64_t end = std::min(data_size_, offset + length);
+    
+    for (int64_t position = std::max<int64_t>(offset, 0); position < end;) {
+        int64_t stripe = position / getStripeSize();
+        size_t cell_size = getCellSize(stripe);
+        int64_t in_stripe = position - stripe * static_cast<int64_t>(getStripeSize());
+        int64_t in_cell = in_stripe % cell_size;
+        
+        Extent extent;
+        extent.stripe = stripe;
+        extent.block = static_cast<int>(in_stripe / cell_size);
+        extent.block_offset = stripe * static_cast<int64_t>(cell_size_) + in_cell;
+        extent.data_offset = position;
+        extent.length = static_cast<size_t>(std::min<int64_t>(cell_size - in_cell, end - position));
+        
+        extents.push_back(extent);
+        position += extent.length;
+    }
+    
+    return extents;
+}
+
+// StripeEncoder implementation
+
+StripeEncoder::StripeEncoder(const ErasureCoding& coder, const StripeLayout& layout, StripeCallback callback)
+    : coder_(coder), layout_(layout), callback_(std::move(callback)),
+      stripe_buffer_(coder.getTotalBlocks() * layout.getCellSize(0)),
+      buffered_(0), next_stripe_(0), failed_(false) {
+    if (coder.getDataBlocks() != layout.getDataBlocks()) {
+        throw std::invalid_argument("Stripe layout does not match the erasure coding profile");
+    }
+}
+
+bool StripeEncoder::append(const uint8_t* data, size_t size) {
+    while (size > 0 && !failed_) {
+        if (next_stripe_ >= layout_.getStripeCount()) {
+            failed_ = true; // More data than the layout holds
+            break;
+        }
+        
+        size_t capacity = layout_.getDataBlocks() * layout_.getCellSize(next_stripe_);
+        size_t count = std::min(size, capacity - buffered_);
+        std::memcpy(stripe_buffer_.data() + buffered_, data, count);
+        buffered_ += count;
+        data += count;
+        size -= count;
+        
+        if (buffered_ == capacity && !flushStripe()) {
+            failed_ = true;
+        }
+    }
+    return !failed_;
+}
+
+bool StripeEncoder::finish() {
+    if (!failed_ && buffered_ > 0 && !flushStripe()) {
+        failed_ = true;
+    }
+    return !failed_ && next_stripe_ == layout_.getStripeCount();
+}
+
+bool StripeEncoder::flushStripe() {
+    size_t cell_size = layout_.getCellSize(next_stripe_);
+    int data_blocks = coder_.getDataBlocks();
+    
+    // A partial last stripe is zero-padded
+    std::memset(stripe_buffer_.data() + buffered_, 0, data_blocks * cell_size - buffered_);
+    
+    std::vector<const uint8_t*> cells;
+    std::vector<const uint8_t*> data_cells;
+    std::vector<uint8_t*> parity_cells;
+    for (int i = 0; i < coder_.getTotalBlocks(); ++i) {
+        uint8_t* cell = stripe_buffer_.data() + i * cell_size;
+        cells.push_back(cell);
+        if (i < data_blocks) {
+            data_cells.push_back(cell);
+        } else {
+            parity_cells.push_back(cell);
+        }
+    }
+    
+    coder_.encodeStripe(data_cells, parity_cells, cell_size);
+    
+    buffered_ = 0;
+    return callback_(next_stripe_++, cells, cell_size);
+}
+
+// StripeReader implementation
+
+StripeReader::StripeReader(ErasureCoding& coder, const StripeLayout& layout, BlockReader reader)
+    : coder_(coder), layout_(layout), reader_(std::move(reader)),
+      available_(coder.getTotalBlocks(), true) {
+    if (coder.getDataBlocks() != layout.getDataBlocks()) {
+        throw std::invalid_argument("Stripe layout does not match the erasure coding profile");
+    }
+}
+
+bool StripeReader::read(int64_t offset, size_t length, uint8_t* out) {
+    if (offset < 0 || offset + static_cast<int64_t>(length) > layout_.getDataSize()) {
+        return false;
+    }
+    
+    for (const auto& extent : layout_.mapRange(offset, length)) {
+        uint8_t* target = out + (extent.data_offset - offset);
+        
+        if (available_[extent.block] &&
+            reader_(extent.block, extent.block_offset, extent.length, target)) {
+            continue;
+        }
+        available_[extent.block] = false;
+        
+        if (!readDegraded(extent.block, extent.block_offset, extent.length, target)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StripeReader::readDegraded(int block, int64_t offset, size_t length, uint8_t* out) {
+    std::vector<std::vector<uint8_t>> blocks(coder_.getTotalBlocks());
+    
+    // Sources that fail are dropped and the repair is planned again
+    while (true) {
+        std::vector<int> sources = coder_.getRepairSources(block, available_);
+        if (sources.empty()) {
+            Utils::logError("Not enough blocks to rebuild block " + std::to_string(block) +
+                           " of an erasure-coded group");
+            return false;
+        }
+        
+        bool complete = true;
+        for (int source : sources) {
+            if (blocks[source].size() == length) {
+                continue; // Read for an earlier plan
+            }
+            blocks[source].resize(length);
+            if (!reader_(source, offset, length, blocks[source].data())) {
+                blocks[source].clear();
+                available_[source] = false;
+                complete = false;
+                break;
+            }
+        }
+        
+        if (complete) {
+            std::vector<uint8_t> rebuilt = coder_.repairBlock(block, blocks, available_);
+            std::memcpy(out, rebuilt.data(), length);
+            return true;
+        }
+    }
+}
+
+} // namespace dfs
@@ -1,58 +1,150 @@
 #pragma once
 
+#include "utils.h"
 #include <vector>
 #include <string>
 #include <memory>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
 
 namespace dfs {
 
-// Reed-Solomon erasure coding implementation
+// Shape of an erasure-coded stripe. Plain Reed-Solomon stripes have
+// data_blocks + parity_blocks blocks, any data_blocks of which rebuild the
+// data, written "k+m" (e.g. "6+3"). Locally repairable (LRC) stripes split
+// the data blocks into local_parity_blocks equal groups, each with an XOR
+// parity block, on top of parity_blocks global parities, written "k+l+g"
+// (e.g. "12+2+2"). A single lost block of a group is rebuilt from its group
+// alone: k / l reads instead of k.
+struct ErasureCodingProfile {
+    int data_blocks = ERASURE_CODING_DATA_BLOCKS;
+    int parity_blocks = ERASURE_CODING_PARITY_BLOCKS;  // Global parities
+    int local_parity_blocks = 0;                       // Local groups, 0 for plain RS
+    
+    int getTotalBlocks() const { return data_blocks + local_parity_blocks + parity_blocks; }
+    bool isLocallyRepairable() const { return local_parity_blocks > 0; }
+    
+    // Stored bytes per byte of data
+    double getStorageOverhead() const {
+        return static_cast<double>(getTotalBlocks()) / data_blocks;
+    }
+    
+    bool isValid() const;
+    std::string toString() const;
+    
+    // Parse "k+m" or "k+l+g"; false if malformed or not a valid profile
+    static bool parse(const std::string& text, ErasureCodingProfile& profile);
+};
+
+// Systematic Cauchy Reed-Solomon erasure coding, optionally with local
+// groups (LRC). The data blocks are stored as they are; blocks are ordered
+// data, local parities, global parities. Without local groups any
+// data_blocks of the blocks rebuild the data.
 class ErasureCoding {
 public:
+    // At most MAX_TOTAL_BLOCKS blocks in total (throws std::invalid_argument)
     ErasureCoding(int dataBlocks, int parityBlocks);
+    explicit ErasureCoding(const ErasureCodingProfile& profile);
     ~ErasureCoding();
     
+    static constexpr int MAX_TOTAL_BLOCKS = 64;
+    
     // Encode data into data blocks + parity blocks
     std::vector<std::vector<uint8_t>> encode(const std::vector<uint8_t>& data);
     
-    // Decode data from available blocks (requires at least dataBlocks)
+    // Compute the parity cells (local, then global) of one stripe from its
+    // data cells, all cell_size bytes
+    void encodeStripe(const std::vector<const uint8_t*>& data_cells,
+                      const std::vector<uint8_t*>& parity_cells,
+                      size_t cell_size) const;
+    
+    // Decode data from available blocks (requires dataBlocks independent ones)
     std::vector<uint8_t> decode(const std::vector<std::vector<uint8_t>>& blocks,
                                const std::vector<bool>& availability);
     
     // Check if we have enough blocks to decode
     bool canDecode(const std::vector<bool>& availability) const;
     
+    // Blocks to read to rebuild `block`: the rest of its local group if all
+    // of it is available, otherwise dataBlocks blocks to decode from; empty
+    // if it cannot be rebuilt
+    std::vector<int> getRepairSources(int block, const std::vector<bool>& availability) const;
+    
+    // Rebuild one block from the blocks named by getRepairSources (the
+    // others may be missing)
+    std::vector<uint8_t> repairBlock(int block,
+                                     const std::vector<std::vector<uint8_t>>& blocks,
+                                     const std::vector<bool>& availability);
+    
     // Get total number of blocks (data + parity)
-    int getTotalBlocks() const { return data_blocks_ + parity_blocks_; }
+    int getTotalBlocks() const { return data_blocks_ + local_parity_blocks_ + parity_blocks_; }
     
     // Get number of data blocks
     int getDataBlocks() const { return data_blocks_; }
     
-    // Get number of parity blocks
+    // Get number of global parity blocks
     int getParityBlocks() const { return parity_blocks_; }
     
+    // Get number of local parity blocks (local groups)
+    int getLocalParityBlocks() const { return local_parity_blocks_; }
+    
+    ErasureCodingProfile getProfile() const {
+        return {data_blocks_, parity_blocks_, local_parity_blocks_};
+    }
+    
 private:
     int data_blocks_;
     int parity_blocks_;
+    int local_parity_blocks_;
+    
+    // Local group of a data or local parity block, -1 for global parities
+    int getLocalGroup(int block) const;
     
-    // Galois field operations
-    uint8_t gf_add(uint8_t a, uint8_t b);
-    uint8_t gf_multiply(uint8_t a, uint8_t b);
-    uint8_t gf_divide(uint8_t a, uint8_t b);
-    uint8_t gf_power(uint8_t base, int exp);
+    // The rest of block's local group, and whether all of it is available
+    bool getLocalRepairSources(int block, const std::vector<bool>& availability,
+                               std::vector<int>& members) const;
     
-    // Matrix operations in GF(256)
-    std::vector<std::vector<uint8_t>> createVandermondeMatrix(int rows, int cols);
-    std::vector<std::vector<uint8_t>> invertMatrix(const std::vector<std::vector<uint8_t>>& matrix);
-    std::vector<uint8_t> matrixVectorMultiply(const std::vector<std::vector<uint8_t>>& matrix,
-                                             const std::vector<uint8_t>& vector);
+    // The first dataBlocks available blocks with independent generator
+    // rows; false if there are not enough
+    bool selectSourceBlocks(const std::vector<bool>& availability, std::vector<int>& source_blocks) const;
     
-    // Precomputed tables for Galois field operations
-    static uint8_t gf_log_table_[256];
-    static uint8_t gf_exp_table_[256];
-    static bool tables_initialized_;
+    // Generator matrix, computed once: one row per block (identity rows for
+    // the data blocks, XOR rows for the local parities, then the Cauchy
+    // parity rows), row-major, data_blocks_ columns
+    std::vector<uint8_t> encoding_matrix_;
     
-    void initializeTables();
+    // How to rebuild the missing data blocks from a given set of surviving
+    // blocks: the matching rows of the inverted decode matrix
+    struct DecodePlan {
+        std::vector<int> missing_blocks;    // Data blocks to rebuild
+        std::vector<uint8_t> recovery_rows; // missing_blocks.size() x data_blocks_
+    };
+    
+    // Plans for recent erasure patterns (bitmap of source blocks), most
+    // recently used first
+    static constexpr size_t DECODE_CACHE_CAPACITY = 64;
+    using DecodePlanList = std::list<std::pair<uint64_t, std::shared_ptr<const DecodePlan>>>;
+    DecodePlanList decode_plans_;
+    std::unordered_map<uint64_t, DecodePlanList::iterator> decode_plan_index_;
+    std::mutex decode_cache_mutex_;
+    
+    std::shared_ptr<const DecodePlan> getDecodePlan(const std::vector<int>& source_blocks);
+    std::shared_ptr<const DecodePlan> createDecodePlan(const std::vector<int>& source_blocks) const;
+    
+    // Matrix operations in GF(256) on row-major n x n matrices (see gf256.h
+    // for the field itself)
+    static std::vector<uint8_t> invertMatrix(const std::vector<uint8_t>& matrix, int n);
+    
+    // outputs[i] = sum over j of matrix[i][j] * inputs[j] for a row-major
+    // matrix with inputs.size() columns, a whole block at a time; the region
+    // is processed in cache-sized slices
+    static void multiplyBlocks(const uint8_t* matrix,
+                               const std::vector<const uint8_t*>& inputs,
+                               const std::vector<uint8_t*>& outputs,
+                               size_t block_size);
 };
 
 // Chunk manager with erasure coding support
@@ -70,11 +162,14 @@ public:
         std::string group_id;
         std::vector<CodedChunk> blocks;
         int data_blocks;
-        int parity_blocks;
+        int parity_blocks;          // Global parities
+        int local_parity_blocks;
         int64_t original_size;
     };
     
-    ErasureCodedChunkManager(int dataBlocks = 4, int parityBlocks = 2);
+    ErasureCodedChunkManager(int dataBlocks = ERASURE_CODING_DATA_BLOCKS,
+                             int parityBlocks = ERASURE_CODING_PARITY_BLOCKS);
+    explicit ErasureCodedChunkManager(const ErasureCodingProfile& profile);
     
     // Encode a chunk into multiple coded blocks
     CodeGroup encodeChunk(const std::string& chunkId, const std::vector<uint8_t>& data);
@@ -88,18 +183,115 @@ public:
     // Get minimum blocks needed for decoding
     int getMinimumBlocksNeeded() const { return erasure_coder_.getDataBlocks(); }
     
-    // Repair missing blocks
+    ErasureCodingProfile getProfile() const { return erasure_coder_.getProfile(); }
+    
+    // Blocks of the group to fetch before repairing missingIndex; with local
+    // groups a single loss only needs the rest of its group
+    std::vector<int> getBlocksNeededForRepair(const CodeGroup& group, int missingIndex) const;
+    
+    // Repair missing blocks from the blocks present in `group`
     std::vector<CodedChunk> repairMissingBlocks(const CodeGroup& group,
                                                const std::vector<int>& missingIndices);
     
 private:
     ErasureCoding erasure_coder_;
     
-    // Pad data to make it divisible by data_blocks
-    std::vector<uint8_t> padData(const std::vector<uint8_t>& data, int blockSize);
+    // Blocks of the group by index, with which of them are present
+    void collectBlocks(const CodeGroup& group, std::vector<std::vector<uint8_t>>& blocks,
+                       std::vector<bool>& availability) const;
     
     // Remove padding from decoded data
     std::vector<uint8_t> removePadding(const std::vector<uint8_t>& data, int64_t originalSize);
 };
 
-} // namespace dfs
\ No newline at end of file
+// Striped layout of an erasure-coded block group. The group's data is cut
+// into cells dealt round-robin over the data blocks: stripe s is the data
+// at s * stripe size, its cells sit at s * cell size in every block (parity
+// blocks hold the stripe's parity cells). The last stripe's cells shrink to
+// fit its data, zero-padded, so every block has the same size.
+class StripeLayout {
+public:
+    static constexpr size_t DEFAULT_CELL_SIZE = STREAM_FRAME_SIZE;
+    
+    StripeLayout(int dataBlocks, size_t cellSize, int64_t dataSize);
+    
+    int getDataBlocks() const { return data_blocks_; }
+    int64_t getDataSize() const { return data_size_; }
+    size_t getStripeSize() const { return data_blocks_ * cell_size_; }
+    int64_t getStripeCount() const;
+    size_t getCellSize(int64_t stripe) const;
+    int64_t getBlockSize() const;
+    
+    // A piece of the data that lies in a single cell
+    struct Extent {
+        int64_t stripe;
+        int block;
+        int64_t block_offset;
+        int64_t data_offset;
+        size_t length;
+    };
+    
+    // Cells covering the data range [offset, offset + length), in order
+    std::vector<Extent> mapRange(int64_t offset, int64_t length) const;
+    
+private:
+    int data_blocks_;
+    size_t cell_size_;
+    int64_t data_size_;
+    int64_t full_stripes_;
+    size_t last_cell_size_;     // Cell size of a trailing partial stripe, 0 if none
+};
+
+// Streaming encoder: takes a block group's data in pieces of any size and
+// hands over each stripe, data and parity cells, as soon as it is complete,
+// so memory stays at one stripe
+class StripeEncoder {
+public:
+    // Receives the cells of one stripe (one per block, in block order);
+    // returning false stops the encoder
+    using StripeCallback = std::function<bool(int64_t stripe, const std::vector<const uint8_t*>& cells,
+                                              size_t cell_size)>;
+    
+    StripeEncoder(const ErasureCoding& coder, const StripeLayout& layout, StripeCallback callback);
+    
+    // False if the callback failed or the data exceeds the layout's size
+    bool append(const uint8_t* data, size_t size);
+    
+    // Emits the trailing partial stripe; false unless all data was encoded
+    bool finish();
+    
+private:
+    const ErasureCoding& coder_;
+    StripeLayout layout_;
+    StripeCallback callback_;
+    std::vector<uint8_t> stripe_buffer_;    // Data cells, then parity cells
+    size_t buffered_;
+    int64_t next_stripe_;
+    bool failed_;
+    
+    bool flushStripe();
+};
+
+// Reads byte ranges of a block group. Healthy reads touch only the cells in
+// the range; when a block cannot be read, only the same byte range of the
+// blocks needed to rebuild it (its local group if possible) is read and
+// decoded. Blocks that failed once are not tried again.
+class StripeReader {
+public:
+    // Reads `length` bytes at `offset` of `block` into `out`
+    using BlockReader = std::function<bool(int block, int64_t offset, size_t length, uint8_t* out)>;
+    
+    StripeReader(ErasureCoding& coder, const StripeLayout& layout, BlockReader reader);
+    
+    bool read(int64_t offset, size_t length, uint8_t* out);
+    
+private:
+    ErasureCoding& coder_;
+    StripeLayout layout_;
+    BlockReader reader_;
+    std::vector<bool> available_;
+    
+    bool readDegraded(int block, int64_t offset, size_t length, uint8_t* out);
+};
+
+} // namespace dfs
@@ -0,0 +1,187 @@
+#include "gf256.h"
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DFS_GF256_X86 1
+#endif
+
+namespace dfs {
+namespace gf256 {
+
+namespace {
+
+struct Tables {
+    uint8_t exp[512];           // Doubled so that exp[log a + log b] needs no modulo
+    uint8_t log[256];
+    uint8_t product[256][256];  // product[c][x] = c * x
+    uint8_t low[256][16];       // low[c][n] = c * n
+    uint8_t high[256][16];      // high[c][n] = c * (n << 4)
+
+    Tables() {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11D;
+            }
+        }
+        for (int i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0; // Undefined; callers handle zero
+
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                product[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+            for (int n = 0; n < 16; ++n) {
+                low[a][n] = product[a][n];
+                high[a][n] = product[a][n << 4];
+            }
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+using RegionKernel = void (*)(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size, bool accumulate);
+
+void scalarKernel(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size, bool accumulate) {
+    const uint8_t* row = tables().product[c];
+    if (accumulate) {
+        for (size_t i = 0; i < size; ++i) {
+            dst[i] ^= row[src[i]];
+        }
+    } else {
+        for (size_t i = 0; i < size; ++i) {
+            dst[i] = row[src[i]];
+        }
+    }
+}
+
+#ifdef DFS_GF256_X86
+
+// Each byte is split into nibbles, and each nibble indexes a 16-entry table
+// of products with a shuffle; the two results XOR to the full product
+__attribute__((target("ssse3")))
+void ssse3Kernel(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size, bool accumulate) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables().low[c]));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables().high[c]));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_and_si128(in, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi64(in, 4), mask);
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, lo), _mm_shuffle_epi8(high, hi));
+        if (accumulate) {
+            product = _mm_xor_si128(product, _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), product);
+    }
+    scalarKernel(c, src + i, dst + i, size - i, accumulate);
+}
+
+__attribute__((target("avx2")))
+void avx2Kernel(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size, bool accumulate) {
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables().low[c])));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables().high[c])));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i lo = _mm256_and_si256(in, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi64(in, 4), mask);
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low, lo), _mm256_shuffle_epi8(high, hi));
+        if (accumulate) {
+            product = _mm256_xor_si256(product, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), product);
+    }
+    ssse3Kernel(c, src + i, dst + i, size - i, accumulate);
+}
+
+#endif
+
+struct Kernel {
+    RegionKernel function;
+    const char* name;
+};
+
+Kernel selectKernel() {
+#ifdef DFS_GF256_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {avx2Kernel, "avx2"};
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return {ssse3Kernel, "ssse3"};
+    }
+#endif
+    return {scalarKernel, "scalar"};
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+uint8_t mul(uint8_t a, uint8_t b) {
+    return tables().product[a][b];
+}
+
+uint8_t div(uint8_t a, uint8_t b) {
+    if (b == 0) throw std::runtime_error("Division by zero in GF(256)");
+    if (a == 0) return 0;
+
+    const Tables& t = tables();
+    return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+uint8_t inv(uint8_t a) {
+    return div(1, a);
+}
+
+uint8_t pow(uint8_t base, int exp) {
+    if (exp == 0) return 1;
+    if (base == 0) return 0;
+
+    const Tables& t = tables();
+    return t.exp[(t.log[base] * exp) % 255];
+}
+
+void mulRegion(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size) {
+    if (c == 0) {
+        std::memset(dst, 0, size);
+    } else if (c == 1) {
+        std::memmove(dst, src, size);
+    } else {
+        kernel().function(c, src, dst, size, false);
+    }
+}
+
+void mulAddRegion(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size) {
+    if (c != 0) {
+        kernel().function(c, src, dst, size, true);
+    }
+}
+
+const char* kernelName() {
+    return kernel().name;
+}
+
+} // namespace gf256
+} // namespace dfs
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace dfs {
+namespace gf256 {
+
+// Arithmetic in GF(2^8) with the primitive polynomial
+// x^8 + x^4 + x^3 + x^2 + 1 (0x11D). Addition is XOR.
+uint8_t mul(uint8_t a, uint8_t b);
+uint8_t div(uint8_t a, uint8_t b);      // b must not be zero
+uint8_t inv(uint8_t a);                 // a must not be zero
+uint8_t pow(uint8_t base, int exp);
+
+// Region operations over `size` bytes, the building blocks of erasure
+// coding. They use split-nibble lookup tables with AVX2 or SSSE3 shuffles
+// when the CPU has them (checked once at startup) and a full
+// multiplication table otherwise.
+void mulRegion(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size);     // dst = c * src
+void mulAddRegion(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size);  // dst ^= c * src
+
+// Name of the region kernel in use ("avx2", "ssse3" or "scalar")
+const char* kernelName();
+
+} // namespace gf256
+} // namespace dfs
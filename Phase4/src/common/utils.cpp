@@ -1,5 +1,5 @@
 #include "utils.h"
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <iomanip>
 #include <sstream>
@@ -7,15 +7,23 @@
 #include <iostream>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <chrono>
 #include <thread>
 #include <random>
 #include <algorithm>
+#include <array>
 #include <ctime>
+#include <cstring>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define DFS_CRC32C_X86 1
+#endif
+
 namespace dfs {
 
 std::mt19937 Utils::rng_(std::chrono::steady_clock::now().time_since_epoch().count());
@@ -32,20 +40,115 @@ std::string Utils::generateServerId() {
     return "server_" + getRandomString(16);
 }
 
+std::string Utils::calculateSHA256(const void* data, size_t size) {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (EVP_Digest(data, size, hash, &length, EVP_sha256(), nullptr) != 1) {
+        return "";
+    }
+    return toHex(hash, length);
+}
+
 std::string Utils::calculateSHA256(const std::vector<uint8_t>& data) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256(data.data(), data.size(), hash);
+    return calculateSHA256(data.data(), data.size());
+}
+
+std::string Utils::calculateSHA256(const std::string& data) {
+    return calculateSHA256(data.data(), data.size());
+}
+
+std::string Utils::toHex(const unsigned char* bytes, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(length * 2, '0');
+    for (size_t i = 0; i < length; ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+    return hex;
+}
+
+namespace {
+
+// Both variants work on the raw (not inverted) CRC register
+uint32_t crc32cSoftware(const uint8_t* bytes, size_t length, uint32_t crc) {
+    // Castagnoli polynomial (reflected), table built on first use
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
     
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
     }
-    return ss.str();
+    return crc;
 }
 
-std::string Utils::calculateSHA256(const std::string& data) {
-    std::vector<uint8_t> bytes(data.begin(), data.end());
-    return calculateSHA256(bytes);
+#ifdef DFS_CRC32C_X86
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const uint8_t* bytes, size_t length, uint32_t crc) {
+    uint64_t crc64 = crc;
+    for (; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    
+    crc = static_cast<uint32_t>(crc64);
+    for (; length > 0; ++bytes, --length) {
+        crc = _mm_crc32_u8(crc, *bytes);
+    }
+    return crc;
+}
+#endif
+
+using Crc32cFunction = uint32_t (*)(const uint8_t*, size_t, uint32_t);
+
+Crc32cFunction selectCrc32c() {
+#ifdef DFS_CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32cHardware;
+    }
+#endif
+    return crc32cSoftware;
+}
+
+} // namespace
+
+uint32_t Utils::crc32c(const void* data, size_t length, uint32_t crc) {
+    static const Crc32cFunction function = selectCrc32c();
+    return ~function(static_cast<const uint8_t*>(data), length, ~crc);
+}
+
+SHA256Stream::SHA256Stream() : ctx_(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+}
+
+SHA256Stream::~SHA256Stream() {
+    EVP_MD_CTX_free(ctx_);
+}
+
+void SHA256Stream::update(const void* data, size_t size) {
+    if (size > 0) {
+        EVP_DigestUpdate(ctx_, data, size);
+    }
+}
+
+std::string SHA256Stream::finalizeHex() {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(ctx_, hash, &length);
+    
+    // Leave the context ready for reuse
+    EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+    return Utils::toHex(hash, length);
 }
 
 bool Utils::fileExists(const std::string& path) {
@@ -94,6 +197,19 @@ bool Utils::deleteFile(const std::string& path) {
     return unlink(path.c_str()) == 0;
 }
 
+bool Utils::syncPath(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    bool synced = fsync(fd) == 0;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return synced;
+}
+
 std::vector<std::string> Utils::splitString(const std::string& str, char delimiter) {
     std::vector<std::string> tokens;
     std::stringstream ss(str);
@@ -6,6 +6,8 @@
 #include <random>
 #include <map>
 
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
 namespace dfs {
 
 // Configuration constants
@@ -15,8 +17,11 @@ constexpr int ERASURE_CODING_DATA_BLOCKS = 4;
 constexpr int ERASURE_CODING_PARITY_BLOCKS = 2;
 constexpr int HEARTBEAT_INTERVAL_MS = 5000;
 constexpr int HEARTBEAT_TIMEOUT_MS = 15000;
+constexpr int FULL_CHUNK_REPORT_INTERVAL_MS = 60 * 60 * 1000; // Heartbeats send incremental reports in between
 constexpr int MASTER_ELECTION_TIMEOUT_MS = 5000;
 constexpr int CACHE_SIZE_MB = 100;
+constexpr size_t STREAM_FRAME_SIZE = 64 * 1024; // 64KB frames for streaming chunk RPCs
+constexpr size_t CHECKSUM_BLOCK_SIZE = 64 * 1024; // Stored chunks carry a CRC32C per block of this size
 
 // Utility functions
 class Utils {
@@ -26,9 +31,14 @@ public:
     static std::string generateFileId();
     static std::string generateServerId();
     
-    // Hash functions
+    // Hash functions. SHA-256 goes through OpenSSL's EVP interface, which
+    // uses the SHA extensions (SHA-NI / ARMv8 SHA2) when the CPU has them;
+    // CRC32C uses the SSE4.2 crc32 instruction when available.
+    static std::string calculateSHA256(const void* data, size_t size);
     static std::string calculateSHA256(const std::vector<uint8_t>& data);
     static std::string calculateSHA256(const std::string& data);
+    static std::string toHex(const unsigned char* bytes, size_t length);
+    static uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
     
     // File system utilities
     static bool fileExists(const std::string& path);
@@ -37,6 +47,8 @@ public:
     static bool writeFile(const std::string& path, const std::vector<uint8_t>& data);
     static int64_t getFileSize(const std::string& path);
     static bool deleteFile(const std::string& path);
+    // fsync a file or directory (making renames and new entries in it durable)
+    static bool syncPath(const std::string& path);
     
     // Network utilities
     static std::vector<std::string> splitString(const std::string& str, char delimiter);
@@ -63,6 +75,22 @@ private:
     static std::mt19937 rng_;
 };
 
+// Incremental SHA-256 for data that arrives in pieces (streamed chunks)
+class SHA256Stream {
+public:
+    SHA256Stream();
+    ~SHA256Stream();
+    
+    SHA256Stream(const SHA256Stream&) = delete;
+    SHA256Stream& operator=(const SHA256Stream&) = delete;
+    
+    void update(const void* data, size_t size);
+    std::string finalizeHex();
+    
+private:
+    EVP_MD_CTX* ctx_;
+};
+
 // Configuration management
 class Config {
 public:
@@ -16,48 +16,70 @@ ChunkAllocator::ChunkAllocator(std::shared_ptr<MetadataManager> metadata_manager
 
 std::vector<ChunkInfo> ChunkAllocator::allocateChunks(const std::string& file_id,
                                                      int64_t file_size,
-                                                     bool enable_erasure_coding) {
+                                                     bool enable_erasure_coding,
+                                                     const ErasureCodingProfile& erasure_profile) {
     std::lock_guard<std::mutex> lock(allocation_mutex_);
     
     std::vector<ChunkInfo> allocated_chunks;
     
+    // Registered together once every chunk has its servers, so that the
+    // whole allocation costs one metadata log sync
+    std::vector<ChunkMetadata> new_chunks;
+    
     if (enable_erasure_coding) {
-        // Use erasure coding
-        ErasureCodedChunkManager ec_manager;
-        int data_blocks = ec_manager.getMinimumBlocksNeeded();
-        int total_blocks = data_blocks + ERASURE_CODING_PARITY_BLOCKS;
+        if (!erasure_profile.isValid()) {
+            Utils::logError("Invalid erasure coding profile " + erasure_profile.toString() +
+                            " for file " + file_id);
+            return {};
+        }
+        
+        // Each chunk-sized piece of the file is one stripe of k data and m
+        // parity blocks, each block on its own server
+        int data_blocks = erasure_profile.data_blocks;
+        int total_blocks = erasure_profile.getTotalBlocks();
         
-        // Calculate how many erasure coding groups we need
         int64_t chunk_size = Config::getInstance().getChunkSize();
         int groups_needed = (file_size + chunk_size - 1) / chunk_size;
         
         for (int group = 0; group < groups_needed; ++group) {
             std::string group_id = file_id + "_group_" + std::to_string(group);
+            int64_t group_size = std::min(chunk_size, file_size - group * chunk_size);
             
-            // Allocate servers for all blocks in this group
-            std::vector<std::string> exclude_servers;
+            std::vector<std::string> group_servers = selectServers(total_blocks);
+            if (group_servers.size() < static_cast<size_t>(total_blocks)) {
+                // A stripe short of blocks would be written without its full
+                // redundancy; give up on the whole file instead
+                Utils::logError("Only " + std::to_string(group_servers.size()) + " servers available for " +
+                                erasure_profile.toString() + " stripe " + group_id);
+                return {};
+            }
             
             for (int block = 0; block < total_blocks; ++block) {
                 std::string chunk_id = group_id + "_block_" + std::to_string(block);
                 
-                // Allocate one server for this block (no replication in EC)
-                std::vector<std::string> servers = allocateServersForChunk(chunk_id, 1, exclude_servers);
-                
-                if (servers.empty()) {
-                    Utils::logError("Failed to allocate server for erasure coded chunk: " + chunk_id);
-                    continue;
-                }
+                ChunkMetadata chunk_metadata;
+                chunk_metadata.chunk_id = chunk_id;
+                chunk_metadata.server_locations = {group_servers[block]};
+                chunk_metadata.size = 0; // Will be set when chunk is actually written
+                chunk_metadata.is_erasure_coded = true;
+                chunk_metadata.erasure_group_id = group_id;
+                chunk_metadata.erasure_block_index = block;
+                chunk_metadata.erasure_data_blocks = erasure_profile.data_blocks;
+                chunk_metadata.erasure_parity_blocks = erasure_profile.parity_blocks;
+                chunk_metadata.erasure_local_parity_blocks = erasure_profile.local_parity_blocks;
+                chunk_metadata.is_parity_block = block >= data_blocks;
+                chunk_metadata.created_time = Utils::getCurrentTimestamp();
+                chunk_metadata.last_accessed_time = chunk_metadata.created_time;
+                new_chunks.push_back(chunk_metadata);
                 
                 ChunkInfo chunk_info;
-                chunk_info.chunk_id = chunk_id;
-                chunk_info.server_addresses = servers;
-                chunk_info.size = chunk_size / data_blocks; // Each block is smaller
-                chunk_info.is_erasure_coded = true;
+                chunk_info.set_chunk_id(chunk_id);
+                chunk_info.add_server_addresses(group_servers[block]);
+                chunk_info.set_size((group_size + data_blocks - 1) / data_blocks); // Each block is smaller
+                chunk_info.set_is_erasure_coded(true);
+                chunk_info.set_erasure_block_index(block);
                 
                 allocated_chunks.push_back(chunk_info);
-                
-                // Add this server to exclude list to ensure blocks are on different servers
-                exclude_servers.insert(exclude_servers.end(), servers.begin(), servers.end());
             }
         }
     } else {
@@ -68,7 +90,10 @@ std::vector<ChunkInfo> ChunkAllocator::allocateChunks(const std::string& file_id
         for (int i = 0; i < chunk_count; ++i) {
             std::string chunk_id = file_id + "_chunk_" + std::to_string(i);
             
-            std::vector<std::string> servers = allocateServersForChunk(chunk_id, replication_factor);
+            std::vector<std::string> servers = selectServers(replication_factor);
+            if (!servers.empty()) {
+                new_chunks.push_back(makeReplicatedChunk(chunk_id, servers));
+            }
             
             if (servers.size() < static_cast<size_t>(replication_factor)) {
                 Utils::logWarning("Could only allocate " + std::to_string(servers.size()) + 
@@ -77,19 +102,27 @@ std::vector<ChunkInfo> ChunkAllocator::allocateChunks(const std::string& file_id
             }
             
             ChunkInfo chunk_info;
-            chunk_info.chunk_id = chunk_id;
-            chunk_info.server_addresses = servers;
-            chunk_info.size = std::min(static_cast<int64_t>(CHUNK_SIZE), 
-                                     file_size - i * CHUNK_SIZE);
-            chunk_info.is_erasure_coded = false;
+            chunk_info.set_chunk_id(chunk_id);
+            for (const std::string& server : servers) {
+                chunk_info.add_server_addresses(server);
+            }
+            chunk_info.set_size(std::min(static_cast<int64_t>(CHUNK_SIZE), 
+                                         file_size - i * static_cast<int64_t>(CHUNK_SIZE)));
+            chunk_info.set_is_erasure_coded(false);
             
             allocated_chunks.push_back(chunk_info);
         }
     }
     
+    if (!metadata_manager_->addChunks(new_chunks)) {
+        Utils::logError("Failed to record the chunks allocated for file " + file_id);
+        return {};
+    }
+    
     Utils::logInfo("Allocated " + std::to_string(allocated_chunks.size()) + 
                    " chunks for file " + file_id + 
-                   (enable_erasure_coding ? " (erasure coded)" : " (replicated)"));
+                   (enable_erasure_coding ? " (erasure coded " + erasure_profile.toString() + ")"
+                                          : std::string(" (replicated)")));
     
     return allocated_chunks;
 }
@@ -97,37 +130,45 @@ std::vector<ChunkInfo> ChunkAllocator::allocateChunks(const std::string& file_id
 std::vector<std::string> ChunkAllocator::allocateServersForChunk(const std::string& chunk_id,
                                                                 int replication_factor,
                                                                 const std::vector<std::string>& exclude_servers) {
-    std::vector<std::string> allocated_servers;
+    std::vector<std::string> allocated_servers = selectServers(replication_factor, exclude_servers);
+    
+    // Create chunk metadata
+    if (!allocated_servers.empty()) {
+        metadata_manager_->addChunk(chunk_id, makeReplicatedChunk(chunk_id, allocated_servers));
+    }
     
+    return allocated_servers;
+}
+
+ChunkMetadata ChunkAllocator::makeReplicatedChunk(const std::string& chunk_id,
+                                                  const std::vector<std::string>& servers) const {
+    ChunkMetadata chunk_metadata;
+    chunk_metadata.chunk_id = chunk_id;
+    chunk_metadata.server_locations = servers;
+    chunk_metadata.size = 0; // Will be set when chunk is actually written
+    chunk_metadata.created_time = Utils::getCurrentTimestamp();
+    chunk_metadata.last_accessed_time = chunk_metadata.created_time;
+    chunk_metadata.is_erasure_coded = false;
+    chunk_metadata.erasure_block_index = 0;
+    chunk_metadata.erasure_data_blocks = 0;
+    chunk_metadata.erasure_parity_blocks = 0;
+    chunk_metadata.erasure_local_parity_blocks = 0;
+    chunk_metadata.is_parity_block = false;
+    return chunk_metadata;
+}
+
+std::vector<std::string> ChunkAllocator::selectServers(int count, const std::vector<std::string>& exclude_servers) {
     switch (strategy_) {
         case AllocationStrategy::ROUND_ROBIN:
-            allocated_servers = allocateRoundRobin(replication_factor, exclude_servers);
-            break;
+            return allocateRoundRobin(count, exclude_servers);
         case AllocationStrategy::LEAST_LOADED:
-            allocated_servers = allocateLeastLoaded(replication_factor, exclude_servers);
-            break;
+            return allocateLeastLoaded(count, exclude_servers);
         case AllocationStrategy::RANDOM:
-            allocated_servers = allocateRandom(replication_factor, exclude_servers);
-            break;
+            return allocateRandom(count, exclude_servers);
         case AllocationStrategy::ZONE_AWARE:
-            allocated_servers = allocateZoneAware(replication_factor, exclude_servers);
-            break;
+            return allocateZoneAware(count, exclude_servers);
     }
-    
-    // Create chunk metadata
-    if (!allocated_servers.empty()) {
-        ChunkMetadata chunk_metadata;
-        chunk_metadata.chunk_id = chunk_id;
-        chunk_metadata.server_locations = allocated_servers;
-        chunk_metadata.size = 0; // Will be set when chunk is actually written
-        chunk_metadata.created_time = Utils::getCurrentTimestamp();
-        chunk_metadata.last_accessed_time = chunk_metadata.created_time;
-        chunk_metadata.is_erasure_coded = false; // Will be updated if needed
-        
-        metadata_manager_->addChunk(chunk_id, chunk_metadata);
-    }
-    
-    return allocated_servers;
+    return {};
 }
 
 std::vector<std::string> ChunkAllocator::reallocateChunk(const std::string& chunk_id,
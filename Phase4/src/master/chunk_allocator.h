@@ -1,6 +1,7 @@
 #pragma once
 
 #include "metadata_manager.h"
+#include "erasure_coding.h"
 #include "utils.h"
 #include <vector>
 #include <string>
@@ -21,10 +22,13 @@ class ChunkAllocator {
 public:
     ChunkAllocator(std::shared_ptr<MetadataManager> metadata_manager);
     
-    // Allocate chunks for a new file
+    // Allocate chunks for a new file. Erasure-coded files get one stripe of
+    // profile.getTotalBlocks() blocks, on distinct servers, per chunk-sized
+    // piece of the file
     std::vector<ChunkInfo> allocateChunks(const std::string& file_id,
                                          int64_t file_size,
-                                         bool enable_erasure_coding = false);
+                                         bool enable_erasure_coding = false,
+                                         const ErasureCodingProfile& erasure_profile = {});
     
     // Allocate servers for a specific chunk
     std::vector<std::string> allocateServersForChunk(const std::string& chunk_id,
@@ -53,6 +57,9 @@ private:
     std::unordered_map<std::string, std::string> server_zones_;
     mutable std::mutex allocation_mutex_;
     
+    // Pick `count` distinct servers with the current strategy
+    std::vector<std::string> selectServers(int count, const std::vector<std::string>& exclude = {});
+    
     // Allocation algorithms
     std::vector<std::string> allocateRoundRobin(int count, 
                                                const std::vector<std::string>& exclude = {});
@@ -64,6 +71,8 @@ private:
                                               const std::vector<std::string>& exclude = {});
     
     // Helper functions
+    ChunkMetadata makeReplicatedChunk(const std::string& chunk_id,
+                                      const std::vector<std::string>& servers) const;
     std::vector<ServerMetadata> getAvailableServers(const std::vector<std::string>& exclude = {}) const;
     double calculateServerLoad(const ServerMetadata& server) const;
     bool hasEnoughSpace(const ServerMetadata& server, int64_t required_space) const;
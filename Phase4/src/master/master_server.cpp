@@ -5,6 +5,9 @@
 
 namespace dfs {
 
+// Snapshot is <base>.snapshot, the write-ahead log <base>.wal.*
+static const char* METADATA_BASE_PATH = "master_metadata";
+
 // Global pointer for signal handling
 static MasterServer* g_master_server = nullptr;
 
@@ -17,6 +20,7 @@ void signalHandler(int signal) {
 
 MasterServer::MasterServer() 
     : running_(false),
+      metadata_recovered_(false),
       total_requests_(0),
       successful_requests_(0),
       failed_requests_(0) {
@@ -24,8 +28,8 @@ MasterServer::MasterServer()
     metadata_manager_ = std::make_shared<MetadataManager>();
     chunk_allocator_ = std::make_unique<ChunkAllocator>(metadata_manager_);
     
-    // Try to load existing metadata
-    metadata_manager_->loadMetadataFromFile("master_metadata.json");
+    // Recover metadata from the last snapshot and the write-ahead log
+    metadata_recovered_ = metadata_manager_->loadMetadataFromFile(METADATA_BASE_PATH);
     
     Utils::logInfo("MasterServer initialized");
 }
@@ -41,6 +45,13 @@ void MasterServer::start(const std::string& address, int port) {
         return;
     }
     
+    // Serving from a partial namespace would overwrite the good copy on disk
+    if (!metadata_recovered_) {
+        Utils::logError("Refusing to start: metadata could not be recovered from " +
+                        std::string(METADATA_BASE_PATH));
+        return;
+    }
+    
     std::string server_address = address + ":" + std::to_string(port);
     
     grpc::ServerBuilder builder;
@@ -99,8 +110,8 @@ void MasterServer::stop() {
         metadata_persistence_thread_.join();
     }
     
-    // Save metadata before shutdown
-    metadata_manager_->saveMetadataToFile("master_metadata.json");
+    // Snapshot before shutdown so the next start has no log to replay
+    metadata_manager_->saveMetadataToFile(METADATA_BASE_PATH);
     
     Utils::logInfo("MasterServer stopped");
 }
@@ -137,6 +148,26 @@ grpc::Status MasterServer::CreateFile(grpc::ServerContext* context,
     metadata.modified_time = metadata.created_time;
     metadata.is_encrypted = request->enable_encryption();
     metadata.is_erasure_coded = request->enable_erasure_coding();
+    metadata.erasure_data_blocks = 0;
+    metadata.erasure_parity_blocks = 0;
+    metadata.erasure_local_parity_blocks = 0;
+    
+    if (metadata.is_erasure_coded) {
+        ErasureCodingProfile profile;
+        if (request->erasure_data_blocks() > 0) {
+            profile = {request->erasure_data_blocks(), request->erasure_parity_blocks(),
+                       request->erasure_local_parity_blocks()};
+        }
+        if (!profile.isValid()) {
+            response->set_success(false);
+            response->set_message("Unsupported erasure coding profile " + profile.toString());
+            failed_requests_++;
+            return grpc::Status::OK;
+        }
+        metadata.erasure_data_blocks = profile.data_blocks;
+        metadata.erasure_parity_blocks = profile.parity_blocks;
+        metadata.erasure_local_parity_blocks = profile.local_parity_blocks;
+    }
     
     // Generate encryption key if needed
     if (metadata.is_encrypted) {
@@ -218,6 +249,53 @@ grpc::Status MasterServer::GetFileInfo(grpc::ServerContext* context,
     return grpc::Status::OK;
 }
 
+grpc::Status MasterServer::GetFileRange(grpc::ServerContext* context,
+                                       const GetFileRangeRequest* request,
+                                       GetFileRangeResponse* response) {
+    total_requests_++;
+    
+    FileMetadata metadata;
+    if (request->offset() < 0 || request->length() < 0 ||
+        !metadata_manager_->getFileMetadata(request->filename(), metadata)) {
+        response->set_found(false);
+        failed_requests_++;
+        return grpc::Status::OK;
+    }
+    
+    // The file is stored as CHUNK_SIZE pieces, each one chunk or one block
+    // group with a chunk per block
+    size_t blocks_per_unit = 1;
+    if (metadata.is_erasure_coded) {
+        ErasureCodingProfile profile{metadata.erasure_data_blocks, metadata.erasure_parity_blocks,
+                                     metadata.erasure_local_parity_blocks};
+        if (profile.isValid()) {
+            blocks_per_unit = profile.getTotalBlocks();
+        }
+    }
+    
+    int64_t end = metadata.size;
+    if (request->length() > 0 && request->length() < metadata.size - request->offset()) {
+        end = request->offset() + request->length();
+    }
+    
+    int64_t first_unit = request->offset() / static_cast<int64_t>(CHUNK_SIZE);
+    int64_t end_unit = request->offset() < end
+        ? (end + static_cast<int64_t>(CHUNK_SIZE) - 1) / static_cast<int64_t>(CHUNK_SIZE)
+        : first_unit;
+    
+    size_t first = std::min<size_t>(first_unit * blocks_per_unit, metadata.chunk_ids.size());
+    size_t last = std::min<size_t>(end_unit * blocks_per_unit, metadata.chunk_ids.size());
+    metadata.chunk_ids = std::vector<std::string>(metadata.chunk_ids.begin() + first,
+                                                  metadata.chunk_ids.begin() + last);
+    
+    response->set_found(true);
+    response->set_first_chunk_index(first_unit);
+    convertFileMetadataToProto(metadata, response->mutable_file_info());
+    
+    successful_requests_++;
+    return grpc::Status::OK;
+}
+
 grpc::Status MasterServer::AllocateChunks(grpc::ServerContext* context,
                                          const AllocateChunksRequest* request,
                                          AllocateChunksResponse* response) {
@@ -227,30 +305,24 @@ grpc::Status MasterServer::AllocateChunks(grpc::ServerContext* context,
     
     // Get file metadata to determine size
     FileMetadata file_metadata;
-    bool found = false;
-    
-    // Find file by ID
-    auto all_files = metadata_manager_->listFiles();
-    for (const auto& file : all_files) {
-        if (file.file_id == request->file_id()) {
-            file_metadata = file;
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!metadata_manager_->getFileById(request->file_id(), file_metadata)) {
         response->set_success(false);
         response->set_message("File not found");
         failed_requests_++;
         return grpc::Status::OK;
     }
     
-    // Allocate chunks
+    // Allocate chunks; erasure-coded files use the profile chosen at creation
+    ErasureCodingProfile erasure_profile;
+    if (file_metadata.erasure_data_blocks > 0) {
+        erasure_profile = {file_metadata.erasure_data_blocks, file_metadata.erasure_parity_blocks,
+                           file_metadata.erasure_local_parity_blocks};
+    }
     auto allocated_chunks = chunk_allocator_->allocateChunks(
         request->file_id(),
         file_metadata.size,
-        request->enable_erasure_coding()
+        request->enable_erasure_coding(),
+        erasure_profile
     );
     
     if (allocated_chunks.empty()) {
@@ -261,10 +333,18 @@ grpc::Status MasterServer::AllocateChunks(grpc::ServerContext* context,
     }
     
     // Update file metadata with chunk IDs
-    for (const auto& chunk_info : allocated_chunks) {
-        file_metadata.chunk_ids.push_back(chunk_info.chunk_id);
+    bool attached = metadata_manager_->updateFileById(request->file_id(), [&](FileMetadata& metadata) {
+        for (const auto& chunk_info : allocated_chunks) {
+            metadata.chunk_ids.push_back(chunk_info.chunk_id());
+        }
+    });
+    
+    if (!attached) {
+        response->set_success(false);
+        response->set_message("File was removed during allocation");
+        failed_requests_++;
+        return grpc::Status::OK;
     }
-    metadata_manager_->updateFileMetadata(file_metadata.filename, file_metadata);
     
     // Prepare response
     response->set_success(true);
@@ -304,15 +384,10 @@ grpc::Status MasterServer::CompleteUpload(grpc::ServerContext* context,
     Utils::logInfo("CompleteUpload for file: " + request->file_id());
     
     // Update file's modified time
-    auto all_files = metadata_manager_->listFiles();
-    for (const auto& file : all_files) {
-        if (file.file_id == request->file_id()) {
-            FileMetadata updated_metadata = file;
-            updated_metadata.modified_time = Utils::getCurrentTimestamp();
-            metadata_manager_->updateFileMetadata(file.filename, updated_metadata);
-            break;
-        }
-    }
+    int64_t now = Utils::getCurrentTimestamp();
+    metadata_manager_->updateFileById(request->file_id(), [now](FileMetadata& metadata) {
+        metadata.modified_time = now;
+    });
     
     response->set_success(true);
     response->set_message("Upload completed successfully");
@@ -360,27 +435,34 @@ grpc::Status MasterServer::SendHeartbeat(grpc::ServerContext* context,
                                         HeartbeatResponse* response) {
     // Don't count heartbeats in total requests (too frequent)
     
-    ServerMetadata metadata;
-    if (!metadata_manager_->getServerMetadata(request->server_id(), metadata)) {
+    const std::string& server_id = request->server_id();
+    if (!metadata_manager_->recordHeartbeat(server_id, request->free_space(), request->chunk_count(),
+                                            request->cpu_usage(), request->memory_usage(),
+                                            request->cache_stats())) {
         response->set_success(false);
         return grpc::Status::OK;
     }
     
-    // Update server metadata
-    metadata.free_space = request->free_space();
-    metadata.chunk_count = request->chunk_count();
-    metadata.cpu_usage = request->cpu_usage();
-    metadata.memory_usage = request->memory_usage();
-    metadata.last_heartbeat = Utils::getCurrentTimestamp();
-    metadata.is_healthy = true;
-    
-    // Update stored chunks
-    metadata.stored_chunks.clear();
-    for (const std::string& chunk_id : request->stored_chunks()) {
-        metadata.stored_chunks.insert(chunk_id);
+    // Apply the chunk report; ask for a full one if we missed something
+    // (or restarted and have none yet)
+    bool report_applied = true;
+    if (request->report_type() == REPORT_FULL) {
+        std::vector<std::string> chunks(request->stored_chunks().begin(),
+                                        request->stored_chunks().end());
+        metadata_manager_->processFullChunkReport(server_id, request->report_sequence(), chunks);
+    } else if (request->report_type() == REPORT_INCREMENTAL) {
+        std::vector<std::string> added(request->added_chunks().begin(), request->added_chunks().end());
+        std::vector<std::string> removed(request->removed_chunks().begin(), request->removed_chunks().end());
+        report_applied = metadata_manager_->processIncrementalChunkReport(
+            server_id, request->report_sequence(), added, removed);
+    } else {
+        report_applied = !metadata_manager_->needsFullChunkReport(server_id);
     }
     
-    metadata_manager_->updateServerMetadata(request->server_id(), metadata);
+    if (!report_applied) {
+        Utils::logInfo("Requesting a full chunk report from " + server_id);
+        response->set_full_report_requested(true);
+    }
     
     // Check if rebalancing is needed
     if (chunk_allocator_->shouldRebalance()) {
@@ -455,6 +537,29 @@ grpc::Status MasterServer::ReportChunkCorruption(grpc::ServerContext* context,
                     " on server " + request->server_id() + 
                     " - " + request->error_details());
     
+    // Located corruption is repaired in place by the reporting server from
+    // one of the other replicas; it reports again if that fails
+    if (request->corrupted_blocks_size() > 0) {
+        ChunkMetadata metadata;
+        if (metadata_manager_->getChunkMetadata(request->chunk_id(), metadata)) {
+            for (const std::string& server_id : metadata.server_locations) {
+                ServerMetadata server_metadata;
+                if (server_id != request->server_id() &&
+                    metadata_manager_->getServerMetadata(server_id, server_metadata) &&
+                    server_metadata.is_healthy) {
+                    response->add_replica_addresses(server_metadata.address + ":" +
+                                                    std::to_string(server_metadata.port));
+                }
+            }
+        }
+        
+        if (response->replica_addresses_size() > 0) {
+            response->set_acknowledged(true);
+            successful_requests_++;
+            return grpc::Status::OK;
+        }
+    }
+    
     // Remove corrupted chunk from server
     metadata_manager_->removeChunkFromServer(request->chunk_id(), request->server_id());
     
@@ -519,14 +624,17 @@ void MasterServer::performRebalancing() {
 }
 
 void MasterServer::persistMetadata() {
-    const int PERSISTENCE_INTERVAL_MS = 30000; // Save every 30 seconds
+    const int PERSISTENCE_INTERVAL_MS = 30000; // Check every 30 seconds
     
     while (running_.load()) {
         std::this_thread::sleep_for(std::chrono::milliseconds(PERSISTENCE_INTERVAL_MS));
         
         if (!running_.load()) break;
         
-        metadata_manager_->saveMetadataToFile("master_metadata.json");
+        // Changes are already in the write-ahead log; snapshot once it has grown
+        if (metadata_manager_->snapshotDue()) {
+            metadata_manager_->saveMetadataToFile(METADATA_BASE_PATH);
+        }
         metadata_manager_->cleanupOrphanedChunks();
         metadata_manager_->cleanupDeadServers();
     }
@@ -539,6 +647,10 @@ void MasterServer::convertFileMetadataToProto(const FileMetadata& metadata, File
     proto_info->set_modified_time(metadata.modified_time);
     proto_info->set_is_encrypted(metadata.is_encrypted);
     proto_info->set_encryption_key_id(metadata.encryption_key_id);
+    proto_info->set_is_erasure_coded(metadata.is_erasure_coded);
+    proto_info->set_erasure_data_blocks(metadata.erasure_data_blocks);
+    proto_info->set_erasure_parity_blocks(metadata.erasure_parity_blocks);
+    proto_info->set_erasure_local_parity_blocks(metadata.erasure_local_parity_blocks);
     
     // Add chunk information
     for (const std::string& chunk_id : metadata.chunk_ids) {
@@ -555,6 +667,7 @@ void MasterServer::convertChunkMetadataToProto(const ChunkMetadata& metadata, Ch
     proto_info->set_size(metadata.size);
     proto_info->set_checksum(metadata.checksum);
     proto_info->set_is_erasure_coded(metadata.is_erasure_coded);
+    proto_info->set_erasure_block_index(metadata.erasure_block_index);
     
     for (const std::string& server_id : metadata.server_locations) {
         ServerMetadata server_metadata;
@@ -36,6 +36,10 @@ public:
                             const GetFileInfoRequest* request,
                             GetFileInfoResponse* response) override;
     
+    grpc::Status GetFileRange(grpc::ServerContext* context,
+                             const GetFileRangeRequest* request,
+                             GetFileRangeResponse* response) override;
+    
     grpc::Status AllocateChunks(grpc::ServerContext* context,
                                const AllocateChunksRequest* request,
                                AllocateChunksResponse* response) override;
@@ -75,6 +79,7 @@ private:
     std::unique_ptr<ChunkAllocator> chunk_allocator_;
     
     std::atomic<bool> running_;
+    bool metadata_recovered_;
     std::thread heartbeat_monitor_thread_;
     std::thread rebalancing_thread_;
     std::thread metadata_persistence_thread_;
@@ -0,0 +1,425 @@
+#include "metadata_log.h"
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace dfs {
+
+namespace {
+
+constexpr size_t FRAME_PREFIX_SIZE = 8;                 // length + crc32c
+constexpr uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;   // Anything larger is corruption
+constexpr size_t SNAPSHOT_BUFFER_SIZE = 1024 * 1024;
+
+void putU32(std::string& buffer, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint32_t getU32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Makes a create, rename or unlink in the file's directory durable
+bool syncParentDirectory(const std::string& path) {
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+} // namespace
+
+MetadataLog::MetadataLog(const std::string& base_path)
+    : base_path_(base_path),
+      snapshot_path_(base_path + ".snapshot"),
+      last_sequence_(0),
+      durable_sequence_(0),
+      rotate_requested_(false),
+      stopping_(false),
+      failed_(false),
+      wal_fd_(-1),
+      records_since_snapshot_(0),
+      checkpoint_running_(false) {
+}
+
+MetadataLog::~MetadataLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    flush_cv_.notify_all();
+
+    // The flusher drains whatever is still pending before it exits
+    if (flusher_thread_.joinable()) {
+        flusher_thread_.join();
+    }
+    if (wal_fd_ >= 0) {
+        ::close(wal_fd_);
+    }
+}
+
+bool MetadataLog::open(const MutationVisitor& apply) {
+    persist::MetadataMutation mutation;
+    uint64_t snapshot_sequence = 0;
+    uint64_t snapshot_entries = 0;
+
+    if (Utils::fileExists(snapshot_path_)) {
+        std::vector<uint8_t> data = Utils::readFile(snapshot_path_);
+        persist::SnapshotHeader header;
+        bool have_header = false;
+        size_t valid_end = 0;
+
+        bool ok = readFrames(data, valid_end, [&](const uint8_t* payload, size_t length) {
+            if (!have_header) {
+                have_header = header.ParseFromArray(payload, static_cast<int>(length));
+                return have_header;
+            }
+            if (!mutation.ParseFromArray(payload, static_cast<int>(length))) {
+                return false;
+            }
+            apply(mutation);
+            snapshot_entries++;
+            return true;
+        });
+
+        if (!ok || !have_header || valid_end != data.size() || snapshot_entries != header.entry_count()) {
+            Utils::logError("Metadata snapshot is corrupt: " + snapshot_path_);
+            return false;
+        }
+        snapshot_sequence = header.last_sequence();
+    }
+
+    uint64_t last_sequence = snapshot_sequence;
+    int64_t replayed = 0;
+    std::vector<WalFile> wal_files = listWalFiles();
+
+    for (size_t i = 0; i < wal_files.size(); ++i) {
+        const WalFile& wal = wal_files[i];
+        std::vector<uint8_t> data = Utils::readFile(wal.path);
+        size_t valid_end = 0;
+        bool gap = false;
+
+        readFrames(data, valid_end, [&](const uint8_t* payload, size_t length) {
+            if (!mutation.ParseFromArray(payload, static_cast<int>(length))) {
+                return false;
+            }
+            if (mutation.sequence() <= last_sequence) {
+                return true; // Already part of the snapshot
+            }
+            if (mutation.sequence() != last_sequence + 1) {
+                gap = true;
+                return false;
+            }
+            apply(mutation);
+            last_sequence = mutation.sequence();
+            replayed++;
+            return true;
+        });
+
+        if (gap) {
+            Utils::logError("Metadata WAL is missing records after sequence " +
+                            std::to_string(last_sequence) + " in " + wal.path);
+            return false;
+        }
+
+        if (valid_end < data.size()) {
+            // Only the newest file can legitimately end in a torn write
+            if (i + 1 < wal_files.size()) {
+                Utils::logError("Corrupt record in metadata WAL: " + wal.path);
+                return false;
+            }
+            Utils::logWarning("Truncating metadata WAL after " + std::to_string(valid_end) +
+                              " of " + std::to_string(data.size()) + " bytes");
+            if (::truncate(wal.path.c_str(), static_cast<off_t>(valid_end)) != 0) {
+                Utils::logError("Failed to truncate metadata WAL: " + std::string(std::strerror(errno)));
+                return false;
+            }
+        }
+    }
+
+    Utils::logInfo("Metadata recovered: " + std::to_string(snapshot_entries) +
+                   " snapshot entries, " + std::to_string(replayed) + " WAL records");
+
+    uint64_t first_sequence = wal_files.empty() ? last_sequence + 1 : wal_files.back().first_sequence;
+    if (!openWalFile(first_sequence)) {
+        return false;
+    }
+    if (wal_files.empty()) {
+        wal_files.push_back({first_sequence, getWalPath(first_sequence)});
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wal_files_ = std::move(wal_files);
+        last_sequence_ = last_sequence;
+        durable_sequence_ = last_sequence;
+    }
+    records_since_snapshot_ = replayed;
+    flusher_thread_ = std::thread(&MetadataLog::flusherLoop, this);
+    return true;
+}
+
+uint64_t MetadataLog::append(persist::MetadataMutation& mutation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (failed_ || stopping_ || !flusher_thread_.joinable()) {
+        return 0;
+    }
+
+    mutation.set_sequence(++last_sequence_);
+    encodeFrame(pending_, mutation);
+    records_since_snapshot_++;
+    flush_cv_.notify_one();
+    return last_sequence_;
+}
+
+bool MetadataLog::waitDurable(uint64_t sequence) {
+    if (sequence == 0) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_cv_.wait(lock, [&] { return durable_sequence_ >= sequence || failed_; });
+    return durable_sequence_ >= sequence;
+}
+
+uint64_t MetadataLog::getLastSequence() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_sequence_;
+}
+
+bool MetadataLog::snapshotDue() const {
+    return records_since_snapshot_ >= SNAPSHOT_INTERVAL;
+}
+
+bool MetadataLog::checkpoint(uint64_t sequence, uint64_t entry_count, const SnapshotSource& source) {
+    // One checkpoint at a time; whoever loses the race has nothing to do
+    bool expected = false;
+    if (!checkpoint_running_.compare_exchange_strong(expected, true)) {
+        return true;
+    }
+
+    // Start a new WAL file so the current one can go once the snapshot is down
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rotate_requested_ = true;
+    }
+    flush_cv_.notify_one();
+    records_since_snapshot_ = 0;
+
+    if (!writeSnapshot(snapshot_path_, sequence, entry_count, source)) {
+        checkpoint_running_ = false;
+        return false;
+    }
+
+    // A WAL file is redundant once the file after it starts within the snapshot
+    std::vector<std::string> obsolete;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (wal_files_.size() > 1 && wal_files_[1].first_sequence <= sequence + 1) {
+            obsolete.push_back(wal_files_.front().path);
+            wal_files_.erase(wal_files_.begin());
+        }
+    }
+    for (const std::string& path : obsolete) {
+        Utils::deleteFile(path);
+    }
+
+    checkpoint_running_ = false;
+    Utils::logDebug("Wrote metadata snapshot at sequence " + std::to_string(sequence) +
+                    ", dropped " + std::to_string(obsolete.size()) + " WAL files");
+    return true;
+}
+
+bool MetadataLog::writeSnapshot(const std::string& path, uint64_t sequence, uint64_t entry_count,
+                                const SnapshotSource& source) {
+    std::string temp_path = path + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Utils::logError("Failed to open metadata snapshot: " + temp_path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+
+    persist::SnapshotHeader header;
+    header.set_last_sequence(sequence);
+    header.set_entry_count(entry_count);
+
+    std::string buffer;
+    buffer.reserve(SNAPSHOT_BUFFER_SIZE);
+    encodeFrame(buffer, header);
+
+    bool ok = true;
+    uint64_t entries = 0;
+
+    source([&](const persist::MetadataMutation& mutation) {
+        encodeFrame(buffer, mutation);
+        entries++;
+        if (buffer.size() >= SNAPSHOT_BUFFER_SIZE) {
+            ok = ok && writeAll(fd, buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    });
+
+    if (entries != entry_count) {
+        Utils::logError("Metadata snapshot produced " + std::to_string(entries) +
+                        " entries, expected " + std::to_string(entry_count));
+        ok = false;
+    }
+
+    ok = ok && writeAll(fd, buffer.data(), buffer.size());
+    ok = ok && ::fdatasync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    ok = ok && ::rename(temp_path.c_str(), path.c_str()) == 0;
+    ok = ok && syncParentDirectory(path);
+
+    if (!ok) {
+        Utils::logError("Failed to write metadata snapshot: " + path + " (" + std::strerror(errno) + ")");
+        Utils::deleteFile(temp_path);
+        return false;
+    }
+    return true;
+}
+
+void MetadataLog::flusherLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        flush_cv_.wait(lock, [this] { return stopping_ || rotate_requested_ || !pending_.empty(); });
+        if (pending_.empty() && stopping_) {
+            break;
+        }
+
+        // Everything appended so far goes out with a single fdatasync
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t batch_last = last_sequence_;
+        bool rotate = rotate_requested_ && wal_files_.back().first_sequence != batch_last + 1;
+        rotate_requested_ = false;
+        bool ok = !failed_;
+        lock.unlock();
+
+        if (ok && !batch.empty()) {
+            ok = writeAll(wal_fd_, batch.data(), batch.size()) && ::fdatasync(wal_fd_) == 0;
+        }
+        if (ok && rotate) {
+            ::close(wal_fd_);
+            wal_fd_ = -1;
+            ok = openWalFile(batch_last + 1);
+        }
+
+        lock.lock();
+        if (ok) {
+            durable_sequence_ = batch_last;
+            if (rotate) {
+                wal_files_.push_back({batch_last + 1, getWalPath(batch_last + 1)});
+            }
+        } else if (!failed_) {
+            Utils::logError("Failed to write metadata WAL: " + std::string(std::strerror(errno)));
+            failed_ = true;
+        }
+        durable_cv_.notify_all();
+    }
+}
+
+bool MetadataLog::openWalFile(uint64_t first_sequence) {
+    std::string path = getWalPath(first_sequence);
+    bool created = !Utils::fileExists(path);
+
+    wal_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (wal_fd_ < 0) {
+        Utils::logError("Failed to open metadata WAL: " + path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    if (created && !syncParentDirectory(path)) {
+        Utils::logWarning("Failed to sync directory of metadata WAL: " + path);
+    }
+    return true;
+}
+
+std::string MetadataLog::getWalPath(uint64_t first_sequence) const {
+    return base_path_ + ".wal." + std::to_string(first_sequence);
+}
+
+std::vector<MetadataLog::WalFile> MetadataLog::listWalFiles() const {
+    std::vector<WalFile> wal_files;
+    std::filesystem::path base(base_path_);
+    std::filesystem::path directory = base.has_parent_path() ? base.parent_path() : std::filesystem::path(".");
+    std::string prefix = base.filename().string() + ".wal.";
+
+    try {
+        for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+            std::string filename = entry.path().filename().string();
+            if (!entry.is_regular_file() || filename.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+
+            std::string suffix = filename.substr(prefix.size());
+            if (suffix.empty() || suffix.find_first_not_of("0123456789") != std::string::npos) {
+                continue;
+            }
+            uint64_t first_sequence = std::stoull(suffix);
+            wal_files.push_back({first_sequence, getWalPath(first_sequence)});
+        }
+    } catch (const std::exception& e) {
+        Utils::logError("Error listing metadata WAL files: " + std::string(e.what()));
+    }
+
+    std::sort(wal_files.begin(), wal_files.end(), [](const WalFile& a, const WalFile& b) {
+        return a.first_sequence < b.first_sequence;
+    });
+    return wal_files;
+}
+
+void MetadataLog::encodeFrame(std::string& buffer, const google::protobuf::Message& message) {
+    std::string payload = message.SerializeAsString();
+    putU32(buffer, static_cast<uint32_t>(payload.size()));
+    putU32(buffer, Utils::crc32c(payload.data(), payload.size()));
+    buffer += payload;
+}
+
+bool MetadataLog::readFrames(const std::vector<uint8_t>& data, size_t& valid_end,
+                             const std::function<bool(const uint8_t* payload, size_t length)>& visit) {
+    size_t offset = 0;
+
+    while (offset + FRAME_PREFIX_SIZE <= data.size()) {
+        uint32_t length = getU32(&data[offset]);
+        uint32_t crc = getU32(&data[offset + 4]);
+        const uint8_t* payload = &data[offset + FRAME_PREFIX_SIZE];
+
+        if (length > MAX_FRAME_SIZE || offset + FRAME_PREFIX_SIZE + length > data.size() ||
+            Utils::crc32c(payload, length) != crc || !visit(payload, length)) {
+            valid_end = offset;
+            return false;
+        }
+        offset += FRAME_PREFIX_SIZE + length;
+    }
+
+    valid_end = offset;
+    return offset == data.size();
+}
+
+} // namespace dfs
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "metadata_log.pb.h"
+#include "utils.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace dfs {
+
+// Write-ahead log and snapshots for the master's metadata.
+//
+// Every change is a persist::MetadataMutation with a sequence number. They
+// are appended to <base>.wal.<first sequence> files, written and fdatasync'd
+// in batches by a flusher thread (group commit). A snapshot at
+// <base>.snapshot holds the full state up to some sequence; once it is
+// written, the WAL files it covers are deleted, so recovery only replays the
+// tail written since the last snapshot.
+//
+// Both files are sequences of frames [length][crc32c][serialized message].
+class MetadataLog {
+public:
+    using MutationVisitor = std::function<void(const persist::MetadataMutation& mutation)>;
+    using SnapshotSource = std::function<void(const MutationVisitor& emit)>;
+
+    static constexpr int64_t SNAPSHOT_INTERVAL = 100000; // WAL records between snapshots
+
+    explicit MetadataLog(const std::string& base_path);
+    ~MetadataLog();
+
+    MetadataLog(const MetadataLog&) = delete;
+    MetadataLog& operator=(const MetadataLog&) = delete;
+
+    // Replays the snapshot and the WAL tail into `apply`, then starts logging
+    bool open(const MutationVisitor& apply);
+
+    // Queues a mutation and returns its sequence number (0 if the log is
+    // unusable). Callers serialize appends with the changes they describe.
+    uint64_t append(persist::MetadataMutation& mutation);
+
+    // Blocks until everything up to `sequence` is on disk
+    bool waitDurable(uint64_t sequence);
+
+    uint64_t getLastSequence() const;
+    bool snapshotDue() const;
+
+    // Writes the `entry_count` entries from `source` as the snapshot of
+    // everything up to `sequence`, then deletes the WAL files that it makes redundant
+    bool checkpoint(uint64_t sequence, uint64_t entry_count, const SnapshotSource& source);
+
+    // Writes a standalone snapshot file (no effect on the log)
+    static bool writeSnapshot(const std::string& path, uint64_t sequence, uint64_t entry_count,
+                              const SnapshotSource& source);
+
+    const std::string& getBasePath() const { return base_path_; }
+
+private:
+    struct WalFile {
+        uint64_t first_sequence;
+        std::string path;
+    };
+
+    std::string base_path_;
+    std::string snapshot_path_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable flush_cv_;
+    std::condition_variable durable_cv_;
+    std::string pending_;               // Encoded records waiting for the flusher
+    uint64_t last_sequence_;
+    uint64_t durable_sequence_;
+    bool rotate_requested_;
+    bool stopping_;
+    bool failed_;
+    std::vector<WalFile> wal_files_;    // Oldest first; the last one is being appended to
+
+    int wal_fd_;                        // Owned by the flusher thread once started
+    std::thread flusher_thread_;
+    std::atomic<int64_t> records_since_snapshot_;
+    std::atomic<bool> checkpoint_running_;
+
+    // Helper methods
+    void flusherLoop();
+    bool openWalFile(uint64_t first_sequence);
+    std::string getWalPath(uint64_t first_sequence) const;
+    std::vector<WalFile> listWalFiles() const;
+    static void encodeFrame(std::string& buffer, const google::protobuf::Message& message);
+    // Calls `visit` for each intact frame; returns false at the first bad one.
+    // valid_end is the offset after the last good frame.
+    static bool readFrames(const std::vector<uint8_t>& data, size_t& valid_end,
+                           const std::function<bool(const uint8_t* payload, size_t length)>& visit);
+};
+
+} // namespace dfs
@@ -1,12 +1,108 @@
 #include "metadata_manager.h"
 #include <algorithm>
-#include <sstream>
-#include <fstream>
 #include <json/json.h>
 #include <shared_mutex>
 
 namespace dfs {
 
+namespace {
+
+void toRecord(const std::string& filename, const FileMetadata& metadata, persist::FileRecord* record) {
+    record->set_filename(filename);
+    record->set_file_id(metadata.file_id);
+    record->set_size(metadata.size);
+    record->set_created_time(metadata.created_time);
+    record->set_modified_time(metadata.modified_time);
+    for (const std::string& chunk_id : metadata.chunk_ids) {
+        record->add_chunk_ids(chunk_id);
+    }
+    record->set_is_encrypted(metadata.is_encrypted);
+    record->set_encryption_key_id(metadata.encryption_key_id);
+    record->set_is_erasure_coded(metadata.is_erasure_coded);
+    record->set_erasure_data_blocks(metadata.erasure_data_blocks);
+    record->set_erasure_parity_blocks(metadata.erasure_parity_blocks);
+    record->set_erasure_local_parity_blocks(metadata.erasure_local_parity_blocks);
+    record->set_checksum(metadata.checksum);
+}
+
+void toRecord(const std::string& chunk_id, const ChunkMetadata& metadata, persist::ChunkRecord* record) {
+    record->set_chunk_id(chunk_id);
+    for (const std::string& server_id : metadata.server_locations) {
+        record->add_server_locations(server_id);
+    }
+    record->set_size(metadata.size);
+    record->set_checksum(metadata.checksum);
+    record->set_is_erasure_coded(metadata.is_erasure_coded);
+    record->set_erasure_group_id(metadata.erasure_group_id);
+    record->set_erasure_block_index(metadata.erasure_block_index);
+    record->set_erasure_data_blocks(metadata.erasure_data_blocks);
+    record->set_erasure_parity_blocks(metadata.erasure_parity_blocks);
+    record->set_erasure_local_parity_blocks(metadata.erasure_local_parity_blocks);
+    record->set_is_parity_block(metadata.is_parity_block);
+    record->set_created_time(metadata.created_time);
+    record->set_last_accessed_time(metadata.last_accessed_time);
+}
+
+void toRecord(const std::string& server_id, const ServerMetadata& metadata, persist::ServerRecord* record) {
+    record->set_server_id(server_id);
+    record->set_address(metadata.address);
+    record->set_port(metadata.port);
+    record->set_total_space(metadata.total_space);
+    record->set_free_space(metadata.free_space);
+    record->set_chunk_count(metadata.chunk_count);
+    record->set_cpu_usage(metadata.cpu_usage);
+    record->set_memory_usage(metadata.memory_usage);
+    record->set_is_healthy(metadata.is_healthy);
+    record->set_last_heartbeat(metadata.last_heartbeat);
+}
+
+void fromRecord(const persist::FileRecord& record, FileMetadata& metadata) {
+    metadata.file_id = record.file_id();
+    metadata.filename = record.filename();
+    metadata.size = record.size();
+    metadata.created_time = record.created_time();
+    metadata.modified_time = record.modified_time();
+    metadata.chunk_ids.assign(record.chunk_ids().begin(), record.chunk_ids().end());
+    metadata.is_encrypted = record.is_encrypted();
+    metadata.encryption_key_id = record.encryption_key_id();
+    metadata.is_erasure_coded = record.is_erasure_coded();
+    metadata.erasure_data_blocks = record.erasure_data_blocks();
+    metadata.erasure_parity_blocks = record.erasure_parity_blocks();
+    metadata.erasure_local_parity_blocks = record.erasure_local_parity_blocks();
+    metadata.checksum = record.checksum();
+}
+
+void fromRecord(const persist::ChunkRecord& record, ChunkMetadata& metadata) {
+    metadata.chunk_id = record.chunk_id();
+    metadata.server_locations.assign(record.server_locations().begin(), record.server_locations().end());
+    metadata.size = record.size();
+    metadata.checksum = record.checksum();
+    metadata.is_erasure_coded = record.is_erasure_coded();
+    metadata.erasure_group_id = record.erasure_group_id();
+    metadata.erasure_block_index = record.erasure_block_index();
+    metadata.erasure_data_blocks = record.erasure_data_blocks();
+    metadata.erasure_parity_blocks = record.erasure_parity_blocks();
+    metadata.erasure_local_parity_blocks = record.erasure_local_parity_blocks();
+    metadata.is_parity_block = record.is_parity_block();
+    metadata.created_time = record.created_time();
+    metadata.last_accessed_time = record.last_accessed_time();
+}
+
+void fromRecord(const persist::ServerRecord& record, ServerMetadata& metadata) {
+    metadata.server_id = record.server_id();
+    metadata.address = record.address();
+    metadata.port = record.port();
+    metadata.total_space = record.total_space();
+    metadata.free_space = record.free_space();
+    metadata.chunk_count = record.chunk_count();
+    metadata.cpu_usage = record.cpu_usage();
+    metadata.memory_usage = record.memory_usage();
+    metadata.is_healthy = record.is_healthy();
+    metadata.last_heartbeat = record.last_heartbeat();
+}
+
+} // namespace
+
 MetadataManager::MetadataManager() {
     Utils::logInfo("MetadataManager initialized");
 }
@@ -16,49 +112,65 @@ MetadataManager::~MetadataManager() {
 }
 
 bool MetadataManager::createFile(const std::string& filename, const FileMetadata& metadata) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    persist::MetadataMutation mutation;
+    toRecord(filename, metadata, mutation.mutable_put_file());
+    
+    FileShard& shard = fileShard(filename);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
     
-    if (files_.find(filename) != files_.end()) {
+    if (shard.files.find(filename) != shard.files.end()) {
         Utils::logWarning("File already exists: " + filename);
         return false;
     }
     
-    files_[filename] = metadata;
-    file_id_to_name_[metadata.file_id] = filename;
+    std::unique_lock<std::shared_mutex> id_lock(fileIdShard(metadata.file_id).mutex);
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyPutFile(filename, metadata);
+    id_lock.unlock();
+    lock.unlock();
     
     Utils::logInfo("Created file: " + filename + " with ID: " + metadata.file_id);
-    return true;
+    return waitForLog(sequence);
 }
 
 bool MetadataManager::deleteFile(const std::string& filename) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
-    
-    auto it = files_.find(filename);
-    if (it == files_.end()) {
-        Utils::logWarning("File not found for deletion: " + filename);
-        return false;
-    }
+    persist::MetadataMutation mutation;
+    mutation.set_delete_file(filename);
     
-    const FileMetadata& metadata = it->second;
-    
-    // Remove all chunks associated with this file
-    for (const std::string& chunk_id : metadata.chunk_ids) {
-        removeChunkFromAllServers(chunk_id);
-        chunks_.erase(chunk_id);
+    uint64_t sequence = 0;
+    {
+        FileShard& shard = fileShard(filename);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        
+        auto it = shard.files.find(filename);
+        if (it == shard.files.end()) {
+            Utils::logWarning("File not found for deletion: " + filename);
+            return false;
+        }
+        
+        std::unique_lock<std::shared_mutex> id_lock(fileIdShard(it->second.file_id).mutex);
+        ExclusiveLocks chunk_locks = lockChunkShards(it->second.chunk_ids);
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        
+        if (!logMutation(mutation, sequence)) {
+            return false;
+        }
+        applyDeleteFile(filename);
     }
     
-    file_id_to_name_.erase(metadata.file_id);
-    files_.erase(it);
-    
     Utils::logInfo("Deleted file: " + filename);
-    return true;
+    return waitForLog(sequence);
 }
 
 bool MetadataManager::getFileMetadata(const std::string& filename, FileMetadata& metadata) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    const FileShard& shard = fileShard(filename);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
     
-    auto it = files_.find(filename);
-    if (it == files_.end()) {
+    auto it = shard.files.find(filename);
+    if (it == shard.files.end()) {
         return false;
     }
     
@@ -67,12 +179,14 @@ bool MetadataManager::getFileMetadata(const std::string& filename, FileMetadata&
 }
 
 std::vector<FileMetadata> MetadataManager::listFiles(const std::string& path_prefix) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
-    
     std::vector<FileMetadata> result;
-    for (const auto& pair : files_) {
-        if (path_prefix.empty() || pair.first.find(path_prefix) == 0) {
-            result.push_back(pair.second);
+    
+    for (const FileShard& shard : file_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& pair : shard.files) {
+            if (path_prefix.empty() || pair.first.find(path_prefix) == 0) {
+                result.push_back(pair.second);
+            }
         }
     }
     
@@ -80,60 +194,160 @@ std::vector<FileMetadata> MetadataManager::listFiles(const std::string& path_pre
 }
 
 bool MetadataManager::updateFileMetadata(const std::string& filename, const FileMetadata& metadata) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    persist::MetadataMutation mutation;
+    toRecord(filename, metadata, mutation.mutable_put_file());
     
-    auto it = files_.find(filename);
-    if (it == files_.end()) {
+    FileShard& shard = fileShard(filename);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    
+    auto it = shard.files.find(filename);
+    if (it == shard.files.end()) {
         return false;
     }
     
-    it->second = metadata;
-    return true;
+    // The id index only changes along with the file id
+    ExclusiveLocks id_locks;
+    if (it->second.file_id != metadata.file_id) {
+        id_locks = lockFileIdShards({it->second.file_id, metadata.file_id});
+    }
+    
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyPutFile(filename, metadata);
+    id_locks.clear();
+    lock.unlock();
+    
+    return waitForLog(sequence);
 }
 
-bool MetadataManager::addChunk(const std::string& chunk_id, const ChunkMetadata& metadata) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+bool MetadataManager::getFileById(const std::string& file_id, FileMetadata& metadata) const {
+    std::string filename;
+    {
+        const FileIdShard& ids = fileIdShard(file_id);
+        std::shared_lock<std::shared_mutex> lock(ids.mutex);
+        
+        auto it = ids.file_id_to_name.find(file_id);
+        if (it == ids.file_id_to_name.end()) {
+            return false;
+        }
+        filename = it->second;
+    }
     
-    chunks_[chunk_id] = metadata;
+    // The file may have been replaced in between, so check the id again
+    return getFileMetadata(filename, metadata) && metadata.file_id == file_id;
+}
+
+bool MetadataManager::updateFileById(const std::string& file_id,
+                                     const std::function<void(FileMetadata&)>& update) {
+    std::string filename;
+    {
+        const FileIdShard& ids = fileIdShard(file_id);
+        std::shared_lock<std::shared_mutex> lock(ids.mutex);
+        
+        auto it = ids.file_id_to_name.find(file_id);
+        if (it == ids.file_id_to_name.end()) {
+            return false;
+        }
+        filename = it->second;
+    }
     
-    // Update chunk-server relationships
-    for (const std::string& server_id : metadata.server_locations) {
-        chunk_to_servers_[chunk_id].insert(server_id);
-        server_to_chunks_[server_id].insert(chunk_id);
+    FileShard& shard = fileShard(filename);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    
+    auto it = shard.files.find(filename);
+    if (it == shard.files.end() || it->second.file_id != file_id) {
+        return false;
+    }
+    
+    FileMetadata metadata = it->second;
+    update(metadata);
+    metadata.file_id = file_id; // Id changes go through updateFileMetadata
+    
+    persist::MetadataMutation mutation;
+    toRecord(filename, metadata, mutation.mutable_put_file());
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyPutFile(filename, metadata);
+    lock.unlock();
+    
+    return waitForLog(sequence);
+}
+
+bool MetadataManager::addChunk(const std::string& chunk_id, const ChunkMetadata& metadata) {
+    persist::MetadataMutation mutation;
+    toRecord(chunk_id, metadata, mutation.mutable_put_chunk());
+    
+    uint64_t sequence = 0;
+    {
+        std::unique_lock<std::shared_mutex> lock(chunkShard(chunk_id).mutex);
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
         
-        // Update server's chunk count
-        auto server_it = servers_.find(server_id);
-        if (server_it != servers_.end()) {
-            server_it->second.stored_chunks.insert(chunk_id);
-            server_it->second.chunk_count = server_it->second.stored_chunks.size();
+        if (!logMutation(mutation, sequence)) {
+            return false;
         }
+        applyPutChunk(chunk_id, metadata);
     }
     
     Utils::logDebug("Added chunk: " + chunk_id + " to " + 
                    std::to_string(metadata.server_locations.size()) + " servers");
-    return true;
+    return waitForLog(sequence);
+}
+
+bool MetadataManager::addChunks(const std::vector<ChunkMetadata>& chunks) {
+    uint64_t sequence = 0;
+    for (const ChunkMetadata& metadata : chunks) {
+        persist::MetadataMutation mutation;
+        toRecord(metadata.chunk_id, metadata, mutation.mutable_put_chunk());
+        
+        std::unique_lock<std::shared_mutex> lock(chunkShard(metadata.chunk_id).mutex);
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        
+        if (!logMutation(mutation, sequence)) {
+            return false;
+        }
+        applyPutChunk(metadata.chunk_id, metadata);
+    }
+    
+    Utils::logDebug("Added " + std::to_string(chunks.size()) + " chunks");
+    
+    // The log is durable in order, so the last record covers all of them
+    return chunks.empty() || waitForLog(sequence);
 }
 
 bool MetadataManager::removeChunk(const std::string& chunk_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    persist::MetadataMutation mutation;
+    mutation.set_remove_chunk(chunk_id);
     
-    auto it = chunks_.find(chunk_id);
-    if (it == chunks_.end()) {
-        return false;
+    uint64_t sequence = 0;
+    {
+        ChunkShard& shard = chunkShard(chunk_id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        
+        if (shard.chunks.find(chunk_id) == shard.chunks.end()) {
+            return false;
+        }
+        
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        if (!logMutation(mutation, sequence)) {
+            return false;
+        }
+        applyRemoveChunk(chunk_id);
     }
     
-    removeChunkFromAllServers(chunk_id);
-    chunks_.erase(it);
-    
     Utils::logDebug("Removed chunk: " + chunk_id);
-    return true;
+    return waitForLog(sequence);
 }
 
 bool MetadataManager::getChunkMetadata(const std::string& chunk_id, ChunkMetadata& metadata) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    const ChunkShard& shard = chunkShard(chunk_id);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
     
-    auto it = chunks_.find(chunk_id);
-    if (it == chunks_.end()) {
+    auto it = shard.chunks.find(chunk_id);
+    if (it == shard.chunks.end()) {
         return false;
     }
     
@@ -142,19 +356,17 @@ bool MetadataManager::getChunkMetadata(const std::string& chunk_id, ChunkMetadat
 }
 
 std::vector<ChunkMetadata> MetadataManager::getChunksForFile(const std::string& filename) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
-    
     std::vector<ChunkMetadata> result;
     
-    auto file_it = files_.find(filename);
-    if (file_it == files_.end()) {
+    FileMetadata file_metadata;
+    if (!getFileMetadata(filename, file_metadata)) {
         return result;
     }
     
-    for (const std::string& chunk_id : file_it->second.chunk_ids) {
-        auto chunk_it = chunks_.find(chunk_id);
-        if (chunk_it != chunks_.end()) {
-            result.push_back(chunk_it->second);
+    for (const std::string& chunk_id : file_metadata.chunk_ids) {
+        ChunkMetadata chunk_metadata;
+        if (getChunkMetadata(chunk_id, chunk_metadata)) {
+            result.push_back(std::move(chunk_metadata));
         }
     }
     
@@ -163,62 +375,75 @@ std::vector<ChunkMetadata> MetadataManager::getChunksForFile(const std::string&
 
 bool MetadataManager::updateChunkLocations(const std::string& chunk_id, 
                                           const std::vector<std::string>& locations) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    persist::MetadataMutation mutation;
+    persist::ChunkLocations* record = mutation.mutable_set_chunk_locations();
+    record->set_chunk_id(chunk_id);
+    for (const std::string& server_id : locations) {
+        record->add_server_ids(server_id);
+    }
+    
+    ChunkShard& shard = chunkShard(chunk_id);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
     
-    auto it = chunks_.find(chunk_id);
-    if (it == chunks_.end()) {
+    if (shard.chunks.find(chunk_id) == shard.chunks.end()) {
         return false;
     }
     
-    // Remove old relationships
-    removeChunkFromAllServers(chunk_id);
+    std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
     
-    // Add new relationships
-    it->second.server_locations = locations;
-    for (const std::string& server_id : locations) {
-        chunk_to_servers_[chunk_id].insert(server_id);
-        server_to_chunks_[server_id].insert(chunk_id);
-        
-        // Update server's chunk count
-        auto server_it = servers_.find(server_id);
-        if (server_it != servers_.end()) {
-            server_it->second.stored_chunks.insert(chunk_id);
-            server_it->second.chunk_count = server_it->second.stored_chunks.size();
-        }
+    // Locations are re-reported by chunk servers, so don't wait for the disk
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
     }
-    
+    applyChunkLocations(chunk_id, locations);
     return true;
 }
 
 bool MetadataManager::registerServer(const std::string& server_id, const ServerMetadata& metadata) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    persist::MetadataMutation mutation;
+    toRecord(server_id, metadata, mutation.mutable_put_server());
+    
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
-    servers_[server_id] = metadata;
-    server_to_chunks_[server_id]; // Initialize empty set
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyPutServer(server_id, metadata);
+    lock.unlock();
     
     Utils::logInfo("Registered server: " + server_id + " at " + 
                    metadata.address + ":" + std::to_string(metadata.port));
-    return true;
+    return waitForLog(sequence);
 }
 
 bool MetadataManager::unregisterServer(const std::string& server_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
-    
-    auto it = servers_.find(server_id);
-    if (it == servers_.end()) {
-        return false;
+    persist::MetadataMutation mutation;
+    mutation.set_unregister_server(server_id);
+    
+    uint64_t sequence = 0;
+    {
+        // The server's chunks can be in any shard; this is rare enough to lock them all
+        ExclusiveLocks chunk_locks = lockAllChunkShards();
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        
+        if (servers_.find(server_id) == servers_.end()) {
+            return false;
+        }
+        
+        if (!logMutation(mutation, sequence)) {
+            return false;
+        }
+        applyUnregisterServer(server_id);
     }
     
-    removeAllChunksFromServer(server_id);
-    servers_.erase(it);
-    server_to_chunks_.erase(server_id);
-    
     Utils::logInfo("Unregistered server: " + server_id);
-    return true;
+    return waitForLog(sequence);
 }
 
 bool MetadataManager::updateServerMetadata(const std::string& server_id, const ServerMetadata& metadata) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
     auto it = servers_.find(server_id);
     if (it == servers_.end()) {
@@ -230,7 +455,7 @@ bool MetadataManager::updateServerMetadata(const std::string& server_id, const S
 }
 
 bool MetadataManager::getServerMetadata(const std::string& server_id, ServerMetadata& metadata) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
     
     auto it = servers_.find(server_id);
     if (it == servers_.end()) {
@@ -242,7 +467,7 @@ bool MetadataManager::getServerMetadata(const std::string& server_id, ServerMeta
 }
 
 std::vector<ServerMetadata> MetadataManager::getAllServers() const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
     
     std::vector<ServerMetadata> result;
     for (const auto& pair : servers_) {
@@ -253,7 +478,7 @@ std::vector<ServerMetadata> MetadataManager::getAllServers() const {
 }
 
 std::vector<ServerMetadata> MetadataManager::getHealthyServers() const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
     
     std::vector<ServerMetadata> result;
     for (const auto& pair : servers_) {
@@ -265,60 +490,120 @@ std::vector<ServerMetadata> MetadataManager::getHealthyServers() const {
     return result;
 }
 
-bool MetadataManager::addChunkToServer(const std::string& chunk_id, const std::string& server_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
-    
-    chunk_to_servers_[chunk_id].insert(server_id);
-    server_to_chunks_[server_id].insert(chunk_id);
+bool MetadataManager::recordHeartbeat(const std::string& server_id, int64_t free_space, int chunk_count,
+                                      double cpu_usage, double memory_usage,
+                                      const ChunkCacheStats& cache_stats) {
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
-    // Update chunk metadata
-    auto chunk_it = chunks_.find(chunk_id);
-    if (chunk_it != chunks_.end()) {
-        auto& locations = chunk_it->second.server_locations;
-        if (std::find(locations.begin(), locations.end(), server_id) == locations.end()) {
-            locations.push_back(server_id);
-        }
+    auto it = servers_.find(server_id);
+    if (it == servers_.end()) {
+        return false;
     }
     
-    // Update server metadata
-    auto server_it = servers_.find(server_id);
-    if (server_it != servers_.end()) {
-        server_it->second.stored_chunks.insert(chunk_id);
-        server_it->second.chunk_count = server_it->second.stored_chunks.size();
+    ServerMetadata& server = it->second;
+    server.free_space = free_space;
+    server.chunk_count = chunk_count;
+    server.cpu_usage = cpu_usage;
+    server.memory_usage = memory_usage;
+    server.cache_stats = cache_stats;
+    server.last_heartbeat = Utils::getCurrentTimestamp();
+    server.is_healthy = true;
+    return true;
+}
+
+bool MetadataManager::processFullChunkReport(const std::string& server_id, uint64_t sequence,
+                                             const std::vector<std::string>& chunks) {
+    std::unordered_set<std::string> stored_chunks(chunks.begin(), chunks.end());
+    
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
+    
+    auto it = servers_.find(server_id);
+    if (it == servers_.end()) {
+        return false;
     }
     
+    it->second.stored_chunks.swap(stored_chunks);
+    it->second.last_report_sequence = sequence;
+    lock.unlock();
+    
+    Utils::logDebug("Full chunk report from " + server_id + ": " + std::to_string(chunks.size()) + " chunks");
     return true;
 }
 
-bool MetadataManager::removeChunkFromServer(const std::string& chunk_id, const std::string& server_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+bool MetadataManager::processIncrementalChunkReport(const std::string& server_id, uint64_t sequence,
+                                                    const std::vector<std::string>& added,
+                                                    const std::vector<std::string>& removed) {
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
-    chunk_to_servers_[chunk_id].erase(server_id);
-    server_to_chunks_[server_id].erase(chunk_id);
+    auto it = servers_.find(server_id);
+    if (it == servers_.end()) {
+        return false;
+    }
     
-    // Update chunk metadata
-    auto chunk_it = chunks_.find(chunk_id);
-    if (chunk_it != chunks_.end()) {
-        auto& locations = chunk_it->second.server_locations;
-        locations.erase(std::remove(locations.begin(), locations.end(), server_id), 
-                       locations.end());
+    ServerMetadata& server = it->second;
+    
+    // A repeat is a retry whose response got lost; every entry states the
+    // chunk's current state, so applying it again is harmless
+    uint64_t last = server.last_report_sequence;
+    if (last == 0 || (sequence != last && sequence != last + 1)) {
+        return false;
     }
     
-    // Update server metadata
-    auto server_it = servers_.find(server_id);
-    if (server_it != servers_.end()) {
-        server_it->second.stored_chunks.erase(chunk_id);
-        server_it->second.chunk_count = server_it->second.stored_chunks.size();
+    for (const std::string& chunk_id : added) {
+        server.stored_chunks.insert(chunk_id);
+    }
+    for (const std::string& chunk_id : removed) {
+        server.stored_chunks.erase(chunk_id);
     }
+    server.last_report_sequence = sequence;
+    return true;
+}
+
+bool MetadataManager::needsFullChunkReport(const std::string& server_id) const {
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
+    
+    auto it = servers_.find(server_id);
+    return it != servers_.end() && it->second.last_report_sequence == 0;
+}
+
+bool MetadataManager::addChunkToServer(const std::string& chunk_id, const std::string& server_id) {
+    persist::MetadataMutation mutation;
+    mutation.mutable_add_chunk_to_server()->set_chunk_id(chunk_id);
+    mutation.mutable_add_chunk_to_server()->set_server_id(server_id);
+    
+    std::unique_lock<std::shared_mutex> lock(chunkShard(chunk_id).mutex);
+    std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+    
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyAddChunkToServer(chunk_id, server_id);
+    return true;
+}
+
+bool MetadataManager::removeChunkFromServer(const std::string& chunk_id, const std::string& server_id) {
+    persist::MetadataMutation mutation;
+    mutation.mutable_remove_chunk_from_server()->set_chunk_id(chunk_id);
+    mutation.mutable_remove_chunk_from_server()->set_server_id(server_id);
+    
+    std::unique_lock<std::shared_mutex> lock(chunkShard(chunk_id).mutex);
+    std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
     
+    uint64_t sequence = 0;
+    if (!logMutation(mutation, sequence)) {
+        return false;
+    }
+    applyRemoveChunkFromServer(chunk_id, server_id);
     return true;
 }
 
 std::vector<std::string> MetadataManager::getServersForChunk(const std::string& chunk_id) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    const ChunkShard& shard = chunkShard(chunk_id);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
     
-    auto it = chunk_to_servers_.find(chunk_id);
-    if (it == chunk_to_servers_.end()) {
+    auto it = shard.chunk_to_servers.find(chunk_id);
+    if (it == shard.chunk_to_servers.end()) {
         return {};
     }
     
@@ -326,7 +611,7 @@ std::vector<std::string> MetadataManager::getServersForChunk(const std::string&
 }
 
 std::vector<std::string> MetadataManager::getChunksForServer(const std::string& server_id) const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
     
     auto it = server_to_chunks_.find(server_id);
     if (it == server_to_chunks_.end()) {
@@ -337,7 +622,7 @@ std::vector<std::string> MetadataManager::getChunksForServer(const std::string&
 }
 
 void MetadataManager::markServerUnhealthy(const std::string& server_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
     auto it = servers_.find(server_id);
     if (it != servers_.end()) {
@@ -347,7 +632,7 @@ void MetadataManager::markServerUnhealthy(const std::string& server_id) {
 }
 
 void MetadataManager::markServerHealthy(const std::string& server_id) {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::unique_lock<std::shared_mutex> lock(server_mutex_);
     
     auto it = servers_.find(server_id);
     if (it != servers_.end()) {
@@ -358,7 +643,7 @@ void MetadataManager::markServerHealthy(const std::string& server_id) {
 }
 
 std::vector<std::string> MetadataManager::getUnhealthyServers() const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+    std::shared_lock<std::shared_mutex> lock(server_mutex_);
     
     std::vector<std::string> result;
     for (const auto& pair : servers_) {
@@ -371,24 +656,32 @@ std::vector<std::string> MetadataManager::getUnhealthyServers() const {
 }
 
 MetadataManager::Statistics MetadataManager::getStatistics() const {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
-    
     Statistics stats = {};
-    stats.total_files = files_.size();
-    stats.total_chunks = chunks_.size();
-    stats.total_servers = servers_.size();
+    
+    for (const FileShard& shard : file_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        stats.total_files += shard.files.size();
+    }
     
     int64_t total_replicas = 0;
-    for (const auto& pair : servers_) {
-        if (pair.second.is_healthy) {
-            stats.healthy_servers++;
+    for (const ChunkShard& shard : chunk_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        stats.total_chunks += shard.chunks.size();
+        for (const auto& pair : shard.chunks) {
+            total_replicas += pair.second.server_locations.size();
         }
-        stats.total_storage_used += (pair.second.total_space - pair.second.free_space);
-        stats.total_storage_available += pair.second.free_space;
     }
     
-    for (const auto& pair : chunks_) {
-        total_replicas += pair.second.server_locations.size();
+    {
+        std::shared_lock<std::shared_mutex> lock(server_mutex_);
+        stats.total_servers = servers_.size();
+        for (const auto& pair : servers_) {
+            if (pair.second.is_healthy) {
+                stats.healthy_servers++;
+            }
+            stats.total_storage_used += (pair.second.total_space - pair.second.free_space);
+            stats.total_storage_available += pair.second.free_space;
+        }
     }
     
     if (stats.total_chunks > 0) {
@@ -399,113 +692,477 @@ MetadataManager::Statistics MetadataManager::getStatistics() const {
 }
 
 void MetadataManager::cleanupOrphanedChunks() {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    // Every chunk some file refers to, gathered one shard at a time
+    std::unordered_set<std::string> referenced_chunks;
+    for (const FileShard& shard : file_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& pair : shard.files) {
+            referenced_chunks.insert(pair.second.chunk_ids.begin(), pair.second.chunk_ids.end());
+        }
+    }
     
-    std::vector<std::string> chunks_to_remove;
+    // Chunks allocated after the scan aren't in the set yet; the grace
+    // period leaves them alone until their file has had time to claim them
+    int64_t cutoff = Utils::getCurrentTimestamp() - ORPHAN_GRACE_PERIOD_MS;
+    uint64_t sequence = 0;
+    size_t removed = 0;
     
-    for (const auto& pair : chunks_) {
-        const std::string& chunk_id = pair.first;
+    for (ChunkShard& shard : chunk_shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
         
-        // Check if chunk belongs to any file
-        bool belongs_to_file = false;
-        for (const auto& file_pair : files_) {
-            const auto& chunk_ids = file_pair.second.chunk_ids;
-            if (std::find(chunk_ids.begin(), chunk_ids.end(), chunk_id) != chunk_ids.end()) {
-                belongs_to_file = true;
-                break;
+        std::vector<std::string> chunks_to_remove;
+        for (const auto& pair : shard.chunks) {
+            if (pair.second.created_time < cutoff &&
+                referenced_chunks.find(pair.first) == referenced_chunks.end()) {
+                chunks_to_remove.push_back(pair.first);
             }
         }
+        if (chunks_to_remove.empty()) {
+            continue;
+        }
         
-        if (!belongs_to_file) {
-            chunks_to_remove.push_back(chunk_id);
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        for (const std::string& chunk_id : chunks_to_remove) {
+            persist::MetadataMutation mutation;
+            mutation.set_remove_chunk(chunk_id);
+            if (!logMutation(mutation, sequence)) {
+                return;
+            }
+            applyRemoveChunk(chunk_id);
+            Utils::logInfo("Cleaned up orphaned chunk: " + chunk_id);
+            ++removed;
         }
     }
     
-    for (const std::string& chunk_id : chunks_to_remove) {
-        removeChunk(chunk_id);
-        Utils::logInfo("Cleaned up orphaned chunk: " + chunk_id);
+    if (removed > 0) {
+        waitForLog(sequence);
     }
 }
 
 void MetadataManager::cleanupDeadServers() {
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
-    
     int64_t current_time = Utils::getCurrentTimestamp();
-    int64_t timeout = Config::getInstance().getHeartbeatTimeout();
     
-    std::vector<std::string> servers_to_remove;
+    // Look first so the usual case doesn't lock every chunk shard
+    {
+        std::shared_lock<std::shared_mutex> lock(server_mutex_);
+        bool any_dead = false;
+        for (const auto& pair : servers_) {
+            if (isDeadServer(pair.second, current_time)) {
+                any_dead = true;
+                break;
+            }
+        }
+        if (!any_dead) {
+            return;
+        }
+    }
     
-    for (const auto& pair : servers_) {
-        const std::string& server_id = pair.first;
-        const ServerMetadata& metadata = pair.second;
+    std::vector<std::string> servers_to_remove;
+    uint64_t sequence = 0;
+    {
+        ExclusiveLocks chunk_locks = lockAllChunkShards();
+        std::unique_lock<std::shared_mutex> server_lock(server_mutex_);
+        
+        for (const auto& pair : servers_) {
+            if (isDeadServer(pair.second, current_time)) {
+                servers_to_remove.push_back(pair.first);
+            }
+        }
         
-        if (!metadata.is_healthy && 
-            (current_time - metadata.last_heartbeat) > timeout * 2) {
-            servers_to_remove.push_back(server_id);
+        for (const std::string& server_id : servers_to_remove) {
+            persist::MetadataMutation mutation;
+            mutation.set_unregister_server(server_id);
+            if (!logMutation(mutation, sequence)) {
+                return;
+            }
+            applyUnregisterServer(server_id);
+            Utils::logInfo("Cleaned up dead server: " + server_id);
         }
     }
     
-    for (const std::string& server_id : servers_to_remove) {
-        unregisterServer(server_id);
-        Utils::logInfo("Cleaned up dead server: " + server_id);
+    if (!servers_to_remove.empty()) {
+        waitForLog(sequence);
     }
 }
 
-bool MetadataManager::saveMetadataToFile(const std::string& filename) {
-    std::shared_lock<std::shared_mutex> lock(metadata_mutex_);
+bool MetadataManager::saveMetadataToFile(const std::string& base_path) {
+    // Take the log position first, then copy one shard at a time so changes
+    // only ever wait for the copy of their own shard. Every change at or
+    // below `sequence` was applied under locks the copy has to take after
+    // it, so the snapshot holds all of them. Changes after `sequence` may
+    // be partly in it too, but replay applies them again from the log, and
+    // each record sets the state it describes, so that's harmless.
+    uint64_t sequence = log_ ? log_->getLastSequence() : 0;
+    
+    std::vector<persist::MetadataMutation> entries;
+    for (const FileShard& shard : file_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& pair : shard.files) {
+            entries.emplace_back();
+            toRecord(pair.first, pair.second, entries.back().mutable_put_file());
+        }
+    }
+    for (const ChunkShard& shard : chunk_shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& pair : shard.chunks) {
+            entries.emplace_back();
+            toRecord(pair.first, pair.second, entries.back().mutable_put_chunk());
+        }
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(server_mutex_);
+        for (const auto& pair : servers_) {
+            entries.emplace_back();
+            toRecord(pair.first, pair.second, entries.back().mutable_put_server());
+        }
+    }
+    
+    auto source = [&entries](const MetadataLog::MutationVisitor& emit) {
+        for (const persist::MetadataMutation& entry : entries) {
+            emit(entry);
+        }
+    };
     
-    std::string serialized = serializeMetadata();
+    bool ok;
+    if (log_ && log_->getBasePath() == base_path) {
+        ok = log_->checkpoint(sequence, entries.size(), source);
+    } else {
+        ok = MetadataLog::writeSnapshot(base_path + ".snapshot", sequence, entries.size(), source);
+    }
     
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        Utils::logError("Failed to open metadata file for writing: " + filename);
+    if (!ok) {
+        Utils::logError("Failed to save metadata snapshot: " + base_path);
         return false;
     }
     
-    file.write(serialized.c_str(), serialized.size());
+    Utils::logInfo("Saved metadata snapshot: " + base_path + " (" +
+                   std::to_string(entries.size()) + " entries)");
+    return true;
+}
+
+bool MetadataManager::loadMetadataFromFile(const std::string& base_path) {
+    std::string legacy_path = base_path + ".json";
+    bool migrate = false;
+    
+    auto log = std::make_unique<MetadataLog>(base_path);
     
-    if (!file.good()) {
-        Utils::logError("Failed to write metadata to file: " + filename);
-        return false;
+    {
+        ExclusiveLocks locks = lockEverything();
+        
+        // Metadata written by older versions as a single JSON document
+        if (Utils::fileExists(legacy_path) && !Utils::fileExists(base_path + ".snapshot")) {
+            std::vector<uint8_t> data = Utils::readFile(legacy_path);
+            if (!deserializeMetadata(std::string(data.begin(), data.end()))) {
+                Utils::logError("Failed to deserialize metadata from file: " + legacy_path);
+                return false;
+            }
+            migrate = true;
+        }
+        
+        if (!log->open([this](const persist::MetadataMutation& mutation) { applyMutation(mutation); })) {
+            Utils::logError("Failed to recover metadata from: " + base_path);
+            return false;
+        }
+        log_ = std::move(log);
+    }
+    
+    if (migrate) {
+        if (!saveMetadataToFile(base_path)) {
+            return false;
+        }
+        Utils::deleteFile(legacy_path);
+        Utils::logInfo("Migrated metadata from " + legacy_path);
     }
     
-    Utils::logInfo("Saved metadata to file: " + filename);
+    Utils::logInfo("Loaded metadata from: " + base_path);
     return true;
 }
 
-bool MetadataManager::loadMetadataFromFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        Utils::logWarning("Metadata file not found: " + filename);
-        return false;
+bool MetadataManager::snapshotDue() const {
+    return log_ && log_->snapshotDue();
+}
+
+size_t MetadataManager::shardIndex(const std::string& key) {
+    return std::hash<std::string>{}(key) % NAMESPACE_SHARDS;
+}
+
+MetadataManager::ExclusiveLocks MetadataManager::lockFileIdShards(const std::vector<std::string>& file_ids) {
+    std::vector<size_t> indices;
+    for (const std::string& file_id : file_ids) {
+        indices.push_back(shardIndex(file_id));
     }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
     
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    ExclusiveLocks locks;
+    for (size_t index : indices) {
+        locks.emplace_back(file_id_shards_[index].mutex);
+    }
+    return locks;
+}
+
+MetadataManager::ExclusiveLocks MetadataManager::lockChunkShards(const std::vector<std::string>& chunk_ids) {
+    std::vector<size_t> indices;
+    for (const std::string& chunk_id : chunk_ids) {
+        indices.push_back(shardIndex(chunk_id));
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
     
-    std::string data(size, '\0');
-    file.read(&data[0], size);
+    ExclusiveLocks locks;
+    for (size_t index : indices) {
+        locks.emplace_back(chunk_shards_[index].mutex);
+    }
+    return locks;
+}
+
+MetadataManager::ExclusiveLocks MetadataManager::lockAllChunkShards() {
+    ExclusiveLocks locks;
+    for (ChunkShard& shard : chunk_shards_) {
+        locks.emplace_back(shard.mutex);
+    }
+    return locks;
+}
+
+MetadataManager::ExclusiveLocks MetadataManager::lockEverything() {
+    ExclusiveLocks locks;
+    for (FileShard& shard : file_shards_) {
+        locks.emplace_back(shard.mutex);
+    }
+    for (FileIdShard& shard : file_id_shards_) {
+        locks.emplace_back(shard.mutex);
+    }
+    for (ChunkShard& shard : chunk_shards_) {
+        locks.emplace_back(shard.mutex);
+    }
+    locks.emplace_back(server_mutex_);
+    return locks;
+}
+
+bool MetadataManager::logMutation(persist::MetadataMutation& mutation, uint64_t& sequence) {
+    sequence = 0;
+    if (!log_) {
+        return true;
+    }
     
-    if (!file.good()) {
-        Utils::logError("Failed to read metadata from file: " + filename);
+    sequence = log_->append(mutation);
+    if (sequence == 0) {
+        Utils::logError("Metadata log is not accepting changes");
+        return false;
+    }
+    return true;
+}
+
+bool MetadataManager::waitForLog(uint64_t sequence) {
+    if (!log_) {
+        return true;
+    }
+    if (!log_->waitDurable(sequence)) {
+        Utils::logError("Metadata change was not persisted");
         return false;
     }
+    return true;
+}
+
+void MetadataManager::applyMutation(const persist::MetadataMutation& mutation) {
+    switch (mutation.operation_case()) {
+        case persist::MetadataMutation::kPutFile: {
+            FileMetadata metadata;
+            fromRecord(mutation.put_file(), metadata);
+            applyPutFile(mutation.put_file().filename(), metadata);
+            break;
+        }
+        case persist::MetadataMutation::kDeleteFile:
+            applyDeleteFile(mutation.delete_file());
+            break;
+        case persist::MetadataMutation::kPutChunk: {
+            ChunkMetadata metadata;
+            fromRecord(mutation.put_chunk(), metadata);
+            applyPutChunk(mutation.put_chunk().chunk_id(), metadata);
+            break;
+        }
+        case persist::MetadataMutation::kRemoveChunk:
+            applyRemoveChunk(mutation.remove_chunk());
+            break;
+        case persist::MetadataMutation::kSetChunkLocations: {
+            const persist::ChunkLocations& record = mutation.set_chunk_locations();
+            applyChunkLocations(record.chunk_id(),
+                                std::vector<std::string>(record.server_ids().begin(),
+                                                         record.server_ids().end()));
+            break;
+        }
+        case persist::MetadataMutation::kPutServer: {
+            ServerMetadata metadata;
+            fromRecord(mutation.put_server(), metadata);
+            applyPutServer(mutation.put_server().server_id(), metadata);
+            break;
+        }
+        case persist::MetadataMutation::kUnregisterServer:
+            applyUnregisterServer(mutation.unregister_server());
+            break;
+        case persist::MetadataMutation::kAddChunkToServer:
+            applyAddChunkToServer(mutation.add_chunk_to_server().chunk_id(),
+                                  mutation.add_chunk_to_server().server_id());
+            break;
+        case persist::MetadataMutation::kRemoveChunkFromServer:
+            applyRemoveChunkFromServer(mutation.remove_chunk_from_server().chunk_id(),
+                                       mutation.remove_chunk_from_server().server_id());
+            break;
+        default:
+            Utils::logWarning("Ignoring unknown metadata mutation at sequence " +
+                              std::to_string(mutation.sequence()));
+            break;
+    }
+}
+
+void MetadataManager::applyPutFile(const std::string& filename, const FileMetadata& metadata) {
+    FileShard& shard = fileShard(filename);
     
-    std::unique_lock<std::shared_mutex> lock(metadata_mutex_);
+    auto it = shard.files.find(filename);
+    if (it != shard.files.end() && it->second.file_id == metadata.file_id) {
+        it->second = metadata;
+        return;
+    }
     
-    if (!deserializeMetadata(data)) {
-        Utils::logError("Failed to deserialize metadata from file: " + filename);
-        return false;
+    if (it != shard.files.end()) {
+        fileIdShard(it->second.file_id).file_id_to_name.erase(it->second.file_id);
+    }
+    shard.files[filename] = metadata;
+    fileIdShard(metadata.file_id).file_id_to_name[metadata.file_id] = filename;
+}
+
+void MetadataManager::applyDeleteFile(const std::string& filename) {
+    FileShard& shard = fileShard(filename);
+    
+    auto it = shard.files.find(filename);
+    if (it == shard.files.end()) {
+        return;
     }
     
-    Utils::logInfo("Loaded metadata from file: " + filename);
-    return true;
+    // Remove all chunks associated with this file
+    for (const std::string& chunk_id : it->second.chunk_ids) {
+        removeChunkFromAllServers(chunk_id);
+        chunkShard(chunk_id).chunks.erase(chunk_id);
+    }
+    
+    fileIdShard(it->second.file_id).file_id_to_name.erase(it->second.file_id);
+    shard.files.erase(it);
+}
+
+void MetadataManager::applyPutChunk(const std::string& chunk_id, const ChunkMetadata& metadata) {
+    ChunkShard& shard = chunkShard(chunk_id);
+    shard.chunks[chunk_id] = metadata;
+    
+    // Update chunk-server relationships
+    for (const std::string& server_id : metadata.server_locations) {
+        shard.chunk_to_servers[chunk_id].insert(server_id);
+        server_to_chunks_[server_id].insert(chunk_id);
+        
+        // Update server's chunk count
+        auto server_it = servers_.find(server_id);
+        if (server_it != servers_.end()) {
+            server_it->second.stored_chunks.insert(chunk_id);
+            server_it->second.chunk_count = server_it->second.stored_chunks.size();
+        }
+    }
+}
+
+void MetadataManager::applyRemoveChunk(const std::string& chunk_id) {
+    removeChunkFromAllServers(chunk_id);
+    chunkShard(chunk_id).chunks.erase(chunk_id);
+}
+
+void MetadataManager::applyChunkLocations(const std::string& chunk_id,
+                                          const std::vector<std::string>& locations) {
+    ChunkShard& shard = chunkShard(chunk_id);
+    
+    auto it = shard.chunks.find(chunk_id);
+    if (it == shard.chunks.end()) {
+        return;
+    }
+    
+    // Remove old relationships
+    removeChunkFromAllServers(chunk_id);
+    
+    // Add new relationships
+    it->second.server_locations = locations;
+    for (const std::string& server_id : locations) {
+        shard.chunk_to_servers[chunk_id].insert(server_id);
+        server_to_chunks_[server_id].insert(chunk_id);
+        
+        // Update server's chunk count
+        auto server_it = servers_.find(server_id);
+        if (server_it != servers_.end()) {
+            server_it->second.stored_chunks.insert(chunk_id);
+            server_it->second.chunk_count = server_it->second.stored_chunks.size();
+        }
+    }
+}
+
+void MetadataManager::applyPutServer(const std::string& server_id, const ServerMetadata& metadata) {
+    ServerMetadata& server = servers_[server_id];
+    server = metadata;
+    
+    // Chunks already known to live on this server stay attached to it until
+    // its first chunk report
+    server.stored_chunks = server_to_chunks_[server_id];
+    server.last_report_sequence = 0;
+}
+
+void MetadataManager::applyUnregisterServer(const std::string& server_id) {
+    removeAllChunksFromServer(server_id);
+    servers_.erase(server_id);
+    server_to_chunks_.erase(server_id);
+}
+
+void MetadataManager::applyAddChunkToServer(const std::string& chunk_id, const std::string& server_id) {
+    ChunkShard& shard = chunkShard(chunk_id);
+    shard.chunk_to_servers[chunk_id].insert(server_id);
+    server_to_chunks_[server_id].insert(chunk_id);
+    
+    // Update chunk metadata
+    auto chunk_it = shard.chunks.find(chunk_id);
+    if (chunk_it != shard.chunks.end()) {
+        auto& locations = chunk_it->second.server_locations;
+        if (std::find(locations.begin(), locations.end(), server_id) == locations.end()) {
+            locations.push_back(server_id);
+        }
+    }
+    
+    // Update server metadata
+    auto server_it = servers_.find(server_id);
+    if (server_it != servers_.end()) {
+        server_it->second.stored_chunks.insert(chunk_id);
+        server_it->second.chunk_count = server_it->second.stored_chunks.size();
+    }
+}
+
+void MetadataManager::applyRemoveChunkFromServer(const std::string& chunk_id, const std::string& server_id) {
+    ChunkShard& shard = chunkShard(chunk_id);
+    shard.chunk_to_servers[chunk_id].erase(server_id);
+    server_to_chunks_[server_id].erase(chunk_id);
+    
+    // Update chunk metadata
+    auto chunk_it = shard.chunks.find(chunk_id);
+    if (chunk_it != shard.chunks.end()) {
+        auto& locations = chunk_it->second.server_locations;
+        locations.erase(std::remove(locations.begin(), locations.end(), server_id), 
+                       locations.end());
+    }
+    
+    // Update server metadata
+    auto server_it = servers_.find(server_id);
+    if (server_it != servers_.end()) {
+        server_it->second.stored_chunks.erase(chunk_id);
+        server_it->second.chunk_count = server_it->second.stored_chunks.size();
+    }
 }
 
 void MetadataManager::removeChunkFromAllServers(const std::string& chunk_id) {
-    auto it = chunk_to_servers_.find(chunk_id);
-    if (it != chunk_to_servers_.end()) {
+    ChunkShard& shard = chunkShard(chunk_id);
+    
+    auto it = shard.chunk_to_servers.find(chunk_id);
+    if (it != shard.chunk_to_servers.end()) {
         for (const std::string& server_id : it->second) {
             server_to_chunks_[server_id].erase(chunk_id);
             
@@ -516,7 +1173,7 @@ void MetadataManager::removeChunkFromAllServers(const std::string& chunk_id) {
                 server_it->second.chunk_count = server_it->second.stored_chunks.size();
             }
         }
-        chunk_to_servers_.erase(it);
+        shard.chunk_to_servers.erase(it);
     }
 }
 
@@ -524,11 +1181,12 @@ void MetadataManager::removeAllChunksFromServer(const std::string& server_id) {
     auto it = server_to_chunks_.find(server_id);
     if (it != server_to_chunks_.end()) {
         for (const std::string& chunk_id : it->second) {
-            chunk_to_servers_[chunk_id].erase(server_id);
+            ChunkShard& shard = chunkShard(chunk_id);
+            shard.chunk_to_servers[chunk_id].erase(server_id);
             
             // Update chunk metadata
-            auto chunk_it = chunks_.find(chunk_id);
-            if (chunk_it != chunks_.end()) {
+            auto chunk_it = shard.chunks.find(chunk_id);
+            if (chunk_it != shard.chunks.end()) {
                 auto& locations = chunk_it->second.server_locations;
                 locations.erase(std::remove(locations.begin(), locations.end(), server_id), 
                                locations.end());
@@ -538,84 +1196,9 @@ void MetadataManager::removeAllChunksFromServer(const std::string& server_id) {
     }
 }
 
-std::string MetadataManager::serializeMetadata() const {
-    Json::Value root;
-    
-    // Serialize files
-    Json::Value files_json(Json::arrayValue);
-    for (const auto& pair : files_) {
-        Json::Value file_json;
-        const FileMetadata& metadata = pair.second;
-        
-        file_json["filename"] = pair.first;
-        file_json["file_id"] = metadata.file_id;
-        file_json["size"] = static_cast<Json::Int64>(metadata.size);
-        file_json["created_time"] = static_cast<Json::Int64>(metadata.created_time);
-        file_json["modified_time"] = static_cast<Json::Int64>(metadata.modified_time);
-        file_json["is_encrypted"] = metadata.is_encrypted;
-        file_json["encryption_key_id"] = metadata.encryption_key_id;
-        file_json["is_erasure_coded"] = metadata.is_erasure_coded;
-        file_json["checksum"] = metadata.checksum;
-        
-        Json::Value chunks_json(Json::arrayValue);
-        for (const std::string& chunk_id : metadata.chunk_ids) {
-            chunks_json.append(chunk_id);
-        }
-        file_json["chunk_ids"] = chunks_json;
-        
-        files_json.append(file_json);
-    }
-    root["files"] = files_json;
-    
-    // Serialize chunks
-    Json::Value chunks_json(Json::arrayValue);
-    for (const auto& pair : chunks_) {
-        Json::Value chunk_json;
-        const ChunkMetadata& metadata = pair.second;
-        
-        chunk_json["chunk_id"] = pair.first;
-        chunk_json["size"] = static_cast<Json::Int64>(metadata.size);
-        chunk_json["checksum"] = metadata.checksum;
-        chunk_json["is_erasure_coded"] = metadata.is_erasure_coded;
-        chunk_json["erasure_group_id"] = metadata.erasure_group_id;
-        chunk_json["erasure_block_index"] = metadata.erasure_block_index;
-        chunk_json["is_parity_block"] = metadata.is_parity_block;
-        chunk_json["created_time"] = static_cast<Json::Int64>(metadata.created_time);
-        chunk_json["last_accessed_time"] = static_cast<Json::Int64>(metadata.last_accessed_time);
-        
-        Json::Value servers_json(Json::arrayValue);
-        for (const std::string& server_id : metadata.server_locations) {
-            servers_json.append(server_id);
-        }
-        chunk_json["server_locations"] = servers_json;
-        
-        chunks_json.append(chunk_json);
-    }
-    root["chunks"] = chunks_json;
-    
-    // Serialize servers
-    Json::Value servers_json(Json::arrayValue);
-    for (const auto& pair : servers_) {
-        Json::Value server_json;
-        const ServerMetadata& metadata = pair.second;
-        
-        server_json["server_id"] = pair.first;
-        server_json["address"] = metadata.address;
-        server_json["port"] = metadata.port;
-        server_json["total_space"] = static_cast<Json::Int64>(metadata.total_space);
-        server_json["free_space"] = static_cast<Json::Int64>(metadata.free_space);
-        server_json["chunk_count"] = metadata.chunk_count;
-        server_json["cpu_usage"] = metadata.cpu_usage;
-        server_json["memory_usage"] = metadata.memory_usage;
-        server_json["is_healthy"] = metadata.is_healthy;
-        server_json["last_heartbeat"] = static_cast<Json::Int64>(metadata.last_heartbeat);
-        
-        servers_json.append(server_json);
-    }
-    root["servers"] = servers_json;
-    
-    Json::StreamWriterBuilder builder;
-    return Json::writeString(builder, root);
+bool MetadataManager::isDeadServer(const ServerMetadata& metadata, int64_t current_time) const {
+    int64_t timeout = Config::getInstance().getHeartbeatTimeout();
+    return !metadata.is_healthy && (current_time - metadata.last_heartbeat) > timeout * 2;
 }
 
 bool MetadataManager::deserializeMetadata(const std::string& data) {
@@ -629,14 +1212,6 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
         return false;
     }
     
-    // Clear existing metadata
-    files_.clear();
-    file_id_to_name_.clear();
-    chunks_.clear();
-    servers_.clear();
-    chunk_to_servers_.clear();
-    server_to_chunks_.clear();
-    
     try {
         // Deserialize files
         const Json::Value& files_json = root["files"];
@@ -652,6 +1227,10 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
             metadata.is_encrypted = file_json["is_encrypted"].asBool();
             metadata.encryption_key_id = file_json["encryption_key_id"].asString();
             metadata.is_erasure_coded = file_json["is_erasure_coded"].asBool();
+            // Legacy metadata predates per-file profiles; everything was 4+2
+            metadata.erasure_data_blocks = metadata.is_erasure_coded ? ERASURE_CODING_DATA_BLOCKS : 0;
+            metadata.erasure_parity_blocks = metadata.is_erasure_coded ? ERASURE_CODING_PARITY_BLOCKS : 0;
+            metadata.erasure_local_parity_blocks = 0;
             metadata.checksum = file_json["checksum"].asString();
             
             const Json::Value& chunks_json = file_json["chunk_ids"];
@@ -659,8 +1238,7 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
                 metadata.chunk_ids.push_back(chunk_json.asString());
             }
             
-            files_[filename] = metadata;
-            file_id_to_name_[metadata.file_id] = filename;
+            applyPutFile(filename, metadata);
         }
         
         // Deserialize chunks
@@ -675,22 +1253,22 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
             metadata.is_erasure_coded = chunk_json["is_erasure_coded"].asBool();
             metadata.erasure_group_id = chunk_json["erasure_group_id"].asString();
             metadata.erasure_block_index = chunk_json["erasure_block_index"].asInt();
+            metadata.erasure_data_blocks = metadata.is_erasure_coded ? ERASURE_CODING_DATA_BLOCKS : 0;
+            metadata.erasure_parity_blocks = metadata.is_erasure_coded ? ERASURE_CODING_PARITY_BLOCKS : 0;
+            metadata.erasure_local_parity_blocks = 0;
             metadata.is_parity_block = chunk_json["is_parity_block"].asBool();
             metadata.created_time = chunk_json["created_time"].asInt64();
             metadata.last_accessed_time = chunk_json["last_accessed_time"].asInt64();
             
             const Json::Value& servers_json = chunk_json["server_locations"];
             for (const Json::Value& server_json : servers_json) {
-                std::string server_id = server_json.asString();
-                metadata.server_locations.push_back(server_id);
-                chunk_to_servers_[chunk_id].insert(server_id);
-                server_to_chunks_[server_id].insert(chunk_id);
+                metadata.server_locations.push_back(server_json.asString());
             }
             
-            chunks_[chunk_id] = metadata;
+            applyPutChunk(chunk_id, metadata);
         }
         
-        // Deserialize servers
+        // Deserialize servers (stored chunks are rebuilt from the chunk locations)
         const Json::Value& servers_json = root["servers"];
         for (const Json::Value& server_json : servers_json) {
             ServerMetadata metadata;
@@ -707,13 +1285,7 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
             metadata.is_healthy = server_json["is_healthy"].asBool();
             metadata.last_heartbeat = server_json["last_heartbeat"].asInt64();
             
-            // Rebuild stored_chunks set
-            auto chunks_it = server_to_chunks_.find(server_id);
-            if (chunks_it != server_to_chunks_.end()) {
-                metadata.stored_chunks = chunks_it->second;
-            }
-            
-            servers_[server_id] = metadata;
+            applyPutServer(server_id, metadata);
         }
         
     } catch (const std::exception& e) {
@@ -724,4 +1296,4 @@ bool MetadataManager::deserializeMetadata(const std::string& data) {
     return true;
 }
 
-} // namespace dfs
\ No newline at end of file
+} // namespace dfs
@@ -2,11 +2,15 @@
 
 #include "file_system.pb.h"
 #include "file_system.grpc.pb.h"
+#include "metadata_log.h"
 #include "utils.h"
 #include <unordered_map>
 #include <unordered_set>
+#include <array>
 #include <mutex>
+#include <shared_mutex>
 #include <memory>
+#include <functional>
 #include <fstream>
 
 namespace dfs {
@@ -22,6 +26,9 @@ struct FileMetadata {
     bool is_encrypted;
     std::string encryption_key_id;
     bool is_erasure_coded;
+    int erasure_data_blocks;    // Stripe profile (k+m or k+l+g) of erasure-coded files, 0 otherwise
+    int erasure_parity_blocks;
+    int erasure_local_parity_blocks;
     std::string checksum;
 };
 
@@ -34,6 +41,9 @@ struct ChunkMetadata {
     bool is_erasure_coded;
     std::string erasure_group_id;
     int erasure_block_index;
+    int erasure_data_blocks;    // Profile of the block's stripe, 0 if not erasure coded
+    int erasure_parity_blocks;
+    int erasure_local_parity_blocks;
     bool is_parity_block;
     int64_t created_time;
     int64_t last_accessed_time;
@@ -52,6 +62,8 @@ struct ServerMetadata {
     bool is_healthy;
     int64_t last_heartbeat;
     std::unordered_set<std::string> stored_chunks;
+    uint64_t last_report_sequence;      // Last chunk report applied, 0 if none yet
+    ChunkCacheStats cache_stats;        // Read cache counters from the last heartbeat
 };
 
 // Metadata manager class
@@ -67,8 +79,15 @@ public:
     std::vector<FileMetadata> listFiles(const std::string& path_prefix = "") const;
     bool updateFileMetadata(const std::string& filename, const FileMetadata& metadata);
     
+    // Lookups by file id through the file id index; `update` edits the stored
+    // metadata in place under the write lock (name and id must not change)
+    bool getFileById(const std::string& file_id, FileMetadata& metadata) const;
+    bool updateFileById(const std::string& file_id, const std::function<void(FileMetadata&)>& update);
+    
     // Chunk operations
     bool addChunk(const std::string& chunk_id, const ChunkMetadata& metadata);
+    // Adds every chunk (keyed by its chunk_id) and waits for the log once
+    bool addChunks(const std::vector<ChunkMetadata>& chunks);
     bool removeChunk(const std::string& chunk_id);
     bool getChunkMetadata(const std::string& chunk_id, ChunkMetadata& metadata) const;
     std::vector<ChunkMetadata> getChunksForFile(const std::string& filename) const;
@@ -82,15 +101,34 @@ public:
     std::vector<ServerMetadata> getAllServers() const;
     std::vector<ServerMetadata> getHealthyServers() const;
     
+    // Heartbeats, applied in place. Chunk reports are soft state that is
+    // never logged: a full report replaces the server's stored chunks, and an
+    // incremental one is only applied if its sequence follows (or repeats)
+    // the last one - otherwise it returns false and a full report is needed.
+    bool recordHeartbeat(const std::string& server_id, int64_t free_space, int chunk_count,
+                         double cpu_usage, double memory_usage,
+                         const ChunkCacheStats& cache_stats = ChunkCacheStats());
+    bool processFullChunkReport(const std::string& server_id, uint64_t sequence,
+                                const std::vector<std::string>& chunks);
+    bool processIncrementalChunkReport(const std::string& server_id, uint64_t sequence,
+                                       const std::vector<std::string>& added,
+                                       const std::vector<std::string>& removed);
+    bool needsFullChunkReport(const std::string& server_id) const;
+    
     // Chunk-server relationship
     bool addChunkToServer(const std::string& chunk_id, const std::string& server_id);
     bool removeChunkFromServer(const std::string& chunk_id, const std::string& server_id);
     std::vector<std::string> getServersForChunk(const std::string& chunk_id) const;
     std::vector<std::string> getChunksForServer(const std::string& server_id) const;
     
-    // Persistence
-    bool saveMetadataToFile(const std::string& filename);
-    bool loadMetadataFromFile(const std::string& filename);
+    // Persistence. State lives in <base_path>.snapshot plus the write-ahead
+    // log of later changes (see MetadataLog). Loading recovers both and then
+    // logs every change; file, chunk and server registration changes return
+    // once they are on disk, chunk locations are logged without waiting.
+    // Heartbeat statistics and health are only captured by snapshots.
+    bool saveMetadataToFile(const std::string& base_path);
+    bool loadMetadataFromFile(const std::string& base_path);
+    bool snapshotDue() const;
     
     // Health checking
     void markServerUnhealthy(const std::string& server_id);
@@ -115,24 +153,81 @@ public:
     void cleanupDeadServers();
     
 private:
-    mutable std::shared_mutex metadata_mutex_;
+    // Lock order: file shards, then file id shards, then chunk shards (each
+    // in index order), then server_mutex_. Every change holds the locks of
+    // everything it touches while it is logged and then applied, so
+    // conflicting changes reach the log in the order they are applied, and
+    // a change the log refuses is never applied.
+    static constexpr size_t NAMESPACE_SHARDS = 64;
+    static constexpr int64_t ORPHAN_GRACE_PERIOD_MS = 10 * 60 * 1000; // Time to attach a new chunk to its file
     
-    // Metadata storage
-    std::unordered_map<std::string, FileMetadata> files_;           // filename -> metadata
-    std::unordered_map<std::string, std::string> file_id_to_name_;  // file_id -> filename
-    std::unordered_map<std::string, ChunkMetadata> chunks_;         // chunk_id -> metadata
-    std::unordered_map<std::string, ServerMetadata> servers_;       // server_id -> metadata
+    struct FileShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, FileMetadata> files;            // filename -> metadata
+    };
+    
+    struct FileIdShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::string> file_id_to_name;   // file_id -> filename
+    };
+    
+    struct ChunkShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, ChunkMetadata> chunks;          // chunk_id -> metadata
+        std::unordered_map<std::string, std::unordered_set<std::string>> chunk_to_servers;
+    };
     
-    // Relationship mappings
-    std::unordered_map<std::string, std::unordered_set<std::string>> chunk_to_servers_;
+    std::array<FileShard, NAMESPACE_SHARDS> file_shards_;
+    std::array<FileIdShard, NAMESPACE_SHARDS> file_id_shards_;
+    std::array<ChunkShard, NAMESPACE_SHARDS> chunk_shards_;
+    
+    mutable std::shared_mutex server_mutex_;
+    std::unordered_map<std::string, ServerMetadata> servers_;       // server_id -> metadata
     std::unordered_map<std::string, std::unordered_set<std::string>> server_to_chunks_;
     
+    std::unique_ptr<MetadataLog> log_;
+    
+    using ExclusiveLocks = std::vector<std::unique_lock<std::shared_mutex>>;
+    
+    static size_t shardIndex(const std::string& key);
+    FileShard& fileShard(const std::string& filename) { return file_shards_[shardIndex(filename)]; }
+    const FileShard& fileShard(const std::string& filename) const { return file_shards_[shardIndex(filename)]; }
+    FileIdShard& fileIdShard(const std::string& file_id) { return file_id_shards_[shardIndex(file_id)]; }
+    const FileIdShard& fileIdShard(const std::string& file_id) const { return file_id_shards_[shardIndex(file_id)]; }
+    ChunkShard& chunkShard(const std::string& chunk_id) { return chunk_shards_[shardIndex(chunk_id)]; }
+    const ChunkShard& chunkShard(const std::string& chunk_id) const { return chunk_shards_[shardIndex(chunk_id)]; }
+    
+    // Lock the shards holding the given keys, in index order
+    ExclusiveLocks lockFileIdShards(const std::vector<std::string>& file_ids);
+    ExclusiveLocks lockChunkShards(const std::vector<std::string>& chunk_ids);
+    ExclusiveLocks lockAllChunkShards();
+    // Every lock, for exclusive access to everything
+    ExclusiveLocks lockEverything();
+    
+    // Changes shared by the public methods and log replay; the caller holds
+    // the locks for every key involved (and server_mutex_ for the chunk ones)
+    void applyMutation(const persist::MetadataMutation& mutation);
+    void applyPutFile(const std::string& filename, const FileMetadata& metadata);
+    void applyDeleteFile(const std::string& filename);
+    void applyPutChunk(const std::string& chunk_id, const ChunkMetadata& metadata);
+    void applyRemoveChunk(const std::string& chunk_id);
+    void applyChunkLocations(const std::string& chunk_id, const std::vector<std::string>& locations);
+    void applyPutServer(const std::string& server_id, const ServerMetadata& metadata);
+    void applyUnregisterServer(const std::string& server_id);   // needs all chunk shards
+    void applyAddChunkToServer(const std::string& chunk_id, const std::string& server_id);
+    void applyRemoveChunkFromServer(const std::string& chunk_id, const std::string& server_id);
+    
+    // Appends while the change's locks are held, before it is applied; false
+    // if the log refused it. Wait for `sequence` after releasing the locks
+    bool logMutation(persist::MetadataMutation& mutation, uint64_t& sequence);
+    bool waitForLog(uint64_t sequence);
+    
     // Helper methods
     void removeChunkFromAllServers(const std::string& chunk_id);
     void removeAllChunksFromServer(const std::string& server_id);
+    bool isDeadServer(const ServerMetadata& metadata, int64_t current_time) const;
     
-    // Serialization helpers
-    std::string serializeMetadata() const;
+    // Import of the JSON format used before the write-ahead log
     bool deserializeMetadata(const std::string& data);
 };
 
@@ -1,4 +1,5 @@
 #include "web_server.h"
+#include "erasure_coding.h"
 #include <iostream>
 #include <sstream>
 #include <sys/socket.h>
@@ -227,7 +228,9 @@ std::string WebServer::generateFilesPage() {
         html << "<td>" << Utils::timestampToString(file.created_time) << "</td>";
         html << "<td>" << file.chunk_ids.size() << "</td>";
         html << "<td>" << (file.is_encrypted ? "Yes" : "No") << "</td>";
-        html << "<td>" << (file.is_erasure_coded ? "Yes" : "No") << "</td>";
+        ErasureCodingProfile profile{file.erasure_data_blocks, file.erasure_parity_blocks,
+                                     file.erasure_local_parity_blocks};
+        html << "<td>" << (file.is_erasure_coded ? profile.toString() : "No") << "</td>";
         html << "</tr>";
     }
     
@@ -560,6 +563,9 @@ std::string WebServer::serializeFileList() {
         json_file["chunk_count"] = static_cast<int>(file.chunk_ids.size());
         json_file["is_encrypted"] = file.is_encrypted;
         json_file["is_erasure_coded"] = file.is_erasure_coded;
+        json_file["erasure_data_blocks"] = file.erasure_data_blocks;
+        json_file["erasure_parity_blocks"] = file.erasure_parity_blocks;
+        json_file["erasure_local_parity_blocks"] = file.erasure_local_parity_blocks;
         json_files.append(json_file);
     }
     
@@ -582,6 +588,14 @@ std::string WebServer::serializeServerList() {
         json_server["total_space"] = static_cast<Json::Int64>(server.total_space);
         json_server["cpu_usage"] = server.cpu_usage;
         json_server["memory_usage"] = server.memory_usage;
+        
+        const ChunkCacheStats& cache = server.cache_stats;
+        int64_t lookups = cache.hits() + cache.misses();
+        json_server["cache_hits"] = static_cast<Json::Int64>(cache.hits());
+        json_server["cache_misses"] = static_cast<Json::Int64>(cache.misses());
+        json_server["cache_hit_ratio"] = lookups > 0 ? static_cast<double>(cache.hits()) / lookups : 0.0;
+        json_server["cache_bytes"] = static_cast<Json::Int64>(cache.cached_bytes());
+        json_server["cache_capacity"] = static_cast<Json::Int64>(cache.capacity_bytes());
         json_server["last_heartbeat"] = static_cast<Json::Int64>(server.last_heartbeat);
         json_servers.append(json_server);
     }
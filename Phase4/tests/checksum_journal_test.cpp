@@ -0,0 +1,180 @@
+#include "test_framework.h"
+#include "../src/chunkserver/checksum_journal.h"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <unistd.h>
+
+namespace dfs {
+namespace test {
+
+class ChecksumJournalTest : public DFSTestBase {
+protected:
+    using Index = std::map<std::string, std::string>;
+    
+    void SetUp() override {
+        DFSTestBase::SetUp();
+        journal_path_ = test_dir_ + "/checksums.journal";
+        ASSERT_TRUE(reopen().empty());
+    }
+    
+    // Closes the journal and replays it into a fresh index, as ChunkStorage
+    // does on startup
+    Index reopen() {
+        journal_.reset();
+        journal_ = std::make_unique<ChecksumJournal>(test_dir_);
+        Index index;
+        EXPECT_TRUE(journal_->open([&](const std::string& chunk_id, const std::string& checksum) {
+            if (checksum.empty()) {
+                index.erase(chunk_id);
+            } else {
+                index[chunk_id] = checksum;
+            }
+        }));
+        return index;
+    }
+    
+    bool checkpoint(const Index& index) {
+        return journal_->checkpoint([&](const ChecksumJournal::EntryVisitor& emit) {
+            for (const auto& entry : index) {
+                emit(entry.first, entry.second);
+            }
+        });
+    }
+    
+    int64_t journalSize() const {
+        return Utils::getFileSize(journal_path_);
+    }
+    
+    std::string journal_path_;
+    std::unique_ptr<ChecksumJournal> journal_;
+};
+
+TEST_F(ChecksumJournalTest, ReplaysRecordsAfterRestart) {
+    ASSERT_TRUE(journal_->recordPut("a", "sum_a"));
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b1"));
+    ASSERT_TRUE(journal_->recordDelete("a"));
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b2"));
+    ASSERT_TRUE(journal_->recordPut("c", "sum_c"));
+    ASSERT_TRUE(journal_->sync());
+    
+    EXPECT_EQ(reopen(), (Index{{"b", "sum_b2"}, {"c", "sum_c"}}));
+    EXPECT_FALSE(journal_->checkpointDue());
+    
+    // Appends after a restart land behind the replayed records
+    ASSERT_TRUE(journal_->recordDelete("c"));
+    ASSERT_TRUE(journal_->recordPut("a", "sum_a2"));
+    EXPECT_EQ(reopen(), (Index{{"a", "sum_a2"}, {"b", "sum_b2"}}));
+}
+
+TEST_F(ChecksumJournalTest, TornTailIsDropped) {
+    ASSERT_TRUE(journal_->recordPut("a", "sum_a"));
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b"));
+    int64_t intact = journalSize();
+    ASSERT_TRUE(journal_->recordPut("c", "sum_c"));
+    journal_.reset();
+    
+    // Cut the last record short, as a crash in the middle of the write would
+    ASSERT_EQ(::truncate(journal_path_.c_str(), journalSize() - 3), 0);
+    EXPECT_EQ(reopen(), (Index{{"a", "sum_a"}, {"b", "sum_b"}}));
+    EXPECT_EQ(journalSize(), intact);
+    
+    // Later records must not end up behind the garbage
+    ASSERT_TRUE(journal_->recordPut("d", "sum_d"));
+    EXPECT_EQ(reopen(), (Index{{"a", "sum_a"}, {"b", "sum_b"}, {"d", "sum_d"}}));
+}
+
+TEST_F(ChecksumJournalTest, CorruptRecordEndsReplay) {
+    ASSERT_TRUE(journal_->recordPut("a", "sum_a"));
+    int64_t second = journalSize();
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b"));
+    ASSERT_TRUE(journal_->recordPut("c", "sum_c"));
+    journal_.reset();
+    
+    {
+        std::fstream file(journal_path_, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(second + 10);
+        file.put('X');
+    }
+    EXPECT_EQ(reopen(), (Index{{"a", "sum_a"}}));
+    EXPECT_EQ(journalSize(), second);
+}
+
+TEST_F(ChecksumJournalTest, ReplaysCheckpointThenJournal) {
+    Index index;
+    for (int i = 0; i < 100; ++i) {
+        index["chunk" + std::to_string(i)] = "sum" + std::to_string(i);
+        ASSERT_TRUE(journal_->recordPut("chunk" + std::to_string(i), "sum" + std::to_string(i)));
+    }
+    ASSERT_TRUE(checkpoint(index));
+    EXPECT_TRUE(std::filesystem::exists(test_dir_ + "/checksums.checkpoint"));
+    EXPECT_FALSE(std::filesystem::exists(test_dir_ + "/checksums.journal.old"));
+    EXPECT_EQ(journalSize(), 0);
+    
+    // Changes after the checkpoint are replayed on top of it
+    ASSERT_TRUE(journal_->recordDelete("chunk3"));
+    ASSERT_TRUE(journal_->recordPut("chunk4", "changed"));
+    ASSERT_TRUE(journal_->recordPut("new", "sum_new"));
+    index.erase("chunk3");
+    index["chunk4"] = "changed";
+    index["new"] = "sum_new";
+    EXPECT_EQ(reopen(), index);
+}
+
+TEST_F(ChecksumJournalTest, RecordsRacingWithCheckpointAreKept) {
+    ASSERT_TRUE(journal_->recordPut("a", "sum_a"));
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b"));
+    
+    // Writers keep appending while the snapshot is being written
+    ASSERT_TRUE(journal_->checkpoint([&](const ChecksumJournal::EntryVisitor& emit) {
+        emit("a", "sum_a");
+        EXPECT_TRUE(journal_->recordPut("late", "sum_late"));
+        EXPECT_TRUE(journal_->recordDelete("b"));
+        emit("b", "sum_b");
+    }));
+    
+    EXPECT_EQ(reopen(), (Index{{"a", "sum_a"}, {"late", "sum_late"}}));
+}
+
+TEST_F(ChecksumJournalTest, InterruptedCheckpointIsFinishedAfterRestart) {
+    ASSERT_TRUE(checkpoint({{"a", "sum_a"}}));
+    ASSERT_TRUE(journal_->recordPut("b", "sum_b"));
+    journal_.reset();
+    
+    // A crash after the journal was rotated but before the checkpoint replaced
+    std::filesystem::rename(journal_path_, test_dir_ + "/checksums.journal.old");
+    Index index = reopen();
+    EXPECT_EQ(index, (Index{{"a", "sum_a"}, {"b", "sum_b"}}));
+    EXPECT_TRUE(journal_->checkpointDue());
+    
+    ASSERT_TRUE(journal_->recordPut("c", "sum_c"));
+    index["c"] = "sum_c";
+    ASSERT_TRUE(checkpoint(index));
+    EXPECT_FALSE(journal_->checkpointDue());
+    EXPECT_FALSE(std::filesystem::exists(test_dir_ + "/checksums.journal.old"));
+    EXPECT_EQ(reopen(), index);
+}
+
+TEST_F(ChecksumJournalTest, ReplaysJournalsLargerThanTheReadBuffer) {
+    // Several megabytes, so records straddle the replay buffer's refills
+    Index index;
+    const std::string padding(200, 'x');
+    for (int i = 0; i < 30000; ++i) {
+        std::string chunk_id = "chunk_" + std::to_string(i) + "_" + padding.substr(0, i % 200);
+        std::string checksum = Utils::calculateSHA256(std::vector<uint8_t>(chunk_id.begin(), chunk_id.end()));
+        index[chunk_id] = checksum;
+        ASSERT_TRUE(journal_->recordPut(chunk_id, checksum));
+    }
+    ASSERT_GT(journalSize(), 4 * 1024 * 1024);
+    journal_.reset();
+    
+    ASSERT_EQ(::truncate(journal_path_.c_str(), journalSize() - 1), 0);
+    Index replayed = reopen();
+    EXPECT_EQ(replayed.size(), index.size() - 1);
+    for (const auto& entry : replayed) {
+        EXPECT_EQ(entry.second, index[entry.first]);
+    }
+}
+
+} // namespace test
+} // namespace dfs
@@ -0,0 +1,214 @@
+#include "test_framework.h"
+#include "../src/chunkserver/chunk_cache.h"
+#include "../src/chunkserver/chunk_storage.h"
+#include <random>
+
+namespace dfs {
+namespace test {
+
+class ChunkCacheTest : public DFSTestBase {
+protected:
+    static constexpr int64_t KB = 1000;
+    
+    static ChunkCacheOptions options(int64_t capacity, double protected_ratio = 0.8) {
+        ChunkCacheOptions result;
+        result.capacity_bytes = capacity;
+        result.max_entry_bytes = capacity;
+        result.protected_ratio = protected_ratio;
+        return result;
+    }
+    
+    static ChunkCache::Data data(int64_t size) {
+        return std::make_shared<const std::vector<uint8_t>>(static_cast<size_t>(size), 0xAB);
+    }
+    
+    static bool insert(ChunkCache& cache, const std::string& chunk_id, int64_t size = KB) {
+        return cache.insert(chunk_id, "sum_" + chunk_id, data(size));
+    }
+    
+    static bool cached(ChunkCache& cache, const std::string& chunk_id) {
+        return cache.lookup(chunk_id, "sum_" + chunk_id) != nullptr;
+    }
+    
+    // Raises the chunk's frequency with lookups that miss
+    static void lookUp(ChunkCache& cache, const std::string& chunk_id, int times) {
+        for (int i = 0; i < times; ++i) {
+            cache.lookup(chunk_id, "sum_" + chunk_id);
+        }
+    }
+};
+
+TEST_F(ChunkCacheTest, AdmitsEverythingWhileThereIsRoom) {
+    ChunkCache cache(options(4 * KB));
+    ASSERT_TRUE(insert(cache, "a"));
+    ASSERT_TRUE(insert(cache, "b"));
+    ASSERT_TRUE(insert(cache, "c", 2 * KB));
+    
+    ChunkCache::Stats stats = cache.getStats();
+    EXPECT_EQ(stats.entries, 3);
+    EXPECT_EQ(stats.bytes, 4 * KB);
+    EXPECT_EQ(stats.insertions, 3);
+    EXPECT_EQ(stats.capacity_bytes, 4 * KB);
+    
+    auto hit = cache.lookup("c", "sum_c");
+    ASSERT_NE(hit, nullptr);
+    EXPECT_EQ(hit->size(), static_cast<size_t>(2 * KB));
+    EXPECT_EQ(cache.lookup("missing", "sum_missing"), nullptr);
+    EXPECT_EQ(cache.getStats().hits, 1);
+    EXPECT_EQ(cache.getStats().misses, 1);
+}
+
+TEST_F(ChunkCacheTest, RejectsChunksItCannotHold) {
+    ChunkCacheOptions limited = options(10 * KB);
+    limited.max_entry_bytes = 2 * KB;
+    ChunkCache cache(limited);
+    
+    EXPECT_FALSE(cache.wouldAdmit("big", 3 * KB));
+    EXPECT_FALSE(insert(cache, "big", 3 * KB));
+    EXPECT_FALSE(cache.insert("empty", "sum_empty", data(0)));
+    EXPECT_FALSE(cache.insert("null", "sum_null", nullptr));
+    EXPECT_TRUE(insert(cache, "fits", 2 * KB));
+    
+    ChunkCache::Stats stats = cache.getStats();
+    EXPECT_EQ(stats.rejections, 3);
+    EXPECT_EQ(stats.entries, 1);
+    EXPECT_EQ(stats.bytes, 2 * KB);
+    
+    // A disabled cache takes nothing
+    ChunkCache disabled(options(0));
+    EXPECT_FALSE(disabled.wouldAdmit("a", KB));
+    EXPECT_FALSE(insert(disabled, "a"));
+}
+
+TEST_F(ChunkCacheTest, OnlyMoreFrequentChunksDisplaceOthers) {
+    ChunkCache cache(options(3 * KB));
+    for (const char* chunk_id : {"a", "b", "c"}) {
+        lookUp(cache, chunk_id, 3);
+        ASSERT_TRUE(insert(cache, chunk_id));
+    }
+    
+    // Looked up less often than everything cached: turned away
+    lookUp(cache, "rare", 1);
+    EXPECT_FALSE(cache.wouldAdmit("rare", KB));
+    EXPECT_FALSE(insert(cache, "rare"));
+    EXPECT_EQ(cache.getStats().rejections, 1);
+    EXPECT_EQ(cache.getStats().evictions, 0);
+    
+    // Looked up more often: gets in at the expense of one of them
+    lookUp(cache, "popular", 6);
+    EXPECT_TRUE(cache.wouldAdmit("popular", KB));
+    ASSERT_TRUE(insert(cache, "popular"));
+    EXPECT_EQ(cache.getStats().evictions, 1);
+    EXPECT_EQ(cache.getStats().bytes, 3 * KB);
+    EXPECT_TRUE(cached(cache, "popular"));
+}
+
+TEST_F(ChunkCacheTest, ProbationIsEvictedBeforeProtected) {
+    ChunkCache cache(options(4 * KB));
+    ASSERT_TRUE(insert(cache, "hot"));
+    ASSERT_TRUE(cached(cache, "hot"));
+    
+    // Chunks read once stay on probation, however recently they came in
+    ASSERT_TRUE(insert(cache, "once1"));
+    ASSERT_TRUE(insert(cache, "once2"));
+    ASSERT_TRUE(insert(cache, "once3"));
+    
+    lookUp(cache, "new1", 3);
+    ASSERT_TRUE(insert(cache, "new1"));
+    lookUp(cache, "new2", 3);
+    ASSERT_TRUE(insert(cache, "new2"));
+    
+    EXPECT_TRUE(cached(cache, "hot"));
+    EXPECT_FALSE(cached(cache, "once1"));
+    EXPECT_FALSE(cached(cache, "once2"));
+    EXPECT_TRUE(cached(cache, "once3"));
+    EXPECT_EQ(cache.getStats().evictions, 2);
+}
+
+TEST_F(ChunkCacheTest, PromotionDemotesWhenProtectedIsFull) {
+    // Room for one protected chunk
+    ChunkCache cache(options(3 * KB, 0.5));
+    ASSERT_TRUE(insert(cache, "a"));
+    ASSERT_TRUE(insert(cache, "b"));
+    ASSERT_TRUE(cached(cache, "a"));
+    ASSERT_TRUE(cached(cache, "b"));    // Pushes a back to probation
+    ASSERT_TRUE(insert(cache, "c"));
+    
+    // a is now the least recently used probationary chunk
+    lookUp(cache, "d", 3);
+    ASSERT_TRUE(insert(cache, "d"));
+    EXPECT_EQ(cache.getStats().evictions, 1);
+    EXPECT_TRUE(cached(cache, "b"));
+    EXPECT_TRUE(cached(cache, "c"));
+    EXPECT_TRUE(cached(cache, "d"));
+    EXPECT_FALSE(cached(cache, "a"));
+}
+
+TEST_F(ChunkCacheTest, SizeAccountingFollowsEveryChange) {
+    ChunkCache cache(options(10 * KB));
+    ASSERT_TRUE(insert(cache, "a", 2 * KB));
+    ASSERT_TRUE(insert(cache, "b", 3 * KB));
+    ASSERT_TRUE(cached(cache, "b"));
+    
+    // Replacing a chunk swaps its size
+    ASSERT_TRUE(insert(cache, "a", 4 * KB));
+    EXPECT_EQ(cache.getStats().bytes, 7 * KB);
+    EXPECT_EQ(cache.getStats().entries, 2);
+    
+    // A lookup for another version drops the stale one
+    EXPECT_EQ(cache.lookup("a", "other"), nullptr);
+    EXPECT_EQ(cache.getStats().bytes, 3 * KB);
+    
+    cache.invalidate("b");
+    cache.invalidate("unknown");
+    EXPECT_EQ(cache.getStats().bytes, 0);
+    EXPECT_EQ(cache.getStats().entries, 0);
+    
+    // Under churn the cache never holds more than its capacity
+    std::mt19937 random(42);
+    for (int i = 0; i < 2000; ++i) {
+        std::string chunk_id = "c" + std::to_string(random() % 50);
+        if (random() % 3 == 0) {
+            lookUp(cache, chunk_id, 1);
+        } else if (random() % 10 == 0) {
+            cache.invalidate(chunk_id);
+        } else {
+            insert(cache, chunk_id, 1 + random() % (3 * KB));
+        }
+        ChunkCache::Stats stats = cache.getStats();
+        ASSERT_LE(stats.bytes, 10 * KB);
+        ASSERT_GE(stats.bytes, stats.entries);
+    }
+}
+
+TEST_F(ChunkCacheTest, StorageDropsCachedChunksWhenTheyChange) {
+    ChunkCacheOptions cache_options = options(64 * 1024 * 1024);
+    cache_options.max_entry_bytes = 16 * 1024 * 1024;
+    ChunkStorage storage(test_dir_, StorageBackendType::FILE_PER_CHUNK, IoEngineOptions(),
+                         DurabilityOptions(), cache_options);
+    
+    auto v1 = TestDataGenerator::generateRandom(100000, 1);
+    auto v2 = TestDataGenerator::generateRandom(50000, 2);
+    ASSERT_TRUE(storage.writeChunk("chunk", v1));
+    
+    // The first whole read fills the cache, the second is served from it
+    EXPECT_TRUE(storage.readChunk("chunk") == v1);
+    ASSERT_EQ(storage.getCacheStats().entries, 1);
+    int64_t hits = storage.getCacheStats().hits;
+    EXPECT_TRUE(storage.readChunk("chunk") == v1);
+    EXPECT_EQ(storage.getCacheStats().hits, hits + 1);
+    
+    // An overwrite must never be answered with the old data
+    ASSERT_TRUE(storage.writeChunk("chunk", v2));
+    EXPECT_EQ(storage.getCacheStats().entries, 0);
+    EXPECT_TRUE(storage.readChunk("chunk") == v2);
+    EXPECT_EQ(storage.getCacheStats().bytes, static_cast<int64_t>(v2.size()));
+    
+    ASSERT_TRUE(storage.deleteChunk("chunk"));
+    EXPECT_EQ(storage.getCacheStats().entries, 0);
+    EXPECT_EQ(storage.getCacheStats().bytes, 0);
+    EXPECT_TRUE(storage.readChunk("chunk").empty());
+}
+
+} // namespace test
+} // namespace dfs
@@ -0,0 +1,125 @@
+#include "test_framework.h"
+#include "../src/chunkserver/chunk_storage.h"
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dfs {
+namespace test {
+
+class ChunkStorageTest : public DFSTestBase {
+protected:
+    static constexpr int64_t BLOCK = CHECKSUM_BLOCK_SIZE;
+    
+    // No cache, so every read goes to disk and is verified
+    std::unique_ptr<ChunkStorage> openStorage(StorageBackendType backend = StorageBackendType::FILE_PER_CHUNK,
+                                              const std::string& directory = "chunks") {
+        ChunkCacheOptions cache_options;
+        cache_options.capacity_bytes = 0;
+        return std::make_unique<ChunkStorage>(test_dir_ + "/" + directory, backend, IoEngineOptions(),
+                                              DurabilityOptions(), cache_options);
+    }
+    
+    void flipByte(const std::string& chunk_id, int64_t offset) {
+        int fd = ::open((test_dir_ + "/chunks/" + chunk_id).c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        uint8_t byte = 0;
+        ASSERT_EQ(::pread(fd, &byte, 1, offset), 1);
+        byte ^= 0xFF;
+        ASSERT_EQ(::pwrite(fd, &byte, 1, offset), 1);
+        ::close(fd);
+    }
+    
+    static std::vector<uint8_t> slice(const std::vector<uint8_t>& data, int64_t offset, int64_t length) {
+        return std::vector<uint8_t>(data.begin() + offset, data.begin() + offset + length);
+    }
+};
+
+TEST_F(ChunkStorageTest, RangeReadsReturnTheRequestedBytes) {
+    // Not a whole number of blocks, so the last one is short
+    auto data = TestDataGenerator::generateRandom(5 * BLOCK + 1234, 1);
+    
+    for (auto backend : {StorageBackendType::FILE_PER_CHUNK, StorageBackendType::LOG_STRUCTURED}) {
+        std::string name = backend == StorageBackendType::LOG_STRUCTURED ? "log_structured" : "file_per_chunk";
+        SCOPED_TRACE(name);
+        auto storage = openStorage(backend, name);
+        ASSERT_TRUE(storage->writeChunk("chunk", data));
+        
+        const std::vector<std::pair<int64_t, int64_t>> ranges = {
+            {0, 1}, {0, BLOCK}, {BLOCK - 1, 2}, {100, 3 * BLOCK}, {2 * BLOCK + 7, 10},
+            {5 * BLOCK, 1234}, {0, static_cast<int64_t>(data.size())},
+        };
+        for (const auto& range : ranges) {
+            std::vector<uint8_t> read;
+            ASSERT_TRUE(storage->readChunkRange("chunk", range.first, range.second, read))
+                << range.first << "+" << range.second;
+            EXPECT_TRUE(read == slice(data, range.first, range.second)) << range.first << "+" << range.second;
+        }
+        
+        // Clipped at the end of the chunk, empty right at it
+        std::vector<uint8_t> read;
+        ASSERT_TRUE(storage->readChunkRange("chunk", data.size() - 10, 1000, read));
+        EXPECT_TRUE(read == slice(data, data.size() - 10, 10));
+        ASSERT_TRUE(storage->readChunkRange("chunk", data.size(), 10, read));
+        EXPECT_TRUE(read.empty());
+        
+        EXPECT_FALSE(storage->readChunkRange("chunk", data.size() + 1, 10, read));
+        EXPECT_FALSE(storage->readChunkRange("chunk", -1, 10, read));
+        EXPECT_FALSE(storage->readChunkRange("chunk", 0, -1, read));
+        EXPECT_FALSE(storage->readChunkRange("missing", 0, 10, read));
+    }
+}
+
+TEST_F(ChunkStorageTest, CorruptionOnlyFailsRangesTouchingTheBlock) {
+    auto data = TestDataGenerator::generateRandom(4 * BLOCK, 2);
+    auto storage = openStorage();
+    ASSERT_TRUE(storage->writeChunk("chunk", data));
+    flipByte("chunk", 2 * BLOCK + 100);
+    
+    // Blocks 0, 1 and 3 are still served
+    std::vector<uint8_t> read;
+    std::vector<int64_t> corrupted;
+    ASSERT_TRUE(storage->readChunkRange("chunk", 0, 2 * BLOCK, read, &corrupted));
+    EXPECT_TRUE(read == slice(data, 0, 2 * BLOCK));
+    ASSERT_TRUE(storage->readChunkRange("chunk", 3 * BLOCK + 5, 100, read, &corrupted));
+    EXPECT_TRUE(read == slice(data, 3 * BLOCK + 5, 100));
+    EXPECT_TRUE(corrupted.empty());
+    
+    // Any range touching block 2 fails and names it, even if it misses the byte
+    EXPECT_FALSE(storage->readChunkRange("chunk", 2 * BLOCK - 1, 2, read, &corrupted));
+    EXPECT_EQ(corrupted, std::vector<int64_t>{2});
+    corrupted.clear();
+    EXPECT_FALSE(storage->readChunkRange("chunk", 2 * BLOCK + 200, 10, read, &corrupted));
+    EXPECT_EQ(corrupted, std::vector<int64_t>{2});
+    
+    EXPECT_TRUE(storage->readChunk("chunk").empty());
+}
+
+TEST_F(ChunkStorageTest, ChunksWithoutBlockChecksumsAreVerifiedWhole) {
+    // A chunk as stored before block checksums: bare data plus a .meta file
+    auto data = TestDataGenerator::generateRandom(3 * BLOCK, 3);
+    Utils::createDirectory(test_dir_ + "/chunks");
+    {
+        std::ofstream file(test_dir_ + "/chunks/old", std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        std::ofstream meta(test_dir_ + "/chunks/old.meta");
+        meta << "{\"chunk_id\": \"old\", \"checksum\": \"" << Utils::calculateSHA256(data)
+             << "\", \"is_encrypted\": false, \"is_erasure_coded\": false, \"created_time\": 0}";
+    }
+    
+    auto storage = openStorage();
+    std::vector<uint8_t> read;
+    ASSERT_TRUE(storage->readChunkRange("old", BLOCK + 10, 100, read));
+    EXPECT_TRUE(read == slice(data, BLOCK + 10, 100));
+    
+    // Without block checksums, damage anywhere fails every range
+    storage.reset();
+    flipByte("old", 2 * BLOCK + 1);
+    storage = openStorage();
+    std::vector<int64_t> corrupted;
+    EXPECT_FALSE(storage->readChunkRange("old", 0, 100, read, &corrupted));
+    EXPECT_TRUE(corrupted.empty());
+}
+
+} // namespace test
+} // namespace dfs
@@ -0,0 +1,148 @@
+#include "test_framework.h"
+#include "../src/client/client.h"
+#include <algorithm>
+
+namespace dfs {
+namespace test {
+
+class ClientCacheTest : public DFSTestBase {
+protected:
+    static constexpr size_t KB = 1024;
+    static constexpr size_t MB = 1024 * KB;
+    
+    static CacheManager::BufferPtr buffer(size_t size, uint8_t fill = 0) {
+        return std::make_shared<const CacheManager::Buffer>(size, fill);
+    }
+    
+    // Same mapping as the cache uses, so a test can pick its shards
+    static size_t shardOf(const std::string& chunk_id, size_t shard_count) {
+        return std::hash<std::string>{}(chunk_id) & (shard_count - 1);
+    }
+    
+    static std::string idInShard(size_t shard, size_t shard_count, const std::string& prefix) {
+        for (int i = 0;; ++i) {
+            std::string chunk_id = prefix + std::to_string(i);
+            if (shardOf(chunk_id, shard_count) == shard) {
+                return chunk_id;
+            }
+        }
+    }
+};
+
+TEST_F(ClientCacheTest, EvictsLeastRecentlyUsedFirst) {
+    CacheManager cache(1, 1);
+    for (const char* chunk_id : {"a", "b", "c", "d"}) {
+        ASSERT_TRUE(cache.put(chunk_id, buffer(256 * KB)));
+    }
+    EXPECT_EQ(cache.getTotalSize(), MB);
+    
+    // A hit makes a the most recently used, so b goes first, then c
+    ASSERT_NE(cache.get("a"), nullptr);
+    ASSERT_TRUE(cache.put("e", buffer(256 * KB)));
+    EXPECT_FALSE(cache.contains("b"));
+    EXPECT_TRUE(cache.contains("a"));
+    
+    ASSERT_TRUE(cache.put("f", buffer(256 * KB)));
+    EXPECT_FALSE(cache.contains("c"));
+    for (const char* chunk_id : {"a", "d", "e", "f"}) {
+        EXPECT_TRUE(cache.contains(chunk_id)) << chunk_id;
+    }
+    EXPECT_EQ(cache.size(), 4u);
+    EXPECT_EQ(cache.getTotalSize(), MB);
+    
+    // Replacing an entry swaps its size
+    ASSERT_TRUE(cache.put("a", buffer(100 * KB)));
+    EXPECT_EQ(cache.size(), 4u);
+    EXPECT_EQ(cache.getTotalSize(), 868 * KB);
+}
+
+TEST_F(ClientCacheTest, BudgetCoversAllShards) {
+    const size_t shards = 4;
+    CacheManager cache(1, shards);
+    
+    // Two chunks filling most of the budget in shard 0, then a chunk in
+    // shard 1 that only fits once they are gone
+    std::string big1 = idInShard(0, shards, "big");
+    std::string big2 = idInShard(0, shards, big1 + "_");
+    std::string other = idInShard(1, shards, "other");
+    ASSERT_TRUE(cache.put(big1, buffer(400 * KB)));
+    ASSERT_TRUE(cache.put(big2, buffer(400 * KB)));
+    ASSERT_NE(cache.get(big1), nullptr);
+    
+    ASSERT_TRUE(cache.put(other, buffer(300 * KB)));
+    EXPECT_LE(cache.getTotalSize(), MB);
+    EXPECT_TRUE(cache.contains(other));
+    EXPECT_TRUE(cache.contains(big1));
+    EXPECT_FALSE(cache.contains(big2));
+    
+    // Spread over every shard, the total stays within the budget
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(cache.put("chunk" + std::to_string(i), buffer(70 * KB)));
+        ASSERT_LE(cache.getTotalSize(), MB);
+        ASSERT_TRUE(cache.contains("chunk" + std::to_string(i)));
+    }
+    EXPECT_EQ(cache.size(), MB / (70 * KB));
+}
+
+TEST_F(ClientCacheTest, ConcurrentPutsStayWithinBudget) {
+    CacheManager cache(1, 16);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&cache, t]() {
+            for (int i = 0; i < 500; ++i) {
+                std::string chunk_id = "t" + std::to_string(t) + "_" + std::to_string(i % 50);
+                cache.put(chunk_id, buffer(16 * KB + 512 * t));
+                cache.get("t" + std::to_string((t + 1) % 8) + "_" + std::to_string(i % 50));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    EXPECT_LE(cache.getTotalSize(), MB);
+    EXPECT_GT(cache.size(), 0u);
+    
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_EQ(cache.getTotalSize(), 0u);
+}
+
+TEST_F(ClientCacheTest, RejectsChunksLargerThanTheCache) {
+    CacheManager cache(1, 4);
+    ASSERT_TRUE(cache.put("small", buffer(KB)));
+    
+    EXPECT_FALSE(cache.put("huge", buffer(MB + 1)));
+    EXPECT_FALSE(cache.put("null", nullptr));
+    EXPECT_FALSE(cache.contains("huge"));
+    EXPECT_TRUE(cache.contains("small"));
+    EXPECT_EQ(cache.getTotalSize(), KB);
+    
+    // Exactly the budget fits, at the expense of everything else
+    EXPECT_TRUE(cache.put("whole", buffer(MB)));
+    EXPECT_TRUE(cache.contains("whole"));
+    EXPECT_FALSE(cache.contains("small"));
+    EXPECT_EQ(cache.getTotalSize(), MB);
+}
+
+TEST_F(ClientCacheTest, CachedBufferOutlivesEviction) {
+    CacheManager cache(1, 1);
+    ASSERT_TRUE(cache.put("kept", buffer(512 * KB, 0x5A)));
+    CacheManager::BufferPtr held = cache.get("kept");
+    ASSERT_NE(held, nullptr);
+    
+    // Evicted, removed or cleared, the reader's buffer stays intact
+    ASSERT_TRUE(cache.put("a", buffer(512 * KB)));
+    ASSERT_TRUE(cache.put("b", buffer(512 * KB)));
+    EXPECT_FALSE(cache.contains("kept"));
+    cache.remove("a");
+    cache.clear();
+    
+    ASSERT_EQ(held->size(), 512 * KB);
+    EXPECT_TRUE(std::all_of(held->begin(), held->end(), [](uint8_t byte) { return byte == 0x5A; }));
+    EXPECT_EQ(cache.get("kept"), nullptr);
+    EXPECT_DOUBLE_EQ(cache.getHitRate(), 0.5);
+}
+
+} // namespace test
+} // namespace dfs
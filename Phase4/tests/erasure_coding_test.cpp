@@ -1,182 +1,327 @@
 #include "test_framework.h"
 #include "../src/common/erasure_coding.h"
+#include <algorithm>
+#include <bitset>
+#include <set>
 
 namespace dfs {
 namespace test {
 
 class ErasureCodingTest : public DFSTestBase {
 protected:
-    void SetUp() override {
-        DFSTestBase::SetUp();
-        erasure_coding_ = std::make_unique<ErasureCoding>(4, 2); // 4 data + 2 parity
+    // Copies of `blocks` with the blocks in `lost` overwritten, so that a
+    // decoder reading them would produce the wrong bytes
+    static std::vector<std::vector<uint8_t>> eraseBlocks(const std::vector<std::vector<uint8_t>>& blocks,
+                                                         uint64_t lost, std::vector<bool>& availability) {
+        std::vector<std::vector<uint8_t>> erased = blocks;
+        availability.assign(blocks.size(), true);
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (lost & (uint64_t(1) << i)) {
+                std::fill(erased[i].begin(), erased[i].end(), 0xEE);
+                availability[i] = false;
+            }
+        }
+        return erased;
     }
     
-    std::unique_ptr<ErasureCoding> erasure_coding_;
+    // Encodes `data`, then decodes it for every combination of at most
+    // `max_lost` lost blocks and checks the bytes are unchanged; returns the
+    // number of combinations checked
+    static int checkEveryErasure(ErasureCoding& coder, const std::vector<uint8_t>& data, int max_lost) {
+        auto blocks = coder.encode(data);
+        EXPECT_EQ(blocks.size(), static_cast<size_t>(coder.getTotalBlocks()));
+        
+        int checked = 0;
+        for (uint64_t lost = 0; lost < (uint64_t(1) << coder.getTotalBlocks()); ++lost) {
+            if (static_cast<int>(std::bitset<64>(lost).count()) > max_lost) {
+                continue;
+            }
+            
+            std::vector<bool> availability;
+            auto erased = eraseBlocks(blocks, lost, availability);
+            EXPECT_TRUE(coder.canDecode(availability)) << "lost blocks mask " << lost;
+            
+            std::vector<uint8_t> decoded = coder.decode(erased, availability);
+            EXPECT_GE(decoded.size(), data.size());
+            decoded.resize(data.size());
+            EXPECT_TRUE(decoded == data) << "lost blocks mask " << lost;
+            checked++;
+        }
+        return checked;
+    }
 };
 
-TEST_F(ErasureCodingTest, BasicEncoding) {
-    std::vector<uint8_t> data = TestDataGenerator::generateSequential(1024);
+TEST_F(ErasureCodingTest, ProfileParsing) {
+    ErasureCodingProfile profile;
+    ASSERT_TRUE(ErasureCodingProfile::parse("6+3", profile));
+    EXPECT_EQ(profile.data_blocks, 6);
+    EXPECT_EQ(profile.parity_blocks, 3);
+    EXPECT_EQ(profile.local_parity_blocks, 0);
+    EXPECT_EQ(profile.toString(), "6+3");
     
-    auto encoded = erasure_coding_->encode(data);
-    ASSERT_TRUE(encoded.has_value());
-    ASSERT_EQ(encoded->size(), 6); // 4 data + 2 parity blocks
+    ASSERT_TRUE(ErasureCodingProfile::parse("12+2+2", profile));
+    EXPECT_EQ(profile.data_blocks, 12);
+    EXPECT_EQ(profile.local_parity_blocks, 2);
+    EXPECT_EQ(profile.parity_blocks, 2);
+    EXPECT_EQ(profile.toString(), "12+2+2");
     
-    // Verify that we have the correct number of blocks
-    for (const auto& block : *encoded) {
-        ASSERT_EQ(block.size(), 256); // 1024 / 4 = 256 bytes per block
-    }
+    // Local groups must split the data blocks evenly, and the total is capped
+    EXPECT_FALSE(ErasureCodingProfile::parse("7+2+2", profile));
+    EXPECT_FALSE(ErasureCodingProfile::parse("60+10", profile));
+    EXPECT_FALSE(ErasureCodingProfile::parse("6", profile));
+    EXPECT_FALSE(ErasureCodingProfile::parse("6+-1", profile));
+    EXPECT_FALSE(ErasureCodingProfile::parse("6+x", profile));
+    EXPECT_EQ(profile.toString(), "12+2+2");
+    
+    EXPECT_THROW(ErasureCoding(0, 2), std::invalid_argument);
 }
 
-TEST_F(ErasureCodingTest, BasicDecoding) {
-    std::vector<uint8_t> original_data = TestDataGenerator::generateRandom(2048);
-    
-    auto encoded = erasure_coding_->encode(original_data);
-    ASSERT_TRUE(encoded.has_value());
+TEST_F(ErasureCodingTest, EncodeKeepsDataBlocks) {
+    ErasureCoding coder(4, 2);
+    std::vector<uint8_t> data = TestDataGenerator::generateSequential(1000);
     
-    auto decoded = erasure_coding_->decode(*encoded, original_data.size());
-    ASSERT_TRUE(decoded.has_value());
-    ASSERT_EQ(*decoded, original_data);
+    auto blocks = coder.encode(data);
+    ASSERT_EQ(blocks.size(), 6u);
+    for (const auto& block : blocks) {
+        ASSERT_EQ(block.size(), 250u);
+    }
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(std::equal(blocks[i].begin(), blocks[i].end(), data.begin() + i * 250));
+    }
 }
 
-TEST_F(ErasureCodingTest, RecoveryFromSingleFailure) {
-    std::vector<uint8_t> original_data = TestDataGenerator::generatePattern(1024, 0xAB);
-    
-    auto encoded = erasure_coding_->encode(original_data);
-    ASSERT_TRUE(encoded.has_value());
-    
-    // Simulate failure of first data block
-    auto corrupted_blocks = *encoded;
-    corrupted_blocks[0].clear(); // Mark as missing
-    
-    auto recovered = erasure_coding_->decode(corrupted_blocks, original_data.size());
-    ASSERT_TRUE(recovered.has_value());
-    ASSERT_EQ(*recovered, original_data);
+TEST_F(ErasureCodingTest, ReedSolomonSurvivesEveryErasure) {
+    struct Case { int k; int m; size_t size; };
+    for (const Case& c : {Case{4, 2, 4096}, Case{6, 3, 6000}, Case{3, 1, 1001}, Case{10, 4, 4093}}) {
+        SCOPED_TRACE(std::to_string(c.k) + "+" + std::to_string(c.m));
+        ErasureCoding coder(c.k, c.m);
+        std::vector<uint8_t> data = TestDataGenerator::generateRandom(c.size, c.k * 31 + c.m);
+        EXPECT_GT(checkEveryErasure(coder, data, c.m), 0);
+    }
 }
 
-TEST_F(ErasureCodingTest, RecoveryFromDoubleFailure) {
-    std::vector<uint8_t> original_data = TestDataGenerator::generateRandom(4096);
+TEST_F(ErasureCodingTest, ReedSolomonRejectsTooManyErasures) {
+    ErasureCoding coder(4, 2);
+    auto blocks = coder.encode(TestDataGenerator::generateRandom(1024));
     
-    auto encoded = erasure_coding_->encode(original_data);
-    ASSERT_TRUE(encoded.has_value());
+    std::vector<bool> availability;
+    auto erased = eraseBlocks(blocks, 0b010101, availability);
+    EXPECT_FALSE(coder.canDecode(availability));
+    EXPECT_THROW(coder.decode(erased, availability), std::runtime_error);
+}
+
+TEST_F(ErasureCodingTest, LocalReconstructionSurvivesEveryGlobalErasure) {
+    // Any set of as many losses as there are global parities is decodable,
+    // and so is any set the coder accepts beyond that
+    ErasureCoding coder(ErasureCodingProfile{6, 2, 2});
+    std::vector<uint8_t> data = TestDataGenerator::generateRandom(6 * 333 + 5, 7);
+    EXPECT_GT(checkEveryErasure(coder, data, 2), 0);
     
-    // Simulate failure of two blocks (one data, one parity)
-    auto corrupted_blocks = *encoded;
-    corrupted_blocks[1].clear(); // Data block
-    corrupted_blocks[4].clear(); // Parity block
+    auto blocks = coder.encode(data);
+    int decodable = 0;
+    for (uint64_t lost = 0; lost < (uint64_t(1) << coder.getTotalBlocks()); ++lost) {
+        std::vector<bool> availability;
+        auto erased = eraseBlocks(blocks, lost, availability);
+        if (!coder.canDecode(availability)) {
+            EXPECT_GT(std::bitset<64>(lost).count(), 2u) << "lost blocks mask " << lost;
+            continue;
+        }
+        std::vector<uint8_t> decoded = coder.decode(erased, availability);
+        decoded.resize(data.size());
+        EXPECT_TRUE(decoded == data) << "lost blocks mask " << lost;
+        decodable++;
+    }
     
-    auto recovered = erasure_coding_->decode(corrupted_blocks, original_data.size());
-    ASSERT_TRUE(recovered.has_value());
-    ASSERT_EQ(*recovered, original_data);
+    // One loss per local group plus both global parities is still decodable
+    std::vector<bool> availability;
+    eraseBlocks(blocks, (1u << 0) | (1u << 4) | (1u << 8) | (1u << 9), availability);
+    EXPECT_TRUE(coder.canDecode(availability));
+    EXPECT_GT(decodable, checkEveryErasure(coder, data, 2));
 }
 
-TEST_F(ErasureCodingTest, CannotRecoverFromTripleFailure) {
-    std::vector<uint8_t> original_data = TestDataGenerator::generateRandom(1024);
+TEST_F(ErasureCodingTest, LocalGroupRepair) {
+    // 6+2+2: data 0-2 with local parity 6, data 3-5 with local parity 7,
+    // global parities 8 and 9
+    ErasureCoding coder(ErasureCodingProfile{6, 2, 2});
+    auto blocks = coder.encode(TestDataGenerator::generateRandom(6 * 512, 11));
     
-    auto encoded = erasure_coding_->encode(original_data);
-    ASSERT_TRUE(encoded.has_value());
+    auto sources = [&](int block, uint64_t lost) {
+        std::vector<bool> availability;
+        eraseBlocks(blocks, lost, availability);
+        auto list = coder.getRepairSources(block, availability);
+        return std::set<int>(list.begin(), list.end());
+    };
     
-    // Simulate failure of three blocks (exceeds recovery capability)
-    auto corrupted_blocks = *encoded;
-    corrupted_blocks[0].clear();
-    corrupted_blocks[1].clear();
-    corrupted_blocks[2].clear();
+    EXPECT_EQ(sources(1, 1u << 1), (std::set<int>{0, 2, 6}));
+    EXPECT_EQ(sources(4, 1u << 4), (std::set<int>{3, 5, 7}));
+    EXPECT_EQ(sources(6, 1u << 6), (std::set<int>{0, 1, 2}));
     
-    auto recovered = erasure_coding_->decode(corrupted_blocks, original_data.size());
-    ASSERT_FALSE(recovered.has_value());
-}
-
-TEST_F(ErasureCodingTest, VariousDataSizes) {
-    std::vector<size_t> test_sizes = {100, 1000, 10000, 100000, 1000000};
+    // A second loss in the group falls back to a full decode
+    auto fallback = sources(1, (1u << 1) | (1u << 2));
+    EXPECT_EQ(fallback.size(), 6u);
+    EXPECT_EQ(fallback.count(1), 0u);
+    EXPECT_EQ(fallback.count(2), 0u);
     
-    for (size_t size : test_sizes) {
-        std::vector<uint8_t> data = TestDataGenerator::generateRandom(size);
-        
-        auto encoded = erasure_coding_->encode(data);
-        ASSERT_TRUE(encoded.has_value()) << "Failed to encode data of size " << size;
-        
-        auto decoded = erasure_coding_->decode(*encoded, size);
-        ASSERT_TRUE(decoded.has_value()) << "Failed to decode data of size " << size;
-        ASSERT_EQ(*decoded, data) << "Decoded data doesn't match original for size " << size;
+    for (int block = 0; block < coder.getTotalBlocks(); ++block) {
+        for (uint64_t extra : {uint64_t(0), uint64_t(1) << ((block + 1) % coder.getTotalBlocks())}) {
+            std::vector<bool> availability;
+            auto erased = eraseBlocks(blocks, (uint64_t(1) << block) | extra, availability);
+            EXPECT_TRUE(coder.repairBlock(block, erased, availability) == blocks[block])
+                << "block " << block << " extra " << extra;
+        }
     }
 }
 
-TEST_F(ErasureCodingTest, ZeroData) {
-    std::vector<uint8_t> zero_data = TestDataGenerator::generateZeros(1024);
+TEST_F(ErasureCodingTest, ChunkManagerRoundTrip) {
+    ErasureCodedChunkManager manager(ErasureCodingProfile{4, 2, 2});
+    std::vector<uint8_t> data = TestDataGenerator::generateRandom(10007, 3);
     
-    auto encoded = erasure_coding_->encode(zero_data);
-    ASSERT_TRUE(encoded.has_value());
+    auto group = manager.encodeChunk("chunk", data);
+    ASSERT_EQ(group.blocks.size(), 8u);
+    EXPECT_EQ(group.original_size, 10007);
+    EXPECT_TRUE(manager.decodeChunk(group) == data);
     
-    auto decoded = erasure_coding_->decode(*encoded, zero_data.size());
-    ASSERT_TRUE(decoded.has_value());
-    ASSERT_EQ(*decoded, zero_data);
-}
-
-TEST_F(ErasureCodingTest, CompressibleData) {
-    std::vector<uint8_t> compressible_data = TestDataGenerator::generateCompressible(8192);
-    
-    auto encoded = erasure_coding_->encode(compressible_data);
-    ASSERT_TRUE(encoded.has_value());
+    // Lose a data block and a global parity, repair the data block locally
+    auto damaged = group;
+    damaged.blocks.erase(damaged.blocks.begin() + 7);
+    damaged.blocks.erase(damaged.blocks.begin() + 1);
+    ASSERT_TRUE(manager.canDecodeChunk(damaged));
+    EXPECT_TRUE(manager.decodeChunk(damaged) == data);
     
-    // Test recovery with missing block
-    auto corrupted_blocks = *encoded;
-    corrupted_blocks[2].clear();
+    auto needed = manager.getBlocksNeededForRepair(damaged, 1);
+    EXPECT_EQ(std::set<int>(needed.begin(), needed.end()), (std::set<int>{0, 4}));
     
-    auto recovered = erasure_coding_->decode(corrupted_blocks, compressible_data.size());
-    ASSERT_TRUE(recovered.has_value());
-    ASSERT_EQ(*recovered, compressible_data);
+    auto repaired = manager.repairMissingBlocks(damaged, {1, 7});
+    ASSERT_EQ(repaired.size(), 2u);
+    EXPECT_TRUE(repaired[0].data == group.blocks[1].data);
+    EXPECT_TRUE(repaired[1].data == group.blocks[7].data);
 }
 
-PERFORMANCE_TEST(ErasureCodingPerformance, 50)
-    std::vector<uint8_t> data = TestDataGenerator::generateRandom(64 * 1024); // 64KB
-    
-    auto encoded = erasure_coding_->encode(data);
-    ASSERT_TRUE(encoded.has_value());
-    
-    auto decoded = erasure_coding_->decode(*encoded, data.size());
-    ASSERT_TRUE(decoded.has_value());
-    ASSERT_EQ(*decoded, data);
-END_PERFORMANCE_TEST()
-
-class ErasureCodedChunkManagerTest : public DFSTestBase {
+class StripeTest : public DFSTestBase {
 protected:
-    void SetUp() override {
-        DFSTestBase::SetUp();
-        manager_ = std::make_unique<ErasureCodedChunkManager>(4, 2);
-    }
+    static constexpr size_t CELL = 64;
     
-    std::unique_ptr<ErasureCodedChunkManager> manager_;
+    // Streams `data` through a StripeEncoder in pieces of `piece` bytes and
+    // returns the blocks the stripes add up to
+    static std::vector<std::vector<uint8_t>> encodeStriped(const ErasureCoding& coder, const StripeLayout& layout,
+                                                           const std::vector<uint8_t>& data, size_t piece,
+                                                           std::vector<size_t>& cell_sizes) {
+        std::vector<std::vector<uint8_t>> blocks(coder.getTotalBlocks());
+        StripeEncoder encoder(coder, layout,
+            [&](int64_t stripe, const std::vector<const uint8_t*>& cells, size_t cell_size) {
+                EXPECT_EQ(stripe, static_cast<int64_t>(cell_sizes.size()));
+                cell_sizes.push_back(cell_size);
+                for (size_t i = 0; i < cells.size(); ++i) {
+                    blocks[i].insert(blocks[i].end(), cells[i], cells[i] + cell_size);
+                }
+                return true;
+            });
+        
+        for (size_t offset = 0; offset < data.size(); offset += piece) {
+            EXPECT_TRUE(encoder.append(data.data() + offset, std::min(piece, data.size() - offset)));
+        }
+        EXPECT_TRUE(encoder.finish());
+        return blocks;
+    }
 };
 
-TEST_F(ErasureCodedChunkManagerTest, ChunkCreationAndRetrieval) {
-    std::vector<uint8_t> data = TestDataGenerator::generateRandom(256 * 1024); // 256KB
-    std::string chunk_id = "test_chunk_001";
-    
-    auto chunks = manager_->createChunks(chunk_id, data);
-    ASSERT_TRUE(chunks.has_value());
-    ASSERT_EQ(chunks->size(), 6); // 4 data + 2 parity
-    
-    // Test retrieval with all chunks available
-    auto retrieved = manager_->reconstructData(chunk_id, *chunks, data.size());
-    ASSERT_TRUE(retrieved.has_value());
-    ASSERT_EQ(*retrieved, data);
+TEST_F(StripeTest, PartialFinalStripe) {
+    // Three full stripes and 100 bytes: the last cells are 25 bytes
+    ErasureCoding coder(4, 2);
+    const int64_t size = 3 * 4 * CELL + 100;
+    StripeLayout layout(4, CELL, size);
+    ASSERT_EQ(layout.getStripeCount(), 4);
+    ASSERT_EQ(layout.getCellSize(3), 25u);
+    ASSERT_EQ(layout.getBlockSize(), 3 * static_cast<int64_t>(CELL) + 25);
+    
+    std::vector<uint8_t> data = TestDataGenerator::generateRandom(size, 5);
+    std::vector<size_t> cell_sizes;
+    auto blocks = encodeStriped(coder, layout, data, 77, cell_sizes);
+    EXPECT_EQ(cell_sizes, (std::vector<size_t>{CELL, CELL, CELL, 25}));
+    for (const auto& block : blocks) {
+        ASSERT_EQ(static_cast<int64_t>(block.size()), layout.getBlockSize());
+    }
+    
+    // Every stripe is an ordinary codeword, the partial one included
+    for (int64_t stripe = 0; stripe < layout.getStripeCount(); ++stripe) {
+        size_t cell_size = layout.getCellSize(stripe);
+        std::vector<std::vector<uint8_t>> cells;
+        for (const auto& block : blocks) {
+            auto begin = block.begin() + stripe * CELL;
+            cells.emplace_back(begin, begin + cell_size);
+        }
+        std::vector<bool> availability = {false, true, true, false, true, true};
+        std::vector<uint8_t> decoded = coder.decode(cells, availability);
+        
+        size_t offset = stripe * 4 * CELL;
+        size_t length = std::min<size_t>(decoded.size(), size - offset);
+        EXPECT_TRUE(std::equal(data.begin() + offset, data.begin() + offset + length, decoded.begin()));
+        EXPECT_TRUE(std::all_of(decoded.begin() + length, decoded.end(), [](uint8_t b) { return b == 0; }));
+    }
+    
+    // The encoder refuses more data than the layout holds
+    StripeEncoder encoder(coder, layout, [](int64_t, const std::vector<const uint8_t*>&, size_t) { return true; });
+    EXPECT_TRUE(encoder.append(data.data(), data.size()));
+    EXPECT_FALSE(encoder.append(data.data(), 1));
+    EXPECT_FALSE(encoder.finish());
 }
 
-TEST_F(ErasureCodedChunkManagerTest, FaultTolerance) {
-    std::vector<uint8_t> data = TestDataGenerator::generateRandom(128 * 1024);
-    std::string chunk_id = "fault_test_chunk";
+TEST_F(StripeTest, ReaderRebuildsLostBlocks) {
+    ErasureCoding coder(ErasureCodingProfile{4, 2, 2});
+    const int64_t size = 5 * 4 * CELL + 203;
+    StripeLayout layout(4, CELL, size);
+    std::vector<uint8_t> data = TestDataGenerator::generateRandom(size, 9);
+    std::vector<size_t> cell_sizes;
+    auto blocks = encodeStriped(coder, layout, data, 1000, cell_sizes);
+    ASSERT_EQ(cell_sizes.back(), 51u);
     
-    auto chunks = manager_->createChunks(chunk_id, data);
-    ASSERT_TRUE(chunks.has_value());
+    struct Range { int64_t offset; size_t length; };
+    const std::vector<Range> ranges = {
+        {0, static_cast<size_t>(size)}, {1, 62}, {CELL - 3, 9}, {4 * CELL * 5 - 10, 40},
+        {size - 51, 51}, {size - 1, 1}, {3 * CELL + 17, 4 * CELL * 2},
+    };
     
-    // Remove some chunks to simulate failures
-    auto partial_chunks = *chunks;
-    partial_chunks.erase(partial_chunks.begin() + 1); // Remove one data chunk
-    partial_chunks.erase(partial_chunks.begin() + 4); // Remove one parity chunk (adjusted index)
+    for (uint64_t lost : {uint64_t(0), uint64_t(1) << 1, (uint64_t(1) << 0) | (uint64_t(1) << 3),
+                          (uint64_t(1) << 2) | (uint64_t(1) << 6) | (uint64_t(1) << 7)}) {
+        std::set<int> touched;
+        StripeReader reader(coder, layout, [&](int block, int64_t offset, size_t length, uint8_t* out) {
+            if (lost & (uint64_t(1) << block)) {
+                return false;
+            }
+            EXPECT_LE(offset + static_cast<int64_t>(length), static_cast<int64_t>(blocks[block].size()));
+            touched.insert(block);
+            std::copy(blocks[block].begin() + offset, blocks[block].begin() + offset + length, out);
+            return true;
+        });
+        
+        for (const Range& range : ranges) {
+            std::vector<uint8_t> out(range.length);
+            ASSERT_TRUE(reader.read(range.offset, range.length, out.data()))
+                << "lost " << lost << " offset " << range.offset;
+            EXPECT_TRUE(std::equal(out.begin(), out.end(), data.begin() + range.offset))
+                << "lost " << lost << " offset " << range.offset;
+        }
+        
+        if (lost == 0) {
+            EXPECT_EQ(touched, (std::set<int>{0, 1, 2, 3}));
+        } else if (lost == (uint64_t(1) << 1)) {
+            // Block 1 is rebuilt from its local group alone
+            EXPECT_EQ(touched, (std::set<int>{0, 2, 3, 4}));
+        }
+    }
     
-    auto retrieved = manager_->reconstructData(chunk_id, partial_chunks, data.size());
-    ASSERT_TRUE(retrieved.has_value());
-    ASSERT_EQ(*retrieved, data);
+    // Past the end of the data, or with too many blocks lost, reads fail
+    StripeReader reader(coder, layout, [&](int block, int64_t offset, size_t length, uint8_t* out) {
+        if (block < 5) {
+            return false;
+        }
+        std::copy(blocks[block].begin() + offset, blocks[block].begin() + offset + length, out);
+        return true;
+    });
+    std::vector<uint8_t> out(2);
+    EXPECT_FALSE(reader.read(size - 1, 2, out.data()));
+    EXPECT_FALSE(reader.read(0, 1, out.data()));
 }
 
 } // namespace test
-} // namespace dfs
\ No newline at end of file
+} // namespace dfs
@@ -0,0 +1,364 @@
+#include "test_framework.h"
+#include "../src/chunkserver/group_commit.h"
+#include "../src/chunkserver/chunk_storage.h"
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+
+namespace dfs {
+namespace test {
+
+class GroupCommitSyncerTest : public DFSTestBase {
+protected:
+    void TearDown() override {
+        release();
+        DFSTestBase::TearDown();
+    }
+    
+    struct Ack {
+        bool ok;
+        int syncs_finished;     // Syncs that had returned when the callback ran
+    };
+    
+    static DurabilityOptions options(DurabilityMode mode, int64_t interval_ms = 5,
+                                     int64_t batch_bytes = 64 * 1024 * 1024) {
+        DurabilityOptions durability;
+        durability.mode = mode;
+        durability.group_commit_interval_ms = interval_ms;
+        durability.group_commit_bytes = batch_bytes;
+        return durability;
+    }
+    
+    std::unique_ptr<GroupCommitSyncer> makeSyncer(const DurabilityOptions& durability) {
+        return std::make_unique<GroupCommitSyncer>(durability, [this] { return sync(); });
+    }
+    
+    // Stands in for the storage's sync: can be held back, and fails when
+    // told to through results_
+    bool sync() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        syncs_started_++;
+        cv_.notify_all();
+        cv_.wait(lock, [this] { return !held_; });
+        
+        bool ok = true;
+        if (!results_.empty()) {
+            ok = results_.front();
+            results_.pop_front();
+        }
+        syncs_finished_++;
+        return ok;
+    }
+    
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ = true;
+    }
+    
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ = false;
+        cv_.notify_all();
+    }
+    
+    bool waitForSyncs(int started) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::seconds(10), [&] { return syncs_started_ >= started; });
+    }
+    
+    // A callback that records its acknowledgement in acks_, in call order
+    GroupCommitSyncer::DurableCallback recordAck(int index) {
+        return [this, index](bool ok) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            acks_[index] = Ack{ok, syncs_finished_};
+            cv_.notify_all();
+        };
+    }
+    
+    bool waitForAcks(size_t count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::seconds(10), [&] { return acks_.size() >= count; });
+    }
+    
+    size_t ackCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return acks_.size();
+    }
+    
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool held_ = false;
+    int syncs_started_ = 0;
+    int syncs_finished_ = 0;
+    std::deque<bool> results_;
+    std::map<int, Ack> acks_;
+};
+
+TEST_F(GroupCommitSyncerTest, AcknowledgesOnlyAfterTheSync) {
+    auto syncer = makeSyncer(options(DurabilityMode::PER_WRITE));
+    
+    hold();
+    syncer->notifyDurable(4096, recordAck(0));
+    ASSERT_TRUE(waitForSyncs(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(ackCount(), 0u);
+    
+    release();
+    ASSERT_TRUE(waitForAcks(1));
+    EXPECT_TRUE(acks_[0].ok);
+    EXPECT_EQ(acks_[0].syncs_finished, 1);
+}
+
+TEST_F(GroupCommitSyncerTest, BatchesWritersWaitingOnASync) {
+    auto syncer = makeSyncer(options(DurabilityMode::PER_WRITE));
+    
+    // Everything registered while a sync runs goes into the next one
+    hold();
+    syncer->notifyDurable(4096, recordAck(0));
+    ASSERT_TRUE(waitForSyncs(1));
+    
+    std::vector<std::thread> writers;
+    for (int i = 1; i <= 10; ++i) {
+        writers.emplace_back([&, i] { syncer->notifyDurable(4096, recordAck(i)); });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    
+    release();
+    ASSERT_TRUE(waitForAcks(11));
+    EXPECT_EQ(syncer->getSyncCount(), 2);
+    EXPECT_EQ(syncer->getSyncedCommits(), 11);
+    EXPECT_EQ(acks_[0].syncs_finished, 1);
+    for (int i = 1; i <= 10; ++i) {
+        EXPECT_TRUE(acks_[i].ok);
+        EXPECT_EQ(acks_[i].syncs_finished, 2) << "write " << i;
+    }
+}
+
+TEST_F(GroupCommitSyncerTest, GroupCommitWaitsForTheInterval) {
+    auto syncer = makeSyncer(options(DurabilityMode::GROUP_COMMIT, 50));
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; ++i) {
+        syncer->notifyDurable(4096, recordAck(i));
+    }
+    ASSERT_TRUE(waitForAcks(5));
+    
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(45));
+    EXPECT_EQ(syncer->getSyncCount(), 1);
+}
+
+TEST_F(GroupCommitSyncerTest, GroupCommitSyncsEarlyOnceEnoughBytesWait) {
+    auto syncer = makeSyncer(options(DurabilityMode::GROUP_COMMIT, 60 * 1000, 1024 * 1024));
+    
+    syncer->notifyDurable(512 * 1024, recordAck(0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(ackCount(), 0u);
+    
+    syncer->notifyDurable(512 * 1024, recordAck(1));
+    ASSERT_TRUE(waitForAcks(2));
+    EXPECT_EQ(syncer->getSyncCount(), 1);
+}
+
+TEST_F(GroupCommitSyncerTest, FailedSyncOnlyFailsItsBatch) {
+    auto syncer = makeSyncer(options(DurabilityMode::PER_WRITE));
+    results_ = {false, true};
+    
+    hold();
+    syncer->notifyDurable(4096, recordAck(0));
+    ASSERT_TRUE(waitForSyncs(1));
+    syncer->notifyDurable(4096, recordAck(1));
+    release();
+    
+    ASSERT_TRUE(waitForAcks(2));
+    EXPECT_FALSE(acks_[0].ok);
+    EXPECT_TRUE(acks_[1].ok);
+}
+
+TEST_F(GroupCommitSyncerTest, ShutdownSyncsWhatIsWaiting) {
+    auto syncer = makeSyncer(options(DurabilityMode::GROUP_COMMIT, 60 * 1000));
+    
+    syncer->notifyDurable(4096, recordAck(0));
+    syncer->shutdown();
+    EXPECT_EQ(ackCount(), 1u);
+    EXPECT_TRUE(acks_[0].ok);
+    
+    // Later commits are synced before notifyDurable returns
+    syncer->notifyDurable(4096, recordAck(1));
+    EXPECT_EQ(ackCount(), 2u);
+    EXPECT_EQ(acks_[1].syncs_finished, 2);
+}
+
+// FileChunkBackend commits through a syncer, the way ChunkStorage drives it
+TEST_F(GroupCommitSyncerTest, FileBackendCommitIsDurableOnceAcknowledged) {
+    IoEngineOptions io_options;
+    io_options.type = IoEngineType::SYNC;
+    auto io_engine = IoEngine::create(io_options);
+    auto backend = std::make_unique<FileChunkBackend>(test_dir_, io_engine);
+    GroupCommitSyncer syncer(options(DurabilityMode::GROUP_COMMIT), [&] {
+        return sync() && backend->sync();
+    });
+    
+    auto data = TestDataGenerator::generateRandom(3 * CHECKSUM_BLOCK_SIZE + 100, 5);
+    StoredChunkInfo info;
+    info.chunk_id = "chunk";
+    info.checksum = Utils::calculateSHA256(data);
+    info.block_checksums = {1, 2, 3, 4};
+    info.is_encrypted = true;
+    info.created_time = 1234;
+    
+    hold();
+    auto writer = backend->openWriter("chunk", data.size());
+    ASSERT_NE(writer, nullptr);
+    ASSERT_TRUE(writer->append(data.data(), data.size()));
+    ASSERT_TRUE(writer->commit(info));
+    syncer.notifyDurable(data.size(), recordAck(0));
+    
+    // Visible right away, acknowledged only once the group sync ran
+    EXPECT_EQ(backend->getChunkSize("chunk"), static_cast<int64_t>(data.size()));
+    ASSERT_TRUE(waitForSyncs(1));
+    EXPECT_EQ(ackCount(), 0u);
+    release();
+    ASSERT_TRUE(waitForAcks(1));
+    EXPECT_TRUE(acks_[0].ok);
+    
+    // Data and metadata live in one file, and reads stop at the data
+    backend = std::make_unique<FileChunkBackend>(test_dir_, io_engine);
+    EXPECT_FALSE(std::filesystem::exists(test_dir_ + "/chunk.meta"));
+    
+    StoredChunkInfo stored;
+    ASSERT_TRUE(backend->getChunkInfo("chunk", stored));
+    EXPECT_EQ(stored.size, static_cast<int64_t>(data.size()));
+    EXPECT_EQ(stored.checksum, info.checksum);
+    EXPECT_EQ(stored.block_checksums, info.block_checksums);
+    EXPECT_TRUE(stored.is_encrypted);
+    EXPECT_EQ(stored.created_time, 1234);
+    
+    auto reader = backend->openReader("chunk");
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->size(), static_cast<int64_t>(data.size()));
+    std::vector<uint8_t> read_back(data.size() + 4096);
+    EXPECT_EQ(reader->read(0, read_back.data(), read_back.size()), static_cast<ssize_t>(data.size()));
+    read_back.resize(data.size());
+    EXPECT_TRUE(read_back == data);
+    EXPECT_EQ(reader->read(data.size(), read_back.data(), 16), 0);
+    
+    ASSERT_EQ(backend->listChunks().size(), 1u);
+    EXPECT_EQ(backend->listChunks()[0].size, static_cast<int64_t>(data.size()));
+}
+
+TEST_F(GroupCommitSyncerTest, FileBackendReadsLegacyMetadataSidecar) {
+    IoEngineOptions io_options;
+    io_options.type = IoEngineType::SYNC;
+    FileChunkBackend backend(test_dir_, IoEngine::create(io_options));
+    
+    // A chunk stored before the metadata moved into the data file
+    auto data = TestDataGenerator::generateRandom(5000, 6);
+    {
+        std::ofstream file(test_dir_ + "/old", std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        std::ofstream meta(test_dir_ + "/old.meta");
+        meta << R"({"chunk_id": "old", "checksum": "abc", "block_checksums": [7],)"
+             << R"( "is_encrypted": false, "is_erasure_coded": true, "created_time": 99})";
+    }
+    
+    StoredChunkInfo info;
+    ASSERT_TRUE(backend.getChunkInfo("old", info));
+    EXPECT_EQ(info.size, 5000);
+    EXPECT_EQ(info.checksum, "abc");
+    EXPECT_EQ(info.block_checksums, std::vector<uint32_t>{7});
+    EXPECT_TRUE(info.is_erasure_coded);
+    EXPECT_EQ(backend.getChunkSize("old"), 5000);
+    
+    // Rewriting it drops the sidecar
+    info.checksum = "def";
+    auto writer = backend.openWriter("old", data.size());
+    ASSERT_TRUE(writer->append(data.data(), data.size()));
+    ASSERT_TRUE(writer->commit(info));
+    EXPECT_FALSE(std::filesystem::exists(test_dir_ + "/old.meta"));
+    ASSERT_TRUE(backend.getChunkInfo("old", info));
+    EXPECT_EQ(info.checksum, "def");
+    
+    EXPECT_TRUE(backend.removeChunk("old"));
+    EXPECT_EQ(backend.getChunkSize("old"), -1);
+}
+
+class ChunkStorageDurabilityTest : public DFSTestBase {
+protected:
+    std::unique_ptr<ChunkStorage> open(DurabilityMode mode) {
+        IoEngineOptions io_options;
+        io_options.type = IoEngineType::SYNC;
+        DurabilityOptions durability;
+        durability.mode = mode;
+        durability.group_commit_interval_ms = 20;
+        return std::make_unique<ChunkStorage>(test_dir_, StorageBackendType::FILE_PER_CHUNK,
+                                              io_options, durability);
+    }
+    
+    // Commits a chunk through commitAsync; `thread` is where `done` ran
+    static std::future<bool> commit(ChunkStorage& storage, const std::string& chunk_id,
+                                    const std::vector<uint8_t>& data, std::thread::id& thread) {
+        auto promise = std::make_shared<std::promise<bool>>();
+        auto writer = storage.openChunkWriter(chunk_id, false, false, data.size());
+        EXPECT_NE(writer, nullptr);
+        EXPECT_TRUE(writer->append(data.data(), data.size()));
+        
+        writer->commitAsync("", [promise, &thread](bool ok) {
+            thread = std::this_thread::get_id();
+            promise->set_value(ok);
+        });
+        return promise->get_future();
+    }
+};
+
+TEST_F(ChunkStorageDurabilityTest, NoneAcknowledgesInline) {
+    auto storage = open(DurabilityMode::NONE);
+    auto data = TestDataGenerator::generateRandom(10000, 1);
+    
+    std::thread::id thread;
+    auto acked = commit(*storage, "chunk", data, thread);
+    ASSERT_EQ(acked.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_TRUE(acked.get());
+    EXPECT_EQ(thread, std::this_thread::get_id());
+    EXPECT_TRUE(storage->readChunk("chunk") == data);
+}
+
+TEST_F(ChunkStorageDurabilityTest, SyncedModesAcknowledgeFromTheSyncer) {
+    for (DurabilityMode mode : {DurabilityMode::PER_WRITE, DurabilityMode::GROUP_COMMIT}) {
+        SCOPED_TRACE(DurabilityOptions::modeToString(mode));
+        auto storage = open(mode);
+        
+        // Concurrent writers all get their acknowledgement, and the chunks
+        // survive a restart
+        const int writers = 16;
+        std::vector<std::vector<uint8_t>> data;
+        std::vector<std::thread::id> threads(writers);
+        std::vector<std::future<bool>> acked;
+        for (int i = 0; i < writers; ++i) {
+            data.push_back(TestDataGenerator::generateRandom(5000 + i, i));
+            acked.push_back(commit(*storage, "chunk" + std::to_string(i), data[i], threads[i]));
+        }
+        for (int i = 0; i < writers; ++i) {
+            ASSERT_EQ(acked[i].wait_for(std::chrono::seconds(10)), std::future_status::ready);
+            EXPECT_TRUE(acked[i].get());
+            EXPECT_NE(threads[i], std::this_thread::get_id());
+        }
+        
+        storage = open(mode);
+        for (int i = 0; i < writers; ++i) {
+            EXPECT_TRUE(storage->readChunk("chunk" + std::to_string(i)) == data[i]);
+            EXPECT_TRUE(storage->verifyChunkIntegrity("chunk" + std::to_string(i)));
+        }
+        storage.reset();
+        std::filesystem::remove_all(test_dir_);
+        std::filesystem::create_directories(test_dir_);
+    }
+}
+
+} // namespace test
+} // namespace dfs
@@ -0,0 +1,258 @@
+#include "test_framework.h"
+#include "../src/chunkserver/io_engine.h"
+#include "../src/chunkserver/chunk_storage.h"
+#include <condition_variable>
+#include <future>
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dfs {
+namespace test {
+
+class IoEngineTest : public DFSTestBase {
+protected:
+    void SetUp() override {
+        DFSTestBase::SetUp();
+        fd_ = ::open((test_dir_ + "/data").c_str(), O_RDWR | O_CREAT, 0644);
+        ASSERT_GE(fd_, 0);
+    }
+    
+    void TearDown() override {
+        ::close(fd_);
+        DFSTestBase::TearDown();
+    }
+    
+    // Both engines, where the kernel has io_uring
+    static std::vector<std::shared_ptr<IoEngine>> engines() {
+        IoEngineOptions options;
+        options.type = IoEngineType::SYNC;
+        options.sync_threads = 4;
+        std::vector<std::shared_ptr<IoEngine>> result{IoEngine::create(options)};
+        
+        options.type = IoEngineType::IO_URING;
+        auto uring = IoEngine::create(options);
+        if (std::string(uring->name()) == "io_uring") {
+            result.push_back(uring);
+        }
+        return result;
+    }
+    
+    // Counts completions so a test can wait for all it submitted
+    class Completions {
+    public:
+        IoEngine::Completion add(ssize_t* result) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+            return [this, result](ssize_t bytes) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                *result = bytes;
+                if (--pending_ == 0) {
+                    cv_.notify_all();
+                }
+            };
+        }
+        
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return pending_ == 0; });
+        }
+    
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        int pending_ = 0;
+    };
+    
+    int fd_ = -1;
+};
+
+TEST_F(IoEngineTest, BlockingCallsFollowPreadAndPwrite) {
+    auto data = TestDataGenerator::generateRandom(100000, 1);
+    
+    for (const auto& engine : engines()) {
+        SCOPED_TRACE(engine->name());
+        ASSERT_EQ(::ftruncate(fd_, 0), 0);
+        ASSERT_TRUE(engine->writeAll(fd_, data.data(), data.size(), 0));
+        
+        std::vector<uint8_t> read_back(data.size());
+        ASSERT_EQ(engine->read(fd_, read_back.data(), read_back.size(), 0), static_cast<ssize_t>(data.size()));
+        EXPECT_TRUE(read_back == data);
+        
+        // Short at the end of the file, nothing past it
+        EXPECT_EQ(engine->read(fd_, read_back.data(), 1000, data.size() - 10), 10);
+        EXPECT_EQ(engine->read(fd_, read_back.data(), 1000, data.size()), 0);
+        
+        errno = 0;
+        EXPECT_EQ(engine->read(-1, read_back.data(), 10, 0), -1);
+        EXPECT_EQ(errno, EBADF);
+        errno = 0;
+        EXPECT_EQ(engine->write(-1, data.data(), 10, 0), -1);
+        EXPECT_EQ(errno, EBADF);
+    }
+}
+
+TEST_F(IoEngineTest, AsynchronousRequestsComplete) {
+    const int requests = 64;
+    const size_t size = 16 * 1024;
+    
+    for (const auto& engine : engines()) {
+        SCOPED_TRACE(engine->name());
+        ASSERT_EQ(::ftruncate(fd_, 0), 0);
+        
+        std::vector<std::vector<uint8_t>> data;
+        std::vector<ssize_t> results(requests, 0);
+        Completions writes;
+        for (int i = 0; i < requests; ++i) {
+            data.push_back(TestDataGenerator::generateRandom(size, i));
+            engine->submitWrite(fd_, data[i].data(), size, i * size, writes.add(&results[i]));
+        }
+        writes.wait();
+        for (int i = 0; i < requests; ++i) {
+            EXPECT_EQ(results[i], static_cast<ssize_t>(size));
+        }
+        
+        // Reads into pool buffers (registered with io_uring) and heap ones alike
+        std::vector<IoEngine::Buffer> buffers;
+        Completions reads;
+        for (int i = 0; i < requests; ++i) {
+            buffers.push_back(engine->allocateBuffer(size));
+            engine->submitRead(fd_, buffers[i].data(), size, i * size, reads.add(&results[i]));
+        }
+        ssize_t failed = 0;
+        engine->submitRead(-1, buffers[0].data(), size, 0, reads.add(&failed));
+        reads.wait();
+        
+        for (int i = 0; i < requests; ++i) {
+            ASSERT_EQ(results[i], static_cast<ssize_t>(size));
+            EXPECT_TRUE(std::equal(data[i].begin(), data[i].end(), buffers[i].data()));
+        }
+        EXPECT_EQ(failed, -EBADF);
+    }
+}
+
+TEST_F(IoEngineTest, SyncEngineRunsOnTheSharedPool) {
+    IoThreadPool pool(2);
+    IoEngineOptions options;
+    options.type = IoEngineType::SYNC;
+    options.sync_pool = &pool;
+    auto engine = IoEngine::create(options);
+    
+    auto data = TestDataGenerator::generateRandom(4096, 1);
+    ASSERT_TRUE(engine->writeAll(fd_, data.data(), data.size(), 0));
+    
+    std::vector<uint8_t> buffer(data.size());
+    ssize_t result = 0;
+    int64_t busy = 0;
+    Completions reads;
+    IoEngine::Completion done = reads.add(&result);
+    engine->submitRead(fd_, buffer.data(), buffer.size(), 0, [&](ssize_t bytes) {
+        busy = pool.getBusyThreads();
+        done(bytes);
+    });
+    reads.wait();
+    EXPECT_EQ(result, static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(busy, 1);
+    
+    // The pool isn't the engine's to stop
+    engine.reset();
+    std::promise<int64_t> still_running;
+    pool.submit([&] { still_running.set_value(pool.getBusyThreads()); });
+    EXPECT_EQ(still_running.get_future().get(), 1);
+    pool.shutdown();
+}
+
+TEST_F(IoEngineTest, BuffersComeFromThePoolUntilItRunsOut) {
+    IoEngineOptions options;
+    options.type = IoEngineType::SYNC;
+    options.buffer_count = 2;
+    options.buffer_size = 8192;
+    auto engine = IoEngine::create(options);
+    
+    auto first = engine->allocateBuffer(100);
+    auto second = engine->allocateBuffer(8192);
+    auto heap = engine->allocateBuffer(100);
+    auto large = engine->allocateBuffer(20000);
+    
+    for (const auto* buffer : {&first, &second, &heap, &large}) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer->data()) % IoEngine::DIRECT_IO_ALIGNMENT, 0u);
+    }
+    EXPECT_EQ(first.size(), IoEngine::DIRECT_IO_ALIGNMENT);
+    EXPECT_EQ(large.size(), 5 * IoEngine::DIRECT_IO_ALIGNMENT);
+    EXPECT_EQ(std::abs(second.data() - first.data()), 8192);
+    
+    // A released slot is handed out again
+    uint8_t* slot = first.data();
+    first = IoEngine::Buffer();
+    EXPECT_EQ(engine->allocateBuffer(4096).data(), slot);
+}
+
+TEST_F(IoEngineTest, StreamedReadsAreVerifiedOnThePool) {
+    const size_t frame_size = 64 * 1024;
+    auto data = TestDataGenerator::generateRandom(1000000, 1);
+    IoThreadPool pool(2);
+    
+    for (const auto& engine : engines()) {
+        SCOPED_TRACE(engine->name());
+        IoEngineOptions io_options;
+        io_options.type = std::string(engine->name()) == "sync" ? IoEngineType::SYNC : IoEngineType::IO_URING;
+        io_options.sync_pool = &pool;
+        ChunkCacheOptions cache_options;
+        cache_options.capacity_bytes = 0;
+        ChunkStorage storage(test_dir_ + "/" + engine->name(), StorageBackendType::FILE_PER_CHUNK,
+                             io_options, DurabilityOptions(), cache_options);
+        ASSERT_TRUE(storage.writeChunk("good", data));
+        ASSERT_TRUE(storage.writeChunk("bad", data));
+        
+        // Flip a byte in the middle of the stored data
+        {
+            int fd = ::open((test_dir_ + "/" + engine->name() + "/bad").c_str(), O_RDWR);
+            ASSERT_GE(fd, 0);
+            uint8_t flipped = data[data.size() / 2] ^ 0xFF;
+            ASSERT_EQ(::pwrite(fd, &flipped, 1, data.size() / 2), 1);
+            ::close(fd);
+        }
+        
+        // Reads the whole chunk frame by frame; false once a frame fails
+        auto stream = [&](const std::string& chunk_id, std::vector<uint8_t>& received, int64_t& min_busy) {
+            auto reader = storage.openChunkReader(chunk_id, frame_size);
+            if (!reader) {
+                return false;
+            }
+            min_busy = 1;
+            while (true) {
+                std::promise<bool> frame;
+                bool more = false;
+                reader->nextAsync(pool, [&](bool ok, const uint8_t* bytes, size_t size) {
+                    if (ok && size > 0) {
+                        min_busy = std::min(min_busy, pool.getBusyThreads());
+                        received.insert(received.end(), bytes, bytes + size);
+                        more = true;
+                    }
+                    frame.set_value(ok);
+                });
+                if (!frame.get_future().get()) {
+                    return false;
+                }
+                if (!more) {
+                    return true;
+                }
+            }
+        };
+        
+        std::vector<uint8_t> received;
+        int64_t min_busy = 0;
+        ASSERT_TRUE(stream("good", received, min_busy));
+        EXPECT_TRUE(received == data);
+        EXPECT_EQ(min_busy, 1);
+        
+        received.clear();
+        EXPECT_FALSE(stream("bad", received, min_busy));
+        EXPECT_LE(received.size(), data.size() / 2);
+    }
+    pool.shutdown();
+}
+
+} // namespace test
+} // namespace dfs
@@ -1,5 +1,10 @@
 #include "test_framework.h"
 #include "../src/master/metadata_manager.h"
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <csignal>
+#include <sys/resource.h>
 
 namespace dfs {
 namespace test {
@@ -8,6 +13,7 @@ class MetadataManagerTest : public DFSTestBase {
 protected:
     void SetUp() override {
         DFSTestBase::SetUp();
+        base_path_ = test_dir_ + "/master_metadata";
         metadata_manager_ = std::make_unique<MetadataManager>();
     }
     
@@ -16,155 +22,180 @@ protected:
         DFSTestBase::TearDown();
     }
     
+    // Simulates a master restart: the old manager (and its log) is closed
+    // before a new one recovers from the same files
+    bool restart() {
+        metadata_manager_.reset();
+        metadata_manager_ = std::make_unique<MetadataManager>();
+        return metadata_manager_->loadMetadataFromFile(base_path_);
+    }
+    
+    static FileMetadata makeFile(const std::string& filename, int64_t size,
+                                 const std::vector<std::string>& chunk_ids = {}) {
+        FileMetadata file;
+        file.file_id = "id_" + filename;
+        file.filename = filename;
+        file.size = size;
+        file.created_time = Utils::getCurrentTimestamp();
+        file.modified_time = file.created_time;
+        file.chunk_ids = chunk_ids;
+        file.is_encrypted = false;
+        file.is_erasure_coded = false;
+        file.erasure_data_blocks = 0;
+        file.erasure_parity_blocks = 0;
+        file.erasure_local_parity_blocks = 0;
+        return file;
+    }
+    
+    static ChunkMetadata makeChunk(const std::string& chunk_id, const std::vector<std::string>& servers) {
+        ChunkMetadata chunk;
+        chunk.chunk_id = chunk_id;
+        chunk.server_locations = servers;
+        chunk.size = 4 * 1024 * 1024;
+        chunk.checksum = "checksum_" + chunk_id;
+        chunk.is_erasure_coded = false;
+        chunk.erasure_block_index = 0;
+        chunk.erasure_data_blocks = 0;
+        chunk.erasure_parity_blocks = 0;
+        chunk.erasure_local_parity_blocks = 0;
+        chunk.is_parity_block = false;
+        chunk.created_time = Utils::getCurrentTimestamp();
+        chunk.last_accessed_time = chunk.created_time;
+        return chunk;
+    }
+    
+    static ServerMetadata makeServer(const std::string& server_id) {
+        ServerMetadata server;
+        server.server_id = server_id;
+        server.address = "127.0.0.1";
+        server.port = 60051;
+        server.total_space = 2000000000;
+        server.free_space = 1000000000;
+        server.chunk_count = 0;
+        server.cpu_usage = 0.0;
+        server.memory_usage = 0.0;
+        server.is_healthy = true;
+        server.last_heartbeat = Utils::getCurrentTimestamp();
+        server.last_report_sequence = 0;
+        return server;
+    }
+    
+    std::vector<std::string> walFiles() const {
+        std::vector<std::string> paths;
+        for (const auto& entry : std::filesystem::directory_iterator(test_dir_)) {
+            if (entry.path().filename().string().rfind("master_metadata.wal.", 0) == 0) {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+    
+    static void appendBytes(const std::string& path, const std::string& bytes) {
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        file << bytes;
+    }
+    
+    static void flipByte(const std::string& path, std::streamoff offset) {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(offset);
+        char value = 0;
+        file.get(value);
+        file.seekp(offset);
+        file.put(static_cast<char>(value ^ 0x5A));
+    }
+    
+    std::string base_path_;
     std::unique_ptr<MetadataManager> metadata_manager_;
 };
 
-TEST_F(MetadataManagerTest, AddAndGetFile) {
-    FileMetadata file_metadata;
-    file_metadata.filename = "test_file.txt";
-    file_metadata.size = 1024;
-    file_metadata.created_time = Utils::getCurrentTimestamp();
-    file_metadata.is_encrypted = true;
-    file_metadata.is_erasure_coded = false;
-    file_metadata.chunk_ids = {"chunk1", "chunk2", "chunk3"};
-    
-    ASSERT_TRUE(metadata_manager_->addFile(file_metadata));
-    
-    auto retrieved = metadata_manager_->getFile("test_file.txt");
-    ASSERT_TRUE(retrieved.has_value());
-    ASSERT_EQ(retrieved->filename, file_metadata.filename);
-    ASSERT_EQ(retrieved->size, file_metadata.size);
-    ASSERT_EQ(retrieved->is_encrypted, file_metadata.is_encrypted);
-    ASSERT_EQ(retrieved->chunk_ids, file_metadata.chunk_ids);
+TEST_F(MetadataManagerTest, CreateAndGetFile) {
+    FileMetadata file = makeFile("/docs/test_file.txt", 1024, {"chunk1", "chunk2", "chunk3"});
+    file.is_encrypted = true;
+    file.encryption_key_id = "key1";
+    
+    ASSERT_TRUE(metadata_manager_->createFile(file.filename, file));
+    ASSERT_FALSE(metadata_manager_->createFile(file.filename, file));
+    
+    FileMetadata retrieved;
+    ASSERT_TRUE(metadata_manager_->getFileMetadata(file.filename, retrieved));
+    ASSERT_EQ(retrieved.filename, file.filename);
+    ASSERT_EQ(retrieved.size, file.size);
+    ASSERT_EQ(retrieved.is_encrypted, file.is_encrypted);
+    ASSERT_EQ(retrieved.chunk_ids, file.chunk_ids);
+    
+    ASSERT_TRUE(metadata_manager_->getFileById(file.file_id, retrieved));
+    ASSERT_EQ(retrieved.filename, file.filename);
 }
 
-TEST_F(MetadataManagerTest, RemoveFile) {
-    FileMetadata file_metadata;
-    file_metadata.filename = "to_be_removed.txt";
-    file_metadata.size = 512;
-    file_metadata.created_time = Utils::getCurrentTimestamp();
+TEST_F(MetadataManagerTest, DeleteFile) {
+    FileMetadata file = makeFile("to_be_removed.txt", 512);
     
-    ASSERT_TRUE(metadata_manager_->addFile(file_metadata));
-    ASSERT_TRUE(metadata_manager_->getFile("to_be_removed.txt").has_value());
+    ASSERT_TRUE(metadata_manager_->createFile(file.filename, file));
+    ASSERT_TRUE(metadata_manager_->deleteFile(file.filename));
     
-    ASSERT_TRUE(metadata_manager_->removeFile("to_be_removed.txt"));
-    ASSERT_FALSE(metadata_manager_->getFile("to_be_removed.txt").has_value());
+    FileMetadata retrieved;
+    ASSERT_FALSE(metadata_manager_->getFileMetadata(file.filename, retrieved));
+    ASSERT_FALSE(metadata_manager_->getFileById(file.file_id, retrieved));
+    ASSERT_FALSE(metadata_manager_->deleteFile(file.filename));
 }
 
-TEST_F(MetadataManagerTest, ListFiles) {
-    std::vector<FileMetadata> test_files;
-    
+TEST_F(MetadataManagerTest, ListFilesByPrefix) {
     for (int i = 0; i < 5; ++i) {
-        FileMetadata file;
-        file.filename = "file_" + std::to_string(i) + ".txt";
-        file.size = 1024 * (i + 1);
-        file.created_time = Utils::getCurrentTimestamp();
-        test_files.push_back(file);
-        
-        ASSERT_TRUE(metadata_manager_->addFile(file));
-    }
-    
-    auto listed_files = metadata_manager_->listFiles();
-    ASSERT_EQ(listed_files.size(), 5);
-    
-    // Check that all files are present
-    for (const auto& test_file : test_files) {
-        bool found = false;
-        for (const auto& listed_file : listed_files) {
-            if (listed_file.filename == test_file.filename) {
-                found = true;
-                ASSERT_EQ(listed_file.size, test_file.size);
-                break;
-            }
-        }
-        ASSERT_TRUE(found) << "File " << test_file.filename << " not found in list";
+        FileMetadata file = makeFile("/a/file_" + std::to_string(i), 1024 * (i + 1));
+        ASSERT_TRUE(metadata_manager_->createFile(file.filename, file));
     }
+    FileMetadata other = makeFile("/b/file", 1);
+    ASSERT_TRUE(metadata_manager_->createFile(other.filename, other));
+    
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 6u);
+    ASSERT_EQ(metadata_manager_->listFiles("/a/").size(), 5u);
+    ASSERT_EQ(metadata_manager_->listFiles("/c/").size(), 0u);
 }
 
-TEST_F(MetadataManagerTest, AddAndGetChunk) {
-    ChunkMetadata chunk_metadata;
-    chunk_metadata.chunk_id = "test_chunk_001";
-    chunk_metadata.size = 64 * 1024 * 1024; // 64MB
-    chunk_metadata.checksum = "abc123def456";
-    chunk_metadata.server_locations = {"server1", "server2", "server3"};
-    chunk_metadata.created_time = Utils::getCurrentTimestamp();
-    
-    ASSERT_TRUE(metadata_manager_->addChunk(chunk_metadata));
-    
-    auto retrieved = metadata_manager_->getChunk("test_chunk_001");
-    ASSERT_TRUE(retrieved.has_value());
-    ASSERT_EQ(retrieved->chunk_id, chunk_metadata.chunk_id);
-    ASSERT_EQ(retrieved->size, chunk_metadata.size);
-    ASSERT_EQ(retrieved->checksum, chunk_metadata.checksum);
-    ASSERT_EQ(retrieved->server_locations, chunk_metadata.server_locations);
-}
-
-TEST_F(MetadataManagerTest, ServerManagement) {
-    ServerMetadata server1;
-    server1.server_id = "chunk_server_1";
-    server1.address = "192.168.1.10";
-    server1.port = 60051;
-    server1.is_healthy = true;
-    server1.free_space = 1000000000; // 1GB
-    server1.total_space = 2000000000; // 2GB
-    server1.last_heartbeat = Utils::getCurrentTimestamp();
-    
-    ServerMetadata server2;
-    server2.server_id = "chunk_server_2";
-    server2.address = "192.168.1.11";
-    server2.port = 60052;
-    server2.is_healthy = false;
-    server2.free_space = 500000000;
-    server2.total_space = 1000000000;
-    server2.last_heartbeat = Utils::getCurrentTimestamp() - 120; // 2 minutes ago
-    
-    ASSERT_TRUE(metadata_manager_->addServer(server1));
-    ASSERT_TRUE(metadata_manager_->addServer(server2));
-    
-    auto servers = metadata_manager_->getAllServers();
-    ASSERT_EQ(servers.size(), 2);
-    
-    // Update server status
-    ASSERT_TRUE(metadata_manager_->updateServerStatus("chunk_server_2", true));
-    
-    servers = metadata_manager_->getAllServers();
-    bool server2_found = false;
-    for (const auto& server : servers) {
-        if (server.server_id == "chunk_server_2") {
-            ASSERT_TRUE(server.is_healthy);
-            server2_found = true;
-            break;
-        }
-    }
-    ASSERT_TRUE(server2_found);
+TEST_F(MetadataManagerTest, UpdateFileById) {
+    FileMetadata file = makeFile("update.txt", 10);
+    ASSERT_TRUE(metadata_manager_->createFile(file.filename, file));
+    
+    ASSERT_TRUE(metadata_manager_->updateFileById(file.file_id, [](FileMetadata& metadata) {
+        metadata.size = 20;
+        metadata.chunk_ids = {"c0"};
+    }));
+    ASSERT_FALSE(metadata_manager_->updateFileById("missing", [](FileMetadata&) {}));
+    
+    FileMetadata retrieved;
+    ASSERT_TRUE(metadata_manager_->getFileMetadata(file.filename, retrieved));
+    ASSERT_EQ(retrieved.size, 20);
+    ASSERT_EQ(retrieved.chunk_ids, std::vector<std::string>{"c0"});
 }
 
-TEST_F(MetadataManagerTest, Statistics) {
-    // Add some test data
-    for (int i = 0; i < 10; ++i) {
-        FileMetadata file;
-        file.filename = "stats_file_" + std::to_string(i) + ".txt";
-        file.size = (i + 1) * 1024;
-        file.chunk_ids = {"chunk_" + std::to_string(i * 2), "chunk_" + std::to_string(i * 2 + 1)};
-        metadata_manager_->addFile(file);
-    }
+TEST_F(MetadataManagerTest, ChunksAndServers) {
+    ASSERT_TRUE(metadata_manager_->registerServer("s1", makeServer("s1")));
+    ASSERT_TRUE(metadata_manager_->registerServer("s2", makeServer("s2")));
     
-    for (int i = 0; i < 5; ++i) {
-        ServerMetadata server;
-        server.server_id = "stats_server_" + std::to_string(i);
-        server.address = "192.168.1." + std::to_string(10 + i);
-        server.port = 60051 + i;
-        server.is_healthy = (i < 4); // 4 healthy, 1 unhealthy
-        server.free_space = (i + 1) * 1000000000ULL;
-        server.total_space = (i + 2) * 1000000000ULL;
-        metadata_manager_->addServer(server);
-    }
-    
-    auto stats = metadata_manager_->getStatistics();
-    ASSERT_EQ(stats.total_files, 10);
-    ASSERT_EQ(stats.total_servers, 5);
-    ASSERT_EQ(stats.healthy_servers, 4);
-    ASSERT_GT(stats.total_storage_available, 0);
+    ASSERT_TRUE(metadata_manager_->addChunk("single", makeChunk("single", {"s1"})));
+    ASSERT_TRUE(metadata_manager_->addChunks({makeChunk("c0", {"s1", "s2"}), makeChunk("c1", {"s2"})}));
+    
+    ChunkMetadata chunk;
+    ASSERT_TRUE(metadata_manager_->getChunkMetadata("c0", chunk));
+    ASSERT_EQ(chunk.checksum, "checksum_c0");
+    ASSERT_EQ(chunk.server_locations, (std::vector<std::string>{"s1", "s2"}));
+    
+    std::vector<std::string> servers = metadata_manager_->getServersForChunk("c0");
+    std::sort(servers.begin(), servers.end());
+    ASSERT_EQ(servers, (std::vector<std::string>{"s1", "s2"}));
+    
+    std::vector<std::string> chunks = metadata_manager_->getChunksForServer("s2");
+    std::sort(chunks.begin(), chunks.end());
+    ASSERT_EQ(chunks, (std::vector<std::string>{"c0", "c1"}));
+    
+    ASSERT_TRUE(metadata_manager_->removeChunk("c0"));
+    ASSERT_FALSE(metadata_manager_->getChunkMetadata("c0", chunk));
+    ASSERT_EQ(metadata_manager_->getChunksForServer("s2"), std::vector<std::string>{"c1"});
+    
+    ASSERT_EQ(metadata_manager_->getAllServers().size(), 2u);
+    ASSERT_TRUE(metadata_manager_->unregisterServer("s1"));
+    ASSERT_EQ(metadata_manager_->getAllServers().size(), 1u);
 }
 
 TEST_F(MetadataManagerTest, ConcurrentAccess) {
@@ -175,18 +206,15 @@ TEST_F(MetadataManagerTest, ConcurrentAccess) {
     std::atomic<int> success_count{0};
     
     for (int t = 0; t < num_threads; ++t) {
-        threads.emplace_back([this, t, operations_per_thread, &success_count]() {
+        threads.emplace_back([this, t, &success_count]() {
             for (int i = 0; i < operations_per_thread; ++i) {
-                FileMetadata file;
-                file.filename = "thread_" + std::to_string(t) + "_file_" + std::to_string(i) + ".txt";
-                file.size = 1024;
-                file.created_time = Utils::getCurrentTimestamp();
+                FileMetadata file = makeFile("thread_" + std::to_string(t) + "_file_" + std::to_string(i), 1024);
                 
-                if (metadata_manager_->addFile(file)) {
-                    auto retrieved = metadata_manager_->getFile(file.filename);
-                    if (retrieved.has_value() && retrieved->filename == file.filename) {
-                        success_count++;
-                    }
+                FileMetadata retrieved;
+                if (metadata_manager_->createFile(file.filename, file) &&
+                    metadata_manager_->getFileMetadata(file.filename, retrieved) &&
+                    retrieved.filename == file.filename) {
+                    success_count++;
                 }
             }
         });
@@ -197,24 +225,278 @@ TEST_F(MetadataManagerTest, ConcurrentAccess) {
     }
     
     ASSERT_EQ(success_count.load(), num_threads * operations_per_thread);
+    ASSERT_EQ(metadata_manager_->listFiles().size(), static_cast<size_t>(num_threads * operations_per_thread));
+}
+
+TEST_F(MetadataManagerTest, ReplaysLogAfterRestart) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    
+    ASSERT_TRUE(metadata_manager_->registerServer("s1", makeServer("s1")));
+    ASSERT_TRUE(metadata_manager_->addChunks({makeChunk("c0", {"s1"}), makeChunk("c1", {"s1"})}));
+    ASSERT_TRUE(metadata_manager_->createFile("kept", makeFile("kept", 100, {"c0", "c1"})));
+    ASSERT_TRUE(metadata_manager_->createFile("deleted", makeFile("deleted", 5)));
+    ASSERT_TRUE(metadata_manager_->deleteFile("deleted"));
+    ASSERT_TRUE(metadata_manager_->updateFileById("id_kept", [](FileMetadata& metadata) {
+        metadata.size = 200;
+    }));
+    
+    // No snapshot yet: everything comes back from the WAL
+    ASSERT_FALSE(Utils::fileExists(base_path_ + ".snapshot"));
+    ASSERT_TRUE(restart());
+    
+    FileMetadata file;
+    ASSERT_TRUE(metadata_manager_->getFileMetadata("kept", file));
+    ASSERT_EQ(file.size, 200);
+    ASSERT_EQ(file.chunk_ids, (std::vector<std::string>{"c0", "c1"}));
+    ASSERT_TRUE(metadata_manager_->getFileById("id_kept", file));
+    ASSERT_FALSE(metadata_manager_->getFileMetadata("deleted", file));
+    
+    ChunkMetadata chunk;
+    ASSERT_TRUE(metadata_manager_->getChunkMetadata("c1", chunk));
+    ASSERT_EQ(chunk.server_locations, std::vector<std::string>{"s1"});
+    
+    ServerMetadata server;
+    ASSERT_TRUE(metadata_manager_->getServerMetadata("s1", server));
+    ASSERT_EQ(server.address, "127.0.0.1");
+    
+    // Changes after recovery are logged on top of the replayed ones
+    ASSERT_TRUE(metadata_manager_->createFile("later", makeFile("later", 1)));
+    ASSERT_TRUE(restart());
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 2u);
+}
+
+TEST_F(MetadataManagerTest, TruncatesTornTailRecord) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    metadata_manager_.reset();
+    
+    std::vector<std::string> wals = walFiles();
+    ASSERT_EQ(wals.size(), 1u);
+    uintmax_t intact_size = std::filesystem::file_size(wals[0]);
     
-    auto all_files = metadata_manager_->listFiles();
-    ASSERT_EQ(all_files.size(), num_threads * operations_per_thread);
+    // A record cut short by a crash: its length claims more than follows
+    appendBytes(wals[0], std::string("\x40\x00\x00\x00\x12\x34\x56\x78partial", 15));
+    
+    ASSERT_TRUE(restart());
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 10u);
+    ASSERT_EQ(std::filesystem::file_size(wals[0]), intact_size);
+    
+    // The log continues cleanly after the cut
+    ASSERT_TRUE(metadata_manager_->createFile("after", makeFile("after", 1)));
+    ASSERT_TRUE(restart());
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 11u);
+}
+
+TEST_F(MetadataManagerTest, TruncatesCorruptTailRecord) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->createFile("first", makeFile("first", 1)));
+    uintmax_t first_size = std::filesystem::file_size(walFiles()[0]);
+    ASSERT_TRUE(metadata_manager_->createFile("second", makeFile("second", 2)));
+    metadata_manager_.reset();
+    
+    // Garbled bytes in the last record fail its CRC, so it is dropped
+    std::string wal = walFiles()[0];
+    flipByte(wal, static_cast<std::streamoff>(std::filesystem::file_size(wal) - 1));
+    
+    ASSERT_TRUE(restart());
+    FileMetadata file;
+    ASSERT_TRUE(metadata_manager_->getFileMetadata("first", file));
+    ASSERT_FALSE(metadata_manager_->getFileMetadata("second", file));
+    ASSERT_EQ(std::filesystem::file_size(wal), first_size);
 }
 
-PERFORMANCE_TEST(MetadataOperationsPerformance, 1000)
+TEST_F(MetadataManagerTest, CheckpointHandsOverToSnapshot) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    ASSERT_TRUE(Utils::fileExists(base_path_ + ".snapshot"));
+    
+    // Changes after the checkpoint live only in the WAL, some of them
+    // undoing entries the snapshot holds
+    for (int i = 50; i < 60; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(metadata_manager_->deleteFile("f" + std::to_string(i)));
+    }
+    
+    // A second checkpoint drops every WAL file the first one left behind
+    ASSERT_TRUE(restart());
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 55u);
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->createFile("g", makeFile("g", 1)));
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->createFile("h", makeFile("h", 1)));
+    ASSERT_LE(walFiles().size(), 2u);
+    
+    ASSERT_TRUE(restart());
+    ASSERT_EQ(metadata_manager_->listFiles().size(), 57u);
     FileMetadata file;
-    file.filename = "perf_file_" + std::to_string(rand()) + ".txt";
-    file.size = 1024;
-    file.created_time = Utils::getCurrentTimestamp();
+    ASSERT_FALSE(metadata_manager_->getFileMetadata("f0", file));
+    ASSERT_TRUE(metadata_manager_->getFileMetadata("f49", file));
+    ASSERT_TRUE(metadata_manager_->getFileMetadata("f59", file));
+    ASSERT_TRUE(metadata_manager_->getFileMetadata("h", file));
+}
+
+TEST_F(MetadataManagerTest, RecoveryFailsOnCorruptSnapshot) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    metadata_manager_.reset();
+    
+    std::string snapshot = base_path_ + ".snapshot";
+    flipByte(snapshot, static_cast<std::streamoff>(std::filesystem::file_size(snapshot) / 2));
+    uintmax_t snapshot_size = std::filesystem::file_size(snapshot);
+    
+    // The master refuses to start when this fails; nothing on disk is touched
+    ASSERT_FALSE(restart());
+    ASSERT_EQ(std::filesystem::file_size(snapshot), snapshot_size);
+}
+
+TEST_F(MetadataManagerTest, RecoveryFailsOnCorruptOlderWal) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    metadata_manager_.reset();
+    
+    // Only the newest WAL file may end in a torn record; damage anywhere
+    // before it means records in the middle of the history are lost
+    std::vector<std::string> wals = walFiles();
+    ASSERT_EQ(wals.size(), 1u);
+    uintmax_t wal_size = std::filesystem::file_size(wals[0]);
+    flipByte(wals[0], static_cast<std::streamoff>(wal_size / 2));
+    appendBytes(base_path_ + ".wal.11", "");
+    
+    ASSERT_FALSE(restart());
+    ASSERT_EQ(std::filesystem::file_size(wals[0]), wal_size);
+}
+
+TEST_F(MetadataManagerTest, RecoveryFailsWhenSnapshotIsLost) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(metadata_manager_->createFile("f" + std::to_string(i), makeFile("f" + std::to_string(i), i)));
+    }
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    
+    // The checkpoint moves the log to a new file; keep writing until
+    // records land there
+    std::string first_wal = base_path_ + ".wal.1";
+    auto laterWalHasRecords = [&]() {
+        for (const std::string& wal : walFiles()) {
+            if (wal != first_wal && std::filesystem::file_size(wal) > 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (int i = 0; !laterWalHasRecords(); ++i) {
+        ASSERT_LT(i, 100);
+        ASSERT_TRUE(metadata_manager_->createFile("g" + std::to_string(i), makeFile("g" + std::to_string(i), i)));
+    }
+    metadata_manager_.reset();
+    
+    // Without the snapshot (and the WAL it replaced) the remaining log
+    // starts in the middle of the history
+    std::filesystem::remove(base_path_ + ".snapshot");
+    std::filesystem::remove(first_wal);
+    
+    ASSERT_FALSE(restart());
+}
+
+TEST_F(MetadataManagerTest, SnapshotTakenDuringChangesRecovers) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->registerServer("s1", makeServer("s1")));
+    
+    // Writers keep creating, growing and deleting files while checkpoints
+    // copy the shards underneath them
+    const int num_threads = 4;
+    const int files_per_thread = 200;
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([this, t, &failed]() {
+            for (int i = 0; i < files_per_thread; ++i) {
+                std::string name = "t" + std::to_string(t) + "_f" + std::to_string(i);
+                std::string chunk_id = name + "_c";
+                bool ok = metadata_manager_->addChunk(chunk_id, makeChunk(chunk_id, {"s1"})) &&
+                          metadata_manager_->createFile(name, makeFile(name, 0, {chunk_id})) &&
+                          metadata_manager_->updateFileById("id_" + name, [](FileMetadata& metadata) {
+                              metadata.size = 100;
+                          });
+                if (ok && i % 3 == 0) {
+                    ok = metadata_manager_->deleteFile(name);
+                }
+                if (!ok) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_FALSE(failed.load());
+    ASSERT_TRUE(metadata_manager_->saveMetadataToFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->createFile("last", makeFile("last", 1)));
     
-    ASSERT_TRUE(metadata_manager_->addFile(file));
+    ASSERT_TRUE(restart());
+    std::vector<FileMetadata> files = metadata_manager_->listFiles();
+    ASSERT_EQ(files.size(), static_cast<size_t>(num_threads * (files_per_thread - files_per_thread / 3 - 1) + 1));
+    for (const FileMetadata& file : files) {
+        if (file.filename == "last") {
+            continue;
+        }
+        ASSERT_EQ(file.size, 100);
+        ChunkMetadata chunk;
+        ASSERT_TRUE(metadata_manager_->getChunkMetadata(file.filename + "_c", chunk));
+    }
+    
+    // Deleting a file takes its chunks along, in the snapshot as well
+    ChunkMetadata chunk;
+    ASSERT_FALSE(metadata_manager_->getChunkMetadata("t0_f0_c", chunk));
+    ASSERT_EQ(metadata_manager_->getChunksForServer("s1").size(), files.size() - 1);
+}
+
+TEST_F(MetadataManagerTest, ChangesRefusedByTheLogAreNotApplied) {
+    ASSERT_TRUE(metadata_manager_->loadMetadataFromFile(base_path_));
+    ASSERT_TRUE(metadata_manager_->createFile("kept", makeFile("kept", 1)));
     
-    auto retrieved = metadata_manager_->getFile(file.filename);
-    ASSERT_TRUE(retrieved.has_value());
+    // Cap the file size so the next WAL write fails, as a full disk would
+    std::vector<std::string> wals = walFiles();
+    ASSERT_EQ(wals.size(), 1u);
+    struct rlimit saved;
+    ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &saved), 0);
+    auto saved_handler = std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit capped = saved;
+    capped.rlim_cur = std::filesystem::file_size(wals[0]) + 1;
+    ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &capped), 0);
     
-    ASSERT_TRUE(metadata_manager_->removeFile(file.filename));
-END_PERFORMANCE_TEST()
+    // The write that fails was already accepted, so only its caller learns
+    // about it; everything after that is turned away untouched
+    EXPECT_FALSE(metadata_manager_->createFile("unlogged", makeFile("unlogged", 1)));
+    ::setrlimit(RLIMIT_FSIZE, &saved);
+    std::signal(SIGXFSZ, saved_handler);
+    
+    FileMetadata file;
+    EXPECT_FALSE(metadata_manager_->createFile("refused", makeFile("refused", 1)));
+    EXPECT_FALSE(metadata_manager_->getFileMetadata("refused", file));
+    EXPECT_FALSE(metadata_manager_->deleteFile("kept"));
+    EXPECT_TRUE(metadata_manager_->getFileMetadata("kept", file));
+    ServerMetadata server;
+    EXPECT_FALSE(metadata_manager_->registerServer("s1", makeServer("s1")));
+    EXPECT_FALSE(metadata_manager_->getServerMetadata("s1", server));
+}
 
 } // namespace test
-} // namespace dfs
\ No newline at end of file
+} // namespace dfs
@@ -0,0 +1,256 @@
+#include "test_framework.h"
+#include "../src/chunkserver/segment_chunk_backend.h"
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dfs {
+namespace test {
+
+class SegmentChunkBackendTest : public DFSTestBase {
+protected:
+    static constexpr int64_t BLOCK = SegmentChunkBackend::SEGMENT_BLOCK_SIZE;
+    
+    void SetUp() override {
+        DFSTestBase::SetUp();
+        IoEngineOptions options;
+        options.type = IoEngineType::SYNC;
+        options.sync_threads = 2;
+        io_engine_ = IoEngine::create(options);
+        ASSERT_NE(io_engine_, nullptr);
+        open();
+    }
+    
+    // Drops the backend and loads it again from the segment files, as a
+    // restarted chunk server would
+    void open() {
+        backend_.reset();
+        backend_ = std::make_unique<SegmentChunkBackend>(test_dir_, io_engine_);
+    }
+    
+    std::string segmentPath(uint32_t id) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "segment-%08u.log", id);
+        return test_dir_ + "/segments/" + name;
+    }
+    
+    // Space a committed chunk of `size` bytes takes in its segment
+    static int64_t span(int64_t size) {
+        return BLOCK + (size + BLOCK - 1) / BLOCK * BLOCK;
+    }
+    
+    static StoredChunkInfo infoFor(const std::vector<uint8_t>& data) {
+        StoredChunkInfo info;
+        info.checksum = Utils::calculateSHA256(data);
+        info.block_checksums.push_back(Utils::crc32c(data.data(), data.size()));
+        info.created_time = 1234;
+        return info;
+    }
+    
+    bool put(const std::string& chunk_id, const std::vector<uint8_t>& data, int64_t size_hint = -1) {
+        auto writer = backend_->openWriter(chunk_id, size_hint < 0 ? static_cast<int64_t>(data.size()) : size_hint);
+        return writer && writer->append(data.data(), data.size()) && writer->commit(infoFor(data));
+    }
+    
+    // The chunk's bytes, or an empty vector if it isn't readable
+    std::vector<uint8_t> get(const std::string& chunk_id) {
+        auto reader = backend_->openReader(chunk_id);
+        if (!reader) {
+            return {};
+        }
+        std::vector<uint8_t> data(reader->size());
+        if (reader->read(0, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+            return {};
+        }
+        return data;
+    }
+    
+    std::shared_ptr<IoEngine> io_engine_;
+    std::unique_ptr<SegmentChunkBackend> backend_;
+};
+
+TEST_F(SegmentChunkBackendTest, ReopenRebuildsIndex) {
+    auto a = TestDataGenerator::generateRandom(10000, 1);
+    auto b1 = TestDataGenerator::generateRandom(5000, 2);
+    auto b2 = TestDataGenerator::generateRandom(7000, 3);
+    auto c = TestDataGenerator::generateRandom(BLOCK, 4);
+    
+    ASSERT_TRUE(put("a", a));
+    ASSERT_TRUE(put("b", b1));
+    ASSERT_TRUE(put("c", c));
+    ASSERT_TRUE(put("b", b2));
+    ASSERT_TRUE(backend_->removeChunk("c"));
+    EXPECT_FALSE(backend_->removeChunk("c"));
+    ASSERT_TRUE(backend_->sync());
+    
+    open();
+    EXPECT_EQ(backend_->listChunks().size(), 2u);
+    EXPECT_TRUE(get("a") == a);
+    EXPECT_TRUE(get("b") == b2);
+    EXPECT_EQ(backend_->openReader("c"), nullptr);
+    EXPECT_EQ(backend_->getChunkSize("c"), -1);
+    
+    StoredChunkInfo info;
+    ASSERT_TRUE(backend_->getChunkInfo("b", info));
+    EXPECT_EQ(info.chunk_id, "b");
+    EXPECT_EQ(info.size, 7000);
+    EXPECT_EQ(info.checksum, Utils::calculateSHA256(b2));
+    EXPECT_EQ(info.block_checksums, infoFor(b2).block_checksums);
+    EXPECT_EQ(info.created_time, 1234);
+    
+    // Records written after a restart must outrank the scanned ones
+    ASSERT_TRUE(put("a", b1));
+    ASSERT_TRUE(put("c", a));
+    ASSERT_TRUE(backend_->sync());
+    open();
+    EXPECT_TRUE(get("a") == b1);
+    EXPECT_TRUE(get("c") == a);
+}
+
+TEST_F(SegmentChunkBackendTest, UncommittedWritesStayInvisible) {
+    auto a = TestDataGenerator::generateRandom(3000, 1);
+    auto b = TestDataGenerator::generateRandom(9000, 2);
+    auto c = TestDataGenerator::generateRandom(200000, 3);
+    
+    // An aborted writer leaves its extent as a RESERVED record
+    auto writer = backend_->openWriter("aborted", 64 * 1024);
+    ASSERT_NE(writer, nullptr);
+    ASSERT_TRUE(writer->append(a.data(), a.size()));
+    writer->abort();
+    
+    // One still open at "crash" time has written data but no PUT header
+    auto pending = backend_->openWriter("pending", 64 * 1024);
+    ASSERT_NE(pending, nullptr);
+    ASSERT_TRUE(pending->append(b.data(), b.size()));
+    EXPECT_EQ(backend_->openReader("pending"), nullptr);
+    
+    // A small chunk in a big reservation hands the tail back, and one that
+    // outgrows its reservation moves to a bigger extent
+    ASSERT_TRUE(put("small", a, 1024 * 1024));
+    ASSERT_TRUE(put("grown", c, 1000));
+    ASSERT_TRUE(backend_->sync());
+    
+    SegmentChunkBackend restarted(test_dir_, io_engine_);
+    EXPECT_EQ(restarted.listChunks().size(), 2u);
+    EXPECT_EQ(restarted.getChunkSize("aborted"), -1);
+    EXPECT_EQ(restarted.getChunkSize("pending"), -1);
+    EXPECT_EQ(restarted.getChunkSize("small"), 3000);
+    EXPECT_EQ(restarted.getChunkSize("grown"), 200000);
+    
+    // Committing afterwards publishes the chunk in the running instance
+    ASSERT_TRUE(pending->commit(infoFor(b)));
+    pending.reset();
+    EXPECT_TRUE(get("pending") == b);
+    EXPECT_TRUE(get("grown") == c);
+    
+    ASSERT_TRUE(backend_->sync());
+    open();
+    EXPECT_TRUE(get("pending") == b);
+    EXPECT_TRUE(get("small") == a);
+    EXPECT_TRUE(get("grown") == c);
+    EXPECT_EQ(backend_->getChunkSize("aborted"), -1);
+}
+
+TEST_F(SegmentChunkBackendTest, ReopenAfterTornRecord) {
+    auto a = TestDataGenerator::generateRandom(5000, 1);
+    auto b = TestDataGenerator::generateRandom(20000, 2);
+    auto c = TestDataGenerator::generateRandom(30000, 3);
+    
+    ASSERT_TRUE(put("a", a));
+    ASSERT_TRUE(put("b", b));
+    ASSERT_TRUE(put("c", c));
+    ASSERT_TRUE(backend_->sync());
+    backend_.reset();
+    
+    // Cut the segment in the middle of c's data
+    const int64_t c_offset = span(5000) + span(20000);
+    ASSERT_EQ(::truncate(segmentPath(1).c_str(), c_offset + BLOCK + 1000), 0);
+    
+    open();
+    EXPECT_TRUE(get("a") == a);
+    EXPECT_TRUE(get("b") == b);
+    EXPECT_EQ(backend_->getChunkSize("c"), -1);
+    
+    // New records go where the torn one was
+    ASSERT_TRUE(put("d", c));
+    ASSERT_TRUE(backend_->sync());
+    open();
+    EXPECT_TRUE(get("d") == c);
+    EXPECT_EQ(backend_->listChunks().size(), 3u);
+    
+    // A torn header block ends the log at that record too
+    backend_.reset();
+    int fd = ::open(segmentPath(1).c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    uint8_t garbage = 0xFF;
+    ASSERT_EQ(::pwrite(fd, &garbage, 1, span(5000) + 40), 1);
+    ::close(fd);
+    
+    open();
+    EXPECT_TRUE(get("a") == a);
+    EXPECT_EQ(backend_->getChunkSize("b"), -1);
+    EXPECT_EQ(backend_->getChunkSize("d"), -1);
+}
+
+TEST_F(SegmentChunkBackendTest, ReopenAfterCompaction) {
+    const int64_t MB = 1024 * 1024;
+    auto big = TestDataGenerator::generateRandom(136 * MB, 1);
+    auto small = TestDataGenerator::generateRandom(7000, 2);
+    auto other = TestDataGenerator::generateRandom(12000, 3);
+    
+    // Segment 1 stays mostly live: a big chunk, the PUT of a chunk deleted
+    // later, and a chunk whose unused reservation fills the segment exactly
+    ASSERT_TRUE(put("big", big));
+    ASSERT_TRUE(put("deleted", small));
+    const int64_t used = span(big.size()) + span(small.size());
+    ASSERT_TRUE(put("kept1", small, SegmentChunkBackend::SEGMENT_SIZE - used - BLOCK));
+    
+    // Segment 2 ends up sparse: the tombstone, a live chunk, a chunk that is
+    // overwritten in segment 3 and another deleted in the same segment
+    ASSERT_TRUE(backend_->removeChunk("deleted"));
+    ASSERT_TRUE(put("kept2", other, 100 * MB));
+    ASSERT_TRUE(put("moved", small));
+    ASSERT_TRUE(put("gone", small));
+    ASSERT_TRUE(backend_->removeChunk("gone"));
+    ASSERT_TRUE(put("filler", small, 150 * MB));
+    ASSERT_TRUE(put("moved", other, 10 * MB));
+    ASSERT_TRUE(std::filesystem::exists(segmentPath(3)));
+    ASSERT_TRUE(backend_->sync());
+    
+    backend_->compact();
+    EXPECT_TRUE(std::filesystem::exists(segmentPath(1)));
+    EXPECT_FALSE(std::filesystem::exists(segmentPath(2)));
+    
+    auto check = [&]() {
+        EXPECT_EQ(backend_->listChunks().size(), 5u);
+        EXPECT_TRUE(get("big") == big);
+        EXPECT_TRUE(get("kept1") == small);
+        EXPECT_TRUE(get("kept2") == other);
+        EXPECT_TRUE(get("filler") == small);
+        EXPECT_TRUE(get("moved") == other);
+        // The PUT in segment 1 must stay shadowed by the relocated tombstone
+        EXPECT_EQ(backend_->getChunkSize("deleted"), -1);
+        EXPECT_EQ(backend_->getChunkSize("gone"), -1);
+    };
+    check();
+    
+    open();
+    check();
+    
+    // Once segment 1 goes as well, nothing needs the tombstone any more
+    ASSERT_TRUE(backend_->removeChunk("big"));
+    ASSERT_TRUE(put("kept1", other));
+    ASSERT_TRUE(backend_->sync());
+    backend_->compact();
+    EXPECT_FALSE(std::filesystem::exists(segmentPath(1)));
+    
+    open();
+    EXPECT_EQ(backend_->listChunks().size(), 4u);
+    EXPECT_EQ(backend_->getChunkSize("big"), -1);
+    EXPECT_EQ(backend_->getChunkSize("deleted"), -1);
+    EXPECT_TRUE(get("kept1") == other);
+    EXPECT_TRUE(get("kept2") == other);
+}
+
+} // namespace test
+} // namespace dfs
@@ -0,0 +1,52 @@
+#include "test_framework.h"
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <unistd.h>
+
+namespace dfs {
+namespace test {
+
+void DFSTestBase::SetUp() {
+    const ::testing::TestInfo* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    std::filesystem::path directory = std::filesystem::temp_directory_path() /
+        ("dfs_test_" + std::to_string(::getpid()) + "_" + info->test_suite_name() + "_" + info->name());
+    
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    test_dir_ = directory.string();
+}
+
+void DFSTestBase::TearDown() {
+    std::error_code error;
+    std::filesystem::remove_all(test_dir_, error);
+}
+
+std::string DFSTestBase::createTempFile(const std::string& content) {
+    std::string path = test_dir_ + "/temp_" + std::to_string(temp_file_count_++);
+    std::ofstream file(path, std::ios::binary);
+    file << content;
+    return path;
+}
+
+std::vector<uint8_t> TestDataGenerator::generateSequential(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    return data;
+}
+
+std::vector<uint8_t> TestDataGenerator::generateRandom(size_t size, uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+    
+    std::vector<uint8_t> data(size);
+    for (uint8_t& value : data) {
+        value = static_cast<uint8_t>(byte(generator));
+    }
+    return data;
+}
+
+} // namespace test
+} // namespace dfs
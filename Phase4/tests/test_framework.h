@@ -0,0 +1,39 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include "utils.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+namespace dfs {
+namespace test {
+
+// Base fixture: every test gets its own empty scratch directory, test_dir_,
+// which is removed again afterwards
+class DFSTestBase : public ::testing::Test {
+protected:
+    void SetUp() override;
+    void TearDown() override;
+    
+    // Writes `content` to a new file in test_dir_ and returns its path
+    std::string createTempFile(const std::string& content);
+    
+    std::string test_dir_;
+    
+private:
+    int temp_file_count_ = 0;
+};
+
+// Deterministic test data
+class TestDataGenerator {
+public:
+    static std::vector<uint8_t> generateSequential(size_t size);
+    static std::vector<uint8_t> generateRandom(size_t size, uint32_t seed = 42);
+};
+
+} // namespace test
+} // namespace dfs